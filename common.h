@@ -1,6 +1,7 @@
 #include "php.h"
 #include "php_ini.h"
 #include <ext/standard/php_smart_str.h>
+#include <ext/standard/php_var.h>
 
 #ifndef REDIS_COMMON_H
 #define REDIS_COMMON_H
@@ -20,6 +21,20 @@
 
 #define _NL "\r\n"
 
+/* Size of the receive buffer replies are parsed from */
+#define REDIS_SOCK_RBUF_SIZE 16384
+
+/* Arguments this large are written from their own memory instead of being
+ * copied into the command, see redis_sock_request_argv */
+#define REDIS_WRITEV_MIN 65536
+
+/* massInsert sends a batch once it has this many commands, or bytes */
+#define REDIS_MASS_INSERT_WINDOW 1024
+#define REDIS_MASS_INSERT_BYTES  (1024 * 1024)
+
+/* sendAsync refuses more commands once this many replies wait for await() */
+#define REDIS_ASYNC_MAX 65536
+
 /* properties */
 #define REDIS_NOT_FOUND 0
 #define REDIS_STRING 1
@@ -58,11 +73,32 @@ typedef enum _PUBSUB_TYPE {
 #define REDIS_OPT_PREFIX		    2
 #define REDIS_OPT_READ_TIMEOUT		3
 #define REDIS_OPT_SCAN              4
+#define REDIS_OPT_PIPELINE_WINDOW       5
+#define REDIS_OPT_PIPELINE_WINDOW_BYTES 6
+#define REDIS_OPT_MULTI_BUFFER          7
+#define REDIS_OPT_REPLY_ITERATOR        8
+#define REDIS_OPT_INTERN_KEYS           9
+#define REDIS_OPT_COMPRESSION           10
+#define REDIS_OPT_COMPRESSION_LEVEL     11
+#define REDIS_OPT_COMPRESSION_MIN_SIZE  12
+#define REDIS_OPT_COMPRESSION_DICTIONARY 13
+#define REDIS_OPT_CLIENT_CACHE          14
 
 /* serializers */
 #define REDIS_SERIALIZER_NONE		0
 #define REDIS_SERIALIZER_PHP 		1
 #define REDIS_SERIALIZER_IGBINARY 	2
+#define REDIS_SERIALIZER_MSGPACK	3
+
+/* compression, applied to serialized values of at least min_size bytes */
+#define REDIS_COMPRESSION_NONE      0
+#define REDIS_COMPRESSION_LZ4       1
+#define REDIS_COMPRESSION_ZSTD      2
+#define REDIS_COMPRESSION_MIN_SIZE  1024
+#define REDIS_ZSTD_DEFAULT_LEVEL    3
+#define REDIS_ZSTD_MAX_LEVEL        22
+#define REDIS_ZSTD_DICTS_MAX        16          /* dictionaries per process */
+#define REDIS_ZSTD_DICT_MAX_LEN     (16 * 1024 * 1024)
 
 /* SCAN options */
 #define REDIS_SCAN_NORETRY 0
@@ -88,6 +124,8 @@ typedef enum _PUBSUB_TYPE {
 #define IF_NOT_MULTI() if(redis_sock->mode != MULTI)
 #define IF_NOT_ATOMIC() if(redis_sock->mode != ATOMIC)
 #define IF_ATOMIC() if(redis_sock->mode == ATOMIC)
+/* Commands are queued in pipeline_cmd instead of being sent */
+#define IF_BUFFERED() if(redis_sock->mode == PIPELINE || (redis_sock->mode == MULTI && redis_sock->multi_buffered))
 #define ELSE_IF_MULTI() else if(redis_sock->mode == MULTI) { \
 	if(redis_response_enqueued(redis_sock TSRMLS_CC) == 1) {\
 		RETURN_ZVAL(getThis(), 1, 0);\
@@ -101,31 +139,18 @@ typedef enum _PUBSUB_TYPE {
 }
 
 
-#define MULTI_RESPONSE(callback) IF_MULTI_OR_PIPELINE() { \
-	fold_item *f1, *current; \
-	f1 = malloc(sizeof(fold_item)); \
-	f1->fun = (void *)callback; \
-	f1->next = NULL; \
-	current = redis_sock->current;\
-	if(current) current->next = f1; \
-	redis_sock->current = f1; \
-  }
-
-#define PIPELINE_ENQUEUE_COMMAND(cmd, cmd_len) request_item *tmp; \
-	struct request_item *current_request;\
-	tmp = malloc(sizeof(request_item));\
-	tmp->request_str = calloc(cmd_len, 1);\
-	memcpy(tmp->request_str, cmd, cmd_len);\
-	tmp->request_size = cmd_len;\
-	tmp->next = NULL;\
-	current_request = redis_sock->pipeline_current; \
-	if(current_request) {\
-		current_request->next = tmp;\
+#define MULTI_RESPONSE(callback) REDIS_SAVE_CALLBACK(callback, NULL)
+
+/* Callbacks live in an array that keeps its size between transactions */
+#define REDIS_QUEUE_CALLBACK(f1) \
+	if(redis_sock->callbacks_count == redis_sock->callbacks_size) { \
+		redis_sock->callbacks_size = redis_sock->callbacks_size ? 2 * redis_sock->callbacks_size : 16; \
+		redis_sock->callbacks = erealloc(redis_sock->callbacks, redis_sock->callbacks_size * sizeof(fold_item)); \
 	} \
-	redis_sock->pipeline_current = tmp; \
-	if(NULL == redis_sock->pipeline_head) { \
-		redis_sock->pipeline_head = redis_sock->pipeline_current;\
-	}
+	f1 = &redis_sock->callbacks[redis_sock->callbacks_count++];
+
+#define PIPELINE_ENQUEUE_COMMAND(cmd, cmd_len) \
+	smart_str_appendl(&redis_sock->pipeline_cmd, cmd, cmd_len);
 
 #define SOCKET_WRITE_COMMAND(redis_sock, cmd, cmd_len) if(redis_sock_write(redis_sock, cmd, cmd_len TSRMLS_CC) < 0) { \
 	efree(cmd); \
@@ -133,22 +158,19 @@ typedef enum _PUBSUB_TYPE {
 }
 
 #define REDIS_SAVE_CALLBACK(callback, closure_context) IF_MULTI_OR_PIPELINE() { \
-	fold_item *f1, *current; \
-	f1 = malloc(sizeof(fold_item)); \
+	fold_item *f1; \
+	REDIS_QUEUE_CALLBACK(f1); \
 	f1->fun = (void *)callback; \
 	f1->ctx = closure_context; \
-	f1->next = NULL; \
-	current = redis_sock->current;\
-	if(current) current->next = f1; \
-	redis_sock->current = f1; \
-	if(NULL == redis_sock->head) { \
-		redis_sock->head = redis_sock->current;\
-	}\
 }
 
 #define REDIS_ELSE_IF_MULTI(function, closure_context) \
 else if(redis_sock->mode == MULTI) { \
-	if(redis_response_enqueued(redis_sock TSRMLS_CC) == 1) {\
+	if(redis_sock->multi_buffered) { \
+		/* QUEUED is checked by exec() */ \
+		REDIS_SAVE_CALLBACK(function, closure_context); \
+		RETURN_ZVAL(getThis(), 1, 0);\
+	} else if(redis_response_enqueued(redis_sock TSRMLS_CC) == 1) {\
 		REDIS_SAVE_CALLBACK(function, closure_context); \
 		RETURN_ZVAL(getThis(), 1, 0);\
 	} else {\
@@ -156,19 +178,29 @@ else if(redis_sock->mode == MULTI) { \
 	}\
 }
 
+/* Send a windowed pipeline once enough commands or bytes are queued */
+#define REDIS_PIPELINE_WINDOW_CHECK() \
+	if((redis_sock->pipeline_window && \
+	    redis_sock->callbacks_count - redis_sock->pipeline_sent >= redis_sock->pipeline_window) || \
+	   (redis_sock->pipeline_window_bytes && redis_sock->pipeline_cmd.len >= (size_t)redis_sock->pipeline_window_bytes)) { \
+		if(redis_pipeline_flush(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock) < 0) { \
+			RETURN_FALSE; \
+		} \
+	}
+
 #define REDIS_ELSE_IF_PIPELINE(function, closure_context) else IF_PIPELINE() {	\
 	REDIS_SAVE_CALLBACK(function, closure_context); \
+	REDIS_PIPELINE_WINDOW_CHECK(); \
 	RETURN_ZVAL(getThis(), 1, 0);\
 }
 
 #define REDIS_PROCESS_REQUEST(redis_sock, cmd, cmd_len) 	\
-	IF_MULTI_OR_ATOMIC() { \
-		SOCKET_WRITE_COMMAND(redis_sock, cmd, cmd_len); \
-		efree(cmd); \
-	}\
-	IF_PIPELINE() { \
+	IF_BUFFERED() { \
 		PIPELINE_ENQUEUE_COMMAND(cmd, cmd_len); \
 		efree(cmd); \
+	} else { \
+		SOCKET_WRITE_COMMAND(redis_sock, cmd, cmd_len); \
+		efree(cmd); \
 	}
 
 #define REDIS_PROCESS_RESPONSE_CLOSURE(function, closure_context) \
@@ -197,15 +229,8 @@ typedef enum {ATOMIC, MULTI, PIPELINE} redis_mode;
 typedef struct fold_item {
 	zval * (*fun)(INTERNAL_FUNCTION_PARAMETERS, void *, ...);
 	void *ctx;
-	struct fold_item *next;
 } fold_item;
 
-typedef struct request_item {
-	char *request_str; 
-	int request_size; /* size_t */
-	struct request_item *next;
-} request_item;
-
 /* {{{ struct RedisSock */
 typedef struct {
     php_stream     *stream;
@@ -222,22 +247,70 @@ typedef struct {
     char           *persistent_id;
 
     int            serializer;
+    int            compression;
+    int            compression_level;  /* 0 for the algorithm's default */
+    long           compression_min_size;
+    unsigned int   compression_dict;    /* id of the zstd dictionary, 0 for none */
+    void           *zstd_cctx;          /* zstd contexts for dictionaries, made when needed */
+    void           *zstd_dctx;
     long           dbNumber;
 
+    int            serialize_batch; /* nesting of redis_serialize_batch_begin */
+    zend_bool      serialize_vars_init; /* serialize_vars is ours, for the batch */
+    zend_bool      serializing;     /* in php_var_serialize, which can run user code */
+#if ZEND_MODULE_API_NO >= 20100000
+    php_serialize_data_t serialize_vars;
+#else
+    HashTable      serialize_vars;
+#endif
+    smart_str      serialize_buf;   /* output of batched values, kept allocated */
+
     char           *prefix;
     int            prefix_len;
 
     redis_mode     mode;
-    fold_item      *head;
-    fold_item      *current;
-
-    request_item   *pipeline_head;
-    request_item   *pipeline_current;
+    fold_item      *callbacks;      /* reply handlers for MULTI/PIPELINE, in order */
+    int            callbacks_count;
+    int            callbacks_size;
+
+    smart_str      pipeline_cmd;    /* queued commands, kept allocated between pipelines */
+    long           pipeline_window; /* send the pipeline every N commands, 0 to wait for exec */
+    long           pipeline_window_bytes;
+    int            pipeline_sent;   /* callbacks whose commands were sent, replies not read */
+    zval           *pipeline_replies; /* replies read before exec */
+    zend_bool      multi_buffer;    /* OPT_MULTI_BUFFER: send MULTI...EXEC in one write */
+    zend_bool      multi_buffered;  /* the current MULTI is being buffered */
+
+    fold_item      *async;          /* callbacks of sendAsync commands, oldest first */
+    int            async_count;
+    int            async_size;
+    long           async_sent;      /* id of the last async command sent */
+    long           async_read;      /* id of the last async reply read */
+    zval           *async_replies;  /* id => reply, until await() hands it out */
+
+    long           reply_iterator;  /* OPT_REPLY_ITERATOR: stream replies of at least N elements */
+    long           iter_id;         /* the RedisReplyIterator reading from us, if iter_left */
+    long           iter_left;       /* elements of its reply still on the socket */
+    long           iter_pos;
+    int            iter_unserialize;
+    int            iter_decode;
+    zend_bool      iter_zipped;     /* key/value pairs rather than a list */
+    zval           *iter_key;       /* the element the iterator is on */
+    zval           *iter_val;
+
+    zend_bool      intern_keys;     /* OPT_INTERN_KEYS: share the field names of zipped replies */
+
+    struct _redisCache *cache;      /* OPT_CLIENT_CACHE: the worker's cache of our keys */
 
     char           *err;
     int            err_len;
     zend_bool      lazy_connect;
 
+    char           *rbuf;       /* received data, read with big reads */
+    size_t         rbuf_size;
+    size_t         rbuf_pos;    /* first byte not parsed yet */
+    size_t         rbuf_len;    /* bytes received */
+
     int            scan;
 } RedisSock;
 /* }}} */
@@ -11,6 +11,12 @@ PHP_ARG_ENABLE(redis-session, whether to enable sessions,
 PHP_ARG_ENABLE(redis-igbinary, whether to enable igbinary serializer support,
 [  --enable-redis-igbinary      Enable igbinary serializer support], no, no)
 
+PHP_ARG_WITH(redis-lz4, whether to enable lz4 compression support,
+[  --with-redis-lz4[=DIR]       Enable lz4 compression support], no, no)
+
+PHP_ARG_WITH(redis-zstd, whether to enable zstd compression support,
+[  --with-redis-zstd[=DIR]      Enable zstd compression support], no, no)
+
 
 if test "$PHP_REDIS" != "no"; then
 
@@ -60,6 +66,60 @@ dnl Check for igbinary
     AC_MSG_RESULT([disabled])
   fi
 
+dnl Check for lz4
+  if test "$PHP_REDIS_LZ4" != "no"; then
+    AC_MSG_CHECKING([for lz4 includes])
+    for i in $PHP_REDIS_LZ4 /usr/local /usr; do
+      if test -r $i/include/lz4.h && test -r $i/include/lz4hc.h; then
+        LZ4_DIR=$i
+        break
+      fi
+    done
+    if test -z "$LZ4_DIR"; then
+      AC_MSG_ERROR([Cannot find lz4.h])
+    fi
+    AC_MSG_RESULT([$LZ4_DIR])
+
+    PHP_CHECK_LIBRARY(lz4, LZ4_compress_HC,
+    [
+      PHP_ADD_INCLUDE($LZ4_DIR/include)
+      PHP_ADD_LIBRARY_WITH_PATH(lz4, $LZ4_DIR/$PHP_LIBDIR, REDIS_SHARED_LIBADD)
+      AC_DEFINE(HAVE_REDIS_LZ4,1,[Whether redis lz4 compression is enabled])
+    ],[
+      AC_MSG_ERROR([lz4 library not found, or too old])
+    ],[
+      -L$LZ4_DIR/$PHP_LIBDIR
+    ])
+  fi
+
+dnl Check for zstd
+  if test "$PHP_REDIS_ZSTD" != "no"; then
+    AC_MSG_CHECKING([for zstd includes])
+    for i in $PHP_REDIS_ZSTD /usr/local /usr; do
+      if test -r $i/include/zstd.h; then
+        ZSTD_DIR=$i
+        break
+      fi
+    done
+    if test -z "$ZSTD_DIR"; then
+      AC_MSG_ERROR([Cannot find zstd.h])
+    fi
+    AC_MSG_RESULT([$ZSTD_DIR])
+
+    PHP_CHECK_LIBRARY(zstd, ZSTD_compress,
+    [
+      PHP_ADD_INCLUDE($ZSTD_DIR/include)
+      PHP_ADD_LIBRARY_WITH_PATH(zstd, $ZSTD_DIR/$PHP_LIBDIR, REDIS_SHARED_LIBADD)
+      AC_DEFINE(HAVE_REDIS_ZSTD,1,[Whether redis zstd compression is enabled])
+    ],[
+      AC_MSG_ERROR([zstd library not found])
+    ],[
+      -L$ZSTD_DIR/$PHP_LIBDIR
+    ])
+  fi
+
+  PHP_SUBST(REDIS_SHARED_LIBADD)
+
   dnl # --with-redis -> check with-path
   dnl SEARCH_PATH="/usr/local /usr"     # you might want to change this
   dnl SEARCH_FOR="/include/redis.h"  # you most likely want to change this
@@ -99,5 +159,5 @@ dnl Check for igbinary
   dnl
   dnl PHP_SUBST(REDIS_SHARED_LIBADD)
 
-  PHP_NEW_EXTENSION(redis, redis.c library.c redis_session.c redis_array.c redis_array_impl.c, $ext_shared)
+  PHP_NEW_EXTENSION(redis, redis.c library.c redis_session.c redis_array.c redis_array_impl.c redis_cluster.c redis_msgpack.c redis_cache.c, $ext_shared)
 fi
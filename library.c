@@ -7,16 +7,32 @@
 #ifndef _MSC_VER
 #include <netinet/tcp.h>  /* TCP_NODELAY */
 #include <sys/socket.h>
+#include <sys/uio.h>      /* writev */
+#include <limits.h>       /* IOV_MAX */
+#include <errno.h>
+#ifndef IOV_MAX
+#define IOV_MAX 16
+#endif
 #endif
 #include <ext/standard/php_smart_str.h>
 #include <ext/standard/php_var.h>
+#include <ext/standard/basic_functions.h>
 #ifdef HAVE_REDIS_IGBINARY
 #include "igbinary/igbinary.h"
 #endif
+#ifdef HAVE_REDIS_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+#ifdef HAVE_REDIS_ZSTD
+#include <zstd.h>
+#endif
 #include <zend_exceptions.h>
 #include "php_redis.h"
 #include "library.h"
-#include <ext/standard/php_math.h>
+#include "redis_commands.h"
+#include "redis_msgpack.h"
+#include "redis_cache.h"
 #include <ext/standard/php_rand.h>
 
 #ifdef PHP_WIN32
@@ -26,6 +42,9 @@ PHPAPI int usleep(unsigned int useconds);
 # endif
 #endif
 
+/* id of the zstd dictionary new connections compress with, 0 for none */
+static unsigned int redis_zstd_default_dict;
+
 #ifdef _MSC_VER
 #define atoll _atoi64
 #define random rand
@@ -134,6 +153,177 @@ PHP_REDIS_API void redis_stream_close(RedisSock *redis_sock TSRMLS_DC) {
 	} else {
 		php_stream_pclose(redis_sock->stream);
 	}
+
+	/* whatever we had received belongs to the old connection */
+	redis_sock->rbuf_pos = redis_sock->rbuf_len = 0;
+	if (redis_sock->iter_left) {
+		/* the iterator's reply went with it */
+		redis_sock->iter_left = 0;
+		redis_sock->iter_id++;
+	}
+	if (redis_sock->async_count) {
+		redis_sock_async_fail(redis_sock);
+	}
+}
+
+/* The connection broke in the middle of a reply: drop it, and say so */
+static void redis_sock_read_failed(RedisSock *redis_sock TSRMLS_DC) {
+	redis_stream_close(redis_sock TSRMLS_CC);
+	redis_sock->stream = NULL;
+	redis_sock->status = REDIS_SOCK_STATUS_FAILED;
+	redis_sock->mode = ATOMIC;
+	redis_sock->watching = 0;
+	zend_throw_exception(redis_exception_ce, "read error on connection", 0 TSRMLS_CC);
+}
+
+/* Receive more data into the read buffer, first moving what is left to parse
+ * to its start.  Returns the number of bytes received, or -1. */
+static int redis_sock_rbuf_fill(RedisSock *redis_sock TSRMLS_DC)
+{
+    size_t got;
+
+    if (!redis_sock->stream) {
+        return -1;
+    }
+
+    if (!redis_sock->rbuf) {
+        redis_sock->rbuf_size = REDIS_SOCK_RBUF_SIZE;
+        redis_sock->rbuf = emalloc(redis_sock->rbuf_size);
+    }
+
+    if (redis_sock->rbuf_pos) {
+        redis_sock->rbuf_len -= redis_sock->rbuf_pos;
+        memmove(redis_sock->rbuf, redis_sock->rbuf + redis_sock->rbuf_pos, redis_sock->rbuf_len);
+        redis_sock->rbuf_pos = 0;
+    }
+
+    /* only a line longer than the buffer gets here */
+    if (redis_sock->rbuf_len == redis_sock->rbuf_size) {
+        redis_sock->rbuf_size *= 2;
+        redis_sock->rbuf = erealloc(redis_sock->rbuf, redis_sock->rbuf_size);
+    }
+
+    got = php_stream_read(redis_sock->stream, redis_sock->rbuf + redis_sock->rbuf_len,
+                          redis_sock->rbuf_size - redis_sock->rbuf_len);
+    if (got == 0) {
+        return -1;
+    }
+
+    redis_sock->rbuf_len += got;
+    return (int)got;
+}
+
+/**
+ * redis_sock_read_line
+ * Read a line up to and including its \r\n, NULL terminated, like
+ * php_stream_get_line().  The whole line is consumed even if it is truncated
+ * to fit in buf.
+ */
+PHP_REDIS_API char *redis_sock_read_line(RedisSock *redis_sock, char *buf, size_t buf_size,
+                                         size_t *line_size TSRMLS_DC)
+{
+    char *nl = NULL;
+    size_t avail, scanned = 0, len;
+
+    while (1) {
+        avail = redis_sock->rbuf_len - redis_sock->rbuf_pos;
+        if (avail > scanned &&
+            (nl = memchr(redis_sock->rbuf + redis_sock->rbuf_pos + scanned, '\n', avail - scanned)))
+        {
+            break;
+        }
+        scanned = avail;
+        if (redis_sock_rbuf_fill(redis_sock TSRMLS_CC) < 0) {
+            return NULL;
+        }
+    }
+
+    len = nl - (redis_sock->rbuf + redis_sock->rbuf_pos) + 1;
+    avail = len < buf_size ? len : buf_size - 1;
+    memcpy(buf, redis_sock->rbuf + redis_sock->rbuf_pos, avail);
+    buf[avail] = '\0';
+    redis_sock->rbuf_pos += len;
+
+    if (line_size) {
+        *line_size = avail;
+    }
+    return buf;
+}
+
+/**
+ * redis_sock_read_bytes
+ * Read exactly len bytes.  Large payloads are read straight into buf once
+ * what we had buffered is used up.
+ */
+PHP_REDIS_API int redis_sock_read_bytes(RedisSock *redis_sock, char *buf, size_t len TSRMLS_DC)
+{
+    size_t avail = redis_sock->rbuf_len - redis_sock->rbuf_pos, got;
+
+    if (avail >= len) {
+        memcpy(buf, redis_sock->rbuf + redis_sock->rbuf_pos, len);
+        redis_sock->rbuf_pos += len;
+        return 0;
+    }
+
+    memcpy(buf, redis_sock->rbuf + redis_sock->rbuf_pos, avail);
+    buf += avail;
+    len -= avail;
+    redis_sock->rbuf_pos = redis_sock->rbuf_len = 0;
+
+    while (len >= REDIS_SOCK_RBUF_SIZE) {
+        if (!redis_sock->stream || (got = php_stream_read(redis_sock->stream, buf, len)) == 0) {
+            return -1;
+        }
+        buf += got;
+        len -= got;
+    }
+
+    /* the tail comes in a buffered read, along with the replies after it */
+    while (len) {
+        if (redis_sock_rbuf_fill(redis_sock TSRMLS_CC) < 0) {
+            return -1;
+        }
+        got = redis_sock->rbuf_len < len ? redis_sock->rbuf_len : len;
+        memcpy(buf, redis_sock->rbuf, got);
+        redis_sock->rbuf_pos = got;
+        buf += got;
+        len -= got;
+    }
+
+    return 0;
+}
+
+/* Consume len bytes we have no use for */
+static int redis_sock_skip_bytes(RedisSock *redis_sock, size_t len TSRMLS_DC)
+{
+    size_t avail;
+
+    while (1) {
+        avail = redis_sock->rbuf_len - redis_sock->rbuf_pos;
+        if (avail >= len) {
+            redis_sock->rbuf_pos += len;
+            return 0;
+        }
+        len -= avail;
+        redis_sock->rbuf_pos = redis_sock->rbuf_len = 0;
+        if (redis_sock_rbuf_fill(redis_sock TSRMLS_CC) < 0) {
+            return -1;
+        }
+    }
+}
+
+/**
+ * redis_sock_getc
+ */
+PHP_REDIS_API int redis_sock_getc(RedisSock *redis_sock TSRMLS_DC)
+{
+    if (redis_sock->rbuf_pos == redis_sock->rbuf_len &&
+        redis_sock_rbuf_fill(redis_sock TSRMLS_CC) < 0)
+    {
+        return EOF;
+    }
+
+    return (unsigned char)redis_sock->rbuf[redis_sock->rbuf_pos++];
 }
 
 PHP_REDIS_API int redis_check_eof(RedisSock *redis_sock TSRMLS_DC)
@@ -145,6 +335,11 @@ PHP_REDIS_API int redis_check_eof(RedisSock *redis_sock TSRMLS_DC)
 		return -1;
 	}
 
+	/* replies we already received can be parsed whatever the socket says */
+	if (redis_sock->rbuf_pos < redis_sock->rbuf_len) {
+		return 0;
+	}
+
 	eof = php_stream_eof(redis_sock->stream);
     for (; eof; count++) {
         /* Only try up to a certain point */
@@ -205,7 +400,8 @@ redis_sock_read_scan_reply(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock,
                            REDIS_SCAN_TYPE type, long *iter)
 {
     REDIS_REPLY_TYPE reply_type;
-    int reply_info;
+    int reply_info, ret;
+    long reply_iterator;
     char *p_iter;
 
     /* Our response should have two multibulk replies */
@@ -232,44 +428,81 @@ redis_sock_read_scan_reply(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock,
     efree(p_iter);
 
     /* Read our actual keys/members/etc differently depending on what kind of
-       scan command this is.  They all come back in slightly different ways */
+       scan command this is.  They all come back in slightly different ways.
+       SCAN pages are small and read whole, never through an iterator. */
+    reply_iterator = redis_sock->reply_iterator;
+    redis_sock->reply_iterator = 0;
     switch(type) {
         case TYPE_SCAN:
-            return redis_mbulk_reply_raw(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, NULL, NULL);
+            ret = redis_mbulk_reply_raw(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, NULL, NULL);
+            break;
         case TYPE_SSCAN:
-            return redis_sock_read_multibulk_reply(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, NULL, NULL);
+            ret = redis_sock_read_multibulk_reply(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, NULL, NULL);
+            break;
         case TYPE_ZSCAN:
-            return redis_mbulk_reply_zipped_keys_dbl(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, NULL, NULL);
+            ret = redis_mbulk_reply_zipped_keys_dbl(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, NULL, NULL);
+            break;
         case TYPE_HSCAN:
-            return redis_mbulk_reply_zipped_vals(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, NULL, NULL);
+            ret = redis_mbulk_reply_zipped_vals(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, NULL, NULL);
+            break;
         default:
-            return -1;
+            ret = -1;
     }
+    redis_sock->reply_iterator = reply_iterator;
+
+    return ret;
 }
 
-PHP_REDIS_API zval *redis_sock_read_multibulk_reply_zval(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock) {
+/* Read the header of a multi-bulk reply.  Returns 0 with its element count,
+ * 1 if the reply is something else (its error kept as our last error) and
+ * -1 if the connection failed. */
+static int redis_read_mbulk_count(RedisSock *redis_sock, int *count TSRMLS_DC)
+{
     char inbuf[1024];
-	int numElems;
-    zval *z_tab;
 
     if(-1 == redis_check_eof(redis_sock TSRMLS_CC)) {
-        return NULL;
+        return -1;
     }
-
-    if(php_stream_gets(redis_sock->stream, inbuf, 1024) == NULL) {
-		redis_stream_close(redis_sock TSRMLS_CC);
-        redis_sock->stream = NULL;
-        redis_sock->status = REDIS_SOCK_STATUS_FAILED;
-        redis_sock->mode = ATOMIC;
-        redis_sock->watching = 0;
-        zend_throw_exception(redis_exception_ce, "read error on connection", 0 TSRMLS_CC);
-        return NULL;
+    if(redis_sock_read_line(redis_sock, inbuf, sizeof(inbuf), NULL TSRMLS_CC) == NULL) {
+        redis_sock_read_failed(redis_sock TSRMLS_CC);
+        return -1;
     }
 
     if(inbuf[0] != '*') {
+        /* Capture our error if redis has given us one */
+        if (inbuf[0] == '-') {
+            redis_sock_set_err(redis_sock, inbuf+1, strlen(inbuf+1) - 2);
+        }
+        return 1;
+    }
+
+    *count = atoi(inbuf+1);
+    return 0;
+}
+
+/* Same, for the reply callbacks: anything but a multi-bulk is FALSE */
+static int redis_read_mbulk_header(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock,
+                                   zval *z_tab, int *count)
+{
+    int ret = redis_read_mbulk_count(redis_sock, count TSRMLS_CC);
+
+    if(ret > 0) {
+        IF_MULTI_OR_PIPELINE() {
+            add_next_index_bool(z_tab, 0);
+        } else {
+            RETVAL_FALSE;
+        }
+    }
+    return ret ? -1 : 0;
+}
+
+PHP_REDIS_API zval *redis_sock_read_multibulk_reply_zval(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock) {
+	int numElems;
+    zval *z_tab;
+
+    if(redis_read_mbulk_count(redis_sock, &numElems TSRMLS_CC) != 0) {
         return NULL;
     }
-    numElems = atoi(inbuf+1);
 
     MAKE_STD_ZVAL(z_tab);
     array_init(z_tab);
@@ -285,9 +518,6 @@ PHP_REDIS_API zval *redis_sock_read_multibulk_reply_zval(INTERNAL_FUNCTION_PARAM
  */
 PHP_REDIS_API char *redis_sock_read_bulk_reply(RedisSock *redis_sock, int bytes TSRMLS_DC)
 {
-    int offset = 0;
-    size_t got;
-
     char * reply;
 
     if(-1 == redis_check_eof(redis_sock TSRMLS_CC)) {
@@ -297,22 +527,15 @@ PHP_REDIS_API char *redis_sock_read_bulk_reply(RedisSock *redis_sock, int bytes
     if (bytes == -1) {
         return NULL;
     } else {
-        char c;
-        int i;
+        char crlf[2];
 
 		reply = emalloc(bytes+1);
 
-        while(offset < bytes) {
-            got = php_stream_read(redis_sock->stream, reply + offset, bytes-offset);
-            if (got <= 0) {
-                /* Error or EOF */
-				zend_throw_exception(redis_exception_ce, "socket error on read socket", 0 TSRMLS_CC);
-                break;
-            }
-            offset += got;
-        }
-        for(i = 0; i < 2; i++) {
-            php_stream_read(redis_sock->stream, &c, 1);
+        if(redis_sock_read_bytes(redis_sock, reply, bytes TSRMLS_CC) < 0 ||
+           redis_sock_read_bytes(redis_sock, crlf, 2 TSRMLS_CC) < 0)
+        {
+            /* Error or EOF */
+			zend_throw_exception(redis_exception_ce, "socket error on read socket", 0 TSRMLS_CC);
         }
     }
 
@@ -333,13 +556,8 @@ PHP_REDIS_API char *redis_sock_read(RedisSock *redis_sock, int *buf_len TSRMLS_D
         return NULL;
     }
 
-    if(php_stream_gets(redis_sock->stream, inbuf, 1024) == NULL) {
-		redis_stream_close(redis_sock TSRMLS_CC);
-        redis_sock->stream = NULL;
-        redis_sock->status = REDIS_SOCK_STATUS_FAILED;
-        redis_sock->mode = ATOMIC;
-        redis_sock->watching = 0;
-        zend_throw_exception(redis_exception_ce, "read error on connection", 0 TSRMLS_CC);
+    if(redis_sock_read_line(redis_sock, inbuf, sizeof(inbuf), NULL TSRMLS_CC) == NULL) {
+        redis_sock_read_failed(redis_sock TSRMLS_CC);
         return NULL;
     }
 
@@ -398,7 +616,8 @@ void add_constant_long(zend_class_entry *ce, char *name, int value) {
         (void*)&constval, sizeof(zval*), NULL);
 }
 
-int les_crc16(char *key) {
+/* CRC16 (XMODEM) as used by redis cluster to map keys to hash slots */
+unsigned short redis_crc16(const char *buf, int len) {
     static unsigned short LES_CRCINITCODE[256] = {
         0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
         0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
@@ -434,14 +653,17 @@ int les_crc16(char *key) {
         0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
     };
     unsigned short crc = 0;
-    int l = strlen(key);
 
-    while (l-- > 0)
-        crc = LES_CRCINITCODE[(crc >> 8 ^ *key++) & 0xff] ^ (crc << 8);
+    while (len-- > 0)
+        crc = LES_CRCINITCODE[(crc >> 8 ^ *buf++) & 0xff] ^ (crc << 8);
 
     return crc;
 }
 
+int les_crc16(char *key) {
+    return redis_crc16(key, strlen(key));
+}
+
 int
 integer_length(int i) {
 	int sz = 0;
@@ -489,7 +711,7 @@ redis_cmd_format_static(char **ret, char *keyword, char *format, ...) {
     va_list ap;
     smart_str buf = {0};
     int l = strlen(keyword);
-	char *dbl_str;
+	char dbl_str[REDIS_DOUBLE_BUF_SIZE];
 	int dbl_len;
 
 	va_start(ap, format);
@@ -520,11 +742,10 @@ redis_cmd_format_static(char **ret, char *keyword, char *format, ...) {
 			case 'f':
 			case 'F': {
 				double d = va_arg(ap, double);
-				REDIS_DOUBLE_TO_STRING(dbl_str, dbl_len, d)
+				dbl_len = redis_double_to_string(dbl_str, d);
 				smart_str_append_long(&buf, dbl_len);
 				smart_str_appendl(&buf, _NL, sizeof(_NL) - 1);
 				smart_str_appendl(&buf, dbl_str, dbl_len);
-				efree(dbl_str);
 			}
 				break;
 
@@ -570,7 +791,7 @@ redis_cmd_format(char **ret, char *format, ...) {
 	smart_str buf = {0};
 	va_list ap;
 	char *p = format;
-	char *dbl_str;
+	char dbl_str[REDIS_DOUBLE_BUF_SIZE];
 	int dbl_len;
 
 	va_start(ap, format);
@@ -588,11 +809,10 @@ redis_cmd_format(char **ret, char *format, ...) {
 				case 'F':
 				case 'f': {
 					double d = va_arg(ap, double);
-					REDIS_DOUBLE_TO_STRING(dbl_str, dbl_len, d)
+					dbl_len = redis_double_to_string(dbl_str, d);
 					smart_str_append_long(&buf, dbl_len);
 					smart_str_appendl(&buf, _NL, sizeof(_NL) - 1);
 					smart_str_appendl(&buf, dbl_str, dbl_len);
-					efree(dbl_str);
 				}
 					break;
 
@@ -676,6 +896,25 @@ int redis_cmd_append_sstr(smart_str *str, char *append, int append_len) {
     return str->len;
 }
 
+/*
+ * Append a key to a smart_str, writing our prefix (if any) right in front of it
+ */
+int redis_cmd_append_sstr_key(smart_str *str, char *key, int key_len, RedisSock *redis_sock) {
+    int prefix_len = redis_sock->prefix ? redis_sock->prefix_len : 0;
+
+    smart_str_appendc(str, '$');
+    smart_str_append_long(str, prefix_len + key_len);
+    smart_str_appendl(str, _NL, sizeof(_NL) - 1);
+    if(prefix_len) {
+        smart_str_appendl(str, redis_sock->prefix, prefix_len);
+    }
+    smart_str_appendl(str, key, key_len);
+    smart_str_appendl(str, _NL, sizeof(_NL) - 1);
+
+    /* Return our new length */
+    return str->len;
+}
+
 /*
  * Append an integer to a smart string command
  */
@@ -694,23 +933,68 @@ int redis_cmd_append_sstr_long(smart_str *str, long append) {
     return redis_cmd_append_sstr(str, long_buf, long_len);
 }
 
+/*
+ * Format a double the way we send it: integers without a fraction, anything
+ * else with the fewest digits (15, or 17 if needed) that read back as the
+ * very same value.  Locale independent, and written to buf, which must hold
+ * REDIS_DOUBLE_BUF_SIZE bytes.
+ */
+int redis_double_to_string(char *buf, double value) {
+    /* (long)-0.0 is 0, keep the sign */
+    if(value == 0.0 && 1.0 / value < 0) {
+        return snprintf(buf, REDIS_DOUBLE_BUF_SIZE, "-0");
+    }
+
+    /* Integral values a double holds exactly, the common case for scores */
+    if(value > -9007199254740992.0 && value < 9007199254740992.0 &&
+       value >= (double)LONG_MIN && value <= (double)LONG_MAX && value == (double)(long)value)
+    {
+        return snprintf(buf, REDIS_DOUBLE_BUF_SIZE, "%ld", (long)value);
+    }
+
+    if(zend_isinf(value)) {
+        return snprintf(buf, REDIS_DOUBLE_BUF_SIZE, "%s", value > 0 ? "inf" : "-inf");
+    } else if(zend_isnan(value)) {
+        return snprintf(buf, REDIS_DOUBLE_BUF_SIZE, "nan");
+    }
+
+    php_gcvt(value, 15, '.', 'e', buf);
+    if(zend_strtod(buf, NULL) != value) {
+        php_gcvt(value, 17, '.', 'e', buf);
+    }
+    return strlen(buf);
+}
+
+/*
+ * Parse a double sent by the server, zend_strtod doesn't know the infinite
+ * scores it writes as "inf" and "-inf"
+ */
+static double redis_string_to_double(const char *str) {
+    const char *p = str;
+
+    if(*p == '-' || *p == '+') {
+        p++;
+    }
+    if(strcasecmp(p, "inf") == 0) {
+        return *str == '-' ? -HUGE_VAL : HUGE_VAL;
+    }
+    return zend_strtod(str, NULL);
+}
+
 /*
  * Append a double to a smart string command
  */
 int redis_cmd_append_sstr_dbl(smart_str *str, double value) {
-    char *dbl_str;
+    char dbl_str[REDIS_DOUBLE_BUF_SIZE];
     int dbl_len;
 	int retval;
 
     /* Convert to double */
-    REDIS_DOUBLE_TO_STRING(dbl_str, dbl_len, value);
+    dbl_len = redis_double_to_string(dbl_str, value);
 
     /* Append the string */
     retval = redis_cmd_append_sstr(str, dbl_str, dbl_len);
 
-    /* Free our double string */
-    efree(dbl_str);
-
     /* Return new length */
     return retval;
 }
@@ -744,7 +1028,7 @@ PHP_REDIS_API void redis_bulk_double_response(INTERNAL_FUNCTION_PARAMETERS, Redi
 		return;
     }
 
-    ret = atof(response);
+    ret = redis_string_to_double(response);
     efree(response);
     IF_MULTI_OR_PIPELINE() {
 		add_next_index_double(z_tab, ret);
@@ -1074,122 +1358,227 @@ PHP_REDIS_API void redis_long_response(INTERNAL_FUNCTION_PARAMETERS, RedisSock *
     }
 }
 
-/* Helper method to convert [key, value, key, value] into [key => value,
- * key => value] when returning data to the caller.  Depending on our decode
- * flag we'll convert the value data types */
-static void array_zip_values_and_scores(RedisSock *redis_sock, zval *z_tab,
-                                        int decode TSRMLS_DC)
+/* Read one element of a multi-bulk reply with the reply parser, so nested
+ * multi-bulks come back whole: a string (unserialized if unwrap is set), a
+ * long, an array of these, or FALSE for a nil or an error */
+static zval *redis_read_mbulk_elem(RedisSock *redis_sock, int unwrap TSRMLS_DC)
+{
+    zval *z, *z_un = NULL;
+
+    if(redis_sock_read_reply(redis_sock, &z TSRMLS_CC) < 0) {
+        MAKE_STD_ZVAL(z);
+        ZVAL_FALSE(z);
+        return z;
+    }
+
+    if(unwrap && Z_TYPE_P(z) == IS_STRING &&
+       redis_unserialize(redis_sock, Z_STRVAL_P(z), Z_STRLEN_P(z), &z_un TSRMLS_CC))
+    {
+        zval_ptr_dtor(&z);
+        return z_un;
+    }
+    return z;
+}
+
+/* Read one key/value pair of a zipped reply.  The key comes back as a string
+ * we own, unserialized first if we were asked to, and the value decoded.
+ * Returns -1 when there is no value to go with the key (last is set for the
+ * odd element out). */
+static int redis_read_zipped_pair(RedisSock *redis_sock, int last, int unserialize, int decode,
+                                  char **key, int *key_len, zval **z_val TSRMLS_DC)
 {
+    zval *z_key, *z_un = NULL;
+    double score;
 
-    zval *z_ret;
-    HashTable *keytable;
+    z_key = redis_read_mbulk_elem(redis_sock, 0 TSRMLS_CC);
+    if(last) {
+        zval_ptr_dtor(&z_key);
+        return -1;
+    }
+    *z_val = redis_read_mbulk_elem(redis_sock, 0 TSRMLS_CC);
 
-    MAKE_STD_ZVAL(z_ret);
-    array_init(z_ret);
-    keytable = Z_ARRVAL_P(z_tab);
+    /* Keys are strings, once unserialized if we were asked to; a nil is "" */
+    if(Z_TYPE_P(z_key) != IS_STRING) {
+        convert_to_string(z_key);
+    }
+    if(unserialize == UNSERIALIZE_KEYS &&
+       redis_unserialize(redis_sock, Z_STRVAL_P(z_key), Z_STRLEN_P(z_key), &z_un TSRMLS_CC))
+    {
+        zval_ptr_dtor(&z_key);
+        convert_to_string(z_un);
+        z_key = z_un;
+    }
+    *key = Z_STRVAL_P(z_key);
+    *key_len = Z_STRLEN_P(z_key);
+    efree(z_key);
+
+    /* Decode the score depending on flag, nil and errors stay FALSE */
+    if(Z_TYPE_P(*z_val) == IS_BOOL) {
+        return 0;
+    }
+    if(decode == SCORE_DECODE_INT) {
+        convert_to_long(*z_val);
+    } else if(decode == SCORE_DECODE_DOUBLE && Z_TYPE_P(*z_val) == IS_STRING) {
+        score = redis_string_to_double(Z_STRVAL_P(*z_val));
+        zval_dtor(*z_val);
+        ZVAL_DOUBLE(*z_val, score);
+    } else if(unserialize == UNSERIALIZE_VALS && Z_TYPE_P(*z_val) == IS_STRING &&
+              redis_unserialize(redis_sock, Z_STRVAL_P(*z_val), Z_STRLEN_P(*z_val), &z_un TSRMLS_CC))
+    {
+        zval_ptr_dtor(z_val);
+        *z_val = z_un;
+    }
 
-    for(zend_hash_internal_pointer_reset(keytable);
-        zend_hash_has_more_elements(keytable) == SUCCESS;
-        zend_hash_move_forward(keytable)) {
+    return 0;
+}
 
-        char *tablekey, *hkey, *hval;
-        unsigned int tablekey_len;
-        int hkey_len;
-        unsigned long idx;
-        zval **z_key_pp, **z_value_pp;
+/* With OPT_REPLY_ITERATOR, a large enough reply is left on the socket and
+ * handed to a RedisReplyIterator, which reads its elements on demand */
+static int redis_mbulk_reply_iterator(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock,
+                                      int count, int zipped, int unserialize, int decode)
+{
+    if(!redis_sock->reply_iterator || count < redis_sock->reply_iterator ||
+       redis_sock->mode != ATOMIC || !getThis())
+    {
+        return 0;
+    }
 
-        zend_hash_get_current_key_ex(keytable, &tablekey, &tablekey_len, &idx, 0, NULL);
-        if(zend_hash_get_current_data(keytable, (void**)&z_key_pp) == FAILURE) {
-            continue;   /* this should never happen, according to the PHP people. */
-        }
+    redis_sock_iter_reset(redis_sock TSRMLS_CC);
+    redis_sock->iter_id++;
+    if(redis_reply_iterator_new(getThis(), redis_sock, zipped ? count / 2 : count, return_value TSRMLS_CC) < 0) {
+        return 0;
+    }
+    redis_sock->iter_left = count;
+    redis_sock->iter_pos = -1;
+    redis_sock->iter_zipped = zipped;
+    redis_sock->iter_unserialize = unserialize;
+    redis_sock->iter_decode = decode;
+    return 1;
+}
 
-        /* get current value, a key */
-        convert_to_string(*z_key_pp);
-        hkey = Z_STRVAL_PP(z_key_pp);
-        hkey_len = Z_STRLEN_PP(z_key_pp);
+/* Read the next element (or key/value pair) for the iterator.  Returns -1
+ * once there are none left. */
+PHP_REDIS_API int redis_sock_iter_next(RedisSock *redis_sock TSRMLS_DC)
+{
+    char *key;
+    int key_len, last;
+    zval *z_val;
 
-        /* move forward */
-        zend_hash_move_forward(keytable);
+    redis_sock_iter_reset(redis_sock TSRMLS_CC);
+    if(redis_sock->iter_left <= 0) {
+        return -1;
+    }
 
-        /* fetch again */
-        zend_hash_get_current_key_ex(keytable, &tablekey, &tablekey_len, &idx, 0, NULL);
-        if(zend_hash_get_current_data(keytable, (void**)&z_value_pp) == FAILURE) {
-            continue;   /* this should never happen, according to the PHP people. */
+    /* count the element as read first: a failed read drops the reply */
+    if(redis_sock->iter_zipped) {
+        last = redis_sock->iter_left == 1;
+        redis_sock->iter_left = last ? 0 : redis_sock->iter_left - 2;
+        if(redis_read_zipped_pair(redis_sock, last, redis_sock->iter_unserialize,
+                                  redis_sock->iter_decode, &key, &key_len, &z_val TSRMLS_CC) < 0)
+        {
+            return -1;
         }
+        MAKE_STD_ZVAL(redis_sock->iter_key);
+        ZVAL_STRINGL(redis_sock->iter_key, key, key_len, 0);
+    } else {
+        redis_sock->iter_left--;
+        z_val = redis_read_mbulk_elem(redis_sock, redis_sock->iter_unserialize != UNSERIALIZE_NONE TSRMLS_CC);
+        MAKE_STD_ZVAL(redis_sock->iter_key);
+        ZVAL_LONG(redis_sock->iter_key, redis_sock->iter_pos + 1);
+    }
 
-        /* get current value, a hash value now. */
-        hval = Z_STRVAL_PP(z_value_pp);
+    redis_sock->iter_val = z_val;
+    redis_sock->iter_pos++;
+    return EG(exception) ? -1 : 0;
+}
 
-        /* Decode the score depending on flag */
-        if (decode == SCORE_DECODE_INT && Z_STRLEN_PP(z_value_pp) > 0) {
-            add_assoc_long_ex(z_ret, hkey, 1+hkey_len, atoi(hval+1));
-        } else if (decode == SCORE_DECODE_DOUBLE) {
-            add_assoc_double_ex(z_ret, hkey, 1+hkey_len, atof(hval));
-        } else {
-            zval *z = NULL;
-            MAKE_STD_ZVAL(z);
-            *z = **z_value_pp;
-            zval_copy_ctor(z);
-            add_assoc_zval_ex(z_ret, hkey, 1+hkey_len, z);
+/* Forget the element the iterator is on */
+PHP_REDIS_API void redis_sock_iter_reset(RedisSock *redis_sock TSRMLS_DC)
+{
+    if(redis_sock->iter_key) {
+        zval_ptr_dtor(&redis_sock->iter_key);
+        redis_sock->iter_key = NULL;
+    }
+    if(redis_sock->iter_val) {
+        zval_ptr_dtor(&redis_sock->iter_val);
+        redis_sock->iter_val = NULL;
+    }
+}
+
+/* Read past whatever the iterator left of its reply, so the connection can
+ * be used again */
+PHP_REDIS_API int redis_sock_iter_discard(RedisSock *redis_sock TSRMLS_DC)
+{
+    redis_sock_iter_reset(redis_sock TSRMLS_CC);
+    for(; redis_sock->iter_left > 0; redis_sock->iter_left--) {
+        if(redis_sock_skip_reply(redis_sock TSRMLS_CC) < 0) {
+            redis_sock->iter_left = 0;
+            return -1;
         }
     }
-    
-    /* replace */
-    zval_dtor(z_tab);
-    *z_tab = *z_ret;
-    zval_copy_ctor(z_tab);
-    zval_dtor(z_ret);
+    return 0;
+}
+
+/* Add a value to a reply array under a key we read.  With OPT_INTERN_KEYS the
+ * key goes through the request's interned strings first, so the arrays of
+ * many same-shaped hashes share their field names and their hashes are
+ * computed once.  Keys that may be numeric, or that can't be interned (the
+ * table is full, or the opcode cache owns it), are added as usual. */
+static void
+redis_add_assoc_key(RedisSock *redis_sock, zval *z_arr, char *key, int key_len, zval *z_val TSRMLS_DC)
+{
+#ifdef IS_INTERNED
+    const char *interned;
 
-    efree(z_ret);
+    if(redis_sock->intern_keys && key_len > 0 && key[0] != '-' &&
+       (key[0] < '0' || key[0] > '9'))
+    {
+        interned = zend_new_interned_string(key, key_len+1, 0 TSRMLS_CC);
+        if(IS_INTERNED(interned)) {
+            zend_hash_quick_update(Z_ARRVAL_P(z_arr), interned, key_len+1, INTERNED_HASH(interned),
+                                   &z_val, sizeof(zval*), NULL);
+            return;
+        }
+    }
+#endif
+    add_assoc_zval_ex(z_arr, key, 1+key_len, z_val);
 }
 
+/* Read a [key, value, key, value] reply straight into [key => value], the
+ * keys going in as hash keys and the values decoded as we get them, without
+ * building the flat list first */
 static int
 redis_mbulk_reply_zipped(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock,
                          zval *z_tab, int unserialize, int decode)
 {
-    char inbuf[1024];
-	int numElems;
-    zval *z_multi_result;
+	int numElems, key_len;
+    char *key;
+    zval *z_multi_result, *z_val;
 
-    if(-1 == redis_check_eof(redis_sock TSRMLS_CC)) {
+    if(redis_read_mbulk_header(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, z_tab, &numElems) < 0) {
         return -1;
     }
-    if(php_stream_gets(redis_sock->stream, inbuf, 1024) == NULL) {
-		redis_stream_close(redis_sock TSRMLS_CC);
-        redis_sock->stream = NULL;
-        redis_sock->status = REDIS_SOCK_STATUS_FAILED;
-        redis_sock->mode = ATOMIC;
-        redis_sock->watching = 0;
-        zend_throw_exception(redis_exception_ce, "read error on connection", 0 TSRMLS_CC);
-        return -1;
+    if(redis_mbulk_reply_iterator(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, numElems, 1,
+                                  unserialize, decode)) {
+        return 0;
     }
-
-    if(inbuf[0] != '*') {
-        IF_MULTI_OR_PIPELINE() {
-            add_next_index_bool(z_tab, 0);
-        } else {
-            RETVAL_FALSE;
+    MAKE_STD_ZVAL(z_multi_result);
+    array_init_size(z_multi_result, numElems / 2);
+
+    for(; numElems > 0; numElems -= 2) {
+        if(redis_read_zipped_pair(redis_sock, numElems == 1, unserialize, decode,
+                                  &key, &key_len, &z_val TSRMLS_CC) == 0)
+        {
+            redis_add_assoc_key(redis_sock, z_multi_result, key, key_len, z_val TSRMLS_CC);
+            efree(key);
         }
-        return -1;
     }
-    numElems = atoi(inbuf+1);
-    MAKE_STD_ZVAL(z_multi_result);
-    array_init(z_multi_result); /* pre-allocate array for multi's results. */
-
-    /* Grab our key, value, key, value array */
-    redis_mbulk_reply_loop(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock,
-        z_multi_result, numElems, unserialize);
-
-    /* Zip keys and values */
-    array_zip_values_and_scores(redis_sock, z_multi_result, decode TSRMLS_CC);
 
     IF_MULTI_OR_PIPELINE() {
         add_next_index_zval(z_tab, z_multi_result);
     } else {
-	    *return_value = *z_multi_result;
-	    zval_copy_ctor(return_value);
-	    zval_dtor(z_multi_result);
-	    efree(z_multi_result);
+        *return_value = *z_multi_result;
+        efree(z_multi_result);
     }
 
     return 0;
@@ -1226,28 +1615,147 @@ PHP_REDIS_API int redis_mbulk_reply_zipped_vals(INTERNAL_FUNCTION_PARAMETERS, Re
         z_tab, UNSERIALIZE_VALS, SCORE_DECODE_NONE);
 }
 
-PHP_REDIS_API void redis_1_response(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock, zval *z_tab, void *ctx) {
-
-	char *response;
-	int response_len;
-	char ret;
+/* Read the reply to a GET or an HGETALL as strings for the client cache: one
+ * for a GET, none when the key doesn't exist.  Errors aren't kept. */
+static int redis_cache_read_reply(RedisSock *redis_sock, int type, int *count,
+                                  char ***vals, int **lens TSRMLS_DC)
+{
+    char inbuf[1024];
+    size_t err_len;
+    int i;
 
-	if ((response = redis_sock_read(redis_sock, &response_len TSRMLS_CC)) == NULL) {
-		IF_MULTI_OR_PIPELINE() {
-			add_next_index_bool(z_tab, 0);
-			return;
-		} else {
-			RETURN_FALSE;
-		}
-	}
-	ret = response[1];
-	efree(response);
+    if(type == REDIS_CACHE_HASH) {
+        if(redis_read_mbulk_count(redis_sock, count TSRMLS_CC) != 0) {
+            return -1;
+        }
+    } else {
+        if(-1 == redis_check_eof(redis_sock TSRMLS_CC)) {
+            return -1;
+        }
+        if(redis_sock_read_line(redis_sock, inbuf, sizeof(inbuf), NULL TSRMLS_CC) == NULL) {
+            redis_sock_read_failed(redis_sock TSRMLS_CC);
+            return -1;
+        }
+        if(inbuf[0] == '-') {
+            /* without its \r\n, which a short or truncated line may lack */
+            for(err_len = strlen(inbuf + 1);
+                err_len && (inbuf[err_len] == '\r' || inbuf[err_len] == '\n'); err_len--);
+            redis_sock_set_err(redis_sock, inbuf+1, err_len);
+            redis_error_throw(inbuf + 1, err_len TSRMLS_CC);
+            return -1;
+        } else if(inbuf[0] != '$') {
+            return -1;
+        }
+        *count = atoi(inbuf + 1) < 0 ? 0 : 1;
+    }
 
-	IF_MULTI_OR_PIPELINE() {
-		if(ret == '1') {
-			add_next_index_bool(z_tab, 1);
-		} else {
-			add_next_index_bool(z_tab, 0);
+    *vals = emalloc((*count ? *count : 1) * sizeof(char*));
+    *lens = emalloc((*count ? *count : 1) * sizeof(int));
+    for(i = 0; i < *count; i++) {
+        if(type == REDIS_CACHE_HASH) {
+            (*vals)[i] = redis_sock_read(redis_sock, &(*lens)[i] TSRMLS_CC);
+        } else {
+            (*lens)[i] = atoi(inbuf + 1);
+            (*vals)[i] = redis_sock_read_bulk_reply(redis_sock, (*lens)[i] TSRMLS_CC);
+        }
+        /* a read that fails half way throws, and still gives a string */
+        if((*vals)[i] == NULL || EG(exception)) {
+            if((*vals)[i]) {
+                i++;
+            }
+            while(i--) {
+                efree((*vals)[i]);
+            }
+            efree(*vals);
+            efree(*lens);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* GET and HGETALL of a key the client cache may keep: answered from it, or
+ * asked and kept.  Returns -1 if the cache isn't for this key, for the
+ * command to go the usual way. */
+PHP_REDIS_API int redis_cached_read(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock,
+                                    int type, char *key, int key_len)
+{
+    char *cmd, **vals;
+    int *lens, count, cmd_len, hit, i;
+    zval *z_val;
+
+    if((hit = redis_cache_find(redis_sock, type, key, key_len, &count, &vals, &lens TSRMLS_CC)) < 0) {
+        return -1;
+    }
+
+    if(!hit) {
+        if(type == REDIS_CACHE_HASH) {
+            cmd_len = redis_cmd_format_static(&cmd, "HGETALL", "s", key, key_len);
+        } else {
+            cmd_len = redis_cmd_format_static(&cmd, "GET", "s", key, key_len);
+        }
+        if(redis_sock_write(redis_sock, cmd, cmd_len TSRMLS_CC) < 0 ||
+           redis_cache_read_reply(redis_sock, type, &count, &vals, &lens TSRMLS_CC) < 0)
+        {
+            efree(cmd);
+            RETVAL_FALSE;
+            return 0;
+        }
+        efree(cmd);
+        redis_cache_store(redis_sock, type, key, key_len, count, vals, lens TSRMLS_CC);
+    }
+
+    if(type == REDIS_CACHE_HASH) {
+        array_init_size(return_value, count / 2);
+        for(i = 0; i + 1 < count; i += 2) {
+            z_val = NULL;
+            if(!redis_unserialize(redis_sock, vals[i+1], lens[i+1], &z_val TSRMLS_CC)) {
+                MAKE_STD_ZVAL(z_val);
+                ZVAL_STRINGL(z_val, vals[i+1], lens[i+1], 1);
+            }
+            redis_add_assoc_key(redis_sock, return_value, vals[i], lens[i], z_val TSRMLS_CC);
+        }
+    } else if(count == 0) {
+        RETVAL_FALSE;
+    } else if(!redis_unserialize(redis_sock, vals[0], lens[0], &return_value TSRMLS_CC)) {
+        RETVAL_STRINGL(vals[0], lens[0], 1);
+    }
+
+    /* a hit is one block, what we just read is separate strings */
+    if(!hit) {
+        for(i = 0; i < count; i++) {
+            efree(vals[i]);
+        }
+        efree(lens);
+    }
+    if(vals) {
+        efree(vals);
+    }
+    return 0;
+}
+
+PHP_REDIS_API void redis_1_response(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock, zval *z_tab, void *ctx) {
+
+	char *response;
+	int response_len;
+	char ret;
+
+	if ((response = redis_sock_read(redis_sock, &response_len TSRMLS_CC)) == NULL) {
+		IF_MULTI_OR_PIPELINE() {
+			add_next_index_bool(z_tab, 0);
+			return;
+		} else {
+			RETURN_FALSE;
+		}
+	}
+	ret = response[1];
+	efree(response);
+
+	IF_MULTI_OR_PIPELINE() {
+		if(ret == '1') {
+			add_next_index_bool(z_tab, 1);
+		} else {
+			add_next_index_bool(z_tab, 0);
 		}
 	} else {
 		if (ret == '1') {
@@ -1405,11 +1913,13 @@ PHP_REDIS_API RedisSock* redis_sock_create(char *host, int host_len, unsigned sh
     redis_sock->read_timeout = timeout;
 
     redis_sock->serializer = REDIS_SERIALIZER_NONE;
+    redis_sock->compression = REDIS_COMPRESSION_NONE;
+    redis_sock->compression_min_size = REDIS_COMPRESSION_MIN_SIZE;
+    redis_sock->compression_dict = redis_zstd_default_dict;
     redis_sock->mode = ATOMIC;
-    redis_sock->head = NULL;
-    redis_sock->current = NULL;
-    redis_sock->pipeline_head = NULL;
-    redis_sock->pipeline_current = NULL;
+    redis_sock->callbacks = NULL;
+    redis_sock->callbacks_count = 0;
+    redis_sock->callbacks_size = 0;
 
     redis_sock->err = NULL;
     redis_sock->err_len = 0;
@@ -1489,6 +1999,11 @@ PHP_REDIS_API int redis_sock_connect(RedisSock *redis_sock TSRMLS_DC)
     php_stream_set_option(redis_sock->stream,
                           PHP_STREAM_OPTION_WRITE_BUFFER,
                           PHP_STREAM_BUFFER_NONE, NULL);
+    /* we do our own read buffering, see redis_sock_rbuf_fill */
+    php_stream_set_option(redis_sock->stream,
+                          PHP_STREAM_OPTION_READ_BUFFER,
+                          PHP_STREAM_BUFFER_NONE, NULL);
+    redis_sock->rbuf_pos = redis_sock->rbuf_len = 0;
 
     redis_sock->status = REDIS_SOCK_STATUS_CONNECTED;
 
@@ -1543,6 +2058,10 @@ PHP_REDIS_API int redis_sock_disconnect(RedisSock *redis_sock TSRMLS_DC)
 				php_stream_close(redis_sock->stream);
 			}
 			redis_sock->stream = NULL;
+			redis_sock->rbuf_pos = redis_sock->rbuf_len = 0;
+			if(redis_sock->async_count) {
+				redis_sock_async_fail(redis_sock);
+			}
 
 			return 1;
     }
@@ -1610,38 +2129,16 @@ PHP_REDIS_API int redis_sock_set_err(RedisSock *redis_sock, const char *msg, int
  */
 PHP_REDIS_API int redis_sock_read_multibulk_reply(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock, zval *z_tab, void *ctx)
 {
-    char inbuf[1024];
-	int numElems, err_len;
+	int numElems;
     zval *z_multi_result;
 
-    if(-1 == redis_check_eof(redis_sock TSRMLS_CC)) {
+    if(redis_read_mbulk_header(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, z_tab, &numElems) < 0) {
         return -1;
     }
-    if(php_stream_gets(redis_sock->stream, inbuf, 1024) == NULL) {
-		redis_stream_close(redis_sock TSRMLS_CC);
-        redis_sock->stream = NULL;
-        redis_sock->status = REDIS_SOCK_STATUS_FAILED;
-        redis_sock->mode = ATOMIC;
-        redis_sock->watching = 0;
-        zend_throw_exception(redis_exception_ce, "read error on connection", 0 TSRMLS_CC);
-        return -1;
-    }
-
-    if(inbuf[0] != '*') {
-        IF_MULTI_OR_PIPELINE() {
-            add_next_index_bool(z_tab, 0);
-        } else {
-            /* Capture our error if redis has given us one */
-            if (inbuf[0] == '-') {
-                err_len = strlen(inbuf+1) - 2;
-                redis_sock_set_err(redis_sock, inbuf+1, err_len);
-            }
-
-            RETVAL_FALSE;
-        }
-        return -1;
+    if(redis_mbulk_reply_iterator(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, numElems, 0,
+                                  UNSERIALIZE_ALL, SCORE_DECODE_NONE)) {
+        return 0;
     }
-    numElems = atoi(inbuf+1);
     MAKE_STD_ZVAL(z_multi_result);
     array_init(z_multi_result); /* pre-allocate array for multi's results. */
 
@@ -1663,32 +2160,16 @@ PHP_REDIS_API int redis_sock_read_multibulk_reply(INTERNAL_FUNCTION_PARAMETERS,
  */
 PHP_REDIS_API int redis_mbulk_reply_raw(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock, zval *z_tab, void *ctx)
 {
-    char inbuf[1024];
 	int numElems;
     zval *z_multi_result;
 
-    if(-1 == redis_check_eof(redis_sock TSRMLS_CC)) {
-        return -1;
-    }
-    if(php_stream_gets(redis_sock->stream, inbuf, 1024) == NULL) {
-		redis_stream_close(redis_sock TSRMLS_CC);
-        redis_sock->stream = NULL;
-        redis_sock->status = REDIS_SOCK_STATUS_FAILED;
-        redis_sock->mode = ATOMIC;
-        redis_sock->watching = 0;
-        zend_throw_exception(redis_exception_ce, "read error on connection", 0 TSRMLS_CC);
+    if(redis_read_mbulk_header(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, z_tab, &numElems) < 0) {
         return -1;
     }
-
-    if(inbuf[0] != '*') {
-        IF_MULTI_OR_PIPELINE() {
-            add_next_index_bool(z_tab, 0);
-        } else {
-            RETVAL_FALSE;
-        }
-        return -1;
+    if(redis_mbulk_reply_iterator(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, numElems, 0,
+                                  UNSERIALIZE_NONE, SCORE_DECODE_NONE)) {
+        return 0;
     }
-    numElems = atoi(inbuf+1);
     MAKE_STD_ZVAL(z_multi_result);
     array_init(z_multi_result); /* pre-allocate array for multi's results. */
 
@@ -1709,32 +2190,17 @@ PHP_REDIS_API void
 redis_mbulk_reply_loop(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock,
                        zval *z_tab, int count, int unserialize)
 {
-    char *line;
-    int len;
+    int unwrap;
 
     while(count > 0) {
-        line = redis_sock_read(redis_sock, &len TSRMLS_CC);
-        if (line != NULL) {
-            zval *z = NULL;
-            int unwrap;
-
-            /* We will attempt unserialization, if we're unserializing everything,
-             * or if we're unserializing keys and we're on a key, or we're
-             * unserializing values and we're on a value! */
-            unwrap = unserialize == UNSERIALIZE_ALL ||
-                (unserialize == UNSERIALIZE_KEYS && count % 2 == 0) ||
-                (unserialize == UNSERIALIZE_VALS && count % 2 != 0);
-
-            if (unwrap && redis_unserialize(redis_sock, line, len, &z TSRMLS_CC)) {
-                efree(line);
-                add_next_index_zval(z_tab, z);
-            } else {
-                add_next_index_stringl(z_tab, line, len, 0);
-            }
-        } else {
-            add_next_index_bool(z_tab, 0);
-        }
-
+        /* We will attempt unserialization, if we're unserializing everything,
+         * or if we're unserializing keys and we're on a key, or we're
+         * unserializing values and we're on a value! */
+        unwrap = unserialize == UNSERIALIZE_ALL ||
+            (unserialize == UNSERIALIZE_KEYS && count % 2 == 0) ||
+            (unserialize == UNSERIALIZE_VALS && count % 2 != 0);
+
+        add_next_index_zval(z_tab, redis_read_mbulk_elem(redis_sock, unwrap TSRMLS_CC));
         count--;
     }
 }
@@ -1775,51 +2241,20 @@ redis_sock_read_multibulk_reply_loop(INTERNAL_FUNCTION_PARAMETERS, RedisSock *re
  * keys with their returned values */
 PHP_REDIS_API int redis_mbulk_reply_assoc(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock, zval *z_tab, void *ctx)
 {
-    char inbuf[1024], *response;
-    int response_len;
     int i, numElems;
     zval *z_multi_result;
 
     zval **z_keys = ctx;
 
-    if(-1 == redis_check_eof(redis_sock TSRMLS_CC)) {
-        return -1;
-    }
-    if(php_stream_gets(redis_sock->stream, inbuf, 1024) == NULL) {
-        redis_stream_close(redis_sock TSRMLS_CC);
-        redis_sock->stream = NULL;
-        redis_sock->status = REDIS_SOCK_STATUS_FAILED;
-        redis_sock->mode = ATOMIC;
-        redis_sock->watching = 0;
-        zend_throw_exception(redis_exception_ce, "read error on connection", 0 TSRMLS_CC);
-        return -1;
-    }
-
-    if(inbuf[0] != '*') {
-        IF_MULTI_OR_PIPELINE() {
-            add_next_index_bool(z_tab, 0);
-        } else {
-            RETVAL_FALSE;
-        }
+    if(redis_read_mbulk_header(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, z_tab, &numElems) < 0) {
         return -1;
     }
-    numElems = atoi(inbuf+1);
     MAKE_STD_ZVAL(z_multi_result);
     array_init(z_multi_result); /* pre-allocate array for multi's results. */
 
     for(i = 0; i < numElems; ++i) {
-        response = redis_sock_read(redis_sock, &response_len TSRMLS_CC);
-        if(response != NULL) {
-            zval *z = NULL;
-            if(redis_unserialize(redis_sock, response, response_len, &z TSRMLS_CC) == 1) {
-                efree(response);
-                add_assoc_zval_ex(z_multi_result, Z_STRVAL_P(z_keys[i]), 1+Z_STRLEN_P(z_keys[i]), z);
-            } else {
-                add_assoc_stringl_ex(z_multi_result, Z_STRVAL_P(z_keys[i]), 1+Z_STRLEN_P(z_keys[i]), response, response_len, 0);
-            }
-        } else {
-            add_assoc_bool_ex(z_multi_result, Z_STRVAL_P(z_keys[i]), 1+Z_STRLEN_P(z_keys[i]), 0);
-        }
+        add_assoc_zval_ex(z_multi_result, Z_STRVAL_P(z_keys[i]), 1+Z_STRLEN_P(z_keys[i]),
+                          redis_read_mbulk_elem(redis_sock, 1 TSRMLS_CC));
     zval_dtor(z_keys[i]);
     efree(z_keys[i]);
     }
@@ -1837,21 +2272,274 @@ PHP_REDIS_API int redis_mbulk_reply_assoc(INTERNAL_FUNCTION_PARAMETERS, RedisSoc
     return 0;
 }
 
+/* Give the replies we'll never get to the async commands still waiting */
+PHP_REDIS_API void redis_sock_async_fail(RedisSock *redis_sock)
+{
+    if (!redis_sock->async_replies) {
+        MAKE_STD_ZVAL(redis_sock->async_replies);
+        array_init(redis_sock->async_replies);
+    }
+
+    for (; redis_sock->async_count; redis_sock->async_count--) {
+        add_index_bool(redis_sock->async_replies, ++redis_sock->async_read, 0);
+    }
+}
+
+/**
+ * redis_sock_async_read_one
+ * Read the reply to the oldest async command, and keep it under its id.
+ */
+PHP_REDIS_API int redis_sock_async_read_one(RedisSock *redis_sock TSRMLS_DC)
+{
+    fold_item fi;
+    redis_mode mode = redis_sock->mode;
+    zval z_ret, *z_tab, **z_val;
+
+    if (!redis_sock->async_count) {
+        return 0;
+    }
+
+    /* an open reply iterator's elements come before our reply */
+    if (redis_sock->iter_left && redis_sock_iter_discard(redis_sock TSRMLS_CC) < 0) {
+        return -1;
+    }
+
+    fi = redis_sock->async[0];
+    redis_sock->async_count--;
+    memmove(redis_sock->async, redis_sock->async + 1, redis_sock->async_count * sizeof(fold_item));
+
+    if (!redis_sock->async_replies) {
+        MAKE_STD_ZVAL(redis_sock->async_replies);
+        array_init(redis_sock->async_replies);
+    }
+
+    /* the callback was saved in PIPELINE mode, and fills an array there */
+    MAKE_STD_ZVAL(z_tab);
+    array_init(z_tab);
+    INIT_ZVAL(z_ret);
+    redis_sock->mode = PIPELINE;
+    fi.fun(0, &z_ret, NULL, NULL, 0 TSRMLS_CC, redis_sock, z_tab, fi.ctx TSRMLS_CC);
+    redis_sock->mode = mode;
+    zval_dtor(&z_ret);
+
+    redis_sock->async_read++;
+    if (zend_hash_index_find(Z_ARRVAL_P(z_tab), 0, (void**)&z_val) == SUCCESS) {
+        Z_ADDREF_PP(z_val);
+        add_index_zval(redis_sock->async_replies, redis_sock->async_read, *z_val);
+    } else {
+        add_index_bool(redis_sock->async_replies, redis_sock->async_read, 0);
+    }
+    zval_ptr_dtor(&z_tab);
+
+    return EG(exception) ? -1 : 0;
+}
+
 /**
  * redis_sock_write
  */
-PHP_REDIS_API int redis_sock_write(RedisSock *redis_sock, char *cmd, size_t sz TSRMLS_DC)
+static int redis_sock_write_ready(RedisSock *redis_sock TSRMLS_DC)
 {
 	if(redis_sock && redis_sock->status == REDIS_SOCK_STATUS_DISCONNECTED) {
 		zend_throw_exception(redis_exception_ce, "Connection closed", 0 TSRMLS_CC);
 		return -1;
 	}
+
+    /* so do the elements a reply iterator left unread */
+    if(redis_sock->iter_left && redis_sock_iter_discard(redis_sock TSRMLS_CC) < 0) {
+        return -1;
+    }
+
+    /* replies to async commands come before ours, read them first */
+    while(redis_sock->async_count) {
+        if(redis_sock_async_read_one(redis_sock TSRMLS_CC) < 0) {
+            redis_sock_async_fail(redis_sock);
+            return -1;
+        }
+    }
     if(-1 == redis_check_eof(redis_sock TSRMLS_CC)) {
         return -1;
     }
+    return 0;
+}
+
+PHP_REDIS_API int redis_sock_write(RedisSock *redis_sock, char *cmd, size_t sz TSRMLS_DC)
+{
+    if(redis_sock_write_ready(redis_sock TSRMLS_CC) < 0) {
+        return -1;
+    }
+    if(redis_sock->cache) {
+        redis_cache_sent(redis_sock, cmd, sz);
+    }
     return php_stream_write(redis_sock->stream, cmd, sz);
 }
 
+/* Part of a command may have gone out: nothing can follow it on this
+ * connection, so drop it like a failed read would */
+static void redis_sock_write_failed(RedisSock *redis_sock TSRMLS_DC)
+{
+    redis_stream_close(redis_sock TSRMLS_CC);
+    redis_sock->stream = NULL;
+    redis_sock->status = REDIS_SOCK_STATUS_FAILED;
+    redis_sock->mode = ATOMIC;
+    redis_sock->watching = 0;
+}
+
+/* Stop waiting for the reply to async command id.  It would still come, and
+ * be kept for an await() nobody will make, so the connection goes (the next
+ * command opens it again) and what that leaves for id is dropped. */
+PHP_REDIS_API void redis_sock_async_abandon(RedisSock *redis_sock, long id TSRMLS_DC)
+{
+    if (redis_sock->stream && id > redis_sock->async_read && id <= redis_sock->async_sent) {
+        redis_sock_write_failed(redis_sock TSRMLS_CC);
+    }
+    if (redis_sock->async_replies) {
+        zend_hash_index_del(Z_ARRVAL_P(redis_sock->async_replies), id);
+    }
+}
+
+/**
+ * redis_sock_writev
+ * Write pieces of a command with as few system calls as we can.
+ */
+static int redis_sock_writev(RedisSock *redis_sock, struct iovec *iov, int iovcnt TSRMLS_DC)
+{
+#ifndef _MSC_VER
+    php_netstream_data_t *sock;
+    php_pollfd pfd;
+    ssize_t written;
+    int wait_ms;
+#endif
+
+    if(redis_sock_write_ready(redis_sock TSRMLS_CC) < 0) {
+        return -1;
+    }
+
+#ifndef _MSC_VER
+    sock = (php_netstream_data_t*)redis_sock->stream->abstract;
+    wait_ms = redis_sock->read_timeout > 0 ? (int)(redis_sock->read_timeout * 1000) : -1;
+
+    while(iovcnt > 0) {
+        written = writev(sock->socket, iov, iovcnt > IOV_MAX ? IOV_MAX : iovcnt);
+        if(written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                pfd.fd = sock->socket;
+                pfd.events = POLLOUT;
+                pfd.revents = 0;
+                if(php_poll2(&pfd, 1, wait_ms) > 0) {
+                    continue;
+                }
+            }
+            redis_sock_write_failed(redis_sock TSRMLS_CC);
+            return -1;
+        }
+
+        /* skip what went out, there may be part of a piece left */
+        while(iovcnt > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(iovcnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+#else
+    for(; iovcnt > 0; iov++, iovcnt--) {
+        if(php_stream_write(redis_sock->stream, iov->iov_base, iov->iov_len) != iov->iov_len) {
+            redis_sock_write_failed(redis_sock TSRMLS_CC);
+            return -1;
+        }
+    }
+#endif
+
+    return 0;
+}
+
+/**
+ * redis_sock_request_argv
+ * Send a command given as separate arguments, or queue it when we're in a
+ * pipeline or buffered MULTI.  When it is sent right away, arguments of
+ * REDIS_WRITEV_MIN bytes or more go out from their own memory, next to the
+ * protocol framing, rather than being copied into the command first.
+ */
+PHP_REDIS_API int redis_sock_request_argv(RedisSock *redis_sock, char *keyword, int keyword_len,
+                                          int argc, char **argv, int *argv_len TSRMLS_DC)
+{
+    smart_str cmd = {0};
+    struct iovec *iov;
+    int i, iovcnt, ret;
+
+    if(redis_sock->mode == PIPELINE || (redis_sock->mode == MULTI && redis_sock->multi_buffered)) {
+        redis_cmd_init_sstr(&redis_sock->pipeline_cmd, argc, keyword, keyword_len);
+        for(i = 0; i < argc; i++) {
+            redis_cmd_append_sstr(&redis_sock->pipeline_cmd, argv[i], argv_len[i]);
+        }
+        return 0;
+    }
+
+    /* The framing alternates with the large arguments: framing is in the
+     * even pieces, as offsets into cmd until it's done growing */
+    iovcnt = 1;
+    for(i = 0; i < argc; i++) {
+        if(argv_len[i] >= REDIS_WRITEV_MIN) {
+            iovcnt += 2;
+        }
+    }
+
+    if(iovcnt == 1) {
+        redis_cmd_init_sstr(&cmd, argc, keyword, keyword_len);
+        for(i = 0; i < argc; i++) {
+            redis_cmd_append_sstr(&cmd, argv[i], argv_len[i]);
+        }
+        ret = redis_sock_write(redis_sock, cmd.c, cmd.len TSRMLS_CC) < 0 ? -1 : 0;
+        smart_str_free(&cmd);
+        return ret;
+    }
+
+    iov = emalloc(iovcnt * sizeof(struct iovec));
+    iovcnt = 0;
+    iov[0].iov_base = NULL;
+
+    redis_cmd_init_sstr(&cmd, argc, keyword, keyword_len);
+    for(i = 0; i < argc; i++) {
+        if(argv_len[i] < REDIS_WRITEV_MIN) {
+            redis_cmd_append_sstr(&cmd, argv[i], argv_len[i]);
+            continue;
+        }
+
+        smart_str_appendc(&cmd, '$');
+        smart_str_append_long(&cmd, argv_len[i]);
+        smart_str_appendl(&cmd, _NL, sizeof(_NL) - 1);
+
+        iov[iovcnt].iov_len = cmd.len - (size_t)iov[iovcnt].iov_base;
+        iov[iovcnt + 1].iov_base = argv[i];
+        iov[iovcnt + 1].iov_len = argv_len[i];
+        iovcnt += 2;
+
+        iov[iovcnt].iov_base = (void*)cmd.len;
+        smart_str_appendl(&cmd, _NL, sizeof(_NL) - 1);
+    }
+    iov[iovcnt].iov_len = cmd.len - (size_t)iov[iovcnt].iov_base;
+    iovcnt++;
+
+    for(i = 0; i < iovcnt; i += 2) {
+        iov[i].iov_base = cmd.c + (size_t)iov[i].iov_base;
+    }
+
+    if(redis_sock->cache) {
+        redis_cache_sent_argv(redis_sock, keyword, keyword_len, argc, argv, argv_len);
+    }
+    ret = redis_sock_writev(redis_sock, iov, iovcnt TSRMLS_CC);
+
+    efree(iov);
+    smart_str_free(&cmd);
+    return ret;
+}
+
 /**
  * redis_free_socket
  */
@@ -1869,12 +2557,488 @@ PHP_REDIS_API void redis_free_socket(RedisSock *redis_sock)
     if(redis_sock->persistent_id) {
         efree(redis_sock->persistent_id);
     }
+    if(redis_sock->rbuf) {
+        efree(redis_sock->rbuf);
+    }
+    smart_str_free(&redis_sock->pipeline_cmd);
+    smart_str_free(&redis_sock->serialize_buf);
+    if(redis_sock->pipeline_replies) {
+        zval_ptr_dtor(&redis_sock->pipeline_replies);
+    }
+    if(redis_sock->callbacks) {
+        efree(redis_sock->callbacks);
+    }
+    if(redis_sock->async) {
+        efree(redis_sock->async);
+    }
+    if(redis_sock->async_replies) {
+        zval_ptr_dtor(&redis_sock->async_replies);
+    }
+    if(redis_sock->iter_key) {
+        zval_ptr_dtor(&redis_sock->iter_key);
+    }
+    if(redis_sock->iter_val) {
+        zval_ptr_dtor(&redis_sock->iter_val);
+    }
+#ifdef HAVE_REDIS_ZSTD
+    if(redis_sock->zstd_cctx) {
+        ZSTD_freeCCtx(redis_sock->zstd_cctx);
+    }
+    if(redis_sock->zstd_dctx) {
+        ZSTD_freeDCtx(redis_sock->zstd_dctx);
+    }
+#endif
     efree(redis_sock->host);
     efree(redis_sock);
 }
 
-PHP_REDIS_API int
-redis_serialize(RedisSock *redis_sock, zval *z, char **val, int *val_len TSRMLS_DC) {
+/* Values we compressed start with a header: a magic, the algorithm, and the
+ * length of the value once uncompressed, little endian.  Values compressed
+ * with a zstd dictionary have the high bit set on the algorithm, and the id
+ * of the dictionary after the length. */
+#define REDIS_COMPRESSED_MAGIC      "\x1bRZ"
+#define REDIS_COMPRESSED_MAGIC_LEN  3
+#define REDIS_COMPRESSED_HEADER_LEN 8
+#define REDIS_COMPRESSED_DICT       0x80
+#define REDIS_COMPRESSED_DICT_HEADER_LEN 12
+#define REDIS_COMPRESSED_MAX_LEN    (512 * 1024 * 1024)
+
+static void redis_write_le32(char *p, unsigned int v) {
+    p[0] = (char)(v & 0xff);
+    p[1] = (char)((v >> 8) & 0xff);
+    p[2] = (char)((v >> 16) & 0xff);
+    p[3] = (char)((v >> 24) & 0xff);
+}
+
+static unsigned int redis_read_le32(const char *p) {
+    const unsigned char *u = (const unsigned char *)p;
+    return (unsigned int)u[0] | ((unsigned int)u[1] << 8) |
+           ((unsigned int)u[2] << 16) | ((unsigned int)u[3] << 24);
+}
+
+#ifdef HAVE_REDIS_ZSTD
+/* Trained zstd dictionaries.  They are loaded once, kept in persistent memory
+ * for the life of the process, and found by the id zstd gives them.  The
+ * compression side is digested per level, the first time a level needs it. */
+typedef struct {
+    unsigned int id;
+    char         *path;
+    void         *dict;
+    size_t       dict_len;
+    ZSTD_DDict   *ddict;
+    ZSTD_CDict   *cdict[REDIS_ZSTD_MAX_LEVEL + 1];
+} redisZstdDict;
+
+static redisZstdDict redis_zstd_dicts[REDIS_ZSTD_DICTS_MAX];
+static int redis_zstd_dicts_count;
+
+#ifdef ZTS
+static MUTEX_T redis_zstd_dicts_mutex;
+#define REDIS_ZSTD_DICTS_LOCK()     tsrm_mutex_lock(redis_zstd_dicts_mutex)
+#define REDIS_ZSTD_DICTS_UNLOCK()   tsrm_mutex_unlock(redis_zstd_dicts_mutex)
+#else
+#define REDIS_ZSTD_DICTS_LOCK()
+#define REDIS_ZSTD_DICTS_UNLOCK()
+#endif
+
+static redisZstdDict *redis_zstd_dict_find(unsigned int id) {
+    int i;
+
+    for(i = 0; i < redis_zstd_dicts_count; i++) {
+        if(redis_zstd_dicts[i].id == id) {
+            return &redis_zstd_dicts[i];
+        }
+    }
+    return NULL;
+}
+
+static ZSTD_CDict *redis_zstd_cdict(unsigned int id, int level) {
+    redisZstdDict *d;
+    ZSTD_CDict *cdict = NULL;
+
+    REDIS_ZSTD_DICTS_LOCK();
+    if((d = redis_zstd_dict_find(id)) != NULL) {
+        if(!d->cdict[level]) {
+            d->cdict[level] = ZSTD_createCDict(d->dict, d->dict_len, level);
+        }
+        cdict = d->cdict[level];
+    }
+    REDIS_ZSTD_DICTS_UNLOCK();
+
+    return cdict;
+}
+
+static ZSTD_DDict *redis_zstd_ddict(unsigned int id) {
+    redisZstdDict *d;
+    ZSTD_DDict *ddict = NULL;
+
+    REDIS_ZSTD_DICTS_LOCK();
+    if((d = redis_zstd_dict_find(id)) != NULL) {
+        ddict = d->ddict;
+    }
+    REDIS_ZSTD_DICTS_UNLOCK();
+
+    return ddict;
+}
+#endif
+
+/* Load a trained zstd dictionary from a file, once per process.  Returns its
+ * id, or 0 if it can't be read, has no id (raw content isn't a trained
+ * dictionary) or we were built without zstd. */
+PHP_REDIS_API unsigned int
+redis_zstd_dict_load(const char *path)
+{
+#ifdef HAVE_REDIS_ZSTD
+    redisZstdDict *d;
+    FILE *fp;
+    void *dict = NULL;
+    long len = 0;
+    unsigned int id = 0;
+    int i;
+
+    REDIS_ZSTD_DICTS_LOCK();
+    for(i = 0; i < redis_zstd_dicts_count; i++) {
+        if(!strcmp(redis_zstd_dicts[i].path, path)) {
+            id = redis_zstd_dicts[i].id;
+            goto done;
+        }
+    }
+
+    if((fp = VCWD_FOPEN(path, "rb")) == NULL) {
+        goto done;
+    }
+    if(fseek(fp, 0, SEEK_END) == 0 && (len = ftell(fp)) > 0 &&
+       len <= REDIS_ZSTD_DICT_MAX_LEN && fseek(fp, 0, SEEK_SET) == 0)
+    {
+        dict = pemalloc(len, 1);
+        if(fread(dict, 1, len, fp) != (size_t)len) {
+            pefree(dict, 1);
+            dict = NULL;
+        }
+    }
+    fclose(fp);
+
+    if(dict == NULL || (id = ZSTD_getDictID_fromDict(dict, len)) == 0) {
+        goto fail;
+    }
+    /* the same dictionary under another name */
+    if(redis_zstd_dict_find(id)) {
+        pefree(dict, 1);
+        goto done;
+    }
+    if(redis_zstd_dicts_count == REDIS_ZSTD_DICTS_MAX) {
+        goto fail;
+    }
+
+    d = &redis_zstd_dicts[redis_zstd_dicts_count];
+    memset(d, 0, sizeof(*d));
+    if((d->ddict = ZSTD_createDDict(dict, len)) == NULL) {
+        goto fail;
+    }
+    d->id = id;
+    d->path = pestrdup(path, 1);
+    d->dict = dict;
+    d->dict_len = len;
+    redis_zstd_dicts_count++;
+    goto done;
+
+fail:
+    if(dict) {
+        pefree(dict, 1);
+    }
+    id = 0;
+done:
+    REDIS_ZSTD_DICTS_UNLOCK();
+    return id;
+#else
+    return 0;
+#endif
+}
+
+/* Set up what compression keeps across requests: the dictionary new
+ * connections use, from redis.compression.zstd_dictionary */
+PHP_REDIS_API void
+redis_compression_startup(const char *dict_path)
+{
+#if defined(HAVE_REDIS_ZSTD) && defined(ZTS)
+    redis_zstd_dicts_mutex = tsrm_mutex_alloc();
+#endif
+    if(dict_path && *dict_path) {
+        redis_zstd_default_dict = redis_zstd_dict_load(dict_path);
+    }
+}
+
+PHP_REDIS_API void
+redis_compression_shutdown(void)
+{
+#ifdef HAVE_REDIS_ZSTD
+    redisZstdDict *d;
+    int i, level;
+
+    for(i = 0; i < redis_zstd_dicts_count; i++) {
+        d = &redis_zstd_dicts[i];
+        for(level = 0; level <= REDIS_ZSTD_MAX_LEVEL; level++) {
+            if(d->cdict[level]) {
+                ZSTD_freeCDict(d->cdict[level]);
+            }
+        }
+        ZSTD_freeDDict(d->ddict);
+        pefree(d->dict, 1);
+        pefree(d->path, 1);
+    }
+    redis_zstd_dicts_count = 0;
+#ifdef ZTS
+    tsrm_mutex_free(redis_zstd_dicts_mutex);
+#endif
+#endif
+    redis_zstd_default_dict = 0;
+}
+
+/* Compress a serialized value into a new buffer, freeing the old one if it
+ * was ours.  Returns 1 if it did, 0 if the value is left alone: compression
+ * is off, the value is under the threshold, or it wouldn't get smaller. */
+static int
+redis_compress(RedisSock *redis_sock, char **val, int *val_len, int val_free)
+{
+    char *buf = NULL;
+    int len = -1, hdr_len = REDIS_COMPRESSED_HEADER_LEN;
+    unsigned char algo = (unsigned char)redis_sock->compression;
+#if defined(HAVE_REDIS_LZ4) || defined(HAVE_REDIS_ZSTD)
+    int cap;
+#endif
+#ifdef HAVE_REDIS_ZSTD
+    ZSTD_CDict *cdict = NULL;
+    size_t zlen;
+    int level;
+#endif
+
+    if(redis_sock->compression == REDIS_COMPRESSION_NONE ||
+       *val_len < redis_sock->compression_min_size)
+    {
+        return 0;
+    }
+
+    switch(redis_sock->compression) {
+#ifdef HAVE_REDIS_LZ4
+        case REDIS_COMPRESSION_LZ4:
+            cap = LZ4_compressBound(*val_len);
+            buf = emalloc(hdr_len + cap + 1);
+            if(redis_sock->compression_level > 0) {
+                len = LZ4_compress_HC(*val, buf + hdr_len, *val_len, cap,
+                                      redis_sock->compression_level);
+            } else {
+                len = LZ4_compress_default(*val, buf + hdr_len, *val_len, cap);
+            }
+            if(len <= 0) {
+                len = -1;
+            }
+            break;
+#endif
+#ifdef HAVE_REDIS_ZSTD
+        case REDIS_COMPRESSION_ZSTD:
+            level = redis_sock->compression_level > 0 ?
+                MIN(redis_sock->compression_level, REDIS_ZSTD_MAX_LEVEL) : REDIS_ZSTD_DEFAULT_LEVEL;
+            if(redis_sock->compression_dict &&
+               (cdict = redis_zstd_cdict(redis_sock->compression_dict, level)) != NULL)
+            {
+                algo |= REDIS_COMPRESSED_DICT;
+                hdr_len = REDIS_COMPRESSED_DICT_HEADER_LEN;
+            }
+            cap = (int)ZSTD_compressBound(*val_len);
+            buf = emalloc(hdr_len + cap + 1);
+            if(cdict) {
+                if(!redis_sock->zstd_cctx) {
+                    redis_sock->zstd_cctx = ZSTD_createCCtx();
+                }
+                zlen = ZSTD_compress_usingCDict(redis_sock->zstd_cctx, buf + hdr_len, cap,
+                                                *val, *val_len, cdict);
+            } else {
+                zlen = ZSTD_compress(buf + hdr_len, cap, *val, *val_len, level);
+            }
+            len = ZSTD_isError(zlen) ? -1 : (int)zlen;
+            break;
+#endif
+        default:
+            return 0;
+    }
+
+    if(len < 0 || hdr_len + len >= *val_len) {
+        efree(buf);
+        return 0;
+    }
+
+    memcpy(buf, REDIS_COMPRESSED_MAGIC, REDIS_COMPRESSED_MAGIC_LEN);
+    buf[3] = (char)algo;
+    redis_write_le32(buf + 4, (unsigned int)*val_len);
+    if(algo & REDIS_COMPRESSED_DICT) {
+        redis_write_le32(buf + 8, redis_sock->compression_dict);
+    }
+    buf[hdr_len + len] = '\0';
+
+    if(val_free) {
+        efree(*val);
+    }
+    *val = buf;
+    *val_len = hdr_len + len;
+    return 1;
+}
+
+/* Undo redis_compress.  Values are recognized by their header whatever our
+ * own settings are, as long as we were built with their algorithm.  Returns
+ * 1 with the value in a new buffer, 0 if it isn't one of ours, -1 with a
+ * warning if it is but its dictionary isn't loaded. */
+static int
+redis_uncompress(RedisSock *redis_sock, const char *val, int val_len, char **out, int *out_len TSRMLS_DC)
+{
+    unsigned char algo;
+    int ok = 0;
+    unsigned int len;
+    char *buf;
+#if defined(HAVE_REDIS_LZ4) || defined(HAVE_REDIS_ZSTD)
+    int hdr_len = REDIS_COMPRESSED_HEADER_LEN;
+#endif
+#ifdef HAVE_REDIS_ZSTD
+    ZSTD_DDict *ddict = NULL;
+    size_t zlen;
+    unsigned int dict_id;
+#endif
+
+    if(val_len < REDIS_COMPRESSED_HEADER_LEN ||
+       memcmp(val, REDIS_COMPRESSED_MAGIC, REDIS_COMPRESSED_MAGIC_LEN))
+    {
+        return 0;
+    }
+
+    algo = (unsigned char)val[3];
+    len = redis_read_le32(val + 4);
+    if(len > REDIS_COMPRESSED_MAX_LEN) {
+        return 0;
+    }
+
+    switch(algo) {
+#ifdef HAVE_REDIS_LZ4
+        case REDIS_COMPRESSION_LZ4:
+            buf = emalloc(len + 1);
+            ok = LZ4_decompress_safe(val + hdr_len, buf, val_len - hdr_len, (int)len) == (int)len;
+            break;
+#endif
+#ifdef HAVE_REDIS_ZSTD
+        case REDIS_COMPRESSION_ZSTD | REDIS_COMPRESSED_DICT:
+            hdr_len = REDIS_COMPRESSED_DICT_HEADER_LEN;
+            if(val_len < hdr_len) {
+                return 0;
+            }
+            dict_id = redis_read_le32(val + 8);
+            if((ddict = redis_zstd_ddict(dict_id)) == NULL) {
+                php_error_docref(NULL TSRMLS_CC, E_WARNING,
+                    "Value compressed with Zstd dictionary %u, which isn't loaded", dict_id);
+                return -1;
+            }
+            /* fall through */
+        case REDIS_COMPRESSION_ZSTD:
+            buf = emalloc(len + 1);
+            if(ddict) {
+                if(!redis_sock->zstd_dctx) {
+                    redis_sock->zstd_dctx = ZSTD_createDCtx();
+                }
+                zlen = ZSTD_decompress_usingDDict(redis_sock->zstd_dctx, buf, len,
+                                                  val + hdr_len, val_len - hdr_len, ddict);
+            } else {
+                zlen = ZSTD_decompress(buf, len, val + hdr_len, val_len - hdr_len);
+            }
+            ok = !ZSTD_isError(zlen) && zlen == (size_t)len;
+            break;
+#endif
+        default:
+            return 0;
+    }
+
+    if(!ok) {
+        efree(buf);
+        return 0;
+    }
+
+    buf[len] = '\0';
+    *out = buf;
+    *out_len = (int)len;
+    return 1;
+}
+
+/* Start serializing the values of one command.  The PHP serializer's table
+ * of the objects seen is made once for all of them, and emptied between
+ * values rather than rebuilt; values are written to a buffer kept on the
+ * socket.  Batches nest, the outermost one wins. */
+PHP_REDIS_API void
+redis_serialize_batch_begin(RedisSock *redis_sock TSRMLS_DC) {
+	if(redis_sock->serialize_batch++ || redis_sock->serializer != REDIS_SERIALIZER_PHP) {
+		return;
+	}
+#if ZEND_MODULE_API_NO >= 20100000
+	/* Inside someone else's serialize() (a __sleep calling us), the
+	 * table would be theirs: leave it alone */
+	if(BG(serialize).level) {
+		return;
+	}
+	PHP_VAR_SERIALIZE_INIT(redis_sock->serialize_vars);
+#else
+	zend_hash_init(&redis_sock->serialize_vars, 10, NULL, NULL, 0);
+#endif
+	redis_sock->serialize_vars_init = 1;
+}
+
+PHP_REDIS_API void
+redis_serialize_batch_end(RedisSock *redis_sock TSRMLS_DC) {
+	if(redis_sock->serialize_batch == 0 || --redis_sock->serialize_batch) {
+		return;
+	}
+	if(redis_sock->serialize_vars_init) {
+#if ZEND_MODULE_API_NO >= 20100000
+		PHP_VAR_SERIALIZE_DESTROY(redis_sock->serialize_vars);
+#else
+		zend_hash_destroy(&redis_sock->serialize_vars);
+#endif
+		redis_sock->serialize_vars_init = 0;
+	}
+	redis_sock->serialize_buf.len = 0;
+}
+
+/* Serialize a value inside a batch.  Each value still gets a table of its
+ * own as far as back references go, so it reads back on its own */
+static void
+redis_serialize_batched(RedisSock *redis_sock, zval *z, char **val, int *val_len TSRMLS_DC) {
+	smart_str *buf = &redis_sock->serialize_buf;
+
+	buf->len = 0;
+	redis_sock->serializing = 1;
+	if(redis_sock->serializer == REDIS_SERIALIZER_PHP) {
+#if ZEND_MODULE_API_NO >= 20100000
+		HashTable *vars = redis_sock->serialize_vars;
+#else
+		HashTable *vars = &redis_sock->serialize_vars;
+#endif
+		/* user code may have run serialize() on it since our last value */
+		if(zend_hash_num_elements(vars)) {
+			zend_hash_clean(vars);
+		}
+#if ZEND_MODULE_API_NO >= 20100000
+		php_var_serialize(buf, &z, &redis_sock->serialize_vars TSRMLS_CC);
+#else
+		php_var_serialize(buf, &z, vars TSRMLS_CC);
+#endif
+		if(zend_hash_num_elements(vars)) {
+			zend_hash_clean(vars);
+		}
+	} else {
+		redis_msgpack_pack(buf, z TSRMLS_CC);
+	}
+	redis_sock->serializing = 0;
+
+	*val = estrndup(buf->c ? buf->c : "", buf->len);
+	*val_len = (int)buf->len;
+}
+
+static int
+redis_serialize_value(RedisSock *redis_sock, zval *z, char **val, int *val_len TSRMLS_DC) {
 #if ZEND_MODULE_API_NO >= 20100000
 	php_serialize_data_t ht;
 #else
@@ -1921,6 +3085,10 @@ redis_serialize(RedisSock *redis_sock, zval *z, char **val, int *val_len TSRMLS_
 			return 1;
 
 		case REDIS_SERIALIZER_PHP:
+			if(redis_sock->serialize_vars_init && !redis_sock->serializing) {
+				redis_serialize_batched(redis_sock, z, val, val_len TSRMLS_CC);
+				return 1;
+			}
 
 #if ZEND_MODULE_API_NO >= 20100000
 			PHP_VAR_SERIALIZE_INIT(ht);
@@ -1947,12 +3115,31 @@ redis_serialize(RedisSock *redis_sock, zval *z, char **val, int *val_len TSRMLS_
 			}
 #endif
 			return 0;
+
+		case REDIS_SERIALIZER_MSGPACK:
+			if(redis_sock->serialize_batch && !redis_sock->serializing) {
+				redis_serialize_batched(redis_sock, z, val, val_len TSRMLS_CC);
+				return 1;
+			}
+			redis_msgpack_pack(&sstr, z TSRMLS_CC);
+			*val = sstr.c;
+			*val_len = (int)sstr.len;
+			return 1;
 	}
 	return 0;
 }
 
+/* Serialize a value to send, and compress it if that's on.  Returns 1 if
+ * *val was allocated for the occasion, 0 if it points into the zval */
 PHP_REDIS_API int
-redis_unserialize(RedisSock *redis_sock, const char *val, int val_len, zval **return_value TSRMLS_DC) {
+redis_serialize(RedisSock *redis_sock, zval *z, char **val, int *val_len TSRMLS_DC) {
+	int val_free = redis_serialize_value(redis_sock, z, val, val_len TSRMLS_CC);
+
+	return redis_compress(redis_sock, val, val_len, val_free) || val_free;
+}
+
+static int
+redis_unserialize_value(RedisSock *redis_sock, const char *val, int val_len, zval **return_value TSRMLS_DC) {
 
 	php_unserialize_data_t var_hash;
 	int ret, rv_free = 0;
@@ -1973,7 +3160,10 @@ redis_unserialize(RedisSock *redis_sock, const char *val, int val_len, zval **re
 #endif
 			if(!php_var_unserialize(return_value, (const unsigned char**)&val,
 					(const unsigned char*)val + val_len, &var_hash TSRMLS_CC)) {
-				if(rv_free==1) efree(*return_value);
+				if(rv_free==1) {
+					efree(*return_value);
+					*return_value = NULL;
+				}
 				ret = 0;
 			} else {
 				ret = 1;
@@ -1995,14 +3185,62 @@ redis_unserialize(RedisSock *redis_sock, const char *val, int val_len, zval **re
 			if(igbinary_unserialize((const uint8_t *)val, (size_t)val_len, return_value TSRMLS_CC) == 0) {
 				return 1;
 			}
-			if(rv_free==1) efree(*return_value);
+			if(rv_free==1) {
+				efree(*return_value);
+				*return_value = NULL;
+			}
 #endif
 			return 0;
 			break;
+
+		case REDIS_SERIALIZER_MSGPACK:
+			if(!*return_value) {
+				MAKE_STD_ZVAL(*return_value);
+				rv_free = 1;
+			}
+			if(redis_msgpack_unpack(val, val_len, *return_value TSRMLS_CC) == 0) {
+				return 1;
+			}
+			if(rv_free==1) {
+				efree(*return_value);
+				*return_value = NULL;
+			}
+			return 0;
 	}
 	return 0;
 }
 
+/* Get a value back from what we read.  Returns 1 with it in *return_value,
+ * 0 if the caller should take the string as it is.  A compressed value we
+ * can't uncompress is FALSE. */
+PHP_REDIS_API int
+redis_unserialize(RedisSock *redis_sock, const char *val, int val_len, zval **return_value TSRMLS_DC) {
+	char *buf;
+	int buf_len;
+
+	switch(redis_uncompress(redis_sock, val, val_len, &buf, &buf_len TSRMLS_CC)) {
+		case 0:
+			return redis_unserialize_value(redis_sock, val, val_len, return_value TSRMLS_CC);
+		case -1:
+			if(!*return_value) {
+				MAKE_STD_ZVAL(*return_value);
+			}
+			ZVAL_BOOL(*return_value, 0);
+			return 1;
+	}
+
+	/* what we compressed was either serialized or a plain string */
+	if(redis_unserialize_value(redis_sock, buf, buf_len, return_value TSRMLS_CC)) {
+		efree(buf);
+		return 1;
+	}
+	if(!*return_value) {
+		MAKE_STD_ZVAL(*return_value);
+	}
+	ZVAL_STRINGL(*return_value, buf, buf_len, 0);
+	return 1;
+}
+
 PHP_REDIS_API int
 redis_key_prefix(RedisSock *redis_sock, char **key, int *key_len TSRMLS_DC) {
 	int ret_len;
@@ -2026,33 +3264,6 @@ redis_key_prefix(RedisSock *redis_sock, char **key, int *key_len TSRMLS_DC) {
  * Processing for variant reply types (think EVAL)
  */
 
-PHP_REDIS_API int
-redis_sock_gets(RedisSock *redis_sock, char *buf, int buf_size, size_t *line_size TSRMLS_DC) {
-    /* Handle EOF */
-	if(-1 == redis_check_eof(redis_sock TSRMLS_CC)) {
-        return -1;
-    }
-
-	if(php_stream_get_line(redis_sock->stream, buf, buf_size, line_size) == NULL) {
-		/* Close, put our socket state into error */
-		redis_stream_close(redis_sock TSRMLS_CC);
-		redis_sock->stream = NULL;
-		redis_sock->status = REDIS_SOCK_STATUS_FAILED;
-		redis_sock->mode = ATOMIC;
-		redis_sock->watching = 0;
-
-		/* Throw a read error exception */
-		zend_throw_exception(redis_exception_ce, "read error on connection", 0 TSRMLS_CC);
-	}
-
-	/* We don't need \r\n */
-	*line_size-=2;
-	buf[*line_size]='\0';
-
-	/* Success! */
-	return 0;
-}
-
 PHP_REDIS_API int
 redis_read_reply_type(RedisSock *redis_sock, REDIS_REPLY_TYPE *reply_type, int *reply_info TSRMLS_DC) {
 	/* Make sure we haven't lost the connection, even trying to reconnect */
@@ -2062,7 +3273,7 @@ redis_read_reply_type(RedisSock *redis_sock, REDIS_REPLY_TYPE *reply_type, int *
 	}
 
 	/* Attempt to read the reply-type byte */
-	if((*reply_type = php_stream_getc(redis_sock->stream)) == EOF) {
+	if((*reply_type = redis_sock_getc(redis_sock TSRMLS_CC)) == EOF) {
 		zend_throw_exception(redis_exception_ce, "socket error on read socket", 0 TSRMLS_CC);
 	}
 
@@ -2072,7 +3283,7 @@ redis_read_reply_type(RedisSock *redis_sock, REDIS_REPLY_TYPE *reply_type, int *
 		char inbuf[255];
 
 		/* Read up to our newline */
-		if(php_stream_gets(redis_sock->stream, inbuf, sizeof(inbuf)) < 0) {
+		if(redis_sock_read_line(redis_sock, inbuf, sizeof(inbuf), NULL TSRMLS_CC) == NULL) {
 			return -1;
 		}
 
@@ -2085,145 +3296,253 @@ redis_read_reply_type(RedisSock *redis_sock, REDIS_REPLY_TYPE *reply_type, int *
 }
 
 /*
- * Read a single line response, having already consumed the reply-type byte
+ * Reply parser.  Replies are parsed from whatever part of them we have
+ * received so far, and the parser stops at the end of the buffer, ready
+ * to go on once more bytes arrive.  Multi-bulk replies are kept on an explicit
+ * stack instead of the C stack, so nesting depth costs no recursion.
  */
-PHP_REDIS_API int
-redis_read_variant_line(RedisSock *redis_sock, REDIS_REPLY_TYPE reply_type, zval **z_ret TSRMLS_DC) {
-	/* Buffer to read our single line reply */
-	char inbuf[1024];
-	size_t line_size;
+PHP_REDIS_API void
+redis_reply_parser_init(redisReplyParser *p) {
+	memset(p, 0, sizeof(*p));
+}
 
-	/* Attempt to read our single line reply */
-	if(redis_sock_gets(redis_sock, inbuf, sizeof(inbuf), &line_size TSRMLS_CC) < 0) {
-		return -1;
+/* Drop a reply we won't finish */
+PHP_REDIS_API void
+redis_reply_parser_free(redisReplyParser *p) {
+	/* open multi-bulks aren't attached to their parent until they're complete */
+	while(p->depth > 0) {
+		zval_ptr_dtor(&p->stack[--p->depth].z_arr);
+	}
+	if(p->z_bulk) {
+		zval_ptr_dtor(&p->z_bulk);
 	}
+	if(p->stack) {
+		efree(p->stack);
+	}
+	memset(p, 0, sizeof(*p));
+}
 
-	/* If this is an error response, filter specific errors that should throw
-     * an exception, and set our error field in our RedisSock object. */
-	if(reply_type == TYPE_ERR) {
-        /* Handle throwable errors */
-        redis_error_throw(inbuf, line_size TSRMLS_CC);
+/*
+ * Parse len bytes of buf, setting *used to how many were consumed.  Returns 1
+ * once the reply is complete (in p->z_ret), 0 if it needs more bytes and -1
+ * on a protocol error.  A line is only consumed once we have all of it; a
+ * bulk payload is copied as it comes.
+ */
+PHP_REDIS_API int
+redis_reply_parse(redisReplyParser *p, RedisSock *redis_sock, const char *buf, size_t len,
+				  size_t *used TSRMLS_DC) {
+	size_t pos = 0, n;
+	const char *line, *nl;
+	long line_len, count;
+	zval *z;
+
+	*used = 0;
+
+	while(1) {
+		if(p->z_bulk) {
+			/* the payload, then its \r\n */
+			n = MIN(len - pos, (size_t)(p->bulk_len + 2 - p->bulk_got));
+			if(p->bulk_got < p->bulk_len) {
+				memcpy(Z_STRVAL_P(p->z_bulk) + p->bulk_got, buf + pos,
+					   MIN(n, (size_t)(p->bulk_len - p->bulk_got)));
+			}
+			p->bulk_got += n;
+			pos += n;
+			*used = pos;
 
-		/* Set our last error */
-		redis_sock_set_err(redis_sock, inbuf, line_size);
+			if(p->bulk_got < p->bulk_len + 2) {
+				return 0;
+			}
+			z = p->z_bulk;
+			p->z_bulk = NULL;
+		} else {
+			if(pos == len || !(nl = memchr(buf + pos, '\n', len - pos))) {
+				return 0;
+			}
 
-		/* Set our response to FALSE */
-		ZVAL_FALSE(*z_ret);
-	} else {
-		/* Set our response to TRUE */
-		ZVAL_TRUE(*z_ret);
-	}
+			line = buf + pos;
+			line_len = nl - line;
+			if(line_len > 0 && line[line_len - 1] == '\r') {
+				line_len--;
+			}
+			pos = nl - buf + 1;
+			*used = pos;
 
-	return 0;
+			MAKE_STD_ZVAL(z);
+			switch(line_len ? line[0] : 0) {
+				case TYPE_LINE:
+					ZVAL_TRUE(z);
+					break;
+				case TYPE_ERR:
+					redis_error_throw((char*)line + 1, line_len - 1 TSRMLS_CC);
+					redis_sock_set_err(redis_sock, line + 1, line_len - 1);
+					ZVAL_FALSE(z);
+					break;
+				case TYPE_INT:
+					ZVAL_LONG(z, strtol(line + 1, NULL, 10));
+					break;
+				case TYPE_BULK:
+					if((count = strtol(line + 1, NULL, 10)) < 0) {
+						ZVAL_FALSE(z);
+						break;
+					}
+					Z_TYPE_P(z) = IS_STRING;
+					Z_STRLEN_P(z) = count;
+					Z_STRVAL_P(z) = emalloc(count + 1);
+					Z_STRVAL_P(z)[count] = '\0';
+					p->z_bulk = z;
+					p->bulk_len = count;
+					p->bulk_got = 0;
+					continue;
+				case TYPE_MULTIBULK:
+					array_init(z);
+					if((count = strtol(line + 1, NULL, 10)) <= 0) {
+						break;
+					}
+					if(p->depth == p->stack_size) {
+						p->stack_size = p->stack_size ? 2 * p->stack_size : 8;
+						p->stack = erealloc(p->stack, p->stack_size * sizeof(redisReplyFrame));
+					}
+					p->stack[p->depth].z_arr = z;
+					p->stack[p->depth].remaining = count;
+					p->depth++;
+					continue;
+				default:
+					efree(z);
+					zend_throw_exception_ex(redis_exception_ce, 0 TSRMLS_CC,
+						"protocol error, got '%c' as reply-type byte\n", line_len ? line[0] : ' ');
+					return -1;
+			}
+		}
+
+		/* z is complete: add it to the multi-bulk it belongs to, which may
+		 * complete that one in turn */
+		while(1) {
+			if(p->depth == 0) {
+				p->z_ret = z;
+				return 1;
+			}
+			add_next_index_zval(p->stack[p->depth - 1].z_arr, z);
+			if(--p->stack[p->depth - 1].remaining > 0) {
+				break;
+			}
+			z = p->stack[--p->depth].z_arr;
+		}
+	}
 }
 
+/*
+ * Read a whole reply of any shape: errors are FALSE (and our last error),
+ * status lines TRUE, integers longs, bulks strings (FALSE for a nil) and
+ * multi-bulks arrays of these.
+ */
 PHP_REDIS_API int
-redis_read_variant_bulk(RedisSock *redis_sock, int size, zval **z_ret TSRMLS_DC) {
-	/* Attempt to read the bulk reply */
-	char *bulk_resp = redis_sock_read_bulk_reply(redis_sock, size TSRMLS_CC);
+redis_sock_read_reply(RedisSock *redis_sock, zval **z_ret TSRMLS_DC) {
+	redisReplyParser p;
+	size_t used;
+	long left;
+	int ret;
 
-	/* Set our reply to FALSE on failure, and the string on success */
-	if(bulk_resp == NULL) {
-		ZVAL_FALSE(*z_ret);
+	if(-1 == redis_check_eof(redis_sock TSRMLS_CC)) {
+		return -1;
+	}
+
+	redis_reply_parser_init(&p);
+	while(1) {
+		ret = redis_reply_parse(&p, redis_sock, redis_sock->rbuf + redis_sock->rbuf_pos,
+								redis_sock->rbuf_len - redis_sock->rbuf_pos, &used TSRMLS_CC);
+		redis_sock->rbuf_pos += used;
+		if(ret != 0) {
+			break;
+		}
+
+		/* large payloads are read straight into their string; a read may
+		 * also have stopped in the \r\n after one, when none of it is left */
+		left = p.z_bulk && p.bulk_got < p.bulk_len ? p.bulk_len - p.bulk_got : 0;
+		if(left >= REDIS_SOCK_RBUF_SIZE) {
+			if(redis_sock_read_bytes(redis_sock, Z_STRVAL_P(p.z_bulk) + p.bulk_got, (size_t)left TSRMLS_CC) < 0) {
+				ret = -1;
+				break;
+			}
+			p.bulk_got += left;
+		} else if(redis_sock_rbuf_fill(redis_sock TSRMLS_CC) < 0) {
+			ret = -1;
+			break;
+		}
+	}
+
+	if(ret < 0) {
+		redis_reply_parser_free(&p);
+		redis_sock_read_failed(redis_sock TSRMLS_CC);
 		return -1;
-	} else {
-		ZVAL_STRINGL(*z_ret, bulk_resp, size, 0);
-		return 0;
 	}
+
+	*z_ret = p.z_ret;
+	p.z_ret = NULL;
+	redis_reply_parser_free(&p);
+	return 0;
 }
 
+/*
+ * Read past a whole reply without building anything from it, nested ones
+ * included.  Returns 1 if it was an error (kept as our last error), 0 for
+ * anything else, and -1 if the connection failed.
+ */
 PHP_REDIS_API int
-redis_read_multibulk_recursive(RedisSock *redis_sock, int elements, zval **z_ret TSRMLS_DC) {
-	int reply_info;
+redis_sock_skip_reply(RedisSock *redis_sock TSRMLS_DC) {
 	REDIS_REPLY_TYPE reply_type;
-	zval *z_subelem;
+	int reply_info, is_err = 0;
+	long elements = 1;
+	char inbuf[1024];
+	size_t line_size;
 
-	/* Iterate while we have elements */
-	while(elements > 0) {
-		/* Attempt to read our reply type */
+	while(elements-- > 0) {
 		if(redis_read_reply_type(redis_sock, &reply_type, &reply_info TSRMLS_CC) < 0) {
-			zend_throw_exception_ex(redis_exception_ce, 0 TSRMLS_CC, "protocol error, couldn't parse MULTI-BULK response\n", reply_type);
 			return -1;
 		}
 
-		/* Switch on our reply-type byte */
 		switch(reply_type) {
 			case TYPE_ERR:
 			case TYPE_LINE:
-				ALLOC_INIT_ZVAL(z_subelem);
-				redis_read_variant_line(redis_sock, reply_type, &z_subelem TSRMLS_CC);
-				add_next_index_zval(*z_ret, z_subelem);
+				if(redis_sock_read_line(redis_sock, inbuf, sizeof(inbuf), &line_size TSRMLS_CC) == NULL) {
+					return -1;
+				}
+				if(reply_type == TYPE_ERR) {
+					/* without its \r\n */
+					redis_sock_set_err(redis_sock, inbuf, line_size > 2 ? line_size - 2 : 0);
+					is_err = 1;
+				}
 				break;
 			case TYPE_INT:
-				/* Add our long value */
-				add_next_index_long(*z_ret, reply_info);
 				break;
 			case TYPE_BULK:
-				/* Init a zval for our bulk response, read and add it */
-				ALLOC_INIT_ZVAL(z_subelem);
-				redis_read_variant_bulk(redis_sock, reply_info, &z_subelem TSRMLS_CC);
-				add_next_index_zval(*z_ret, z_subelem);
+				/* payload and its \r\n, nothing at all for a nil */
+				if(reply_info >= 0 && redis_sock_skip_bytes(redis_sock, reply_info + 2 TSRMLS_CC) < 0) {
+					return -1;
+				}
 				break;
 			case TYPE_MULTIBULK:
-				/* Construct an array for our sub element, and add it, and recurse */
-				ALLOC_INIT_ZVAL(z_subelem);
-				array_init(z_subelem);
-				add_next_index_zval(*z_ret, z_subelem);
-				redis_read_multibulk_recursive(redis_sock, reply_info, &z_subelem TSRMLS_CC);
+				/* the elements are read as replies of their own */
+				if(reply_info > 0) {
+					elements += reply_info;
+				}
 				break;
-            default: break; /* We know it's not < 0 from previous check */
+			default:
+				return -1;
 		}
-
-		/* Decrement our element counter */
-		elements--;
 	}
 
-	return 0;
+	return is_err;
 }
 
 PHP_REDIS_API int
 redis_read_variant_reply(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock, zval *z_tab) {
-	/* Reply type, and reply size vars */
-	REDIS_REPLY_TYPE reply_type;
-	int reply_info;
-	/*char *bulk_resp; */
 	zval *z_ret;
 
-	/* Attempt to read our header */
-	if(redis_read_reply_type(redis_sock, &reply_type, &reply_info TSRMLS_CC) < 0) {
+	if(redis_sock_read_reply(redis_sock, &z_ret TSRMLS_CC) < 0) {
 		return -1;
 	}
 
-	/* Our return ZVAL */
-	MAKE_STD_ZVAL(z_ret);
-
-	/* Switch based on our top level reply type */
-	switch(reply_type) {
-		case TYPE_ERR:
-		case TYPE_LINE:
-			redis_read_variant_line(redis_sock, reply_type, &z_ret TSRMLS_CC);
-			break;
-		case TYPE_INT:
-			ZVAL_LONG(z_ret, reply_info);
-			break;
-		case TYPE_BULK:
-			redis_read_variant_bulk(redis_sock, reply_info, &z_ret TSRMLS_CC);
-			break;
-		case TYPE_MULTIBULK:
-			/* Initialize an array for our multi-bulk response */
-			array_init(z_ret);
-
-			/* If we've got more than zero elements, parse our multi bulk respoinse recursively */
-			if(reply_info > -1) {
-				redis_read_multibulk_recursive(redis_sock, reply_info, &z_ret TSRMLS_CC);
-			}
-			break;
-		default:
-			/* Protocol error */
-			zend_throw_exception_ex(redis_exception_ce, 0 TSRMLS_CC, "protocol error, got '%c' as reply-type byte\n", reply_type);
-            return FAILURE;
-	}
-
 	IF_MULTI_OR_PIPELINE() {
 		add_next_index_zval(z_tab, z_ret);
 	} else {
@@ -2238,5 +3557,39 @@ redis_read_variant_reply(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock, zv
 	return 0;
 }
 
+
+#define REDIS_CMD_ENTRY(name, flags, key) { #name, sizeof(#name) - 1, flags, key },
+static const redisCommand redis_commands[] = {
+	REDIS_COMMAND_TABLE(REDIS_CMD_ENTRY)
+};
+#undef REDIS_CMD_ENTRY
+
+/* Find a method in the command table, ignoring case.  Returns NULL for
+ * methods that aren't Redis commands (or that we don't know about). */
+const redisCommand *
+redis_command_find(const char *name, int name_len) {
+	int lo = 0, hi = sizeof(redis_commands) / sizeof(redis_commands[0]) - 1;
+	int mid, cmp;
+
+	while(lo <= hi) {
+		mid = (lo + hi) / 2;
+		cmp = strncasecmp(name, redis_commands[mid].name,
+						  MIN(name_len, redis_commands[mid].name_len));
+		if(cmp == 0) {
+			cmp = name_len - redis_commands[mid].name_len;
+		}
+
+		if(cmp == 0) {
+			return &redis_commands[mid];
+		} else if(cmp < 0) {
+			hi = mid - 1;
+		} else {
+			lo = mid + 1;
+		}
+	}
+
+	return NULL;
+}
+
 /* vim: set tabstop=4 softtabstop=4 noexpandtab shiftwidth=4: */
 
@@ -1,5 +1,6 @@
 void add_constant_long(zend_class_entry *ce, char *name, int value);
 int les_crc16(char *key);
+unsigned short redis_crc16(const char *buf, int len);
 int integer_length(int i);
 int redis_cmd_format(char **ret, char *format, ...);
 int redis_cmd_format_static(char **ret, char *keyword, char *format, ...);
@@ -7,6 +8,7 @@ int redis_cmd_format_header(char **ret, char *keyword, int arg_count);
 int redis_cmd_append_str(char **cmd, int cmd_len, char *append, int append_len);
 int redis_cmd_init_sstr(smart_str *str, int num_args, char *keyword, int keyword_len);
 int redis_cmd_append_sstr(smart_str *str, char *append, int append_len);
+int redis_cmd_append_sstr_key(smart_str *str, char *key, int key_len, RedisSock *redis_sock);
 int redis_cmd_append_sstr_int(smart_str *str, int append);
 int redis_cmd_append_sstr_long(smart_str *str, long append);
 int redis_cmd_append_int(char **cmd, int cmd_len, int append);
@@ -17,6 +19,8 @@ PHP_REDIS_API char * redis_sock_read(RedisSock *redis_sock, int *buf_len TSRMLS_
 PHP_REDIS_API void redis_1_response(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock, zval *z_tab, void *ctx);
 PHP_REDIS_API void redis_long_response(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock, zval* z_tab, void *ctx);
 typedef void (*SuccessCallback)(RedisSock *redis_sock);
+/* what reads the reply of a command, called directly or from fold_item */
+typedef void (*redisReplyFn)(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock, zval *z_tab, void *ctx);
 PHP_REDIS_API void redis_boolean_response_impl(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock, zval *z_tab, void *ctx, SuccessCallback success_callback);
 PHP_REDIS_API void redis_boolean_response(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock, zval *z_tab, void *ctx);
 PHP_REDIS_API void redis_bulk_double_response(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock, zval *z_tab, void *ctx);
@@ -37,14 +41,26 @@ PHP_REDIS_API void redis_mbulk_reply_loop(INTERNAL_FUNCTION_PARAMETERS, RedisSoc
 PHP_REDIS_API int redis_mbulk_reply_raw(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock, zval *z_tab, void *ctx);
 PHP_REDIS_API int redis_mbulk_reply_zipped_raw(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock, zval *z_tab, void *ctx);
 PHP_REDIS_API int redis_mbulk_reply_zipped_vals(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock, zval *z_tab, void *ctx);
+PHP_REDIS_API int redis_cached_read(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock, int type, char *key, int key_len);
 PHP_REDIS_API int redis_mbulk_reply_zipped_keys_int(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock, zval *z_tab, void *ctx);
 PHP_REDIS_API int redis_mbulk_reply_zipped_keys_dbl(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock, zval *z_tab, void *ctx);
 PHP_REDIS_API int redis_mbulk_reply_assoc(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock, zval *z_tab, void *ctx);
 
 PHP_REDIS_API int redis_sock_read_scan_reply(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock, REDIS_SCAN_TYPE type, long *iter);
 PHP_REDIS_API int redis_sock_write(RedisSock *redis_sock, char *cmd, size_t sz TSRMLS_DC);
+PHP_REDIS_API int redis_sock_request_argv(RedisSock *redis_sock, char *keyword, int keyword_len, int argc, char **argv, int *argv_len TSRMLS_DC);
 PHP_REDIS_API void redis_stream_close(RedisSock *redis_sock TSRMLS_DC);
 PHP_REDIS_API int redis_check_eof(RedisSock *redis_sock TSRMLS_DC);
+PHP_REDIS_API char *redis_sock_read_line(RedisSock *redis_sock, char *buf, size_t buf_size, size_t *line_size TSRMLS_DC);
+PHP_REDIS_API int redis_sock_read_bytes(RedisSock *redis_sock, char *buf, size_t len TSRMLS_DC);
+PHP_REDIS_API int redis_sock_getc(RedisSock *redis_sock TSRMLS_DC);
+PHP_REDIS_API int redis_sock_skip_reply(RedisSock *redis_sock TSRMLS_DC);
+PHP_REDIS_API int redis_sock_iter_next(RedisSock *redis_sock TSRMLS_DC);
+PHP_REDIS_API void redis_sock_iter_reset(RedisSock *redis_sock TSRMLS_DC);
+PHP_REDIS_API int redis_sock_iter_discard(RedisSock *redis_sock TSRMLS_DC);
+PHP_REDIS_API int redis_sock_async_read_one(RedisSock *redis_sock TSRMLS_DC);
+PHP_REDIS_API void redis_sock_async_fail(RedisSock *redis_sock);
+PHP_REDIS_API void redis_sock_async_abandon(RedisSock *redis_sock, long id TSRMLS_DC);
 /*PHP_REDIS_API int redis_sock_get(zval *id, RedisSock **redis_sock TSRMLS_DC);*/
 PHP_REDIS_API void redis_free_socket(RedisSock *redis_sock);
 PHP_REDIS_API void redis_send_discard(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock);
@@ -60,34 +76,49 @@ PHP_REDIS_API int redis_sock_set_err(RedisSock *redis_sock, const char *msg, int
 
 PHP_REDIS_API int
 redis_serialize(RedisSock *redis_sock, zval *z, char **val, int *val_len TSRMLS_DC);
+PHP_REDIS_API void redis_serialize_batch_begin(RedisSock *redis_sock TSRMLS_DC);
+PHP_REDIS_API void redis_serialize_batch_end(RedisSock *redis_sock TSRMLS_DC);
 PHP_REDIS_API int
 redis_key_prefix(RedisSock *redis_sock, char **key, int *key_len TSRMLS_DC);
 
 PHP_REDIS_API int
 redis_unserialize(RedisSock *redis_sock, const char *val, int val_len, zval **return_value TSRMLS_DC);
+PHP_REDIS_API unsigned int redis_zstd_dict_load(const char *path);
+PHP_REDIS_API void redis_compression_startup(const char *dict_path);
+PHP_REDIS_API void redis_compression_shutdown(void);
 
 
 /*
 * Variant Read methods, mostly to implement eval
 */
 
+/* A multi-bulk reply still waiting for some of its elements */
+typedef struct redisReplyFrame_ {
+	zval *z_arr;
+	long remaining;
+} redisReplyFrame;
+
+/* Where we are in a reply we have only received part of */
+typedef struct redisReplyParser_ {
+	redisReplyFrame *stack;	/* open multi-bulks, innermost last */
+	int depth;
+	int stack_size;
+	zval *z_bulk;			/* bulk string being received */
+	long bulk_len;
+	long bulk_got;			/* bytes of it received so far, \r\n included */
+	zval *z_ret;			/* the reply, once complete */
+} redisReplyParser;
+
+PHP_REDIS_API void redis_reply_parser_init(redisReplyParser *p);
+PHP_REDIS_API void redis_reply_parser_free(redisReplyParser *p);
+PHP_REDIS_API int redis_reply_parse(redisReplyParser *p, RedisSock *redis_sock, const char *buf, size_t len, size_t *used TSRMLS_DC);
+
 PHP_REDIS_API int redis_read_reply_type(RedisSock *redis_sock, REDIS_REPLY_TYPE *reply_type, int *reply_info TSRMLS_DC);
-PHP_REDIS_API int redis_read_variant_line(RedisSock *redis_sock, REDIS_REPLY_TYPE reply_type, zval **z_ret TSRMLS_DC);
-PHP_REDIS_API int redis_read_variant_bulk(RedisSock *redis_sock, int size, zval **z_ret TSRMLS_DC);
-PHP_REDIS_API int redis_read_multibulk_recursive(RedisSock *redis_sock, int elements, zval **z_ret TSRMLS_DC);
+PHP_REDIS_API int redis_sock_read_reply(RedisSock *redis_sock, zval **z_ret TSRMLS_DC);
 PHP_REDIS_API int redis_read_variant_reply(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock, zval *z_tab);
 
 PHP_REDIS_API void redis_client_list_reply(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock, zval *z_tab);
 
-#if ZEND_MODULE_API_NO >= 20100000
-#define REDIS_DOUBLE_TO_STRING(dbl_str, dbl_len, dbl) do { \
-	char dbl_decsep; \
-	dbl_decsep = '.'; \
-    dbl_str = _php_math_number_format_ex(dbl, 16, &dbl_decsep, 1, NULL, 0); \
-	dbl_len = strlen(dbl_str); \
-	} while (0);
-#else
-#define REDIS_DOUBLE_TO_STRING(dbl_str, dbl_len, dbl) \
-	dbl_str = _php_math_number_format(dbl, 16, '.', '\x00'); \
-	dbl_len = strlen(dbl_str);
-#endif
+/* Room for any double redis_double_to_string writes */
+#define REDIS_DOUBLE_BUF_SIZE 64
+int redis_double_to_string(char *buf, double value);
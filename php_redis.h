@@ -174,6 +174,16 @@ PHP_METHOD(Redis, watch);
 PHP_METHOD(Redis, unwatch);
 
 PHP_METHOD(Redis, pipeline);
+PHP_METHOD(Redis, sendAsync);
+PHP_METHOD(Redis, await);
+PHP_METHOD(Redis, massInsert);
+PHP_METHOD(RedisReplyIterator, rewind);
+PHP_METHOD(RedisReplyIterator, valid);
+PHP_METHOD(RedisReplyIterator, current);
+PHP_METHOD(RedisReplyIterator, key);
+PHP_METHOD(RedisReplyIterator, next);
+PHP_METHOD(RedisReplyIterator, count);
+PHP_METHOD(RedisReplyIterator, discard);
 
 PHP_METHOD(Redis, publish);
 PHP_METHOD(Redis, subscribe);
@@ -232,6 +242,7 @@ PHP_RSHUTDOWN_FUNCTION(redis);
 PHP_MINFO_FUNCTION(redis);
 
 PHP_REDIS_API int redis_connect(INTERNAL_FUNCTION_PARAMETERS, int persistent);
+PHP_REDIS_API int redis_sock_get(zval *id, RedisSock **redis_sock TSRMLS_DC, int no_throw);
 PHP_REDIS_API void redis_atomic_increment(INTERNAL_FUNCTION_PARAMETERS, char *keyword, int count);
 PHP_REDIS_API int generic_multiple_args_cmd(INTERNAL_FUNCTION_PARAMETERS, char *keyword, int keyword_len,
 									 int min_argc, RedisSock **redis_sock, int has_timeout, int all_keys, int can_serialize);
@@ -241,6 +252,10 @@ PHP_REDIS_API void generic_empty_cmd_impl(INTERNAL_FUNCTION_PARAMETERS, char *cm
 PHP_REDIS_API void generic_empty_cmd(INTERNAL_FUNCTION_PARAMETERS, char *cmd, int cmd_len, ...);
 PHP_REDIS_API void generic_empty_long_cmd(INTERNAL_FUNCTION_PARAMETERS, char *cmd, int cmd_len, ...);
 
+PHP_REDIS_API int redis_send_async(zval *object, char *cmd, int cmd_len, int argc, zval **args, zval *z_handle TSRMLS_DC);
+PHP_REDIS_API void redis_await(HashTable *handles, double timeout, zval *z_replies TSRMLS_DC);
+PHP_REDIS_API int redis_reply_iterator_new(zval *object, RedisSock *redis_sock, long count, zval *z_ret TSRMLS_DC);
+
 PHP_REDIS_API void generic_subscribe_cmd(INTERNAL_FUNCTION_PARAMETERS, char *sub_cmd);
 PHP_REDIS_API void generic_unsubscribe_cmd(INTERNAL_FUNCTION_PARAMETERS, char *unsub_cmd);
 
@@ -249,14 +264,9 @@ PHP_REDIS_API int redis_response_enqueued(RedisSock *redis_sock TSRMLS_DC);
 PHP_REDIS_API int get_flag(zval *object TSRMLS_DC);
 PHP_REDIS_API void set_flag(zval *object, int new_flag TSRMLS_DC);
 
+PHP_REDIS_API int redis_pipeline_flush(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock);
 PHP_REDIS_API int redis_sock_read_multibulk_multi_reply_loop(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock, zval *z_tab, int numElems);
 
-/* pipeline */
-PHP_REDIS_API request_item* get_pipeline_head(zval *object);
-PHP_REDIS_API void set_pipeline_head(zval *object, request_item *head);
-PHP_REDIS_API request_item* get_pipeline_current(zval *object);
-PHP_REDIS_API void set_pipeline_current(zval *object, request_item *current);
-
 #ifndef _MSC_VER
 ZEND_BEGIN_MODULE_GLOBALS(redis)
 ZEND_END_MODULE_GLOBALS(redis)
@@ -30,7 +30,9 @@
 #include "php_ini.h"
 #include "php_redis.h"
 #include "redis_array.h"
+#include "redis_cluster.h"
 #include <zend_exceptions.h>
+#include <zend_interfaces.h>
 
 #ifdef PHP_SESSION
 #include "ext/session/php_session.h"
@@ -38,9 +40,10 @@
 
 #include <ext/standard/php_smart_str.h>
 #include <ext/standard/php_var.h>
-#include <ext/standard/php_math.h>
 
 #include "library.h"
+#include "redis_cache.h"
+#include "redis_commands.h"
 
 #define R_SUB_CALLBACK_CLASS_TYPE 1
 #define R_SUB_CALLBACK_FT_TYPE 2
@@ -49,17 +52,21 @@
 
 int le_redis_sock;
 extern int le_redis_array;
+extern int le_redis_cluster;
 
 #ifdef PHP_SESSION
 extern ps_module ps_mod_redis;
 #endif
 
 extern zend_class_entry *redis_array_ce;
+extern zend_class_entry *redis_cluster_ce;
 zend_class_entry *redis_ce;
 zend_class_entry *redis_exception_ce;
+zend_class_entry *redis_reply_iterator_ce;
 zend_class_entry *spl_ce_RuntimeException = NULL;
 
 extern zend_function_entry redis_array_functions[];
+extern zend_function_entry redis_cluster_functions[];
 
 PHP_INI_BEGIN()
 	/* redis arrays */
@@ -69,6 +76,20 @@ PHP_INI_BEGIN()
 	PHP_INI_ENTRY("redis.arrays.functions", "", PHP_INI_ALL, NULL)
 	PHP_INI_ENTRY("redis.arrays.index", "", PHP_INI_ALL, NULL)
 	PHP_INI_ENTRY("redis.arrays.autorehash", "", PHP_INI_ALL, NULL)
+
+	/* redis clusters */
+	PHP_INI_ENTRY("redis.clusters.seeds", "", PHP_INI_ALL, NULL)
+	PHP_INI_ENTRY("redis.clusters.timeout", "", PHP_INI_ALL, NULL)
+	PHP_INI_ENTRY("redis.clusters.read_timeout", "", PHP_INI_ALL, NULL)
+	PHP_INI_ENTRY("redis.clusters.persistent", "", PHP_INI_ALL, NULL)
+	PHP_INI_ENTRY("redis.clusters.cache_maps", "16", PHP_INI_SYSTEM, NULL)
+
+	/* compression */
+	PHP_INI_ENTRY("redis.compression.zstd_dictionary", "", PHP_INI_SYSTEM, NULL)
+
+	/* client side cache, per worker */
+	PHP_INI_ENTRY("redis.client_cache.max_memory", REDIS_CACHE_MAX_MEMORY, PHP_INI_SYSTEM, NULL)
+	PHP_INI_ENTRY("redis.client_cache.ttl", REDIS_CACHE_TTL, PHP_INI_SYSTEM, NULL)
 PHP_INI_END()
 
 /**
@@ -228,6 +249,9 @@ static zend_function_entry redis_functions[] = {
      PHP_ME(Redis, discard, NULL, ZEND_ACC_PUBLIC)
      PHP_ME(Redis, exec, NULL, ZEND_ACC_PUBLIC)
      PHP_ME(Redis, pipeline, NULL, ZEND_ACC_PUBLIC)
+     PHP_ME(Redis, sendAsync, NULL, ZEND_ACC_PUBLIC)
+     PHP_ME(Redis, await, NULL, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+     PHP_ME(Redis, massInsert, NULL, ZEND_ACC_PUBLIC)
      PHP_ME(Redis, watch, NULL, ZEND_ACC_PUBLIC)
      PHP_ME(Redis, unwatch, NULL, ZEND_ACC_PUBLIC)
 
@@ -332,6 +356,17 @@ static zend_function_entry redis_functions[] = {
      {NULL, NULL, NULL}
 };
 
+static zend_function_entry redis_reply_iterator_functions[] = {
+     PHP_ME(RedisReplyIterator, rewind, NULL, ZEND_ACC_PUBLIC)
+     PHP_ME(RedisReplyIterator, valid, NULL, ZEND_ACC_PUBLIC)
+     PHP_ME(RedisReplyIterator, current, NULL, ZEND_ACC_PUBLIC)
+     PHP_ME(RedisReplyIterator, key, NULL, ZEND_ACC_PUBLIC)
+     PHP_ME(RedisReplyIterator, next, NULL, ZEND_ACC_PUBLIC)
+     PHP_ME(RedisReplyIterator, count, NULL, ZEND_ACC_PUBLIC)
+     PHP_ME(RedisReplyIterator, discard, NULL, ZEND_ACC_PUBLIC)
+     {NULL, NULL, NULL}
+};
+
 zend_module_entry redis_module_entry = {
 #if ZEND_MODULE_API_NO >= 20010901
      STANDARD_MODULE_HEADER,
@@ -481,7 +516,9 @@ PHP_MINIT_FUNCTION(redis)
 {
     zend_class_entry redis_class_entry;
     zend_class_entry redis_array_class_entry;
+    zend_class_entry redis_cluster_class_entry;
     zend_class_entry redis_exception_class_entry;
+    zend_class_entry redis_reply_iterator_class_entry;
 
 	REGISTER_INI_ENTRIES();
 
@@ -489,6 +526,15 @@ PHP_MINIT_FUNCTION(redis)
 	INIT_CLASS_ENTRY(redis_class_entry, "Redis", redis_functions);
     redis_ce = zend_register_internal_class(&redis_class_entry TSRMLS_CC);
 
+	/* RedisReplyIterator class, handed out by Redis with OPT_REPLY_ITERATOR */
+	INIT_CLASS_ENTRY(redis_reply_iterator_class_entry, "RedisReplyIterator", redis_reply_iterator_functions);
+    redis_reply_iterator_ce = zend_register_internal_class(&redis_reply_iterator_class_entry TSRMLS_CC);
+    redis_reply_iterator_ce->ce_flags |= ZEND_ACC_FINAL_CLASS;
+    zend_class_implements(redis_reply_iterator_ce TSRMLS_CC, 1, zend_ce_iterator);
+    zend_declare_property_null(redis_reply_iterator_ce, "redis", sizeof("redis")-1, ZEND_ACC_PRIVATE TSRMLS_CC);
+    zend_declare_property_null(redis_reply_iterator_ce, "id", sizeof("id")-1, ZEND_ACC_PRIVATE TSRMLS_CC);
+    zend_declare_property_null(redis_reply_iterator_ce, "count", sizeof("count")-1, ZEND_ACC_PRIVATE TSRMLS_CC);
+
 	/* RedisArray class */
 	INIT_CLASS_ENTRY(redis_array_class_entry, "RedisArray", redis_array_functions);
     redis_array_ce = zend_register_internal_class(&redis_array_class_entry TSRMLS_CC);
@@ -499,6 +545,29 @@ PHP_MINIT_FUNCTION(redis)
         "Redis Array", module_number
     );
 
+	/* RedisCluster class */
+	INIT_CLASS_ENTRY(redis_cluster_class_entry, "RedisCluster", redis_cluster_functions);
+    redis_cluster_ce = zend_register_internal_class(&redis_cluster_class_entry TSRMLS_CC);
+
+    le_redis_cluster = zend_register_list_destructors_ex(
+        redis_destructor_redis_cluster,
+        NULL,
+        "Redis Cluster", module_number
+    );
+
+    /* zstd dictionary, loaded once for every request */
+    redis_compression_startup(INI_STR("redis.compression.zstd_dictionary"));
+
+    /* OPT_CLIENT_CACHE caches, kept across requests */
+    redis_cache_startup(zend_atol(INI_STR("redis.client_cache.max_memory"),
+                                  strlen(INI_STR("redis.client_cache.max_memory"))),
+                        INI_INT("redis.client_cache.ttl"));
+
+    /* slot maps shared with the workers we'll be forked into */
+    if (INI_INT("redis.clusters.cache_maps") > 0) {
+        cluster_shm_startup((size_t)INI_INT("redis.clusters.cache_maps"));
+    }
+
 	/* RedisException class */
     INIT_CLASS_ENTRY(redis_exception_class_entry, "RedisException", NULL);
     redis_exception_ce = zend_register_internal_class_ex(
@@ -528,6 +597,12 @@ PHP_MINIT_FUNCTION(redis)
     add_constant_long(redis_ce, "OPT_SERIALIZER", REDIS_OPT_SERIALIZER);
     add_constant_long(redis_ce, "OPT_PREFIX", REDIS_OPT_PREFIX);
     add_constant_long(redis_ce, "OPT_READ_TIMEOUT", REDIS_OPT_READ_TIMEOUT);
+    add_constant_long(redis_ce, "OPT_PIPELINE_WINDOW", REDIS_OPT_PIPELINE_WINDOW);
+    add_constant_long(redis_ce, "OPT_PIPELINE_WINDOW_BYTES", REDIS_OPT_PIPELINE_WINDOW_BYTES);
+    add_constant_long(redis_ce, "OPT_MULTI_BUFFER", REDIS_OPT_MULTI_BUFFER);
+    add_constant_long(redis_ce, "OPT_REPLY_ITERATOR", REDIS_OPT_REPLY_ITERATOR);
+    add_constant_long(redis_ce, "OPT_INTERN_KEYS", REDIS_OPT_INTERN_KEYS);
+    add_constant_long(redis_ce, "OPT_CLIENT_CACHE", REDIS_OPT_CLIENT_CACHE);
 
     /* serializer */
     add_constant_long(redis_ce, "SERIALIZER_NONE", REDIS_SERIALIZER_NONE);
@@ -540,6 +615,20 @@ PHP_MINIT_FUNCTION(redis)
 #ifdef HAVE_REDIS_IGBINARY
     add_constant_long(redis_ce, "SERIALIZER_IGBINARY", REDIS_SERIALIZER_IGBINARY);
 #endif
+    add_constant_long(redis_ce, "SERIALIZER_MSGPACK", REDIS_SERIALIZER_MSGPACK);
+
+    /* compression */
+    add_constant_long(redis_ce, "OPT_COMPRESSION", REDIS_OPT_COMPRESSION);
+    add_constant_long(redis_ce, "OPT_COMPRESSION_LEVEL", REDIS_OPT_COMPRESSION_LEVEL);
+    add_constant_long(redis_ce, "OPT_COMPRESSION_MIN_SIZE", REDIS_OPT_COMPRESSION_MIN_SIZE);
+    add_constant_long(redis_ce, "OPT_COMPRESSION_DICTIONARY", REDIS_OPT_COMPRESSION_DICTIONARY);
+    add_constant_long(redis_ce, "COMPRESSION_NONE", REDIS_COMPRESSION_NONE);
+#ifdef HAVE_REDIS_LZ4
+    add_constant_long(redis_ce, "COMPRESSION_LZ4", REDIS_COMPRESSION_LZ4);
+#endif
+#ifdef HAVE_REDIS_ZSTD
+    add_constant_long(redis_ce, "COMPRESSION_ZSTD", REDIS_COMPRESSION_ZSTD);
+#endif
 
 	zend_declare_class_constant_stringl(redis_ce, "AFTER", 5, "after", 5 TSRMLS_CC);
 	zend_declare_class_constant_stringl(redis_ce, "BEFORE", 6, "before", 6 TSRMLS_CC);
@@ -557,6 +646,9 @@ PHP_MINIT_FUNCTION(redis)
  */
 PHP_MSHUTDOWN_FUNCTION(redis)
 {
+    cluster_shm_shutdown();
+    redis_compression_shutdown();
+    redis_cache_shutdown();
     return SUCCESS;
 }
 
@@ -613,7 +705,10 @@ PHP_METHOD(Redis,__destruct) {
 	}
 
 	/* If we think we're in MULTI mode, send a discard */
-	if(redis_sock->mode == MULTI) {
+	if(redis_sock->mode == MULTI && redis_sock->multi_buffered) {
+		/* nothing was sent yet */
+		free_reply_callbacks(getThis(), redis_sock);
+	} else if(redis_sock->mode == MULTI) {
 		/* Discard any multi commands, and free any callbacks that have been queued */
 		send_discard_static(redis_sock TSRMLS_CC);
 		free_reply_callbacks(getThis(), redis_sock);
@@ -916,12 +1011,26 @@ PHP_METHOD(Redis, close)
 }
 /* }}} */
 
+/* Send "<keyword> <key> <value>", see redis_sock_request_argv */
+static int
+redis_kv_request(RedisSock *redis_sock, char *keyword, char *key, int key_len,
+                 char *val, int val_len TSRMLS_DC)
+{
+    char *argv[2];
+    int argv_len[2];
+
+    argv[0] = key; argv_len[0] = key_len;
+    argv[1] = val; argv_len[1] = val_len;
+    return redis_sock_request_argv(redis_sock, keyword, strlen(keyword), 2, argv, argv_len TSRMLS_CC);
+}
+
 /* {{{ proto boolean Redis::set(string key, mixed value, long timeout | array options) */
 PHP_METHOD(Redis, set) {
     zval *object;
     RedisSock *redis_sock;
-    char *key = NULL, *val = NULL, *cmd, *exp_type = NULL, *set_type = NULL;
-    int key_len, val_len, cmd_len;
+    char *key = NULL, *val = NULL, *exp_type = NULL, *set_type = NULL;
+    char *argv[5], exp_buf[32];
+    int key_len, val_len, argv_len[5], argc = 0, exp_len, setex, ret;
     long expire = -1;
     int val_free = 0, key_free = 0;
     zval *z_value, *z_opts = NULL;
@@ -981,36 +1090,41 @@ PHP_METHOD(Redis, set) {
         expire = Z_LVAL_P(z_opts);
     }
 
-    /* Now let's construct the command we want */
-    if(exp_type && set_type) {
-        /* SET <key> <value> NX|XX PX|EX <timeout> */
-        cmd_len = redis_cmd_format_static(&cmd, "SET", "ssssl", key, key_len,
-                                          val, val_len, set_type, 2, exp_type,
-                                          2, expire);
-    } else if(exp_type) {
-        /* SET <key> <value> PX|EX <timeout> */
-        cmd_len = redis_cmd_format_static(&cmd, "SET", "sssl", key, key_len,
-                                          val, val_len, exp_type, 2, expire);
-    } else if(set_type) {
-        /* SET <key> <value> NX|XX */
-        cmd_len = redis_cmd_format_static(&cmd, "SET", "sss", key, key_len,
-                                          val, val_len, set_type, 2);
-    } else if(expire > 0) {
-        /* Backward compatible SETEX redirection */
-        cmd_len = redis_cmd_format_static(&cmd, "SETEX", "sls", key, key_len,
-                                          expire, val, val_len);
+    /* Now let's construct the command we want, SETEX being the backward
+     * compatible redirection for a long third argument */
+    setex = !exp_type && !set_type && expire > 0;
+    exp_len = snprintf(exp_buf, sizeof(exp_buf), "%ld", expire);
+    argv[argc] = key; argv_len[argc++] = key_len;
+    if(setex) {
+        /* SETEX <key> <timeout> <value> */
+        argv[argc] = exp_buf; argv_len[argc++] = exp_len;
+    }
+    argv[argc] = val; argv_len[argc++] = val_len;
+    if(set_type) {
+        /* SET <key> <value> NX|XX ... */
+        argv[argc] = set_type; argv_len[argc++] = 2;
+    }
+    if(exp_type) {
+        /* SET <key> <value> [NX|XX] PX|EX <timeout> */
+        argv[argc] = exp_type; argv_len[argc++] = 2;
+        argv[argc] = exp_buf; argv_len[argc++] = exp_len;
+    }
+
+    /* Kick off the command, large values are sent without a copy */
+    if(setex) {
+        ret = redis_sock_request_argv(redis_sock, "SETEX", sizeof("SETEX")-1, argc, argv, argv_len TSRMLS_CC);
     } else {
-        /* SET <key> <value> */
-        cmd_len = redis_cmd_format_static(&cmd, "SET", "ss", key, key_len,
-                                          val, val_len);
+        ret = redis_sock_request_argv(redis_sock, "SET", sizeof("SET")-1, argc, argv, argv_len TSRMLS_CC);
     }
 
     /* Free our key or value if we prefixed/serialized */
     if(key_free) efree(key);
     if(val_free) STR_FREE(val);
 
-    /* Kick off the command */
-    REDIS_PROCESS_REQUEST(redis_sock, cmd, cmd_len);
+    if(ret < 0) {
+        RETURN_FALSE;
+    }
+
     IF_ATOMIC() {
         redis_boolean_response(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, NULL, NULL);
     }
@@ -1021,8 +1135,8 @@ PHP_REDIS_API void redis_generic_setex(INTERNAL_FUNCTION_PARAMETERS, char *keywo
 
     zval *object;
     RedisSock *redis_sock;
-    char *key = NULL, *val = NULL, *cmd;
-    int key_len, val_len, cmd_len;
+    char *key = NULL, *val = NULL, *argv[3], exp_buf[32];
+    int key_len, val_len, argv_len[3], ret;
     long expire;
     int val_free = 0, key_free = 0;
     zval *z_value;
@@ -1039,11 +1153,18 @@ PHP_REDIS_API void redis_generic_setex(INTERNAL_FUNCTION_PARAMETERS, char *keywo
 
     val_free = redis_serialize(redis_sock, z_value, &val, &val_len TSRMLS_CC);
 	key_free = redis_key_prefix(redis_sock, &key, &key_len TSRMLS_CC);
-    cmd_len = redis_cmd_format_static(&cmd, keyword, "sls", key, key_len, expire, val, val_len);
+
+    argv[0] = key; argv_len[0] = key_len;
+    argv[1] = exp_buf; argv_len[1] = snprintf(exp_buf, sizeof(exp_buf), "%ld", expire);
+    argv[2] = val; argv_len[2] = val_len;
+    ret = redis_sock_request_argv(redis_sock, keyword, strlen(keyword), 3, argv, argv_len TSRMLS_CC);
+
     if(val_free) STR_FREE(val);
     if(key_free) efree(key);
 
-	REDIS_PROCESS_REQUEST(redis_sock, cmd, cmd_len);
+	if(ret < 0) {
+		RETURN_FALSE;
+	}
 	IF_ATOMIC() {
 		redis_boolean_response(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, NULL, NULL);
 	}
@@ -1071,8 +1192,8 @@ PHP_METHOD(Redis, setnx)
 
     zval *object;
     RedisSock *redis_sock;
-    char *key = NULL, *val = NULL, *cmd;
-    int key_len, val_len, cmd_len;
+    char *key = NULL, *val = NULL;
+    int key_len, val_len, ret;
     int val_free = 0, key_free = 0;
     zval *z_value;
 
@@ -1088,11 +1209,13 @@ PHP_METHOD(Redis, setnx)
 
     val_free = redis_serialize(redis_sock, z_value, &val, &val_len TSRMLS_CC);
 	key_free = redis_key_prefix(redis_sock, &key, &key_len TSRMLS_CC);
-    cmd_len = redis_cmd_format_static(&cmd, "SETNX", "ss", key, key_len, val, val_len);
+    ret = redis_kv_request(redis_sock, "SETNX", key, key_len, val, val_len TSRMLS_CC);
     if(val_free) STR_FREE(val);
     if(key_free) efree(key);
 
-    REDIS_PROCESS_REQUEST(redis_sock, cmd, cmd_len);
+    if(ret < 0) {
+        RETURN_FALSE;
+    }
 
     IF_ATOMIC() {
 	  redis_1_response(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, NULL, NULL);
@@ -1109,8 +1232,8 @@ PHP_METHOD(Redis, getSet)
 
     zval *object;
     RedisSock *redis_sock;
-    char *key = NULL, *val = NULL, *cmd;
-    int key_len, val_len, cmd_len;
+    char *key = NULL, *val = NULL;
+    int key_len, val_len, ret;
     int val_free = 0, key_free = 0;
     zval *z_value;
 
@@ -1126,11 +1249,13 @@ PHP_METHOD(Redis, getSet)
 
     val_free = redis_serialize(redis_sock, z_value, &val, &val_len TSRMLS_CC);
 	key_free = redis_key_prefix(redis_sock, &key, &key_len TSRMLS_CC);
-    cmd_len = redis_cmd_format_static(&cmd, "GETSET", "ss", key, key_len, val, val_len);
+    ret = redis_kv_request(redis_sock, "GETSET", key, key_len, val, val_len TSRMLS_CC);
     if(val_free) STR_FREE(val);
     if(key_free) efree(key);
 
-	REDIS_PROCESS_REQUEST(redis_sock, cmd, cmd_len);
+	if(ret < 0) {
+		RETURN_FALSE;
+	}
 	IF_ATOMIC() {
 		redis_string_response(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, NULL, NULL);
 	}
@@ -1297,6 +1422,11 @@ PHP_METHOD(Redis, get)
     }
 
 	key_free = redis_key_prefix(redis_sock, &key, &key_len TSRMLS_CC);
+	if(redis_sock->cache &&
+	   redis_cached_read(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, REDIS_CACHE_STRING, key, key_len) == 0) {
+		if(key_free) efree(key);
+		return;
+	}
     cmd_len = redis_cmd_format_static(&cmd, "GET", "s", key, key_len);
 	if(key_free) efree(key);
 
@@ -1563,7 +1693,7 @@ PHP_METHOD(Redis, getMultiple)
         zend_hash_move_forward_ex(hash, &ptr))
     {
         char *key;
-        int key_len, key_free;
+        int key_len;
         zval *z_tmp = NULL;
 
         /* If the key isn't a string, turn it into one */
@@ -1580,14 +1710,8 @@ PHP_METHOD(Redis, getMultiple)
             key_len = Z_STRLEN_P(z_tmp);
         }
 
-        /* Apply key prefix if necissary */
-        key_free = redis_key_prefix(redis_sock, &key, &key_len TSRMLS_CC);
-
-        /* Append this key to our command */
-        redis_cmd_append_sstr(&cmd, key, key_len);
-
-        /* Free our key if it was prefixed */
-        if(key_free) efree(key);
+        /* Append this key to our command, prefixed if necessary */
+        redis_cmd_append_sstr_key(&cmd, key, key_len, redis_sock);
 
         /* Free oour temporary ZVAL if we converted from a non-string */
         if(z_tmp) {
@@ -1608,38 +1732,6 @@ PHP_METHOD(Redis, getMultiple)
     REDIS_PROCESS_RESPONSE(redis_sock_read_multibulk_reply);
 }
 
-/* {{{ proto boolean Redis::exists(string key)
- */
-PHP_METHOD(Redis, exists)
-{
-    zval *object;
-    RedisSock *redis_sock;
-    char *key = NULL, *cmd;
-    int key_len, cmd_len;
-	int key_free;
-
-    if (zend_parse_method_parameters(ZEND_NUM_ARGS() TSRMLS_CC, getThis(), "Os",
-                                     &object, redis_ce,
-                                     &key, &key_len) == FAILURE) {
-        RETURN_FALSE;
-    }
-    if (redis_sock_get(object, &redis_sock TSRMLS_CC, 0) < 0) {
-        RETURN_FALSE;
-    }
-
-	key_free = redis_key_prefix(redis_sock, &key, &key_len TSRMLS_CC);
-    cmd_len = redis_cmd_format_static(&cmd, "EXISTS", "s", key, key_len);
-	if(key_free) efree(key);
-
-    REDIS_PROCESS_REQUEST(redis_sock, cmd, cmd_len);
-    IF_ATOMIC() {
-	  redis_1_response(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, NULL, NULL);
-    }
-    REDIS_PROCESS_RESPONSE(redis_1_response);
-
-}
-/* }}} */
-
 /* {{{ proto boolean Redis::delete(string key)
  */
 PHP_METHOD(Redis, delete)
@@ -1740,43 +1832,11 @@ PHP_METHOD(Redis, getKeys)
 }
 /* }}} */
 
-/* {{{ proto int Redis::type(string key)
- */
-PHP_METHOD(Redis, type)
-{
-    zval *object;
-    RedisSock *redis_sock;
-    char *key = NULL, *cmd;
-    int key_len, cmd_len, key_free;
-
-    if (zend_parse_method_parameters(ZEND_NUM_ARGS() TSRMLS_CC, getThis(), "Os",
-                                     &object, redis_ce,
-                                     &key, &key_len) == FAILURE) {
-        RETURN_NULL();
-    }
-
-    if (redis_sock_get(object, &redis_sock TSRMLS_CC, 0) < 0) {
-        RETURN_FALSE;
-    }
-
-	key_free = redis_key_prefix(redis_sock, &key, &key_len TSRMLS_CC);
-    cmd_len = redis_cmd_format_static(&cmd, "TYPE", "s", key, key_len);
-	if(key_free) efree(key);
-
-	REDIS_PROCESS_REQUEST(redis_sock, cmd, cmd_len);
-	IF_ATOMIC() {
-	  redis_type_response(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, NULL, NULL);
-	}
-	REDIS_PROCESS_RESPONSE(redis_type_response);
-}
-/* }}} */
-
 PHP_METHOD(Redis, append)
 {
 	zval *object;
 	RedisSock *redis_sock;
-	char *cmd;
-	int cmd_len, key_len, val_len, key_free;
+	int ret, key_len, val_len, key_free;
 	char *key, *val;
 
 	if (zend_parse_method_parameters(ZEND_NUM_ARGS() TSRMLS_CC, getThis(), "Oss",
@@ -1790,10 +1850,12 @@ PHP_METHOD(Redis, append)
 	}
 
 	key_free = redis_key_prefix(redis_sock, &key, &key_len TSRMLS_CC);
-	cmd_len = redis_cmd_format_static(&cmd, "APPEND", "ss", key, key_len, val, val_len);
+	ret = redis_kv_request(redis_sock, "APPEND", key, key_len, val, val_len TSRMLS_CC);
 	if(key_free) efree(key);
 
-	REDIS_PROCESS_REQUEST(redis_sock, cmd, cmd_len);
+	if(ret < 0) {
+		RETURN_FALSE;
+	}
 	IF_ATOMIC() {
 		redis_long_response(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, NULL, NULL);
 	}
@@ -1923,36 +1985,6 @@ PHP_METHOD(Redis, setBit)
 	REDIS_PROCESS_RESPONSE(redis_long_response);
 }
 
-
-PHP_METHOD(Redis, strlen)
-{
-	zval *object;
-	RedisSock *redis_sock;
-	char *cmd;
-	int cmd_len, key_len, key_free;
-	char *key;
-
-	if (zend_parse_method_parameters(ZEND_NUM_ARGS() TSRMLS_CC, getThis(), "Os",
-                                     &object, redis_ce,
-                                     &key, &key_len) == FAILURE) {
-		RETURN_NULL();
-	}
-
-	if (redis_sock_get(object, &redis_sock TSRMLS_CC, 0) < 0) {
-		RETURN_FALSE;
-	}
-
-	key_free = redis_key_prefix(redis_sock, &key, &key_len TSRMLS_CC);
-	cmd_len = redis_cmd_format_static(&cmd, "STRLEN", "s", key, key_len);
-	if(key_free) efree(key);
-
-	REDIS_PROCESS_REQUEST(redis_sock, cmd, cmd_len);
-	IF_ATOMIC() {
-		redis_long_response(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, NULL, NULL);
-	}
-	REDIS_PROCESS_RESPONSE(redis_long_response);
-}
-
 PHP_REDIS_API void
 generic_push_function(INTERNAL_FUNCTION_PARAMETERS, char *keyword, int keyword_len) {
     zval *object;
@@ -2076,9 +2108,11 @@ PHP_METHOD(Redis, rPushx)
 	generic_push_function(INTERNAL_FUNCTION_PARAM_PASSTHRU, "RPUSHX", sizeof("RPUSHX")-1);
 }
 
-PHP_REDIS_API void
-generic_pop_function(INTERNAL_FUNCTION_PARAMETERS, char *keyword, int keyword_len) {
-
+/* The methods of REDIS_KEY_METHOD_TABLE: one key in, one command out, one
+ * reply read with the table's callback */
+static void
+generic_key_cmd(INTERNAL_FUNCTION_PARAMETERS, char *keyword, redisReplyFn reply)
+{
     zval *object;
     RedisSock *redis_sock;
     char *key = NULL, *cmd;
@@ -2100,26 +2134,18 @@ generic_pop_function(INTERNAL_FUNCTION_PARAMETERS, char *keyword, int keyword_le
 
 	REDIS_PROCESS_REQUEST(redis_sock, cmd, cmd_len);
 	IF_ATOMIC() {
-		redis_string_response(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, NULL, NULL);
+		reply(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, NULL, NULL);
 	}
-	REDIS_PROCESS_RESPONSE(redis_string_response);
+	REDIS_PROCESS_RESPONSE(reply);
 }
 
-/* {{{ proto string Redis::lPOP(string key)
- */
-PHP_METHOD(Redis, lPop)
-{
-        generic_pop_function(INTERNAL_FUNCTION_PARAM_PASSTHRU, "LPOP", sizeof("LPOP")-1);
+#define REDIS_KEY_METHOD(method, keyword, reply) \
+PHP_METHOD(Redis, method) \
+{ \
+	generic_key_cmd(INTERNAL_FUNCTION_PARAM_PASSTHRU, keyword, reply); \
 }
-/* }}} */
 
-/* {{{ proto string Redis::rPOP(string key)
- */
-PHP_METHOD(Redis, rPop)
-{
-        generic_pop_function(INTERNAL_FUNCTION_PARAM_PASSTHRU, "RPOP", sizeof("RPOP")-1);
-}
-/* }}} */
+REDIS_KEY_METHOD_TABLE(REDIS_KEY_METHOD)
 
 /* {{{ proto string Redis::blPop(string key1, string key2, ..., int timeout)
  */
@@ -2164,39 +2190,6 @@ PHP_METHOD(Redis, brPop)
 }
 /* }}} */
 
-
-/* {{{ proto int Redis::lSize(string key)
- */
-PHP_METHOD(Redis, lSize)
-{
-    zval *object;
-    RedisSock *redis_sock;
-    char *key = NULL, *cmd;
-    int key_len, cmd_len, key_free;
-
-    if (zend_parse_method_parameters(ZEND_NUM_ARGS() TSRMLS_CC, getThis(), "Os",
-                                     &object, redis_ce,
-                                     &key, &key_len) == FAILURE) {
-        RETURN_FALSE;
-    }
-
-    if (redis_sock_get(object, &redis_sock TSRMLS_CC, 0) < 0) {
-        RETURN_FALSE;
-    }
-
-	key_free = redis_key_prefix(redis_sock, &key, &key_len TSRMLS_CC);
-    cmd_len = redis_cmd_format_static(&cmd, "LLEN", "s", key, key_len);
-	if(key_free) efree(key);
-
-	REDIS_PROCESS_REQUEST(redis_sock, cmd, cmd_len);
-	IF_ATOMIC() {
-		redis_long_response(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, NULL, NULL);
-	}
-	REDIS_PROCESS_RESPONSE(redis_long_response);
-
-}
-/* }}} */
-
 /* {{{ proto boolean Redis::lRemove(string list, string value, int count = 0)
  */
 PHP_METHOD(Redis, lRemove)
@@ -2354,37 +2347,6 @@ PHP_METHOD(Redis, sAdd)
 }
 /* }}} */
 
-/* {{{ proto int Redis::sSize(string key)
- */
-PHP_METHOD(Redis, sSize)
-{
-    zval *object;
-    RedisSock *redis_sock;
-    char *key = NULL, *cmd;
-    int key_len, cmd_len, key_free;
-
-    if (zend_parse_method_parameters(ZEND_NUM_ARGS() TSRMLS_CC, getThis(), "Os",
-                                     &object, redis_ce,
-                                     &key, &key_len) == FAILURE) {
-        RETURN_FALSE;
-    }
-
-    if (redis_sock_get(object, &redis_sock TSRMLS_CC, 0) < 0) {
-        RETURN_FALSE;
-    }
-
-	key_free = redis_key_prefix(redis_sock, &key, &key_len TSRMLS_CC);
-    cmd_len = redis_cmd_format_static(&cmd, "SCARD", "s", key, key_len);
-	if(key_free) efree(key);
-
-	REDIS_PROCESS_REQUEST(redis_sock, cmd, cmd_len);
-	IF_ATOMIC() {
-		redis_long_response(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, NULL, NULL);
-	}
-	REDIS_PROCESS_RESPONSE(redis_long_response);
-}
-/* }}} */
-
 /* {{{ proto boolean Redis::sRemove(string set, string value)
  */
 PHP_METHOD(Redis, sRemove)
@@ -2442,13 +2404,7 @@ PHP_METHOD(Redis, sMove)
 /* }}} */
 
 /* }}} */
-/* {{{ proto string Redis::sPop(string key)
- */
-PHP_METHOD(Redis, sPop)
-{
-    generic_pop_function(INTERNAL_FUNCTION_PARAM_PASSTHRU, "SPOP", 4);
-}
-/* }}} */
+
 
 /* }}} */
 /* {{{ proto string Redis::sRandMember(string key [int count])
@@ -2585,7 +2541,7 @@ PHP_REDIS_API int generic_multiple_args_cmd(INTERNAL_FUNCTION_PARAMETERS, char *
 {
     zval **z_args, *z_array;
     char **keys, *cmd;
-    int cmd_len, *keys_len, *keys_to_free;
+    int cmd_len, *keys_len, *keys_to_free, prefix_len;
     int i, j, argc = ZEND_NUM_ARGS(), real_argc = 0;
     int single_array = 0;
 	int timeout = 0;
@@ -2606,6 +2562,7 @@ PHP_REDIS_API int generic_multiple_args_cmd(INTERNAL_FUNCTION_PARAMETERS, char *
 		return FAILURE;
     }
     redis_sock = *out_sock;
+    prefix_len = redis_sock->prefix ? redis_sock->prefix_len : 0;
 
     z_args = emalloc(argc * sizeof(zval*));
     if(zend_get_parameters_array(ht, argc, z_args) == FAILURE) {
@@ -2650,6 +2607,9 @@ PHP_REDIS_API int generic_multiple_args_cmd(INTERNAL_FUNCTION_PARAMETERS, char *
 
     cmd_len = 1 + integer_length(keyword_len) + 2 +keyword_len + 2; /* start computing the command length */
 
+    if(can_serialize) {
+        redis_serialize_batch_begin(redis_sock TSRMLS_CC);
+    }
     if(single_array) { /* loop over the array */
         HashTable *keytable = Z_ARRVAL_P(z_array);
 
@@ -2690,7 +2650,7 @@ PHP_REDIS_API int generic_multiple_args_cmd(INTERNAL_FUNCTION_PARAMETERS, char *
                 keys[j] = Z_STRVAL_PP(z_value_pp);
                 keys_len[j] = Z_STRLEN_PP(z_value_pp);
 
-				keys_to_free[j] = redis_key_prefix(redis_sock, &keys[j], &keys_len[j] TSRMLS_CC); /* add optional prefix */
+				keys_len[j] += prefix_len; /* written with the key, counted from here on */
 			}
 
             cmd_len += 1 + integer_length(keys_len[j]) + 2 + keys_len[j] + 2; /* $ + size + NL + string + NL */
@@ -2731,7 +2691,7 @@ PHP_REDIS_API int generic_multiple_args_cmd(INTERNAL_FUNCTION_PARAMETERS, char *
 
            	    /* If we have a timeout it should be the last argument, which we do not want to prefix */
 				if(!has_timeout || i < argc-1) {
-					keys_to_free[j] = redis_key_prefix(redis_sock, &keys[j], &keys_len[j] TSRMLS_CC); /* add optional prefix  TSRMLS_CC*/
+					keys_len[j] += prefix_len; /* written with the key, counted from here on */
 				}
 			}
 
@@ -2740,6 +2700,9 @@ PHP_REDIS_API int generic_multiple_args_cmd(INTERNAL_FUNCTION_PARAMETERS, char *
    	        real_argc++;
 		}
     }
+    if(can_serialize) {
+        redis_serialize_batch_end(redis_sock TSRMLS_CC);
+    }
 
     cmd_len += 1 + integer_length(real_argc+1) + 2; /* *count NL  */
     cmd = emalloc(cmd_len+1);
@@ -2754,6 +2717,12 @@ PHP_REDIS_API int generic_multiple_args_cmd(INTERNAL_FUNCTION_PARAMETERS, char *
     for(i = 0; i < real_argc; ++i) {
         sprintf(cmd + pos, "$%d" _NL, keys_len[i]);     /* size */
         pos += 1 + integer_length(keys_len[i]) + 2;
+        /* key prefix, the values and the timeout have none */
+        if(prefix_len && (all_keys || i == 0) && !(has_timeout && i == real_argc - 1)) {
+            memcpy(cmd + pos, redis_sock->prefix, prefix_len);
+            pos += prefix_len;
+            keys_len[i] -= prefix_len;
+        }
         memcpy(cmd + pos, keys[i], keys_len[i]);
         pos += keys_len[i];
         memcpy(cmd + pos, _NL, 2);
@@ -2776,17 +2745,16 @@ PHP_REDIS_API int generic_multiple_args_cmd(INTERNAL_FUNCTION_PARAMETERS, char *
     if(z_args) efree(z_args);
 
 	/* call REDIS_PROCESS_REQUEST and skip void returns */
-	IF_MULTI_OR_ATOMIC() {
+	IF_BUFFERED() {
+		PIPELINE_ENQUEUE_COMMAND(cmd, cmd_len);
+		efree(cmd);
+	} else {
 		if(redis_sock_write(redis_sock, cmd, cmd_len TSRMLS_CC) < 0) {
 			efree(cmd);
 			return FAILURE;
 		}
 		efree(cmd);
 	}
-	IF_PIPELINE() {
-		PIPELINE_ENQUEUE_COMMAND(cmd, cmd_len);
-		efree(cmd);
-	}
 
     return SUCCESS;
 }
@@ -3552,6 +3520,7 @@ PHP_METHOD(Redis, auth) {
     /* Free previously stored auth if we have one, and store this password */
     if(redis_sock->auth) efree(redis_sock->auth);
     redis_sock->auth = estrndup(password, password_len);
+    redis_cache_auth(redis_sock TSRMLS_CC);
 
 	REDIS_PROCESS_REQUEST(redis_sock, cmd, cmd_len);
 	IF_ATOMIC() {
@@ -3561,18 +3530,17 @@ PHP_METHOD(Redis, auth) {
 }
 /* }}} */
 
-/* {{{ proto long Redis::persist(string key)
+/* {{{ proto array Redis::info()
  */
-PHP_METHOD(Redis, persist) {
+PHP_METHOD(Redis, info) {
 
     zval *object;
     RedisSock *redis_sock;
+    char *cmd, *opt = NULL;
+    int cmd_len, opt_len;
 
-    char *cmd, *key;
-    int cmd_len, key_len, key_free;
-
-    if (zend_parse_method_parameters(ZEND_NUM_ARGS() TSRMLS_CC, getThis(), "Os",
-                                     &object, redis_ce, &key, &key_len) == FAILURE) {
+    if (zend_parse_method_parameters(ZEND_NUM_ARGS() TSRMLS_CC, getThis(), "O|s",
+                                     &object, redis_ce, &opt, &opt_len) == FAILURE) {
         RETURN_FALSE;
     }
 
@@ -3580,90 +3548,19 @@ PHP_METHOD(Redis, persist) {
         RETURN_FALSE;
     }
 
-	key_free = redis_key_prefix(redis_sock, &key, &key_len TSRMLS_CC);
-    cmd_len = redis_cmd_format_static(&cmd, "PERSIST", "s", key, key_len);
-	if(key_free) efree(key);
+    /* Build a standalone INFO command or one with an option */
+    if(opt != NULL) {
+    	cmd_len = redis_cmd_format_static(&cmd, "INFO", "s", opt, opt_len);
+    } else {
+    	cmd_len = redis_cmd_format_static(&cmd, "INFO", "");
+    }
 
 	REDIS_PROCESS_REQUEST(redis_sock, cmd, cmd_len);
 	IF_ATOMIC() {
-	  redis_1_response(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, NULL, NULL);
+	  redis_info_response(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, NULL, NULL);
 	}
-	REDIS_PROCESS_RESPONSE(redis_1_response);
-}
-/* }}} */
-
-PHP_REDIS_API void generic_ttl(INTERNAL_FUNCTION_PARAMETERS, char *keyword) {
-    zval *object;
-    RedisSock *redis_sock;
-
-    char *cmd, *key;
-    int cmd_len, key_len, key_free;
-
-    if (zend_parse_method_parameters(ZEND_NUM_ARGS() TSRMLS_CC, getThis(), "Os",
-                                     &object, redis_ce, &key, &key_len) == FAILURE) {
-        RETURN_FALSE;
-    }
-
-    if (redis_sock_get(object, &redis_sock TSRMLS_CC, 0) < 0) {
-        RETURN_FALSE;
-    }
-
-	key_free = redis_key_prefix(redis_sock, &key, &key_len TSRMLS_CC);
-    cmd_len = redis_cmd_format_static(&cmd, keyword, "s", key, key_len);
-	if(key_free) efree(key);
-
-	REDIS_PROCESS_REQUEST(redis_sock, cmd, cmd_len);
-	IF_ATOMIC() {
-	  redis_long_response(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, NULL, NULL);
-	}
-	REDIS_PROCESS_RESPONSE(redis_long_response);
-}
-
-/* {{{ proto long Redis::ttl(string key)
- */
-PHP_METHOD(Redis, ttl) {
-	generic_ttl(INTERNAL_FUNCTION_PARAM_PASSTHRU, "TTL");
-}
-/* }}} */
-
-/* {{{ proto long Redis::pttl(string key)
- */
-PHP_METHOD(Redis, pttl) {
-	generic_ttl(INTERNAL_FUNCTION_PARAM_PASSTHRU, "PTTL");
-}
-/* }}} */
-
-/* {{{ proto array Redis::info()
- */
-PHP_METHOD(Redis, info) {
-
-    zval *object;
-    RedisSock *redis_sock;
-    char *cmd, *opt = NULL;
-    int cmd_len, opt_len;
-
-    if (zend_parse_method_parameters(ZEND_NUM_ARGS() TSRMLS_CC, getThis(), "O|s",
-                                     &object, redis_ce, &opt, &opt_len) == FAILURE) {
-        RETURN_FALSE;
-    }
-
-    if (redis_sock_get(object, &redis_sock TSRMLS_CC, 0) < 0) {
-        RETURN_FALSE;
-    }
-
-    /* Build a standalone INFO command or one with an option */
-    if(opt != NULL) {
-    	cmd_len = redis_cmd_format_static(&cmd, "INFO", "s", opt, opt_len);
-    } else {
-    	cmd_len = redis_cmd_format_static(&cmd, "INFO", "");
-    }
-
-	REDIS_PROCESS_REQUEST(redis_sock, cmd, cmd_len);
-	IF_ATOMIC() {
-	  redis_info_response(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, NULL, NULL);
-	}
-	REDIS_PROCESS_RESPONSE(redis_info_response);
-
+	REDIS_PROCESS_RESPONSE(redis_info_response);
+
 }
 /* }}} */
 
@@ -3749,11 +3646,13 @@ generic_mset(INTERNAL_FUNCTION_PARAMETERS, char *kw, void (*fun)(INTERNAL_FUNCTI
     RedisSock *redis_sock;
 
     char *cmd = NULL, *p = NULL;
-    int cmd_len = 0, argc = 0, kw_len = strlen(kw);
+    int cmd_len = 0, argc = 0, kw_len = strlen(kw), prefix_len;
 	int step = 0;	/* 0: compute size; 1: copy strings. */
     zval *z_array;
 
 	HashTable *keytable;
+	char **vals;	/* serialized in step 0, copied in step 1 */
+	int *val_lens, *val_frees, count, i;
 
     if (zend_parse_method_parameters(ZEND_NUM_ARGS() TSRMLS_CC, getThis(), "Oa",
                                      &object, redis_ce, &z_array) == FAILURE) {
@@ -3767,7 +3666,14 @@ generic_mset(INTERNAL_FUNCTION_PARAMETERS, char *kw, void (*fun)(INTERNAL_FUNCTI
     if(zend_hash_num_elements(Z_ARRVAL_P(z_array)) == 0) {
         RETURN_FALSE;
     }
+    prefix_len = redis_sock->prefix ? redis_sock->prefix_len : 0;
 
+	count = zend_hash_num_elements(Z_ARRVAL_P(z_array));
+	vals = emalloc(count * sizeof(char*));
+	val_lens = emalloc(count * sizeof(int));
+	val_frees = emalloc(count * sizeof(int));
+
+	redis_serialize_batch_begin(redis_sock TSRMLS_CC);
 	for(step = 0; step < 2; ++step) {
 		if(step == 1) {
 			cmd_len += 1 + integer_length(1 + 2 * argc) + 2;	/* star + arg count + NL */
@@ -3779,17 +3685,15 @@ generic_mset(INTERNAL_FUNCTION_PARAMETERS, char *kw, void (*fun)(INTERNAL_FUNCTI
 		}
 
 		keytable = Z_ARRVAL_P(z_array);
-		for(zend_hash_internal_pointer_reset(keytable);
+		for(i = 0, zend_hash_internal_pointer_reset(keytable);
 				zend_hash_has_more_elements(keytable) == SUCCESS;
 				zend_hash_move_forward(keytable)) {
 
-			char *key, *val;
+			char *key;
 			unsigned int key_len;
-			int val_len;
 			unsigned long idx;
 			int type;
 			zval **z_value_pp;
-			int val_free, key_free;
 			char buf[32];
 
 			type = zend_hash_get_current_key_ex(keytable, &key, &key_len, &idx, 0, NULL);
@@ -3808,31 +3712,37 @@ generic_mset(INTERNAL_FUNCTION_PARAMETERS, char *kw, void (*fun)(INTERNAL_FUNCTI
 				key_len--;
 			}
 
-			if(step == 0)
+			if(step == 0) { /* counting, and serializing once for both steps */
 				argc++; /* found a valid arg */
+				val_frees[i] = redis_serialize(redis_sock, *z_value_pp, &vals[i], &val_lens[i] TSRMLS_CC);
 
-			val_free = redis_serialize(redis_sock, *z_value_pp, &val, &val_len TSRMLS_CC);
-			key_free = redis_key_prefix(redis_sock, &key, (int*)&key_len TSRMLS_CC);
-
-			if(step == 0) { /* counting */
-				cmd_len += 1 + integer_length(key_len) + 2
-						+ key_len + 2
-						+ 1 + integer_length(val_len) + 2
-						+ val_len + 2;
+				cmd_len += 1 + integer_length(key_len + prefix_len) + 2
+						+ prefix_len + key_len + 2
+						+ 1 + integer_length(val_lens[i]) + 2
+						+ val_lens[i] + 2;
 			} else {
-				p += sprintf(p, "$%d" _NL, key_len);	/* key len */
+				p += sprintf(p, "$%d" _NL, key_len + prefix_len);	/* key len */
+				if(prefix_len) {
+					memcpy(p, redis_sock->prefix, prefix_len); p += prefix_len;	/* key prefix */
+				}
 				memcpy(p, key, key_len); p += key_len;	/* key */
 				memcpy(p, _NL, 2); p += 2;
 
-				p += sprintf(p, "$%d" _NL, val_len);	/* val len */
-				memcpy(p, val, val_len); p += val_len;	/* val */
+				p += sprintf(p, "$%d" _NL, val_lens[i]);	/* val len */
+				memcpy(p, vals[i], val_lens[i]); p += val_lens[i];	/* val */
 				memcpy(p, _NL, 2); p += 2;
 			}
-
-			if(val_free) STR_FREE(val);
-			if(key_free) efree(key);
+			i++;
 		}
 	}
+	redis_serialize_batch_end(redis_sock TSRMLS_CC);
+
+	for(i = 0; i < argc; i++) {
+		if(val_frees[i]) STR_FREE(vals[i]);
+	}
+	efree(vals);
+	efree(val_lens);
+	efree(val_frees);
 
 	REDIS_PROCESS_REQUEST(redis_sock, cmd, cmd_len);
 
@@ -3939,7 +3849,7 @@ PHP_METHOD(Redis, zAdd) {
     double score;
     char *key, *val;
     int val_free, key_free = 0;
-	char *dbl_str;
+	char dbl_str[REDIS_DOUBLE_BUF_SIZE];
 	int dbl_len;
     smart_str buf = {0};
 
@@ -3990,19 +3900,19 @@ PHP_METHOD(Redis, zAdd) {
 	smart_str_appendl(&buf, key, key_len);
 	smart_str_appendl(&buf, _NL, sizeof(_NL) - 1);
 
+	redis_serialize_batch_begin(redis_sock TSRMLS_CC);
 	for(i = 1; i < argc; i +=2) {
 		convert_to_double(z_args[i]); /* convert score to double */
 		val_free = redis_serialize(redis_sock, z_args[i+1], &val, &val_len TSRMLS_CC); /* possibly serialize value. */
 
 		/* add score */
 		score = Z_DVAL_P(z_args[i]);
-		REDIS_DOUBLE_TO_STRING(dbl_str, dbl_len, score)
+		dbl_len = redis_double_to_string(dbl_str, score);
 		smart_str_appendc(&buf, '$');
 		smart_str_append_long(&buf, dbl_len);
 		smart_str_appendl(&buf, _NL, sizeof(_NL) - 1);
 		smart_str_appendl(&buf, dbl_str, dbl_len);
 		smart_str_appendl(&buf, _NL, sizeof(_NL) - 1);
-		efree(dbl_str);
 
 		/* add value */
 		smart_str_appendc(&buf, '$');
@@ -4013,6 +3923,7 @@ PHP_METHOD(Redis, zAdd) {
 
 		if(val_free) STR_FREE(val);
 	}
+	redis_serialize_batch_end(redis_sock TSRMLS_CC);
 
 	/* end string */
 	smart_str_0(&buf);
@@ -4411,38 +4322,6 @@ PHP_METHOD(Redis, zRangeByLex) {
     REDIS_PROCESS_RESPONSE(redis_sock_read_multibulk_reply);
 }
 
-/* {{{ proto long Redis::zCard(string key)
- */
-PHP_METHOD(Redis, zCard)
-{
-    zval *object;
-    RedisSock *redis_sock;
-    char *key = NULL, *cmd;
-    int key_len, cmd_len, key_free;
-
-    if (zend_parse_method_parameters(ZEND_NUM_ARGS() TSRMLS_CC, getThis(), "Os",
-                                     &object, redis_ce,
-                                     &key, &key_len) == FAILURE) {
-        RETURN_FALSE;
-    }
-
-    if (redis_sock_get(object, &redis_sock TSRMLS_CC, 0) < 0) {
-        RETURN_FALSE;
-    }
-
-	key_free = redis_key_prefix(redis_sock, &key, &key_len TSRMLS_CC);
-    cmd_len = redis_cmd_format_static(&cmd, "ZCARD", "s", key, key_len);
-	if(key_free) efree(key);
-
-	REDIS_PROCESS_REQUEST(redis_sock, cmd, cmd_len);
-	IF_ATOMIC() {
-	  redis_long_response(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, NULL, NULL);
-	}
-	REDIS_PROCESS_RESPONSE(redis_long_response);
-
-}
-/* }}} */
-
 /* {{{ proto double Redis::zScore(string key, mixed member)
  */
 PHP_METHOD(Redis, zScore)
@@ -4577,7 +4456,6 @@ PHP_REDIS_API void generic_z_command(INTERNAL_FUNCTION_PARAMETERS, char *command
     HashPosition ptr;
     char *store_key, *agg_op = NULL;
     int cmd_arg_count = 2, store_key_len, agg_op_len = 0, keys_count;
-	int key_free;
 
     /* Grab our parameters */
     if(zend_parse_method_parameters(ZEND_NUM_ARGS() TSRMLS_CC, getThis(), "Osa|a!s",
@@ -4635,10 +4513,8 @@ PHP_REDIS_API void generic_z_command(INTERNAL_FUNCTION_PARAMETERS, char *command
     /* Command header */
     redis_cmd_init_sstr(&cmd, cmd_arg_count, command, command_len);
 
-    /* Prefix our key if necessary and add the output key */
-    key_free = redis_key_prefix(redis_sock, &store_key, &store_key_len TSRMLS_CC);
-    redis_cmd_append_sstr(&cmd, store_key, store_key_len);
-    if(key_free) efree(store_key);
+    /* Add the output key, prefixed if necessary */
+    redis_cmd_append_sstr_key(&cmd, store_key, store_key_len, redis_sock);
 
     /* Number of input keys argument */
     redis_cmd_append_sstr_int(&cmd, keys_count);
@@ -4649,7 +4525,7 @@ PHP_REDIS_API void generic_z_command(INTERNAL_FUNCTION_PARAMETERS, char *command
         zend_hash_move_forward_ex(ht_keys, &ptr))
     {
         char *key;
-        int key_free, key_len;
+        int key_len;
         zval *z_tmp = NULL;
 
         if(Z_TYPE_PP(z_data) == IS_STRING) {
@@ -4664,14 +4540,8 @@ PHP_REDIS_API void generic_z_command(INTERNAL_FUNCTION_PARAMETERS, char *command
             key_len = Z_STRLEN_P(z_tmp);
         }
 
-        /* Apply key prefix if necessary */
-        key_free = redis_key_prefix(redis_sock, &key, &key_len TSRMLS_CC);
-
-        /* Append this input set */
-        redis_cmd_append_sstr(&cmd, key, key_len);
-
-        /* Free our key if it was prefixed */
-        if(key_free) efree(key);
+        /* Append this input set, prefixed if necessary */
+        redis_cmd_append_sstr_key(&cmd, key, key_len, redis_sock);
 
         /* Free our temporary z_val if it was converted */
         if(z_tmp) {
@@ -4820,35 +4690,7 @@ PHP_METHOD(Redis, hGet)
 /* }}} */
 
 /* hLen */
-PHP_METHOD(Redis, hLen)
-{
-    zval *object;
-    RedisSock *redis_sock;
-    char *key = NULL, *cmd;
-    int key_len, cmd_len, key_free;
-
-    if (zend_parse_method_parameters(ZEND_NUM_ARGS() TSRMLS_CC, getThis(), "Os",
-                                     &object, redis_ce,
-                                     &key, &key_len) == FAILURE) {
-        RETURN_FALSE;
-    }
 
-    if (redis_sock_get(object, &redis_sock TSRMLS_CC, 0) < 0) {
-        RETURN_FALSE;
-    }
-
-	key_free = redis_key_prefix(redis_sock, &key, &key_len TSRMLS_CC);
-    cmd_len = redis_cmd_format_static(&cmd, "HLEN", "s", key, key_len);
-	if(key_free) efree(key);
-
-	REDIS_PROCESS_REQUEST(redis_sock, cmd, cmd_len);
-	IF_ATOMIC() {
-	  redis_long_response(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, NULL, NULL);
-	}
-	REDIS_PROCESS_RESPONSE(redis_long_response);
-
-}
-/* }}} */
 
 PHP_REDIS_API RedisSock*
 generic_hash_command_2(INTERNAL_FUNCTION_PARAMETERS, char *keyword, int keyword_len, char **out_cmd, int *out_len) {
@@ -4935,17 +4777,16 @@ generic_hash_command_1(INTERNAL_FUNCTION_PARAMETERS, char *keyword, int keyword_
 	if(key_free) efree(key);
 
 	/* call REDIS_PROCESS_REQUEST(redis_sock, cmd, cmd_len) without breaking the return value */
-	IF_MULTI_OR_ATOMIC() {
+	IF_BUFFERED() {
+		PIPELINE_ENQUEUE_COMMAND(cmd, cmd_len);
+		efree(cmd);
+	} else {
 		if(redis_sock_write(redis_sock, cmd, cmd_len TSRMLS_CC) < 0) {
 			efree(cmd);
 			return NULL;
 		}
 		efree(cmd);
 	}
-	IF_PIPELINE() {
-		PIPELINE_ENQUEUE_COMMAND(cmd, cmd_len);
-		efree(cmd);
-	}
     return redis_sock;
 }
 
@@ -4985,10 +4826,32 @@ PHP_METHOD(Redis, hVals)
 
 PHP_METHOD(Redis, hGetAll) {
 
-    RedisSock *redis_sock = generic_hash_command_1(INTERNAL_FUNCTION_PARAM_PASSTHRU, "HGETALL", sizeof("HGETALL")-1);
-	if(!redis_sock)
-		RETURN_FALSE;
+    zval *object;
+    RedisSock *redis_sock;
+    char *key = NULL, *cmd;
+    int key_len, cmd_len, key_free;
+
+    if (zend_parse_method_parameters(ZEND_NUM_ARGS() TSRMLS_CC, getThis(), "Os",
+                                     &object, redis_ce,
+                                     &key, &key_len) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    if (redis_sock_get(object, &redis_sock TSRMLS_CC, 0) < 0) {
+        RETURN_FALSE;
+    }
+
+	/* like generic_hash_command_1, with a look in the client cache first */
+	key_free = redis_key_prefix(redis_sock, &key, &key_len TSRMLS_CC);
+	if(redis_sock->cache &&
+	   redis_cached_read(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, REDIS_CACHE_HASH, key, key_len) == 0) {
+		if(key_free) efree(key);
+		return;
+	}
+    cmd_len = redis_cmd_format_static(&cmd, "HGETALL", "s", key, key_len);
+	if(key_free) efree(key);
 
+	REDIS_PROCESS_REQUEST(redis_sock, cmd, cmd_len);
 	IF_ATOMIC() {
 	    if (redis_mbulk_reply_zipped_vals(INTERNAL_FUNCTION_PARAM_PASSTHRU,
     	                                    redis_sock, NULL, NULL) < 0) {
@@ -5077,7 +4940,7 @@ PHP_METHOD(Redis, hMget) {
     RedisSock *redis_sock;
     char *key = NULL;
     zval *z_array, **z_keys, **data;
-    int field_count, i, valid, key_len, key_free;
+    int field_count, i, valid, key_len;
     HashTable *ht_array;
     HashPosition ptr;
     smart_str cmd = {0};
@@ -5100,9 +4963,6 @@ PHP_METHOD(Redis, hMget) {
         RETURN_FALSE;
     }
 
-    /* Prefix our key if we need to */
-    key_free = redis_key_prefix(redis_sock, &key, &key_len TSRMLS_CC);
-
     /* Allocate enough memory for the number of keys being requested */
     z_keys = ecalloc(field_count, sizeof(zval *));
 
@@ -5132,7 +4992,6 @@ PHP_METHOD(Redis, hMget) {
 
     /* If we don't have any valid keys, we can abort here */
     if(valid == 0) {
-        if(key_free) efree(key);
         efree(z_keys);
         RETURN_FALSE;
     }
@@ -5140,11 +4999,8 @@ PHP_METHOD(Redis, hMget) {
     /* Build command header.  One extra argument for the hash key itself */
     redis_cmd_init_sstr(&cmd, valid+1, "HMGET", sizeof("HMGET")-1);
 
-    /* Add the hash key */
-    redis_cmd_append_sstr(&cmd, key, key_len);
-
-    /* Free key memory if it was prefixed */
-    if(key_free) efree(key);
+    /* Add the hash key, prefixed if we need to */
+    redis_cmd_append_sstr_key(&cmd, key, key_len, redis_sock);
 
     /* Iterate our keys, appending them as arguments */
     for(i=0;i<valid;i++) {
@@ -5193,6 +5049,7 @@ PHP_METHOD(Redis, hMset)
     if(key_free) efree(key);
 
     /* looping on each item of the array */
+    redis_serialize_batch_begin(redis_sock TSRMLS_CC);
     for(i =0, zend_hash_internal_pointer_reset(ht_hash);
         zend_hash_has_more_elements(ht_hash) == SUCCESS;
         i++, zend_hash_move_forward(ht_hash)) {
@@ -5227,6 +5084,7 @@ PHP_METHOD(Redis, hMset)
 
         if(hval_free) STR_FREE(hval);
     }
+    redis_serialize_batch_end(redis_sock TSRMLS_CC);
 
     /* Now construct the entire command */
     old_cmd = cmd;
@@ -5289,11 +5147,20 @@ PHP_METHOD(Redis, multi)
         RETURN_FALSE;
 	}
 
-    redis_sock->current = NULL;
+    redis_sock->callbacks_count = 0;
 
 	IF_MULTI() {
         cmd_len = redis_cmd_format_static(&cmd, "MULTI", "");
 
+        /* queue MULTI with the commands, exec() sends them all at once */
+        if(redis_sock->multi_buffer) {
+            redis_sock->pipeline_cmd.len = 0;
+            redis_sock->multi_buffered = 1;
+            PIPELINE_ENQUEUE_COMMAND(cmd, cmd_len);
+            efree(cmd);
+            RETURN_ZVAL(getThis(), 1, 0);
+        }
+
 		if (redis_sock_write(redis_sock, cmd, cmd_len TSRMLS_CC) < 0) {
         	efree(cmd);
 	        RETURN_FALSE;
@@ -5332,6 +5199,13 @@ PHP_METHOD(Redis, discard)
         RETURN_FALSE;
     }
 
+	if(redis_sock->mode == MULTI && redis_sock->multi_buffered) {
+		/* the server hasn't seen this transaction */
+		free_reply_callbacks(object, redis_sock);
+		redis_sock->mode = ATOMIC;
+		RETURN_TRUE;
+	}
+
 	redis_sock->mode = ATOMIC;
 	redis_send_discard(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock);
 }
@@ -5339,8 +5213,15 @@ PHP_METHOD(Redis, discard)
 PHP_REDIS_API int redis_sock_read_multibulk_pipeline_reply(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock)
 {
     zval *z_tab;
-    MAKE_STD_ZVAL(z_tab);
-    array_init(z_tab);
+
+    /* a windowed pipeline has already read some of its replies */
+    if(redis_sock->pipeline_replies) {
+        z_tab = redis_sock->pipeline_replies;
+        redis_sock->pipeline_replies = NULL;
+    } else {
+        MAKE_STD_ZVAL(z_tab);
+        array_init(z_tab);
+    }
 
     redis_sock_read_multibulk_multi_reply_loop(INTERNAL_FUNCTION_PARAM_PASSTHRU,
                     redis_sock, z_tab, 0);
@@ -5365,8 +5246,14 @@ PHP_REDIS_API int redis_sock_read_multibulk_multi_reply(INTERNAL_FUNCTION_PARAME
 
     redis_check_eof(redis_sock TSRMLS_CC);
 
-    php_stream_gets(redis_sock->stream, inbuf, 1024);
+    if(redis_sock_read_line(redis_sock, inbuf, sizeof(inbuf), NULL TSRMLS_CC) == NULL) {
+        return -1;
+    }
     if(inbuf[0] != '*') {
+        /* EXECABORT, the transaction had a command refused */
+        if(inbuf[0] == '-' && strlen(inbuf) > 3) {
+            redis_sock_set_err(redis_sock, inbuf+1, strlen(inbuf+1) - 2);
+        }
         return -1;
     }
 
@@ -5393,27 +5280,46 @@ PHP_REDIS_API int redis_sock_read_multibulk_multi_reply(INTERNAL_FUNCTION_PARAME
 
 void
 free_reply_callbacks(zval *z_this, RedisSock *redis_sock) {
+    /* keep the callback array allocated for the next transaction */
+    redis_sock->callbacks_count = 0;
+    redis_sock->pipeline_sent = 0;
+    if(redis_sock->pipeline_replies) {
+        zval_ptr_dtor(&redis_sock->pipeline_replies);
+        redis_sock->pipeline_replies = NULL;
+    }
+
+    /* keep the pipeline buffer for the next pipeline */
+    redis_sock->pipeline_cmd.len = 0;
+    redis_sock->multi_buffered = 0;
+}
 
-	fold_item *fi;
-    fold_item *head = redis_sock->head;
-	request_item *ri;
+/* Read the replies to a buffered MULTI and its commands.  A command that
+ * wasn't QUEUED loses its callback, and gets FALSE in the results. */
+static int
+redis_read_queued_replies(RedisSock *redis_sock TSRMLS_DC)
+{
+    char *response;
+    int response_len, i;
 
-	for(fi = head; fi; ) {
-        fold_item *fi_next = fi->next;
-        free(fi);
-        fi = fi_next;
+    if ((response = redis_sock_read(redis_sock, &response_len TSRMLS_CC)) == NULL) {
+        return -1;
+    }
+    if (strncmp(response, "+OK", 3) != 0) {
+        efree(response);
+        return -1;
     }
-    redis_sock->head = NULL;
-    redis_sock->current = NULL;
+    efree(response);
 
-    for(ri = redis_sock->pipeline_head; ri; ) {
-        struct request_item *ri_next = ri->next;
-        free(ri->request_str);
-        free(ri);
-        ri = ri_next;
+    for (i = 0; i < redis_sock->callbacks_count; i++) {
+        if (redis_response_enqueued(redis_sock TSRMLS_CC) != 1) {
+            redis_sock->callbacks[i].fun = NULL;
+        }
+        if (EG(exception)) {
+            return -1;
+        }
     }
-    redis_sock->pipeline_head = NULL;
-    redis_sock->pipeline_current = NULL;
+
+    return 0;
 }
 
 /* exec */
@@ -5424,7 +5330,6 @@ PHP_METHOD(Redis, exec)
     char *cmd;
 	int cmd_len;
 	zval *object;
-    struct request_item *ri;
 
 	if (zend_parse_method_parameters(ZEND_NUM_ARGS() TSRMLS_CC, getThis(), "O",
                                      &object, redis_ce) == FAILURE) {
@@ -5438,11 +5343,32 @@ PHP_METHOD(Redis, exec)
 
         cmd_len = redis_cmd_format_static(&cmd, "EXEC", "");
 
-		if (redis_sock_write(redis_sock, cmd, cmd_len TSRMLS_CC) < 0) {
-			efree(cmd);
-			RETURN_FALSE;
-		}
-		efree(cmd);
+        if(redis_sock->multi_buffered) {
+            /* MULTI, the commands and EXEC in one write, then every QUEUED */
+            PIPELINE_ENQUEUE_COMMAND(cmd, cmd_len);
+            efree(cmd);
+            if (redis_sock_write(redis_sock, redis_sock->pipeline_cmd.c,
+                                 redis_sock->pipeline_cmd.len TSRMLS_CC) < 0 ||
+                redis_read_queued_replies(redis_sock TSRMLS_CC) < 0)
+            {
+                /* we can't tell where the replies stop, drop the connection */
+                if(redis_sock->stream) {
+                    redis_stream_close(redis_sock TSRMLS_CC);
+                    redis_sock->stream = NULL;
+                    redis_sock->status = REDIS_SOCK_STATUS_FAILED;
+                }
+                free_reply_callbacks(object, redis_sock);
+                redis_sock->mode = ATOMIC;
+                redis_sock->watching = 0;
+                RETURN_FALSE;
+            }
+        } else {
+		    if (redis_sock_write(redis_sock, cmd, cmd_len TSRMLS_CC) < 0) {
+			    efree(cmd);
+			    RETURN_FALSE;
+		    }
+		    efree(cmd);
+        }
 
 	    if (redis_sock_read_multibulk_multi_reply(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock) < 0) {
             zval_dtor(return_value);
@@ -5458,33 +5384,15 @@ PHP_METHOD(Redis, exec)
 
 	IF_PIPELINE() {
 
-		char *request = NULL;
-		int total = 0;
-		int offset = 0;
-
-        /* compute the total request size */
-		for(ri = redis_sock->pipeline_head; ri; ri = ri->next) {
-            total += ri->request_size;
-		}
-        if(total) {
-		    request = malloc(total);
-        }
-
-        /* concatenate individual elements one by one in the target buffer */
-		for(ri = redis_sock->pipeline_head; ri; ri = ri->next) {
-			memcpy(request + offset, ri->request_str, ri->request_size);
-			offset += ri->request_size;
-		}
-
-		if(request != NULL) {
-		    if (redis_sock_write(redis_sock, request, total TSRMLS_CC) < 0) {
-    		    free(request);
+        /* every queued command goes out in a single write */
+		if(redis_sock->pipeline_cmd.len) {
+		    if (redis_sock_write(redis_sock, redis_sock->pipeline_cmd.c,
+		                         redis_sock->pipeline_cmd.len TSRMLS_CC) < 0) {
                 free_reply_callbacks(object, redis_sock);
                 redis_sock->mode = ATOMIC;
         		RETURN_FALSE;
 		    }
-		   	free(request);
-		} else {
+		} else if(!redis_sock->callbacks_count && !redis_sock->pipeline_replies) {
                 redis_sock->mode = ATOMIC;
                 free_reply_callbacks(object, redis_sock);
                 array_init(return_value); /* empty array when no command was run. */
@@ -5505,46 +5413,704 @@ PHP_REDIS_API void fold_this_item(INTERNAL_FUNCTION_PARAMETERS, fold_item *item,
 	item->fun(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, z_tab, item->ctx TSRMLS_CC);
 }
 
+/* Send the commands a windowed pipeline has queued, then read the replies
+ * to the previous window while the server works on this one.  The replies
+ * are kept until exec(), which reads those of the last window. */
+PHP_REDIS_API int redis_pipeline_flush(INTERNAL_FUNCTION_PARAMETERS, RedisSock *redis_sock)
+{
+    zval z_ret;
+    int i, count;
+
+    if(redis_sock->pipeline_cmd.len) {
+        if(redis_sock_write(redis_sock, redis_sock->pipeline_cmd.c,
+                            redis_sock->pipeline_cmd.len TSRMLS_CC) < 0) {
+            free_reply_callbacks(getThis(), redis_sock);
+            redis_sock->mode = ATOMIC;
+            return -1;
+        }
+        redis_sock->pipeline_cmd.len = 0;
+    }
+
+    count = redis_sock->pipeline_sent;
+    redis_sock->pipeline_sent = redis_sock->callbacks_count;
+
+    if(!redis_sock->pipeline_replies) {
+        MAKE_STD_ZVAL(redis_sock->pipeline_replies);
+        array_init(redis_sock->pipeline_replies);
+    }
+
+    /* callbacks only fill the replies array, don't touch our return value */
+    INIT_ZVAL(z_ret);
+    for(i = 0; i < count; i++) {
+        fold_this_item(ht, &z_ret, return_value_ptr, this_ptr, return_value_used TSRMLS_CC,
+                       &redis_sock->callbacks[i], redis_sock, redis_sock->pipeline_replies);
+    }
+    zval_dtor(&z_ret);
+
+    /* the callbacks left are those of the window we just sent */
+    redis_sock->callbacks_count -= count;
+    redis_sock->pipeline_sent -= count;
+    memmove(redis_sock->callbacks, redis_sock->callbacks + count,
+            redis_sock->callbacks_count * sizeof(fold_item));
+
+    return 0;
+}
+
 PHP_REDIS_API int redis_sock_read_multibulk_multi_reply_loop(INTERNAL_FUNCTION_PARAMETERS,
 							RedisSock *redis_sock, zval *z_tab, int numElems)
 {
 
-    fold_item *head = redis_sock->head;
-    fold_item *current = redis_sock->current;
-    for(current = head; current; current = current->next) {
-		fold_this_item(INTERNAL_FUNCTION_PARAM_PASSTHRU, current, redis_sock, z_tab);
+    int i;
+
+    for(i = 0; i < redis_sock->callbacks_count; i++) {
+        if(!redis_sock->callbacks[i].fun) {
+            /* refused when queued, there is no reply for it */
+            add_next_index_bool(z_tab, 0);
+            continue;
+        }
+		fold_this_item(INTERNAL_FUNCTION_PARAM_PASSTHRU, &redis_sock->callbacks[i], redis_sock, z_tab);
     }
-    redis_sock->current = current;
     return 0;
 }
 
-PHP_METHOD(Redis, pipeline)
+/* Send a command on a Redis object without waiting for its reply.  On
+ * success z_handle is set to the handle await() takes, and 0 is returned. */
+PHP_REDIS_API int
+redis_send_async(zval *object, char *cmd, int cmd_len, int argc, zval **args,
+                 zval *z_handle TSRMLS_DC)
 {
     RedisSock *redis_sock;
-	zval *object;
+    zval z_fun, z_ret;
+    long window, window_bytes;
+    int ok;
 
-	if (zend_parse_method_parameters(ZEND_NUM_ARGS() TSRMLS_CC, getThis(), "O",
-                                     &object, redis_ce) == FAILURE) {
-        RETURN_FALSE;
+    if (redis_sock_get(object, &redis_sock TSRMLS_CC, 0) < 0 || redis_sock->mode != ATOMIC) {
+        return -1;
     }
 
-    /* if the flag is activated, send the command, the reply will be "QUEUED" or -ERR */
-    if (redis_sock_get(object, &redis_sock TSRMLS_CC, 0) < 0) {
-        RETURN_FALSE;
+    /* these change the connection state, or don't have a single reply */
+    if (!strcasecmp(cmd, "multi") || !strcasecmp(cmd, "exec") || !strcasecmp(cmd, "discard") ||
+        !strcasecmp(cmd, "pipeline") || !strcasecmp(cmd, "subscribe") ||
+        !strcasecmp(cmd, "psubscribe") || !strcasecmp(cmd, "sendAsync") ||
+        !strcasecmp(cmd, "connect") || !strcasecmp(cmd, "pconnect") || !strcasecmp(cmd, "close"))
+    {
+        return -1;
     }
-	redis_sock->mode = PIPELINE;
 
-	/*
-		NB : we keep the function fold, to detect the last function.
-		We need the response format of the n - 1 command. So, we can delete when n > 2, the { 1 .. n - 2} commands
-	*/
+    /* replies are kept until awaited, don't let them pile up forever */
+    if (redis_sock->async_count + (redis_sock->async_replies ?
+        zend_hash_num_elements(Z_ARRVAL_P(redis_sock->async_replies)) : 0) >= REDIS_ASYNC_MAX)
+    {
+        redis_sock_set_err(redis_sock, "Too many async replies not awaited",
+                           sizeof("Too many async replies not awaited") - 1);
+        return -1;
+    }
 
-    free_reply_callbacks(getThis(), redis_sock);
+    /* build the command and its callback like a pipeline of one */
+    window = redis_sock->pipeline_window;
+    window_bytes = redis_sock->pipeline_window_bytes;
+    redis_sock->pipeline_window = redis_sock->pipeline_window_bytes = 0;
+    redis_sock->mode = PIPELINE;
+    redis_sock->callbacks_count = 0;
+    redis_sock->pipeline_cmd.len = 0;
 
-	RETURN_ZVAL(getThis(), 1, 0);
-}
+    ZVAL_STRINGL(&z_fun, cmd, cmd_len, 0);
+    call_user_function(&redis_ce->function_table, &object, &z_fun, &z_ret, argc, args TSRMLS_CC);
 
-/*
+    ok = !EG(exception) && redis_sock->mode == PIPELINE &&
+         redis_sock->callbacks_count == 1 && redis_sock->pipeline_cmd.len &&
+         Z_TYPE(z_ret) == IS_OBJECT;
+
+    zval_dtor(&z_ret);
+    redis_sock->mode = ATOMIC;
+    redis_sock->pipeline_window = window;
+    redis_sock->pipeline_window_bytes = window_bytes;
+
+    /* written straight to the stream: redis_sock_write would wait for the
+     * replies to our other async commands first.  What an open reply
+     * iterator left is read now, it would be taken for our reply. */
+    if (ok && redis_sock->iter_left && redis_sock_iter_discard(redis_sock TSRMLS_CC) < 0) {
+        ok = 0;
+    }
+    if (ok && redis_sock->cache) {
+        redis_cache_sent(redis_sock, redis_sock->pipeline_cmd.c, redis_sock->pipeline_cmd.len);
+    }
+    if (!ok || redis_check_eof(redis_sock TSRMLS_CC) < 0 ||
+        php_stream_write(redis_sock->stream, redis_sock->pipeline_cmd.c,
+                         redis_sock->pipeline_cmd.len) != redis_sock->pipeline_cmd.len)
+    {
+        free_reply_callbacks(object, redis_sock);
+        return -1;
+    }
+
+    if (redis_sock->async_count == redis_sock->async_size) {
+        redis_sock->async_size = redis_sock->async_size ? 2 * redis_sock->async_size : 16;
+        redis_sock->async = erealloc(redis_sock->async, redis_sock->async_size * sizeof(fold_item));
+    }
+    redis_sock->async[redis_sock->async_count++] = redis_sock->callbacks[0];
+    free_reply_callbacks(object, redis_sock);
+
+    /* the handle is the object and the id of the command on it */
+    array_init(z_handle);
+    Z_ADDREF_P(object);
+    add_next_index_zval(z_handle, object);
+    add_next_index_long(z_handle, ++redis_sock->async_sent);
+
+    return 0;
+}
+
+/* {{{ proto array Redis::sendAsync(string command [, array args])
+    Send a command without waiting for its reply, returns a handle for await() */
+PHP_METHOD(Redis, sendAsync)
+{
+    zval *object, *z_args = NULL, **z_arg, **z_callargs = NULL;
+    char *cmd;
+    int cmd_len, argc = 0, i;
+    HashPosition pos;
+
+    if (zend_parse_method_parameters(ZEND_NUM_ARGS() TSRMLS_CC, getThis(), "Os|a",
+                                     &object, redis_ce, &cmd, &cmd_len, &z_args) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    if (z_args) {
+        argc = zend_hash_num_elements(Z_ARRVAL_P(z_args));
+        z_callargs = emalloc((argc ? argc : 1) * sizeof(zval*));
+        for (i = 0, zend_hash_internal_pointer_reset_ex(Z_ARRVAL_P(z_args), &pos);
+             zend_hash_get_current_data_ex(Z_ARRVAL_P(z_args), (void**)&z_arg, &pos) == SUCCESS;
+             i++, zend_hash_move_forward_ex(Z_ARRVAL_P(z_args), &pos))
+        {
+            z_callargs[i] = *z_arg;
+        }
+    }
+
+    if (redis_send_async(object, cmd, cmd_len, argc, z_callargs, return_value TSRMLS_CC) < 0) {
+        RETVAL_FALSE;
+    }
+
+    if (z_callargs) {
+        efree(z_callargs);
+    }
+}
+/* }}} */
+
+/* The socket and command id behind an async handle */
+static RedisSock *
+redis_async_handle(zval *z_handle, long *id TSRMLS_DC)
+{
+    zval **z_obj, **z_id;
+    RedisSock *redis_sock;
+
+    if (Z_TYPE_P(z_handle) != IS_ARRAY ||
+        zend_hash_index_find(Z_ARRVAL_P(z_handle), 0, (void**)&z_obj) == FAILURE ||
+        zend_hash_index_find(Z_ARRVAL_P(z_handle), 1, (void**)&z_id) == FAILURE ||
+        Z_TYPE_PP(z_obj) != IS_OBJECT || Z_TYPE_PP(z_id) != IS_LONG ||
+        !instanceof_function(Z_OBJCE_PP(z_obj), redis_ce TSRMLS_CC) ||
+        redis_sock_get(*z_obj, &redis_sock TSRMLS_CC, 1) < 0)
+    {
+        return NULL;
+    }
+
+    *id = Z_LVAL_PP(z_id);
+    return redis_sock;
+}
+
+/* Wait for the replies to async commands, on all their connections at once.
+ * z_replies gets the replies under the keys of their handles; those that
+ * didn't come in time are left out and can be awaited again. */
+PHP_REDIS_API void
+redis_await(HashTable *handles, double timeout, zval *z_replies TSRMLS_DC)
+{
+    zval **z_handle, **z_val;
+    RedisSock *redis_sock, **socks;
+    php_pollfd *pfds;
+    struct timeval now, deadline;
+    HashPosition pos;
+    char *str_key;
+    unsigned int str_key_len;
+    unsigned long idx;
+    long id;
+    int count, nsocks, i, wait_ms, progress;
+
+    count = zend_hash_num_elements(handles);
+    socks = emalloc((count ? count : 1) * sizeof(RedisSock*));
+    pfds = emalloc((count ? count : 1) * sizeof(php_pollfd));
+
+    gettimeofday(&deadline, NULL);
+    if (timeout > 0) {
+        deadline.tv_sec += (time_t)timeout;
+        deadline.tv_usec += (int)((timeout - (time_t)timeout) * 1000000);
+        if (deadline.tv_usec >= 1000000) {
+            deadline.tv_sec++;
+            deadline.tv_usec -= 1000000;
+        }
+    }
+
+    while (!EG(exception)) {
+        /* the connections we're still waiting on */
+        nsocks = 0;
+        progress = 0;
+        for (zend_hash_internal_pointer_reset_ex(handles, &pos);
+             zend_hash_get_current_data_ex(handles, (void**)&z_handle, &pos) == SUCCESS;
+             zend_hash_move_forward_ex(handles, &pos))
+        {
+            if (!(redis_sock = redis_async_handle(*z_handle, &id TSRMLS_CC)) ||
+                id <= redis_sock->async_read || id > redis_sock->async_sent)
+            {
+                continue;
+            }
+
+            if (!redis_sock->stream) {
+                redis_sock_async_fail(redis_sock);
+                continue;
+            }
+
+            /* the rest of an open reply iterator's reply comes first */
+            if (redis_sock->iter_left) {
+                if (redis_sock_iter_discard(redis_sock TSRMLS_CC) < 0) {
+                    redis_sock_async_fail(redis_sock);
+                }
+                progress = 1;
+                continue;
+            }
+
+            /* a reply we already received doesn't need a poll */
+            if (redis_sock->rbuf_pos < redis_sock->rbuf_len) {
+                redis_sock_async_read_one(redis_sock TSRMLS_CC);
+                progress = 1;
+                continue;
+            }
+
+            for (i = 0; i < nsocks && socks[i] != redis_sock; i++);
+            if (i == nsocks) {
+                socks[nsocks] = redis_sock;
+                pfds[nsocks].fd = ((php_netstream_data_t*)redis_sock->stream->abstract)->socket;
+                pfds[nsocks].events = POLLIN;
+                pfds[nsocks].revents = 0;
+                nsocks++;
+            }
+        }
+
+        if (progress) {
+            continue;
+        }
+        if (!nsocks) {
+            break;
+        }
+
+        wait_ms = -1;
+        if (timeout > 0) {
+            gettimeofday(&now, NULL);
+            wait_ms = (deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_usec - now.tv_usec) / 1000;
+            if (wait_ms <= 0) {
+                break;
+            }
+        } else if (timeout == 0) {
+            wait_ms = 0;
+        }
+
+        if (php_poll2(pfds, nsocks, wait_ms) <= 0) {
+            break;
+        }
+
+        /* a reply has started to arrive, read it whole */
+        for (i = 0; i < nsocks; i++) {
+            if (pfds[i].revents) {
+                if (redis_sock_async_read_one(socks[i] TSRMLS_CC) < 0) {
+                    redis_sock_async_fail(socks[i]);
+                }
+            }
+        }
+    }
+
+    efree(socks);
+    efree(pfds);
+
+    /* hand out the replies that came in */
+    array_init(z_replies);
+    for (zend_hash_internal_pointer_reset_ex(handles, &pos);
+         zend_hash_get_current_data_ex(handles, (void**)&z_handle, &pos) == SUCCESS;
+         zend_hash_move_forward_ex(handles, &pos))
+    {
+        if (!(redis_sock = redis_async_handle(*z_handle, &id TSRMLS_CC)) || !redis_sock->async_replies ||
+            zend_hash_index_find(Z_ARRVAL_P(redis_sock->async_replies), id, (void**)&z_val) == FAILURE)
+        {
+            continue;
+        }
+
+        Z_ADDREF_PP(z_val);
+        if (zend_hash_get_current_key_ex(handles, &str_key, &str_key_len, &idx, 0, &pos) == HASH_KEY_IS_STRING) {
+            add_assoc_zval_ex(z_replies, str_key, str_key_len, *z_val);
+        } else {
+            add_index_zval(z_replies, idx, *z_val);
+        }
+        zend_hash_index_del(Z_ARRVAL_P(redis_sock->async_replies), id);
+    }
+}
+
+/* {{{ proto array Redis::await(array handles [, double timeout])
+    Wait for the replies to async commands, on all their connections at once.
+    Returns the replies under the keys of their handles; those that didn't
+    come in time are left out and can be awaited again. */
+PHP_METHOD(Redis, await)
+{
+    zval *z_handles;
+    double timeout = -1.0;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "a|d", &z_handles, &timeout) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    redis_await(Z_ARRVAL_P(z_handles), timeout, return_value TSRMLS_CC);
+}
+/* }}} */
+
+/* State of a massInsert: the batch being encoded, and how many replies the
+ * server owes us for the batch sent before it */
+typedef struct {
+    RedisSock *redis_sock;
+    smart_str buf;
+    char *cmd;
+    int cmd_len;
+    zend_bool prefix;
+    long window;
+    long batch;             /* commands in buf */
+    long in_flight;         /* sent, replies not read yet */
+    long sent;
+    long errors;
+} mass_insert;
+
+/* Send the batch, then read the replies to the previous one, which the
+ * server had time to work on while we were encoding this one */
+static int
+mass_insert_flush(mass_insert *mi TSRMLS_DC)
+{
+    int ret;
+
+    if (mi->buf.len && redis_sock_write(mi->redis_sock, mi->buf.c, mi->buf.len TSRMLS_CC) < 0) {
+        return -1;
+    }
+    mi->buf.len = 0;
+
+    for (; mi->in_flight; mi->in_flight--) {
+        if ((ret = redis_sock_skip_reply(mi->redis_sock TSRMLS_CC)) < 0) {
+            return -1;
+        }
+        mi->errors += ret;
+    }
+
+    mi->in_flight = mi->batch;
+    mi->batch = 0;
+    return 0;
+}
+
+/* Encode one row, an array of arguments, as a command */
+static int
+mass_insert_row(mass_insert *mi, zval *z_row TSRMLS_DC)
+{
+    zval **z_arg, z_tmp;
+    HashPosition pos;
+    int first = 1;
+
+    if (Z_TYPE_P(z_row) != IS_ARRAY || !zend_hash_num_elements(Z_ARRVAL_P(z_row))) {
+        php_error_docref(NULL TSRMLS_CC, E_WARNING, "Rows must be non-empty arrays of arguments");
+        mi->errors++;
+        return 0;
+    }
+
+    redis_cmd_init_sstr(&mi->buf, zend_hash_num_elements(Z_ARRVAL_P(z_row)), mi->cmd, mi->cmd_len);
+
+    for (zend_hash_internal_pointer_reset_ex(Z_ARRVAL_P(z_row), &pos);
+         zend_hash_get_current_data_ex(Z_ARRVAL_P(z_row), (void**)&z_arg, &pos) == SUCCESS;
+         zend_hash_move_forward_ex(Z_ARRVAL_P(z_row), &pos))
+    {
+        if (Z_TYPE_PP(z_arg) == IS_STRING) {
+            z_tmp = **z_arg;
+        } else {
+            z_tmp = **z_arg;
+            zval_copy_ctor(&z_tmp);
+            convert_to_string(&z_tmp);
+        }
+
+        /* the first argument is the key */
+        if (first && mi->prefix) {
+            redis_cmd_append_sstr_key(&mi->buf, Z_STRVAL(z_tmp), Z_STRLEN(z_tmp), mi->redis_sock);
+        } else {
+            redis_cmd_append_sstr(&mi->buf, Z_STRVAL(z_tmp), Z_STRLEN(z_tmp));
+        }
+        first = 0;
+
+        if (Z_TYPE_PP(z_arg) != IS_STRING) {
+            zval_dtor(&z_tmp);
+        }
+    }
+
+    mi->sent++;
+    if (++mi->batch >= mi->window || mi->buf.len >= REDIS_MASS_INSERT_BYTES) {
+        return mass_insert_flush(mi TSRMLS_CC);
+    }
+    return 0;
+}
+
+/* {{{ proto array Redis::massInsert(array|Traversable rows, string command [, array options])
+    Run a command once per row, each row being the array of its arguments.
+    Commands are encoded straight into large writes, and replies are only
+    checked for errors.  Options: "window" (commands per batch, 1024) and
+    "prefix" (apply our key prefix to the first argument, TRUE).
+    Returns array("sent" => n, "errors" => n), the last error message is
+    available from getLastError(). */
+PHP_METHOD(Redis, massInsert)
+{
+    zval *object, *z_rows, *z_opts = NULL, **z_opt, **z_row;
+    RedisSock *redis_sock;
+    mass_insert mi;
+    HashPosition pos;
+    zend_object_iterator *it = NULL;
+    int failed = 0;
+
+    if (zend_parse_method_parameters(ZEND_NUM_ARGS() TSRMLS_CC, getThis(), "Ozs|a",
+                                     &object, redis_ce, &z_rows, &mi.cmd, &mi.cmd_len,
+                                     &z_opts) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    if (Z_TYPE_P(z_rows) != IS_ARRAY &&
+        (Z_TYPE_P(z_rows) != IS_OBJECT ||
+         !instanceof_function(Z_OBJCE_P(z_rows), zend_ce_traversable TSRMLS_CC)))
+    {
+        php_error_docref(NULL TSRMLS_CC, E_WARNING, "Rows must be an array or Traversable");
+        RETURN_FALSE;
+    }
+
+    if (redis_sock_get(object, &redis_sock TSRMLS_CC, 0) < 0) {
+        RETURN_FALSE;
+    }
+
+    if (redis_sock->mode != ATOMIC) {
+        php_error_docref(NULL TSRMLS_CC, E_WARNING, "Can't call massInsert in multi or pipeline mode");
+        RETURN_FALSE;
+    }
+
+    memset(&mi.buf, 0, sizeof(mi.buf));
+    mi.redis_sock = redis_sock;
+    mi.prefix = 1;
+    mi.window = REDIS_MASS_INSERT_WINDOW;
+    mi.batch = mi.in_flight = mi.sent = mi.errors = 0;
+
+    if (z_opts) {
+        if (zend_hash_find(Z_ARRVAL_P(z_opts), "window", sizeof("window"), (void**)&z_opt) == SUCCESS) {
+            convert_to_long_ex(z_opt);
+            mi.window = Z_LVAL_PP(z_opt) > 0 ? Z_LVAL_PP(z_opt) : 1;
+        }
+        if (zend_hash_find(Z_ARRVAL_P(z_opts), "prefix", sizeof("prefix"), (void**)&z_opt) == SUCCESS) {
+            mi.prefix = zend_is_true(*z_opt);
+        }
+    }
+
+    redis_sock_set_err(redis_sock, NULL, 0);
+
+    if (Z_TYPE_P(z_rows) == IS_ARRAY) {
+        for (zend_hash_internal_pointer_reset_ex(Z_ARRVAL_P(z_rows), &pos);
+             !failed && zend_hash_get_current_data_ex(Z_ARRVAL_P(z_rows), (void**)&z_row, &pos) == SUCCESS;
+             zend_hash_move_forward_ex(Z_ARRVAL_P(z_rows), &pos))
+        {
+            failed = mass_insert_row(&mi, *z_row TSRMLS_CC) < 0;
+        }
+    } else {
+        it = Z_OBJCE_P(z_rows)->get_iterator(Z_OBJCE_P(z_rows), z_rows, 0 TSRMLS_CC);
+        if (it && !EG(exception) && it->funcs->rewind) {
+            it->funcs->rewind(it TSRMLS_CC);
+        }
+        while (it && !failed && !EG(exception) && it->funcs->valid(it TSRMLS_CC) == SUCCESS) {
+            it->funcs->get_current_data(it, &z_row TSRMLS_CC);
+            if (EG(exception)) {
+                break;
+            }
+            failed = mass_insert_row(&mi, *z_row TSRMLS_CC) < 0;
+            it->funcs->move_forward(it TSRMLS_CC);
+        }
+        if (it) {
+            it->funcs->dtor(it TSRMLS_CC);
+        }
+    }
+
+    /* whatever was sent still has replies to read, even if the rows failed */
+    if (!failed) {
+        failed = mass_insert_flush(&mi TSRMLS_CC) < 0 || mass_insert_flush(&mi TSRMLS_CC) < 0;
+    }
+    smart_str_free(&mi.buf);
+
+    if (failed) {
+        /* we can't tell where the replies stopped */
+        redis_sock_disconnect(redis_sock TSRMLS_CC);
+        RETURN_FALSE;
+    }
+
+    array_init(return_value);
+    add_assoc_long(return_value, "sent", mi.sent);
+    add_assoc_long(return_value, "errors", mi.errors);
+}
+/* }}} */
+
+/* A RedisReplyIterator reads a large reply one element at a time, as it is
+ * iterated.  Its state lives in the RedisSock, since the reply is on the
+ * connection; the iterator only remembers which reply it was handed, and is
+ * finished once the connection moved on to another command. */
+PHP_REDIS_API int
+redis_reply_iterator_new(zval *object, RedisSock *redis_sock, long count, zval *z_ret TSRMLS_DC)
+{
+    if (!instanceof_function(Z_OBJCE_P(object), redis_ce TSRMLS_CC)) {
+        return -1;
+    }
+
+    object_init_ex(z_ret, redis_reply_iterator_ce);
+    zend_update_property(redis_reply_iterator_ce, z_ret, "redis", sizeof("redis")-1, object TSRMLS_CC);
+    zend_update_property_long(redis_reply_iterator_ce, z_ret, "id", sizeof("id")-1, redis_sock->iter_id TSRMLS_CC);
+    zend_update_property_long(redis_reply_iterator_ce, z_ret, "count", sizeof("count")-1, count TSRMLS_CC);
+    return 0;
+}
+
+/* The socket our reply is on, or NULL if it was read or discarded.  The first
+ * element is only read when it is asked for. */
+static RedisSock *
+redis_reply_iterator_sock(zval *object TSRMLS_DC)
+{
+    zval *z_redis, *z_id;
+    RedisSock *redis_sock;
+
+    z_redis = zend_read_property(redis_reply_iterator_ce, object, "redis", sizeof("redis")-1, 1 TSRMLS_CC);
+    z_id = zend_read_property(redis_reply_iterator_ce, object, "id", sizeof("id")-1, 1 TSRMLS_CC);
+
+    if (Z_TYPE_P(z_redis) != IS_OBJECT || Z_TYPE_P(z_id) != IS_LONG ||
+        redis_sock_get(z_redis, &redis_sock TSRMLS_CC, 1) < 0 ||
+        redis_sock->iter_id != Z_LVAL_P(z_id))
+    {
+        return NULL;
+    }
+
+    if (redis_sock->iter_pos < 0) {
+        redis_sock_iter_next(redis_sock TSRMLS_CC);
+    }
+    return redis_sock;
+}
+
+/* {{{ proto void RedisReplyIterator::rewind()
+    The reply can only be read once, so this is only valid before the first
+    call to next() */
+PHP_METHOD(RedisReplyIterator, rewind)
+{
+    RedisSock *redis_sock = redis_reply_iterator_sock(getThis() TSRMLS_CC);
+
+    if (redis_sock && redis_sock->iter_pos > 0) {
+        zend_throw_exception(redis_exception_ce, "Cannot rewind a reply iterator", 0 TSRMLS_CC);
+    }
+}
+/* }}} */
+
+/* {{{ proto bool RedisReplyIterator::valid() */
+PHP_METHOD(RedisReplyIterator, valid)
+{
+    RedisSock *redis_sock = redis_reply_iterator_sock(getThis() TSRMLS_CC);
+
+    RETURN_BOOL(redis_sock && redis_sock->iter_val);
+}
+/* }}} */
+
+/* {{{ proto mixed RedisReplyIterator::current() */
+PHP_METHOD(RedisReplyIterator, current)
+{
+    RedisSock *redis_sock = redis_reply_iterator_sock(getThis() TSRMLS_CC);
+
+    if (!redis_sock || !redis_sock->iter_val) {
+        RETURN_NULL();
+    }
+    RETURN_ZVAL(redis_sock->iter_val, 1, 0);
+}
+/* }}} */
+
+/* {{{ proto mixed RedisReplyIterator::key()
+    The position in a list, the field or member of a zipped reply */
+PHP_METHOD(RedisReplyIterator, key)
+{
+    RedisSock *redis_sock = redis_reply_iterator_sock(getThis() TSRMLS_CC);
+
+    if (!redis_sock || !redis_sock->iter_key) {
+        RETURN_NULL();
+    }
+    RETURN_ZVAL(redis_sock->iter_key, 1, 0);
+}
+/* }}} */
+
+/* {{{ proto void RedisReplyIterator::next() */
+PHP_METHOD(RedisReplyIterator, next)
+{
+    RedisSock *redis_sock = redis_reply_iterator_sock(getThis() TSRMLS_CC);
+
+    if (redis_sock) {
+        redis_sock_iter_next(redis_sock TSRMLS_CC);
+    }
+}
+/* }}} */
+
+/* {{{ proto long RedisReplyIterator::count()
+    The number of elements (or pairs) in the reply */
+PHP_METHOD(RedisReplyIterator, count)
+{
+    zval *z_count = zend_read_property(redis_reply_iterator_ce, getThis(), "count", sizeof("count")-1, 1 TSRMLS_CC);
+
+    RETURN_LONG(Z_TYPE_P(z_count) == IS_LONG ? Z_LVAL_P(z_count) : 0);
+}
+/* }}} */
+
+/* {{{ proto bool RedisReplyIterator::discard()
+    Stop here: read past the rest of the reply without decoding it.  Sending
+    another command on the connection does the same. */
+PHP_METHOD(RedisReplyIterator, discard)
+{
+    zval *z_redis, *z_id;
+    RedisSock *redis_sock;
+
+    z_redis = zend_read_property(redis_reply_iterator_ce, getThis(), "redis", sizeof("redis")-1, 1 TSRMLS_CC);
+    z_id = zend_read_property(redis_reply_iterator_ce, getThis(), "id", sizeof("id")-1, 1 TSRMLS_CC);
+
+    if (Z_TYPE_P(z_redis) != IS_OBJECT || Z_TYPE_P(z_id) != IS_LONG ||
+        redis_sock_get(z_redis, &redis_sock TSRMLS_CC, 1) < 0 ||
+        redis_sock->iter_id != Z_LVAL_P(z_id))
+    {
+        RETURN_TRUE;
+    }
+
+    RETURN_BOOL(redis_sock_iter_discard(redis_sock TSRMLS_CC) == 0);
+}
+/* }}} */
+
+PHP_METHOD(Redis, pipeline)
+{
+    RedisSock *redis_sock;
+	zval *object;
+
+	if (zend_parse_method_parameters(ZEND_NUM_ARGS() TSRMLS_CC, getThis(), "O",
+                                     &object, redis_ce) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    /* if the flag is activated, send the command, the reply will be "QUEUED" or -ERR */
+    if (redis_sock_get(object, &redis_sock TSRMLS_CC, 0) < 0) {
+        RETURN_FALSE;
+    }
+	redis_sock->mode = PIPELINE;
+
+	/*
+		NB : we keep the function fold, to detect the last function.
+		We need the response format of the n - 1 command. So, we can delete when n > 2, the { 1 .. n - 2} commands
+	*/
+
+    free_reply_callbacks(getThis(), redis_sock);
+
+	RETURN_ZVAL(getThis(), 1, 0);
+}
+
+/*
 	publish channel message
 	@return the number of subscribers
 */
@@ -5973,6 +6539,26 @@ PHP_METHOD(Redis, getOption)  {
             RETURN_DOUBLE(redis_sock->read_timeout);
         case REDIS_OPT_SCAN:
             RETURN_LONG(redis_sock->scan);
+        case REDIS_OPT_MULTI_BUFFER:
+            RETURN_LONG(redis_sock->multi_buffer);
+        case REDIS_OPT_REPLY_ITERATOR:
+            RETURN_LONG(redis_sock->reply_iterator);
+        case REDIS_OPT_INTERN_KEYS:
+            RETURN_LONG(redis_sock->intern_keys);
+        case REDIS_OPT_CLIENT_CACHE:
+            RETURN_STRING(redis_cache_spec(redis_sock), 1);
+        case REDIS_OPT_COMPRESSION:
+            RETURN_LONG(redis_sock->compression);
+        case REDIS_OPT_COMPRESSION_LEVEL:
+            RETURN_LONG(redis_sock->compression_level);
+        case REDIS_OPT_COMPRESSION_MIN_SIZE:
+            RETURN_LONG(redis_sock->compression_min_size);
+        case REDIS_OPT_COMPRESSION_DICTIONARY:
+            RETURN_LONG(redis_sock->compression_dict);
+        case REDIS_OPT_PIPELINE_WINDOW:
+            RETURN_LONG(redis_sock->pipeline_window);
+        case REDIS_OPT_PIPELINE_WINDOW_BYTES:
+            RETURN_LONG(redis_sock->pipeline_window_bytes);
         default:
             RETURN_FALSE;
     }
@@ -6005,6 +6591,7 @@ PHP_METHOD(Redis, setOption) {
 #ifdef HAVE_REDIS_IGBINARY
                     || val_long == REDIS_SERIALIZER_IGBINARY
 #endif
+                    || val_long == REDIS_SERIALIZER_MSGPACK
                     || val_long == REDIS_SERIALIZER_PHP) {
                         redis_sock->serializer = val_long;
                         RETURN_TRUE;
@@ -6041,6 +6628,76 @@ PHP_METHOD(Redis, setOption) {
                 }
                 RETURN_FALSE;
                 break;
+            case REDIS_OPT_MULTI_BUFFER:
+                redis_sock->multi_buffer = atol(val_str) ? 1 : 0;
+                RETURN_TRUE;
+            case REDIS_OPT_INTERN_KEYS:
+                redis_sock->intern_keys = atol(val_str) ? 1 : 0;
+                RETURN_TRUE;
+            case REDIS_OPT_CLIENT_CACHE:
+                /* key prefixes separated by commas, or nothing to stop */
+                if(redis_cache_enable(redis_sock, val_str, val_len TSRMLS_CC) < 0) {
+                    RETURN_FALSE;
+                }
+                RETURN_TRUE;
+            case REDIS_OPT_COMPRESSION:
+                val_long = atol(val_str);
+                if(val_long == REDIS_COMPRESSION_NONE
+#ifdef HAVE_REDIS_LZ4
+                        || val_long == REDIS_COMPRESSION_LZ4
+#endif
+#ifdef HAVE_REDIS_ZSTD
+                        || val_long == REDIS_COMPRESSION_ZSTD
+#endif
+                        ) {
+                    redis_sock->compression = val_long;
+                    RETURN_TRUE;
+                }
+                RETURN_FALSE;
+            case REDIS_OPT_COMPRESSION_LEVEL:
+                redis_sock->compression_level = atoi(val_str);
+                RETURN_TRUE;
+            case REDIS_OPT_COMPRESSION_MIN_SIZE:
+                val_long = atol(val_str);
+                if(val_long < 0) {
+                    RETURN_FALSE;
+                }
+                redis_sock->compression_min_size = val_long;
+                RETURN_TRUE;
+            case REDIS_OPT_COMPRESSION_DICTIONARY:
+                /* a path to load, or an empty string to stop using one */
+                if(val_len == 0) {
+                    redis_sock->compression_dict = 0;
+                    RETURN_TRUE;
+                }
+                if(strlen(val_str) != (size_t)val_len || php_check_open_basedir(val_str TSRMLS_CC)) {
+                    RETURN_FALSE;
+                }
+                if((val_long = redis_zstd_dict_load(val_str)) == 0) {
+                    php_error_docref(NULL TSRMLS_CC, E_WARNING, "Can't load a zstd dictionary from %s", val_str);
+                    RETURN_FALSE;
+                }
+                redis_sock->compression_dict = (unsigned int)val_long;
+                RETURN_TRUE;
+            case REDIS_OPT_REPLY_ITERATOR:
+                val_long = atol(val_str);
+                if(val_long < 0) {
+                    RETURN_FALSE;
+                }
+                redis_sock->reply_iterator = val_long;
+                RETURN_TRUE;
+            case REDIS_OPT_PIPELINE_WINDOW:
+            case REDIS_OPT_PIPELINE_WINDOW_BYTES:
+                val_long = atol(val_str);
+                if(val_long < 0) {
+                    RETURN_FALSE;
+                }
+                if(option == REDIS_OPT_PIPELINE_WINDOW) {
+                    redis_sock->pipeline_window = val_long;
+                } else {
+                    redis_sock->pipeline_window_bytes = val_long;
+                }
+                RETURN_TRUE;
             default:
                 RETURN_FALSE;
     }
@@ -6281,7 +6938,7 @@ redis_build_pubsub_cmd(RedisSock *redis_sock, char **ret, PUBSUB_TYPE type,
             zend_hash_move_forward_ex(ht_chan, &ptr))
         {
             char *key;
-            int key_len, key_free;
+            int key_len;
             zval *z_tmp = NULL;
 
             if(Z_TYPE_PP(z_ele) == IS_STRING) {
@@ -6297,14 +6954,8 @@ redis_build_pubsub_cmd(RedisSock *redis_sock, char **ret, PUBSUB_TYPE type,
                 key_len = Z_STRLEN_P(z_tmp);
             }
 
-            /* Apply prefix if required */
-            key_free = redis_key_prefix(redis_sock, &key, &key_len TSRMLS_CC);
-
-            /* Append this channel */
-            redis_cmd_append_sstr(&cmd, key, key_len);
-
-            /* Free key if prefixed */
-            if(key_free) efree(key);
+            /* Append this channel, prefixed if required */
+            redis_cmd_append_sstr_key(&cmd, key, key_len, redis_sock);
 
             /* Free our temp var if we converted from something other than a string */
             if(z_tmp) {
@@ -6399,78 +7050,87 @@ PHP_METHOD(Redis, pubsub) {
 PHP_REDIS_API int
 redis_build_eval_cmd(RedisSock *redis_sock, char **ret, char *keyword, char *value, int val_len, zval *args, int keys_count TSRMLS_DC) {
 	zval **elem;
-	HashTable *args_hash;
+	HashTable *args_hash = NULL;
 	HashPosition hash_pos;
-	int cmd_len, args_count = 0;
-	int eval_cmd_count = 2;
+	smart_str cmd = {0};
+	size_t newlen, size;
+	int args_count = 0;
 
 	/* If we've been provided arguments, we'll want to include those in our eval command */
 	if(args != NULL) {
-		/* Init our hash array value, and grab the count */
 	    args_hash = Z_ARRVAL_P(args);
 	    args_count = zend_hash_num_elements(args_hash);
+	}
 
-	    /* We only need to process the arguments if the array is non empty */
-	    if(args_count >  0) {
-	    	/* Header for our EVAL command */
-	    	cmd_len = redis_cmd_format_header(ret, keyword, eval_cmd_count + args_count);
-
-	    	/* Now append the script itself, and the number of arguments to treat as keys */
-	    	cmd_len = redis_cmd_append_str(ret, cmd_len, value, val_len);
-	    	cmd_len = redis_cmd_append_int(ret, cmd_len, keys_count);
-
-			/* Iterate the values in our "keys" array */
-			for(zend_hash_internal_pointer_reset_ex(args_hash, &hash_pos);
-				zend_hash_get_current_data_ex(args_hash, (void **)&elem, &hash_pos) == SUCCESS;
-				zend_hash_move_forward_ex(args_hash, &hash_pos))
-			{
-				zval *z_tmp = NULL;
-				char *key, *old_cmd;
-				int key_len, key_free;
-
-				if(Z_TYPE_PP(elem) == IS_STRING) {
-					key = Z_STRVAL_PP(elem);
-					key_len = Z_STRLEN_PP(elem);
-				} else {
-					/* Convert it to a string */
-					MAKE_STD_ZVAL(z_tmp);
-					*z_tmp = **elem;
-					zval_copy_ctor(z_tmp);
-					convert_to_string(z_tmp);
-
-					key = Z_STRVAL_P(z_tmp);
-					key_len = Z_STRLEN_P(z_tmp);
-				}
+	/* Without arguments (none passed, or an empty array) there are no keys either */
+	if(args_count < 1) {
+		keys_count = 0;
+	}
 
-				/* Keep track of the old command pointer */
-				old_cmd = *ret;
+	/* Size the buffer for the whole command up front, so that it's built
+	 * in one pass however many arguments there are */
+	size = 64 + strlen(keyword) + val_len;
+	if(args_count > 0) {
+		for(zend_hash_internal_pointer_reset_ex(args_hash, &hash_pos);
+			zend_hash_get_current_data_ex(args_hash, (void **)&elem, &hash_pos) == SUCCESS;
+			zend_hash_move_forward_ex(args_hash, &hash_pos))
+		{
+			size += 16 + (Z_TYPE_PP(elem) == IS_STRING ? Z_STRLEN_PP(elem) : 32);
+		}
+		if(redis_sock->prefix && keys_count > 0) {
+			size += (size_t)keys_count * redis_sock->prefix_len;
+		}
+	}
+	smart_str_alloc(&cmd, size, 0);
 
-				/* If this is still a key argument, prefix it if we've been set up to prefix keys */
-				key_free = keys_count-- > 0 ? redis_key_prefix(redis_sock, &key, &key_len TSRMLS_CC) : 0;
+	/* Header for our EVAL command, the script itself, and the number of arguments to treat as keys */
+	redis_cmd_init_sstr(&cmd, 2 + args_count, keyword, strlen(keyword));
+	redis_cmd_append_sstr(&cmd, value, val_len);
+	redis_cmd_append_sstr_int(&cmd, keys_count);
 
-				/* Append this key to our EVAL command, free our old command */
-				cmd_len = redis_cmd_format(ret, "%s$%d" _NL "%s" _NL, *ret, cmd_len, key_len, key, key_len);
-				efree(old_cmd);
+	/* Iterate the values in our "keys" array */
+	if(args_count > 0) {
+		for(zend_hash_internal_pointer_reset_ex(args_hash, &hash_pos);
+			zend_hash_get_current_data_ex(args_hash, (void **)&elem, &hash_pos) == SUCCESS;
+			zend_hash_move_forward_ex(args_hash, &hash_pos))
+		{
+			zval *z_tmp = NULL;
+			char *key;
+			int key_len;
 
-				/* Free our key, old command if we need to */
-				if(key_free) efree(key);
+			if(Z_TYPE_PP(elem) == IS_STRING) {
+				key = Z_STRVAL_PP(elem);
+				key_len = Z_STRLEN_PP(elem);
+			} else {
+				/* Convert it to a string */
+				MAKE_STD_ZVAL(z_tmp);
+				*z_tmp = **elem;
+				zval_copy_ctor(z_tmp);
+				convert_to_string(z_tmp);
+
+				key = Z_STRVAL_P(z_tmp);
+				key_len = Z_STRLEN_P(z_tmp);
+			}
 
-				/* Free our temporary zval (converted from non string) if we've got one */
-				if(z_tmp) {
-					zval_dtor(z_tmp);
-					efree(z_tmp);
-				}
+			/* If this is still a key argument, prefix it if we've been set up to prefix keys */
+			if(keys_count-- > 0) {
+				redis_cmd_append_sstr_key(&cmd, key, key_len, redis_sock);
+			} else {
+				redis_cmd_append_sstr(&cmd, key, key_len);
 			}
-	    }
-	}
 
-	/* If there weren't any arguments (none passed, or an empty array), construct a standard no args command */
-	if(args_count < 1) {
-		cmd_len = redis_cmd_format_static(ret, keyword, "sd", value, val_len, 0);
+			/* Free our temporary zval (converted from non string) if we've got one */
+			if(z_tmp) {
+				zval_dtor(z_tmp);
+				efree(z_tmp);
+			}
+		}
 	}
 
-	/* Return our command length */
-	return cmd_len;
+	/* Return our command and its length */
+	smart_str_0(&cmd);
+	*ret = cmd.c;
+	return cmd.len;
 }
 
 /* {{{ proto variant Redis::evalsha(string script_sha1, [array keys, int num_key_args])
@@ -6627,38 +7287,6 @@ PHP_METHOD(Redis, script) {
 	REDIS_PROCESS_RESPONSE(redis_read_variant_reply);
 }
 
-/* {{{ proto DUMP key
- */
-PHP_METHOD(Redis, dump) {
-	zval *object;
-	RedisSock *redis_sock;
-	char *cmd, *key;
-	int cmd_len, key_len, key_free;
-
-	/* Parse our arguments */
-	if(zend_parse_method_parameters(ZEND_NUM_ARGS() TSRMLS_CC, getThis(), "Os", &object, redis_ce,
-									&key, &key_len) == FAILURE) {
-		RETURN_FALSE;
-	}
-
-	/* Grab our socket */
-	if(redis_sock_get(object, &redis_sock TSRMLS_CC, 0) < 0) {
-		RETURN_FALSE;
-	}
-
-	/* Prefix our key if we need to */
-	key_free = redis_key_prefix(redis_sock, &key, &key_len TSRMLS_CC);
-	cmd_len = redis_cmd_format_static(&cmd, "DUMP", "s", key, key_len);
-	if(key_free) efree(key);
-
-	/* Kick off our request */
-	REDIS_PROCESS_REQUEST(redis_sock, cmd, cmd_len);
-	IF_ATOMIC() {
-		redis_ping_response(INTERNAL_FUNCTION_PARAM_PASSTHRU, redis_sock, NULL, NULL);
-	}
-	REDIS_PROCESS_RESPONSE(redis_ping_response);
-}
-
 /* {{{ proto Redis::DEBUG(string key) */
 PHP_METHOD(Redis, debug) {
     zval *object;
@@ -6841,7 +7469,7 @@ PHP_METHOD(Redis, _serialize) {
  * {{{ proto Redis::_unserialize(value)
  */
 PHP_METHOD(Redis, _unserialize) {
-	zval *object;
+	zval *object, *z_ret = NULL;
 	RedisSock *redis_sock;
 	char *value;
 	int value_len;
@@ -6856,19 +7484,18 @@ PHP_METHOD(Redis, _unserialize) {
 		RETURN_FALSE;
 	}
 
-	/* We only need to attempt unserialization if we have a serializer running */
-	if(redis_sock->serializer != REDIS_SERIALIZER_NONE) {
-		zval *z_ret = NULL;
-		if(redis_unserialize(redis_sock, value, value_len, &z_ret TSRMLS_CC) == 0) {
-			/* Badly formed input, throw an execption */
-			zend_throw_exception(redis_exception_ce, "Invalid serialized data, or unserialization error", 0 TSRMLS_CC);
-			RETURN_FALSE;
-		}
+	/* Compressed values come back whatever the serializer, anything else
+	 * only needs to be unserialized if we have a serializer running */
+	if(redis_unserialize(redis_sock, value, value_len, &z_ret TSRMLS_CC) == 1) {
 		RETURN_ZVAL(z_ret, 0, 1);
-	} else {
-		/* Just return the value that was passed to us */
-		RETURN_STRINGL(value, value_len, 1);
 	}
+	if(redis_sock->serializer != REDIS_SERIALIZER_NONE) {
+		/* Badly formed input, throw an execption */
+		zend_throw_exception(redis_exception_ce, "Invalid serialized data, or unserialization error", 0 TSRMLS_CC);
+		RETURN_FALSE;
+	}
+	/* Just return the value that was passed to us */
+	RETURN_STRINGL(value, value_len, 1);
 }
 
 /*
@@ -7356,6 +7983,7 @@ PHP_METHOD(Redis, pfadd) {
     if(key_free) efree(key);
 
     // Iterate over members we're adding
+    redis_serialize_batch_begin(redis_sock TSRMLS_CC);
     for(zend_hash_internal_pointer_reset_ex(ht_mems, &pos);
         zend_hash_get_current_data_ex(ht_mems, (void**)&z_mem, &pos)==SUCCESS;
         zend_hash_move_forward_ex(ht_mems, &pos))
@@ -7394,6 +8022,7 @@ PHP_METHOD(Redis, pfadd) {
             efree(mem);
         }
     }
+    redis_serialize_batch_end(redis_sock TSRMLS_CC);
 
     REDIS_PROCESS_REQUEST(redis_sock, cmd.c, cmd.len);
     IF_ATOMIC() {
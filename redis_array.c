@@ -108,9 +108,9 @@ static void redis_array_free(RedisArray *ra) {
         efree(ra->z_dist);
     }
 
-    /* Delete pur commands */
-    zval_dtor(ra->z_pure_cmds);
-    efree(ra->z_pure_cmds);
+    /* Resolved methods */
+    zend_hash_destroy(ra->methods);
+    FREE_HASHTABLE(ra->methods);
 
     /* Free structure itself */
     efree(ra);
@@ -333,7 +333,7 @@ ra_forward_call(INTERNAL_FUNCTION_PARAMETERS, RedisArray *ra, const char *cmd, i
 	int key_len;
 	int i;
 	zval *redis_inst;
-	zval z_fun, **z_callargs;
+	zval **z_callargs;
 	HashPosition pointer;
 	HashTable *h_args;
 
@@ -347,13 +347,17 @@ ra_forward_call(INTERNAL_FUNCTION_PARAMETERS, RedisArray *ra, const char *cmd, i
 		redis_inst = ra->z_multi_exec; /* we already have the instance */
 	} else {
 		/* extract key and hash it. */
-		if(!(key = ra_find_key(ra, z_args, cmd, &key_len))) {
+		if((key = ra_find_key(ra, z_args, cmd, &key_len))) {
+			redis_inst = ra_find_node(ra, key, key_len, NULL TSRMLS_CC);
+		} else if(ra_is_nokey_cmd(cmd, cmd_len)) {
+			/* nothing to hash (echo, config, script...): the first node answers */
+			redis_inst = ra->redis[0];
+		} else {
 			php_error_docref(NULL TSRMLS_CC, E_ERROR, "Could not find key");
 			RETURN_FALSE;
 		}
 
 		/* find node */
-		redis_inst = ra_find_node(ra, key, key_len, NULL TSRMLS_CC);
 		if(!redis_inst) {
 			php_error_docref(NULL TSRMLS_CC, E_ERROR, "Could not find any redis servers for this key.");
 			RETURN_FALSE;
@@ -361,14 +365,13 @@ ra_forward_call(INTERNAL_FUNCTION_PARAMETERS, RedisArray *ra, const char *cmd, i
 	}
 
 	/* check if write cmd */
-	b_write_cmd = ra_is_write_cmd(ra, cmd, cmd_len);
+	b_write_cmd = ra_is_write_cmd(cmd, cmd_len);
 
-	if(ra->index && b_write_cmd && !ra->z_multi_exec) { /* add MULTI + SADD */
+	if(ra->index && b_write_cmd && key && !ra->z_multi_exec) { /* add MULTI + SADD */
 		ra_index_multi(redis_inst, MULTI TSRMLS_CC);
 	}
 
 	/* pass call through */
-	ZVAL_STRING(&z_fun, cmd, 0);	/* method name */
 	z_callargs = emalloc(argc * sizeof(zval*));
 
 	/* copy args to array */
@@ -382,15 +385,15 @@ ra_forward_call(INTERNAL_FUNCTION_PARAMETERS, RedisArray *ra, const char *cmd, i
 
 	/* multi/exec */
 	if(ra->z_multi_exec) {
-		call_user_function(&redis_ce->function_table, &ra->z_multi_exec, &z_fun, return_value, argc, z_callargs TSRMLS_CC);
+		ra_call_method(ra, ra->z_multi_exec, cmd, cmd_len, return_value, argc, z_callargs TSRMLS_CC);
 		efree(z_callargs);
 		RETURN_ZVAL(getThis(), 1, 0);
 	}
 
 	/* CALL! */
-	if(ra->index && b_write_cmd) {
+	if(ra->index && b_write_cmd && key) {
 		/* call using discarded temp value and extract exec results after. */
-		call_user_function(&redis_ce->function_table, &redis_inst, &z_fun, &z_tmp, argc, z_callargs TSRMLS_CC);
+		ra_call_method(ra, redis_inst, cmd, cmd_len, &z_tmp, argc, z_callargs TSRMLS_CC);
 		zval_dtor(&z_tmp);
 
 		/* add keys to index. */
@@ -399,7 +402,7 @@ ra_forward_call(INTERNAL_FUNCTION_PARAMETERS, RedisArray *ra, const char *cmd, i
 		/* call EXEC */
 		ra_index_exec(redis_inst, return_value, 0 TSRMLS_CC);
 	} else { /* call directly through. */
-		call_user_function(&redis_ce->function_table, &redis_inst, &z_fun, return_value, argc, z_callargs TSRMLS_CC);
+		ra_call_method(ra, redis_inst, cmd, cmd_len, return_value, argc, z_callargs TSRMLS_CC);
 
 		/* check if we have an error. */
 		if(RA_CALL_FAILED(return_value,cmd) && ra->prev && !b_write_cmd) { /* there was an error reading, try with prev ring. */
@@ -408,7 +411,7 @@ ra_forward_call(INTERNAL_FUNCTION_PARAMETERS, RedisArray *ra, const char *cmd, i
 		}
 
 		/* Autorehash if the key was found on the previous node if this is a read command and auto rehashing is on */
-		if(!RA_CALL_FAILED(return_value,cmd) && !b_write_cmd && z_new_target && ra->auto_rehash) { /* move key from old ring to new ring */
+		if(!RA_CALL_FAILED(return_value,cmd) && !b_write_cmd && key && z_new_target && ra->auto_rehash) { /* move key from old ring to new ring */
 		    ra_move_key(key, key_len, redis_inst, z_new_target TSRMLS_CC);
 		}
 	}
@@ -576,9 +579,115 @@ PHP_METHOD(RedisArray, _rehash)
 	}
 }
 
+/* How long to wait for the replies of a fan out: as long as the slowest of
+ * the nodes called would wait for its own, -1 for as long as it takes */
+static double
+ra_fan_out_timeout(HashTable *handles TSRMLS_DC)
+{
+	RedisSock *redis_sock;
+	zval **z_handle, **z_obj;
+	double timeout = 0.0, t;
+	HashPosition pos;
+
+	for(zend_hash_internal_pointer_reset_ex(handles, &pos);
+	    zend_hash_get_current_data_ex(handles, (void**)&z_handle, &pos) == SUCCESS;
+	    zend_hash_move_forward_ex(handles, &pos))
+	{
+		if(zend_hash_index_find(Z_ARRVAL_PP(z_handle), 0, (void**)&z_obj) == FAILURE ||
+		   redis_sock_get(*z_obj, &redis_sock TSRMLS_CC, 1) < 0) {
+			continue;
+		}
+		/* the stream falls back on default_socket_timeout without one */
+		t = redis_sock->read_timeout > 0 ? redis_sock->read_timeout :
+			(double)INI_INT("default_socket_timeout");
+		if(t < 0) {
+			return -1.0;
+		}
+		if(t > timeout) {
+			timeout = t;
+		}
+	}
+	return timeout;
+}
+
+/* Run cmd on several nodes at once: it is written to every node before any
+ * reply is read, and the replies are then taken in the order they come in.
+ * Node n gets z_args[n] as its only argument and is skipped if that is NULL;
+ * with no z_args at all every node is called without arguments.  z_rets[n]
+ * receives the reply of node n, or NULL if it wasn't called. */
+static void
+ra_fan_out(RedisArray *ra, char *cmd, int cmd_len, zval **z_args, zval **z_rets TSRMLS_DC)
+{
+	zval z_fun, z_handles, z_replies, *z_handle, **z_reply, **z_sent, **z_id;
+	int n, argc = z_args ? 1 : 0;
+	long reply_iterator;
+	RedisSock *redis_sock;
+
+	ZVAL_STRINGL(&z_fun, cmd, cmd_len, 0);
+	array_init(&z_handles);
+
+	/* send */
+	for(n = 0; n < ra->count; ++n) {
+		z_rets[n] = NULL;
+		if(z_args && !z_args[n]) continue;
+
+		MAKE_STD_ZVAL(z_handle);
+		if(redis_send_async(ra->redis[n], cmd, cmd_len, argc, z_args ? &z_args[n] : NULL,
+					z_handle TSRMLS_CC) == 0) {
+			add_index_zval(&z_handles, n, z_handle);
+			continue;
+		}
+		efree(z_handle);
+
+		/* not connected yet: call it the usual way, that will connect */
+		MAKE_STD_ZVAL(z_rets[n]);
+		reply_iterator = ra_reply_iterator_off(ra->redis[n] TSRMLS_CC);
+		call_user_function(&redis_ce->function_table, &ra->redis[n],
+				&z_fun, z_rets[n], argc, z_args ? &z_args[n] : NULL TSRMLS_CC);
+		ra_reply_iterator_restore(ra->redis[n], reply_iterator TSRMLS_CC);
+	}
+
+	/* collect */
+	redis_await(Z_ARRVAL(z_handles), ra_fan_out_timeout(Z_ARRVAL(z_handles) TSRMLS_CC),
+			&z_replies TSRMLS_CC);
+	for(n = 0; n < ra->count; ++n) {
+		if(!zend_hash_index_exists(Z_ARRVAL(z_handles), n)) continue;
+
+		if(zend_hash_index_find(Z_ARRVAL(z_replies), n, (void**)&z_reply) == SUCCESS) {
+			z_rets[n] = *z_reply;
+			Z_ADDREF_P(z_rets[n]);
+		} else { /* timed out: the reply would be left on the connection */
+			if(zend_hash_index_find(Z_ARRVAL(z_handles), n, (void**)&z_sent) == SUCCESS &&
+			   zend_hash_index_find(Z_ARRVAL_PP(z_sent), 1, (void**)&z_id) == SUCCESS &&
+			   redis_sock_get(ra->redis[n], &redis_sock TSRMLS_CC, 1) == 0) {
+				redis_sock_async_abandon(redis_sock, Z_LVAL_PP(z_id) TSRMLS_CC);
+			}
+			MAKE_STD_ZVAL(z_rets[n]);
+			ZVAL_BOOL(z_rets[n], 0);
+		}
+	}
+
+	zval_dtor(&z_replies);
+	zval_dtor(&z_handles);
+}
+
+/* Release the per-node arguments and replies of ra_fan_out */
+static void
+ra_fan_out_free(RedisArray *ra, zval **z_args, zval **z_rets)
+{
+	int n;
+
+	for(n = 0; n < ra->count; ++n) {
+		if(z_args && z_args[n]) zval_ptr_dtor(&z_args[n]);
+		if(z_rets[n]) zval_ptr_dtor(&z_rets[n]);
+	}
+	if(z_args) efree(z_args);
+	efree(z_rets);
+}
+
 static void multihost_distribute(INTERNAL_FUNCTION_PARAMETERS, const char *method_name)
 {
-	zval *object, z_fun, *z_tmp;
+	zval *object, **z_rets;
 	int i;
 	RedisArray *ra;
 
@@ -591,20 +700,15 @@ static void multihost_distribute(INTERNAL_FUNCTION_PARAMETERS, const char *metho
 		RETURN_FALSE;
 	}
 
-	/* prepare call */
-	ZVAL_STRING(&z_fun, method_name, 0);
+	/* Call all the nodes at once */
+	z_rets = emalloc(ra->count * sizeof(zval*));
+	ra_fan_out(ra, (char*)method_name, strlen(method_name), NULL, z_rets TSRMLS_CC);
 
 	array_init(return_value);
 	for(i = 0; i < ra->count; ++i) {
-
-		MAKE_STD_ZVAL(z_tmp);
-
-		/* Call each node in turn */
-		call_user_function(&redis_ce->function_table, &ra->redis[i],
-				&z_fun, z_tmp, 0, NULL TSRMLS_CC);
-
-		add_assoc_zval(return_value, ra->hosts[i], z_tmp);
+		add_assoc_zval(return_value, ra->hosts[i], z_rets[i]);
 	}
+	efree(z_rets);
 }
 
 PHP_METHOD(RedisArray, info)
@@ -640,7 +744,7 @@ PHP_METHOD(RedisArray, bgsave)
 
 PHP_METHOD(RedisArray, keys)
 {
-	zval *object, *z_args[1], *z_tmp, z_fun;
+	zval *object, *z_pattern, **z_args, **z_rets;
 	RedisArray *ra;
 	char *pattern;
 	int pattern_len, i;
@@ -657,30 +761,29 @@ PHP_METHOD(RedisArray, keys)
 		RETURN_FALSE;
 	}
 
-	/* Set up our function call (KEYS) */
-	ZVAL_STRING(&z_fun, "KEYS", 0);
-
-	/* We will be passing with one string argument (the pattern) */
-	MAKE_STD_ZVAL(z_args[0]);
-	ZVAL_STRINGL(z_args[0], pattern, pattern_len, 0);
-
-	/* Init our array return */
-	array_init(return_value);
+	/* Every node gets the same pattern */
+	MAKE_STD_ZVAL(z_pattern);
+	ZVAL_STRINGL(z_pattern, pattern, pattern_len, 1);
 
-	/* Iterate our RedisArray nodes */
+	z_args = emalloc(ra->count * sizeof(zval*));
+	z_rets = emalloc(ra->count * sizeof(zval*));
 	for(i=0; i<ra->count; ++i) {
-		/* Return for this node */
-		MAKE_STD_ZVAL(z_tmp);
+		z_args[i] = z_pattern;
+		Z_ADDREF_P(z_pattern);
+	}
+	zval_ptr_dtor(&z_pattern);
 
-		/* Call KEYS on each node */
-		call_user_function(&redis_ce->function_table, &ra->redis[i], &z_fun, z_tmp, 1, z_args TSRMLS_CC);
+	/* Call KEYS on all the nodes at once */
+	ra_fan_out(ra, "KEYS", sizeof("KEYS")-1, z_args, z_rets TSRMLS_CC);
 
-		/* Add the result for this host */
-		add_assoc_zval(return_value, ra->hosts[i], z_tmp);
+	/* Init our array return, with the result for each host */
+	array_init(return_value);
+	for(i=0; i<ra->count; ++i) {
+		add_assoc_zval(return_value, ra->hosts[i], z_rets[i]);
+		z_rets[i] = NULL;
 	}
 
-	/* Free arg array */
-	efree(z_args[0]);
+	ra_fan_out_free(ra, z_args, z_rets);
 }
 
 PHP_METHOD(RedisArray, getOption)
@@ -837,7 +940,7 @@ PHP_METHOD(RedisArray, select)
 /* MGET will distribute the call to several nodes and regroup the values. */
 PHP_METHOD(RedisArray, mget)
 {
-	zval *object, *z_keys, z_fun, *z_argarray, **data, *z_ret, **z_cur, *z_tmp_array, *z_tmp;
+	zval *object, *z_keys, **z_argarrays, **z_rets, **data, **z_cur, *z_tmp_array, *z_tmp;
 	int i, j, n;
 	RedisArray *ra;
 	int *pos, argc, *argc_each;
@@ -857,9 +960,6 @@ PHP_METHOD(RedisArray, mget)
 		RETURN_FALSE;
 	}
 
-	/* prepare call */
-	ZVAL_STRING(&z_fun, "MGET", 0);
-
 	/* init data structures */
 	h_keys = Z_ARRVAL_P(z_keys);
 	argc = zend_hash_num_elements(h_keys);
@@ -907,19 +1007,16 @@ PHP_METHOD(RedisArray, mget)
 		argv[i] = *data;
 	}
 
-	/* prepare return value */
-	array_init(return_value);
-	MAKE_STD_ZVAL(z_tmp_array);
-	array_init(z_tmp_array);
-
-	/* calls */
-	for(n = 0; n < ra->count; ++n) { /* for each node */
-	    /* We don't even need to make a call to this node if no keys go there */
-	    if(!argc_each[n]) continue;
+	/* copy args for the MGET call on each node, we don't even need to
+	 * make a call to a node if no keys go there */
+	z_argarrays = emalloc(ra->count * sizeof(zval*));
+	z_rets = emalloc(ra->count * sizeof(zval*));
+	for(n = 0; n < ra->count; ++n) {
+		z_argarrays[n] = NULL;
+		if(!argc_each[n]) continue;
 
-	    /* copy args for MGET call on node. */
-		MAKE_STD_ZVAL(z_argarray);
-		array_init(z_argarray);
+		MAKE_STD_ZVAL(z_argarrays[n]);
+		array_init(z_argarrays[n]);
 
 		for(i = 0; i < argc; ++i) {
 			if(pos[i] != n) continue;
@@ -928,35 +1025,38 @@ PHP_METHOD(RedisArray, mget)
 			*z_tmp = *argv[i];
 			zval_copy_ctor(z_tmp);
 			INIT_PZVAL(z_tmp);
-			add_next_index_zval(z_argarray, z_tmp);
+			add_next_index_zval(z_argarrays[n], z_tmp);
 		}
+	}
 
-		/* call MGET on the node */
-		MAKE_STD_ZVAL(z_ret);
-		call_user_function(&redis_ce->function_table, &ra->redis[n],
-				&z_fun, z_ret, 1, &z_argarray TSRMLS_CC);
+	/* call MGET on all the nodes at once */
+	ra_fan_out(ra, "MGET", sizeof("MGET")-1, z_argarrays, z_rets TSRMLS_CC);
+
+	/* regroup the values by key position */
+	MAKE_STD_ZVAL(z_tmp_array);
+	array_init(z_tmp_array);
 
-		/* cleanup args array */
-		zval_ptr_dtor(&z_argarray);
+	for(n = 0; n < ra->count; ++n) {
+		if(!z_rets[n]) continue;
+
+		/* Error out if we didn't get a proper response */
+		if(Z_TYPE_P(z_rets[n]) != IS_ARRAY) {
+			/* cleanup */
+			ra_fan_out_free(ra, z_argarrays, z_rets);
+			zval_ptr_dtor(&z_tmp_array);
+			efree(argv);
+			efree(pos);
+			efree(redis_instances);
+			efree(argc_each);
+
+			/* failure */
+			RETURN_FALSE;
+		}
 
 		for(i = 0, j = 0; i < argc; ++i) {
-		    /* Error out if we didn't get a proper response */
-		    if(Z_TYPE_P(z_ret) != IS_ARRAY) {
-		        /* cleanup */
-		        zval_dtor(z_ret);
-		        efree(z_ret);
-		        zval_ptr_dtor(&z_tmp_array);
-		        efree(pos);
-		        efree(redis_instances);
-		        efree(argc_each);
-
-		        /* failure */
-		        RETURN_FALSE;
-		    }
-
-		    if(pos[i] != n) continue;
-
-			zend_hash_quick_find(Z_ARRVAL_P(z_ret), NULL, 0, j, (void**)&z_cur);
+			if(pos[i] != n) continue;
+
+			zend_hash_quick_find(Z_ARRVAL_P(z_rets[n]), NULL, 0, j, (void**)&z_cur);
 			j++;
 
 			MAKE_STD_ZVAL(z_tmp);
@@ -965,9 +1065,11 @@ PHP_METHOD(RedisArray, mget)
 			INIT_PZVAL(z_tmp);
 			add_index_zval(z_tmp_array, i, z_tmp);
 		}
-		zval_dtor(z_ret);
-		efree(z_ret);
 	}
+	ra_fan_out_free(ra, z_argarrays, z_rets);
+
+	/* prepare return value */
+	array_init(return_value);
 
 	/* copy temp array in the right order to return_value */
 	for(i = 0; i < argc; ++i) {
@@ -992,7 +1094,7 @@ PHP_METHOD(RedisArray, mget)
 /* MSET will distribute the call to several nodes and regroup the values. */
 PHP_METHOD(RedisArray, mset)
 {
-	zval *object, *z_keys, z_fun, *z_argarray, **data, z_ret;
+	zval *object, *z_keys, z_fun, **z_argarrays, **z_rets, **data, z_ret;
 	int i, n;
 	RedisArray *ra;
 	int *pos, argc, *argc_each;
@@ -1061,17 +1163,15 @@ PHP_METHOD(RedisArray, mset)
 	}
 
 
-	/* calls */
-	for(n = 0; n < ra->count; ++n) { /* for each node */
-		int found = 0;
+	/* copy args for each node, we don't run empty MSETs */
+	z_argarrays = emalloc(ra->count * sizeof(zval*));
+	z_rets = emalloc(ra->count * sizeof(zval*));
+	for(n = 0; n < ra->count; ++n) {
+		z_argarrays[n] = z_rets[n] = NULL;
+		if(!argc_each[n]) continue;
 
-		/* prepare call */
-		ZVAL_STRING(&z_fun, "MSET", 0);
-		redis_inst = ra->redis[n];
-
-		/* copy args */
-		MAKE_STD_ZVAL(z_argarray);
-		array_init(z_argarray);
+		MAKE_STD_ZVAL(z_argarrays[n]);
+		array_init(z_argarrays[n]);
 		for(i = 0; i < argc; ++i) {
 			zval *z_tmp;
 
@@ -1082,34 +1182,32 @@ PHP_METHOD(RedisArray, mset)
 			zval_copy_ctor(z_tmp);
 			INIT_PZVAL(z_tmp);
 
-			add_assoc_zval_ex(z_argarray, keys[i], key_lens[i] + 1, z_tmp); /* +1 to count the \0 here */
-			found++;
+			add_assoc_zval_ex(z_argarrays[n], keys[i], key_lens[i] + 1, z_tmp); /* +1 to count the \0 here */
 		}
+	}
 
-		if(!found)
-		{
-			zval_dtor(z_argarray);
-			efree(z_argarray);
-			continue;				/* don't run empty MSETs */
-		}
+	if(ra->index) {
+		/* the node index is kept in a MULTI block on each node, in turn */
+		ZVAL_STRING(&z_fun, "MSET", 0);
+		for(n = 0; n < ra->count; ++n) {
+			if(!z_argarrays[n]) continue;
+			redis_inst = ra->redis[n];
 
-		if(ra->index) { /* add MULTI */
 			ra_index_multi(redis_inst, MULTI TSRMLS_CC);
-		}
 
-		/* call */
-		call_user_function(&redis_ce->function_table, &ra->redis[n],
-				&z_fun, &z_ret, 1, &z_argarray TSRMLS_CC);
+			call_user_function(&redis_ce->function_table, &redis_inst,
+					&z_fun, &z_ret, 1, &z_argarrays[n] TSRMLS_CC);
 
-		if(ra->index) {
-			ra_index_keys(z_argarray, redis_inst TSRMLS_CC); /* use SADD to add keys to node index */
+			ra_index_keys(z_argarrays[n], redis_inst TSRMLS_CC); /* use SADD to add keys to node index */
 			ra_index_exec(redis_inst, NULL, 0 TSRMLS_CC); /* run EXEC */
-		}
-
-		zval_dtor(&z_ret);
 
-		zval_ptr_dtor(&z_argarray);
+			zval_dtor(&z_ret);
+		}
+	} else {
+		/* call MSET on all the nodes at once */
+		ra_fan_out(ra, "MSET", sizeof("MSET")-1, z_argarrays, z_rets TSRMLS_CC);
 	}
+	ra_fan_out_free(ra, z_argarrays, z_rets);
 
 	/* Free any keys that we needed to allocate memory for, because they weren't strings */
 	for(i=0; i<free_idx; i++) {
@@ -1131,7 +1229,7 @@ PHP_METHOD(RedisArray, mset)
 /* DEL will distribute the call to several nodes and regroup the values. */
 PHP_METHOD(RedisArray, del)
 {
-	zval *object, *z_keys, z_fun, *z_argarray, **data, *z_ret, *z_tmp, **z_args;
+	zval *object, *z_keys, z_fun, **z_argarrays, **z_rets, **data, z_ret, *z_tmp, **z_args;
 	int i, n;
 	RedisArray *ra;
 	int *pos, argc, *argc_each;
@@ -1206,15 +1304,15 @@ PHP_METHOD(RedisArray, del)
 		argv[i] = *data;
 	}
 
-	/* calls */
-	for(n = 0; n < ra->count; ++n) { /* for each node */
-
-		int found = 0;
-		redis_inst = ra->redis[n];
+	/* copy args for each node, we don't run empty DELs */
+	z_argarrays = emalloc(ra->count * sizeof(zval*));
+	z_rets = emalloc(ra->count * sizeof(zval*));
+	for(n = 0; n < ra->count; ++n) {
+		z_argarrays[n] = z_rets[n] = NULL;
+		if(!argc_each[n]) continue;
 
-		/* copy args */
-		MAKE_STD_ZVAL(z_argarray);
-		array_init(z_argarray);
+		MAKE_STD_ZVAL(z_argarrays[n]);
+		array_init(z_argarrays[n]);
 		for(i = 0; i < argc; ++i) {
 			if(pos[i] != n) continue;
 
@@ -1223,39 +1321,40 @@ PHP_METHOD(RedisArray, del)
 			zval_copy_ctor(z_tmp);
 			INIT_PZVAL(z_tmp);
 
-			add_next_index_zval(z_argarray, z_tmp);
-			found++;
+			add_next_index_zval(z_argarrays[n], z_tmp);
 		}
+	}
 
-		if(!found) {	/* don't run empty DELs */
-			zval_dtor(z_argarray);
-			efree(z_argarray);
-			continue;
-		}
+	if(ra->index) {
+		/* the node index is kept in a MULTI block on each node, in turn */
+		for(n = 0; n < ra->count; ++n) {
+			if(!z_argarrays[n]) continue;
+			redis_inst = ra->redis[n];
 
-		if(ra->index) { /* add MULTI */
 			ra_index_multi(redis_inst, MULTI TSRMLS_CC);
-		}
 
-		/* call */
-		MAKE_STD_ZVAL(z_ret);
-		call_user_function(&redis_ce->function_table, &redis_inst,
-				&z_fun, z_ret, 1, &z_argarray TSRMLS_CC);
+			call_user_function(&redis_ce->function_table, &redis_inst,
+					&z_fun, &z_ret, 1, &z_argarrays[n] TSRMLS_CC);
+			zval_dtor(&z_ret);
 
-		if(ra->index) {
-			ra_index_del(z_argarray, redis_inst TSRMLS_CC); /* use SREM to remove keys from node index */
-			ra_index_exec(redis_inst, z_tmp, 0 TSRMLS_CC); /* run EXEC */
-			total += Z_LVAL_P(z_tmp);	/* increment total from multi/exec block */
-		} else {
-			total += Z_LVAL_P(z_ret);	/* increment total from single command */
+			ZVAL_LONG(&z_ret, 0);
+			ra_index_del(z_argarrays[n], redis_inst TSRMLS_CC); /* use SREM to remove keys from node index */
+			ra_index_exec(redis_inst, &z_ret, 0 TSRMLS_CC); /* run EXEC */
+			if(Z_TYPE(z_ret) == IS_LONG) {
+				total += Z_LVAL(z_ret);	/* increment total from multi/exec block */
+			}
+			zval_dtor(&z_ret);
+		}
+	} else {
+		/* call DEL on all the nodes at once */
+		ra_fan_out(ra, "DEL", sizeof("DEL")-1, z_argarrays, z_rets TSRMLS_CC);
+		for(n = 0; n < ra->count; ++n) {
+			if(z_rets[n] && Z_TYPE_P(z_rets[n]) == IS_LONG) {
+				total += Z_LVAL_P(z_rets[n]);	/* increment total from single command */
+			}
 		}
-
-		zval_dtor(z_ret);
-		efree(z_ret);
-
-		zval_dtor(z_argarray);
-		efree(z_argarray);
 	}
+	ra_fan_out_free(ra, z_argarrays, z_rets);
 
 	/* cleanup */
 	efree(argv);
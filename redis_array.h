@@ -50,8 +50,8 @@ typedef struct RedisArray_ {
 	zend_bool pconnect;     /* should we use pconnect */
 	zval *z_fun;			/* key extractor, callable */
 	zval *z_dist;			/* key distributor, callable */
-	zval *z_pure_cmds;		/* hash table */
 	double connect_timeout; /* socket connect timeout */
+	HashTable *methods;		/* command name => zend_function*, Redis methods already resolved */
 
 	struct RedisArray_ *prev;
 } RedisArray;
@@ -19,6 +19,7 @@
 #include "redis_array_impl.h"
 #include "php_redis.h"
 #include "library.h"
+#include "redis_commands.h"
 
 #include "php_variables.h"
 #include "SAPI.h"
@@ -92,47 +93,6 @@ ra_load_hosts(RedisArray *ra, HashTable *hosts, long retry_interval, zend_bool b
 	return ra;
 }
 
-/* List pure functions */
-void ra_init_function_table(RedisArray *ra) {
-
-	MAKE_STD_ZVAL(ra->z_pure_cmds);
-	array_init(ra->z_pure_cmds);
-
-	add_assoc_bool(ra->z_pure_cmds, "HGET", 1);
-	add_assoc_bool(ra->z_pure_cmds, "HGETALL", 1);
-	add_assoc_bool(ra->z_pure_cmds, "HKEYS", 1);
-	add_assoc_bool(ra->z_pure_cmds, "HLEN", 1);
-	add_assoc_bool(ra->z_pure_cmds, "SRANDMEMBER", 1);
-	add_assoc_bool(ra->z_pure_cmds, "HMGET", 1);
-	add_assoc_bool(ra->z_pure_cmds, "STRLEN", 1);
-	add_assoc_bool(ra->z_pure_cmds, "SUNION", 1);
-	add_assoc_bool(ra->z_pure_cmds, "HVALS", 1);
-	add_assoc_bool(ra->z_pure_cmds, "TYPE", 1);
-	add_assoc_bool(ra->z_pure_cmds, "EXISTS", 1);
-	add_assoc_bool(ra->z_pure_cmds, "LINDEX", 1);
-	add_assoc_bool(ra->z_pure_cmds, "SCARD", 1);
-	add_assoc_bool(ra->z_pure_cmds, "LLEN", 1);
-	add_assoc_bool(ra->z_pure_cmds, "SDIFF", 1);
-	add_assoc_bool(ra->z_pure_cmds, "ZCARD", 1);
-	add_assoc_bool(ra->z_pure_cmds, "ZCOUNT", 1);
-	add_assoc_bool(ra->z_pure_cmds, "LRANGE", 1);
-	add_assoc_bool(ra->z_pure_cmds, "ZRANGE", 1);
-	add_assoc_bool(ra->z_pure_cmds, "ZRANK", 1);
-	add_assoc_bool(ra->z_pure_cmds, "GET", 1);
-	add_assoc_bool(ra->z_pure_cmds, "GETBIT", 1);
-	add_assoc_bool(ra->z_pure_cmds, "SINTER", 1);
-	add_assoc_bool(ra->z_pure_cmds, "GETRANGE", 1);
-	add_assoc_bool(ra->z_pure_cmds, "ZREVRANGE", 1);
-	add_assoc_bool(ra->z_pure_cmds, "SISMEMBER", 1);
-	add_assoc_bool(ra->z_pure_cmds, "ZREVRANGEBYSCORE", 1);
-	add_assoc_bool(ra->z_pure_cmds, "ZREVRANK", 1);
-	add_assoc_bool(ra->z_pure_cmds, "HEXISTS", 1);
-	add_assoc_bool(ra->z_pure_cmds, "ZSCORE", 1);
-	add_assoc_bool(ra->z_pure_cmds, "HGET", 1);
-	add_assoc_bool(ra->z_pure_cmds, "OBJECT", 1);
-	add_assoc_bool(ra->z_pure_cmds, "SMEMBERS", 1);
-}
-
 static int
 ra_find_name(const char *name) {
 
@@ -339,7 +299,8 @@ ra_make_array(HashTable *hosts, zval *z_fun, zval *z_dist, HashTable *hosts_prev
 	ra->connect_timeout = connect_timeout;
 
 	/* init array data structures */
-	ra_init_function_table(ra);
+	ALLOC_HASHTABLE(ra->methods);
+	zend_hash_init(ra->methods, 0, NULL, NULL, 0);
 
 	if(NULL == ra_load_hosts(ra, hosts, retry_interval, b_lazy_connect TSRMLS_CC)) {
 		return NULL;
@@ -506,13 +467,34 @@ ra_find_node_by_name(RedisArray *ra, const char *host, int host_len TSRMLS_DC) {
 char *
 ra_find_key(RedisArray *ra, zval *z_args, const char *cmd, int *key_len) {
 
-	zval **zp_tmp;
-	int key_pos = 0; /* TODO: change this depending on the command */
+	zval **zp_tmp, **zp_keys;
+	const redisCommand *info;
+	int key_pos = 0;
 
-	if(	zend_hash_num_elements(Z_ARRVAL_P(z_args)) == 0
-		|| zend_hash_quick_find(Z_ARRVAL_P(z_args), NULL, 0, key_pos, (void**)&zp_tmp) == FAILURE
-		|| Z_TYPE_PP(zp_tmp) != IS_STRING) {
+	if((info = redis_command_find(cmd, strlen(cmd)))) {
+		if(info->flags & REDIS_CMD_NOKEY) {
+			return NULL;
+		}
+		key_pos = info->key_pos;
+	}
 
+	if(zend_hash_index_find(Z_ARRVAL_P(z_args), key_pos, (void**)&zp_tmp) == FAILURE) {
+		return NULL;
+	}
+
+	/* eval(script, keys_and_args, num_keys): route on the first key */
+	if(info && (info->flags & REDIS_CMD_EVAL)) {
+		if(zend_hash_index_find(Z_ARRVAL_P(z_args), 1, (void**)&zp_keys) == FAILURE ||
+		   Z_TYPE_PP(zp_keys) != IS_ARRAY ||
+		   zend_hash_index_find(Z_ARRVAL_P(z_args), 2, (void**)&zp_tmp) == FAILURE ||
+		   Z_TYPE_PP(zp_tmp) != IS_LONG || Z_LVAL_PP(zp_tmp) < 1 ||
+		   zend_hash_index_find(Z_ARRVAL_PP(zp_keys), 0, (void**)&zp_tmp) == FAILURE)
+		{
+			return NULL;
+		}
+	}
+
+	if(Z_TYPE_PP(zp_tmp) != IS_STRING) {
 		return NULL;
 	}
 
@@ -690,20 +672,176 @@ ra_index_unwatch(zval *z_redis, zval *return_value TSRMLS_DC) {
 }
 
 zend_bool
-ra_is_write_cmd(RedisArray *ra, const char *cmd, int cmd_len) {
+ra_is_write_cmd(const char *cmd, int cmd_len) {
+
+	const redisCommand *info = redis_command_find(cmd, cmd_len);
+
+	/* anything we don't know about might write */
+	return !info || !(info->flags & REDIS_CMD_READONLY);
+}
+
+zend_bool
+ra_is_nokey_cmd(const char *cmd, int cmd_len) {
+
+	const redisCommand *info = redis_command_find(cmd, cmd_len);
+
+	return info && (info->flags & REDIS_CMD_NOKEY);
+}
+
+#if PHP_VERSION_ID >= 50300
+/* Run an internal method's handler ourselves.  The arguments go on the VM
+ * stack as zend_call_function lays them out, with their count on top, and
+ * the frame of the running RedisArray method describes the call for as long
+ * as it lasts.  Methods taking an argument by reference need the separation
+ * zend_call_function does, and a zend_execute_internal hook (a profiler)
+ * must see the call: both return FAILURE for the caller to go the long way. */
+static int
+ra_call_handler(zend_function *fptr, zval *z_redis, zval *return_value, int argc, zval **argv TSRMLS_DC) {
+
+	zend_execute_data *ex = EG(current_execute_data);
+	zend_function_state state;
+	zend_class_entry *scope, *called_scope;
+	zval *this_ptr;
+	int i;
+
+	if(!ex || fptr->type != ZEND_INTERNAL_FUNCTION || zend_execute_internal) {
+		return FAILURE;
+	}
+	for(i = 0; i < argc; ++i) {
+		if(ARG_SHOULD_BE_SENT_BY_REF(fptr, i + 1)) {
+			return FAILURE;
+		}
+	}
+
+	ZEND_VM_STACK_GROW_IF_NEEDED(argc + 1);
+	for(i = 0; i < argc; ++i) {
+		Z_ADDREF_P(argv[i]);
+		zend_vm_stack_push_nocheck(argv[i] TSRMLS_CC);
+	}
+	state = ex->function_state;
+	ex->function_state.function = fptr;
+	ex->function_state.arguments = zend_vm_stack_top(TSRMLS_C);
+	zend_vm_stack_push_nocheck((void*)(zend_uintptr_t)argc TSRMLS_CC);
+
+	scope = EG(scope);
+	called_scope = EG(called_scope);
+	this_ptr = EG(This);
+	EG(scope) = fptr->common.scope;
+	EG(called_scope) = Z_OBJCE_P(z_redis);
+	EG(This) = z_redis;
+
+	ZVAL_NULL(return_value);
+	fptr->internal_function.handler(argc, return_value, NULL, z_redis, 1 TSRMLS_CC);
+
+	EG(scope) = scope;
+	EG(called_scope) = called_scope;
+	EG(This) = this_ptr;
+	ex->function_state = state;
+
+	/* pops the count and releases the arguments */
+#if PHP_VERSION_ID >= 50500
+	zend_vm_stack_clear_multiple(0 TSRMLS_CC);
+#else
+	zend_vm_stack_clear_multiple(TSRMLS_C);
+#endif
+	return SUCCESS;
+}
+#endif
 
-	zend_bool ret;
+/* Call a Redis method on one of our nodes.  The method is looked up once per
+ * command name, and its handler then run directly by ra_call_handler, which
+ * saves call_user_function's name lowering, lookup and callable checks and
+ * zend_call_function's parameter array and frame.  What it can't take goes
+ * through zend_call_function with the method we looked up. */
+void
+ra_call_method(RedisArray *ra, zval *z_redis, const char *cmd, int cmd_len, zval *return_value, int argc, zval **argv TSRMLS_DC) {
+
+	zval z_fun;
+#if PHP_VERSION_ID >= 50300
+	zend_function *fptr, **fptr_ptr;
+	zend_fcall_info fci;
+	zend_fcall_info_cache fcc;
+	zval *z_ret = NULL, ***params;
+	char *lc_cmd;
 	int i;
-	char *cmd_up = emalloc(1 + cmd_len);
-	/* convert to uppercase */
-	for(i = 0; i < cmd_len; ++i)
-		cmd_up[i] = toupper(cmd[i]);
-	cmd_up[cmd_len] = 0;
 
-	ret = zend_hash_exists(Z_ARRVAL_P(ra->z_pure_cmds), cmd_up, cmd_len+1);
+	if(zend_hash_find(ra->methods, cmd, cmd_len+1, (void**)&fptr_ptr) == SUCCESS) {
+		fptr = *fptr_ptr;
+	} else {
+		lc_cmd = zend_str_tolower_dup(cmd, cmd_len);
+		if(zend_hash_find(&redis_ce->function_table, lc_cmd, cmd_len+1, (void**)&fptr) == FAILURE) {
+			fptr = NULL;
+		}
+		efree(lc_cmd);
+		zend_hash_add(ra->methods, cmd, cmd_len+1, (void*)&fptr, sizeof(zend_function*), NULL);
+	}
+
+	if(fptr && ra_call_handler(fptr, z_redis, return_value, argc, argv TSRMLS_CC) == SUCCESS) {
+		return;
+	}
+	if(fptr) {
+		params = emalloc((argc ? argc : 1) * sizeof(zval**));
+		for(i = 0; i < argc; ++i) {
+			params[i] = &argv[i];
+		}
+
+		ZVAL_STRINGL(&z_fun, cmd, cmd_len, 0);
+		fci.size = sizeof(fci);
+		fci.function_table = &redis_ce->function_table;
+		fci.function_name = &z_fun;
+		fci.symbol_table = NULL;
+		fci.retval_ptr_ptr = &z_ret;
+		fci.param_count = argc;
+		fci.params = params;
+		fci.object_ptr = z_redis;
+		fci.no_separation = 1;
+
+		fcc.initialized = 1;
+		fcc.function_handler = fptr;
+		fcc.calling_scope = Z_OBJCE_P(z_redis);
+		fcc.called_scope = Z_OBJCE_P(z_redis);
+		fcc.object_ptr = z_redis;
+
+		if(zend_call_function(&fci, &fcc TSRMLS_CC) == SUCCESS && z_ret) {
+			COPY_PZVAL_TO_ZVAL(*return_value, z_ret);
+		} else {
+			ZVAL_NULL(return_value);
+		}
+		efree(params);
+		return;
+	}
+#endif
+
+	/* not a Redis method: let call_user_function deal with it */
+	ZVAL_STRINGL(&z_fun, cmd, cmd_len, 0);
+	call_user_function(&redis_ce->function_table, &z_redis, &z_fun, return_value, argc, argv TSRMLS_CC);
+}
+
+/* The calls we make for ourselves want whole replies, not the iterators a
+ * node with OPT_REPLY_ITERATOR would return.  Returns the node's setting,
+ * to put back with ra_reply_iterator_restore. */
+long
+ra_reply_iterator_off(zval *z_redis TSRMLS_DC) {
 
-	efree(cmd_up);
-	return !ret;
+	RedisSock *redis_sock;
+	long reply_iterator;
+
+	if(redis_sock_get(z_redis, &redis_sock TSRMLS_CC, 1) < 0) {
+		return 0;
+	}
+	reply_iterator = redis_sock->reply_iterator;
+	redis_sock->reply_iterator = 0;
+	return reply_iterator;
+}
+
+void
+ra_reply_iterator_restore(zval *z_redis, long reply_iterator TSRMLS_DC) {
+
+	RedisSock *redis_sock;
+
+	if(redis_sock_get(z_redis, &redis_sock TSRMLS_CC, 1) == 0) {
+		redis_sock->reply_iterator = reply_iterator;
+	}
 }
 
 /* list keys from array index */
@@ -1145,8 +1283,10 @@ ra_move_list(const char *key, int key_len, zval *z_from, zval *z_to, long ttl TS
 void
 ra_move_key(const char *key, int key_len, zval *z_from, zval *z_to TSRMLS_DC) {
 
-	long res[2], type, ttl;
+	long res[2], type, ttl, reply_iterator;
 	zend_bool success = 0;
+
+	reply_iterator = ra_reply_iterator_off(z_from TSRMLS_CC);
 	if (ra_get_key_type(z_from, key, key_len, z_from, res TSRMLS_CC)) {
 		type = res[0];
 		ttl = res[1];
@@ -1186,6 +1326,7 @@ ra_move_key(const char *key, int key_len, zval *z_from, zval *z_to TSRMLS_DC) {
 
 	/* close transaction */
 	ra_index_exec(z_to, NULL, 0 TSRMLS_CC);
+	ra_reply_iterator_restore(z_from, reply_iterator TSRMLS_CC);
 }
 
 /* callback with the current progress, with hostname and count */
@@ -1223,16 +1364,18 @@ ra_rehash_server(RedisArray *ra, zval *z_redis, const char *hostname, zend_bool
 
 	char **keys;
 	int *key_lens;
-	long count, i;
+	long count, i, reply_iterator;
 	int target_pos;
 	zval *z_target;
 
 	/* list all keys */
+	reply_iterator = ra_reply_iterator_off(z_redis TSRMLS_CC);
 	if(b_index) {
 		count = ra_rehash_scan_index(z_redis, &keys, &key_lens TSRMLS_CC);
 	} else {
 		count = ra_rehash_scan_keys(z_redis, &keys, &key_lens TSRMLS_CC);
 	}
+	ra_reply_iterator_restore(z_redis, reply_iterator TSRMLS_CC);
 
 	/* callback */
 	if(z_cb && z_cb_cache) {
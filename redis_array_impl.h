@@ -14,7 +14,6 @@ RedisArray *ra_load_array(const char *name TSRMLS_DC);
 RedisArray *ra_make_array(HashTable *hosts, zval *z_fun, zval *z_dist, HashTable *hosts_prev, zend_bool b_index, zend_bool b_pconnect, long retry_interval, zend_bool b_lazy_connect, double connect_timeout TSRMLS_DC);
 zval *ra_find_node_by_name(RedisArray *ra, const char *host, int host_len TSRMLS_DC);
 zval *ra_find_node(RedisArray *ra, const char *key, int key_len, int *out_pos TSRMLS_DC);
-void ra_init_function_table(RedisArray *ra);
 
 void ra_move_key(const char *key, int key_len, zval *z_from, zval *z_to TSRMLS_DC);
 char * ra_find_key(RedisArray *ra, zval *z_args, const char *cmd, int *key_len);
@@ -26,7 +25,11 @@ void ra_index_del(zval *z_keys, zval *z_redis TSRMLS_DC);
 void ra_index_exec(zval *z_redis, zval *return_value, int keep_all TSRMLS_DC);
 void ra_index_discard(zval *z_redis, zval *return_value TSRMLS_DC);
 void ra_index_unwatch(zval *z_redis, zval *return_value TSRMLS_DC);
-zend_bool ra_is_write_cmd(RedisArray *ra, const char *cmd, int cmd_len);
+zend_bool ra_is_write_cmd(const char *cmd, int cmd_len);
+zend_bool ra_is_nokey_cmd(const char *cmd, int cmd_len);
+long ra_reply_iterator_off(zval *z_redis TSRMLS_DC);
+void ra_reply_iterator_restore(zval *z_redis, long reply_iterator TSRMLS_DC);
+void ra_call_method(RedisArray *ra, zval *z_redis, const char *cmd, int cmd_len, zval *return_value, int argc, zval **argv TSRMLS_DC);
 
 void ra_rehash(RedisArray *ra, zend_fcall_info *z_cb, zend_fcall_info_cache *z_cb_cache TSRMLS_DC);
 
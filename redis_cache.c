@@ -0,0 +1,946 @@
+/* -*- Mode: C; tab-width: 4 -*- */
+/*
+  +----------------------------------------------------------------------+
+  | PHP Version 5                                                        |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 1997-2009 The PHP Group                                |
+  +----------------------------------------------------------------------+
+  | This source file is subject to version 3.01 of the PHP license,      |
+  | that is bundled with this package in the file LICENSE, and is        |
+  | available through the world-wide-web at the following url:           |
+  | http://www.php.net/license/3_01.txt                                  |
+  | If you did not receive a copy of the PHP license and are unable to   |
+  | obtain it through the world-wide-web, please send a note to          |
+  | license@php.net so we can mail you a copy immediately.               |
+  +----------------------------------------------------------------------+
+*/
+
+/*
+ * Client side cache for OPT_CLIENT_CACHE.  GET and HGETALL replies of the
+ * keys under some prefixes are kept in the worker's persistent memory, and
+ * served from there across requests until the server says the key changed.
+ *
+ * Each cache (a server and a set of prefixes) has a side connection that
+ * only listens.  Where the server has it (Redis 6) the connection turns on
+ * CLIENT TRACKING in broadcast mode for the prefixes, redirected to itself,
+ * and reads __redis__:invalidate.  Elsewhere it subscribes to the keyspace
+ * notifications of the prefixes, which the server must be configured to
+ * send.  It is a plain socket rather than a stream, so it lives as long as
+ * the worker, and it is read without waiting before every lookup.  While it
+ * is down nothing is served, and what was kept is dropped: changes may have
+ * gone by unseen.
+ *
+ * Connections only share a cache when they authenticate the same way: its
+ * id has a hash of their password, and the side connection authenticates
+ * with it, so the server decides what a cache may hold.
+ *
+ * Commands sent through a connection using the cache drop the keys they
+ * name at once, so a request reads its own writes.  Other clients' writes
+ * are seen when their invalidation arrives.  Entries also expire after
+ * redis.client_cache.ttl seconds, and the oldest go when the caches of the
+ * worker reach redis.client_cache.max_memory.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <time.h>
+#include "common.h"
+#include "php_network.h"
+#ifndef PHP_WIN32
+#include <sys/un.h>
+#endif
+#include "ext/standard/sha1.h"
+#include "php_redis.h"
+#include "library.h"
+#include "redis_cache.h"
+
+/* seconds to open the side connection when the connection has no timeout */
+#define REDIS_CACHE_TIMEOUT 1.0
+
+/* bytes an entry is counted for beyond its strings */
+#define REDIS_CACHE_OVERHEAD 64
+
+/* A reply we keep.  Its strings follow it in the same block: the pointers,
+ * the lengths, then the strings themselves, each NULL terminated. */
+typedef struct _redisCacheEntry {
+    struct _redisCacheEntry *next;  /* same key, other db or command */
+    long            db;
+    int             type;
+    time_t          expires;        /* 0 for never */
+    size_t          size;           /* counted against max_memory */
+    size_t          data_len;       /* of the block after us */
+    int             count;          /* strings, 0 for a GET of no key */
+    char            **vals;
+    int             *lens;
+} redisCacheEntry;
+
+/* An element of a reply on the side connection.  Arrays come before their
+ * elements, with their count as len; nil is len -1. */
+typedef struct {
+    char            type;
+    const char      *str;
+    long            len;
+} redisCacheTok;
+
+struct _redisCache {
+    char            *spec;          /* the prefixes as they were given */
+    char            *host;
+    int             port;
+    char            *auth;          /* the password of its connections, or NULL */
+    char            **prefixes;     /* with OPT_PREFIX, none under another */
+    int             *prefix_lens;
+    int             prefix_count;
+
+    php_socket_t    fd;             /* side connection, -1 while down */
+    long            pid;            /* of the process that opened it */
+    time_t          retry_at;       /* when to try opening it again */
+    zend_bool       warned;         /* that the server can't tell us */
+    char            *buf;           /* what it received */
+    size_t          buf_pos;        /* first byte not parsed yet */
+    size_t          buf_len;
+    size_t          buf_size;
+    redisCacheTok   *toks;          /* the last reply parsed */
+    int             toks_count;
+    int             toks_size;
+
+    HashTable       entries;        /* key => redisCacheEntry*, oldest first */
+};
+
+static HashTable redis_caches;      /* id => redisCache*, for the process */
+static int redis_caches_init;
+static size_t redis_cache_max_memory;
+static size_t redis_cache_used;
+static long redis_cache_ttl;
+
+#ifdef ZTS
+static MUTEX_T redis_caches_mutex;
+#define REDIS_CACHE_LOCK()      tsrm_mutex_lock(redis_caches_mutex)
+#define REDIS_CACHE_UNLOCK()    tsrm_mutex_unlock(redis_caches_mutex)
+#else
+#define REDIS_CACHE_LOCK()
+#define REDIS_CACHE_UNLOCK()
+#endif
+
+/* commands that leave the keys they name alone */
+static const char *redis_cache_readonly[] = {
+    "GET", "MGET", "STRLEN", "HGETALL", "HGET", "HMGET", "HLEN", "HEXISTS",
+    "HKEYS", "HVALS", "EXISTS", "TYPE", "TTL", "PTTL", NULL
+};
+
+#define REDIS_CACHE_TOK_IS(t, s) \
+    ((t)->type == '$' && (t)->len == sizeof(s) - 1 && !memcmp((t)->str, s, sizeof(s) - 1))
+
+static void redis_cache_entry_free(redisCacheEntry *e) {
+    REDIS_CACHE_LOCK();
+    redis_cache_used -= e->size;
+    REDIS_CACHE_UNLOCK();
+    pefree(e, 1);
+}
+
+static void redis_cache_entries_dtor(void *data) {
+    redisCacheEntry *e = *(redisCacheEntry**)data, *next;
+
+    for(; e; e = next) {
+        next = e->next;
+        redis_cache_entry_free(e);
+    }
+}
+
+static void redis_cache_free(void *data) {
+    redisCache *c = *(redisCache**)data;
+    int i;
+
+    if(c->fd != -1) {
+        closesocket(c->fd);
+    }
+    zend_hash_destroy(&c->entries);
+    for(i = 0; i < c->prefix_count; i++) {
+        pefree(c->prefixes[i], 1);
+    }
+    pefree(c->prefixes, 1);
+    pefree(c->prefix_lens, 1);
+    if(c->buf) pefree(c->buf, 1);
+    if(c->toks) pefree(c->toks, 1);
+    pefree(c->host, 1);
+    if(c->auth) pefree(c->auth, 1);
+    pefree(c->spec, 1);
+    pefree(c, 1);
+}
+
+PHP_REDIS_API void redis_cache_startup(long max_memory, long ttl) {
+#ifdef ZTS
+    redis_caches_mutex = tsrm_mutex_alloc();
+#endif
+    zend_hash_init(&redis_caches, 8, NULL, redis_cache_free, 1);
+    redis_caches_init = 1;
+    redis_cache_max_memory = max_memory > 0 ? (size_t)max_memory : 0;
+    redis_cache_ttl = ttl > 0 ? ttl : 0;
+}
+
+PHP_REDIS_API void redis_cache_shutdown(void) {
+    if(!redis_caches_init) {
+        return;
+    }
+    zend_hash_destroy(&redis_caches);
+    redis_caches_init = 0;
+#ifdef ZTS
+    tsrm_mutex_free(redis_caches_mutex);
+#endif
+}
+
+static int redis_cache_match(redisCache *c, const char *key, int key_len) {
+    int i;
+
+    for(i = 0; i < c->prefix_count; i++) {
+        if(key_len >= c->prefix_lens[i] && !memcmp(key, c->prefixes[i], c->prefix_lens[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Drop what we have of a NULL terminated key, in one db or in all of them
+ * for db -1 */
+static void redis_cache_drop(redisCache *c, char *key, int key_len, long db) {
+    redisCacheEntry **head, **e, *dead;
+
+    if(zend_hash_find(&c->entries, key, key_len + 1, (void**)&head) == FAILURE) {
+        return;
+    }
+    for(e = head; *e; ) {
+        if(db < 0 || (*e)->db == db) {
+            dead = *e;
+            *e = dead->next;
+            redis_cache_entry_free(dead);
+        } else {
+            e = &(*e)->next;
+        }
+    }
+    if(*head == NULL) {
+        zend_hash_del(&c->entries, key, key_len + 1);
+    }
+}
+
+/* Same, for a key in a reply or a command */
+static void redis_cache_drop_key(redisCache *c, const char *key, int key_len, long db) {
+    char buf[256], *k = key_len < (int)sizeof(buf) ? buf : emalloc(key_len + 1);
+
+    memcpy(k, key, key_len);
+    k[key_len] = '\0';
+    redis_cache_drop(c, k, key_len, db);
+    if(k != buf) {
+        efree(k);
+    }
+}
+
+/* The side connection is gone, or isn't ours: what we kept may have changed
+ * without our hearing of it */
+static void redis_cache_lost(redisCache *c) {
+    if(c->fd != -1) {
+        closesocket(c->fd);
+        c->fd = -1;
+    }
+    c->buf_pos = c->buf_len = 0;
+    zend_hash_clean(&c->entries);
+}
+
+/* Receive what the side connection has, waiting up to timeout ms for it.
+ * Returns the number of bytes, 0 if nothing came, -1 if it is closed. */
+static int redis_cache_recv(redisCache *c, int timeout) {
+    php_pollfd pfd;
+    int n;
+
+    pfd.fd = c->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if(php_poll2(&pfd, 1, timeout) <= 0) {
+        return 0;
+    }
+
+    if(c->buf_pos) {
+        memmove(c->buf, c->buf + c->buf_pos, c->buf_len - c->buf_pos);
+        c->buf_len -= c->buf_pos;
+        c->buf_pos = 0;
+    }
+    while(c->buf_size - c->buf_len < 4096) {
+        c->buf_size = c->buf_size ? 2 * c->buf_size : 16384;
+        c->buf = perealloc(c->buf, c->buf_size, 1);
+    }
+
+    n = recv(c->fd, c->buf + c->buf_len, c->buf_size - c->buf_len, 0);
+    if(n <= 0) {
+        return -1;
+    }
+    c->buf_len += n;
+    return n;
+}
+
+static void redis_cache_tok(redisCache *c, char type, const char *str, long len) {
+    redisCacheTok *t;
+
+    if(c->toks_count == c->toks_size) {
+        c->toks_size = c->toks_size ? 2 * c->toks_size : 16;
+        c->toks = perealloc(c->toks, c->toks_size * sizeof(redisCacheTok), 1);
+    }
+    t = &c->toks[c->toks_count++];
+    t->type = type;
+    t->str = str;
+    t->len = len;
+}
+
+/* Parse the reply at p into tokens.  Returns its length, 0 if it hasn't all
+ * arrived, or -1 if it isn't one. */
+static long redis_cache_parse(redisCache *c, const char *p, const char *end, int depth) {
+    const char *nl;
+    long n, len, off, i;
+
+    if(p == end || (nl = memchr(p, '\n', end - p)) == NULL) {
+        return 0;
+    }
+    if(nl - p < 2 || nl[-1] != '\r') {
+        return -1;
+    }
+    off = nl + 1 - p;
+
+    switch(*p) {
+        case '+':
+        case '-':
+        case ':':
+            redis_cache_tok(c, *p, p + 1, nl - 2 - p);
+            return off;
+
+        case '$':
+            n = strtol(p + 1, NULL, 10);
+            if(n < 0) {
+                redis_cache_tok(c, '$', NULL, -1);
+                return off;
+            }
+            if(end - (p + off) < n + 2) {
+                return 0;
+            }
+            redis_cache_tok(c, '$', p + off, n);
+            return off + n + 2;
+
+        case '*':
+            n = strtol(p + 1, NULL, 10);
+            redis_cache_tok(c, '*', NULL, n < 0 ? -1 : n);
+            if(n > 0 && depth >= 4) {
+                return -1;
+            }
+            for(i = 0; i < n; i++) {
+                if((len = redis_cache_parse(c, p + off, end, depth + 1)) <= 0) {
+                    return len;
+                }
+                off += len;
+            }
+            return off;
+    }
+    return -1;
+}
+
+/* Read the next reply on the side connection into c->toks, waiting up to
+ * timeout ms.  Returns 1, 0 if there is none yet, or -1 if the connection
+ * is no good. */
+static int redis_cache_next(redisCache *c, int timeout) {
+    long len;
+
+    while(1) {
+        c->toks_count = 0;
+        len = redis_cache_parse(c, c->buf + c->buf_pos, c->buf + c->buf_len, 0);
+        if(len > 0) {
+            c->buf_pos += len;
+            return 1;
+        } else if(len < 0) {
+            return -1;
+        }
+
+        switch(redis_cache_recv(c, timeout)) {
+            case 0:
+                return 0;
+            case -1:
+                return -1;
+        }
+    }
+}
+
+/* Send a command on the side connection, freeing it, and read the reply.
+ * Returns the type of the reply, or 0 if none came. */
+static char redis_cache_call(redisCache *c, smart_str *cmd, int timeout) {
+    size_t sent = 0;
+    int n;
+
+    while(sent < cmd->len) {
+        if((n = send(c->fd, cmd->c + sent, cmd->len - sent, 0)) <= 0) {
+            smart_str_free(cmd);
+            return 0;
+        }
+        sent += n;
+    }
+    smart_str_free(cmd);
+
+    return redis_cache_next(c, timeout) > 0 ? c->toks[0].type : 0;
+}
+
+static php_socket_t redis_cache_socket(redisCache *c, double timeout TSRMLS_DC) {
+    struct timeval tv;
+    char *errstr = NULL;
+    int err = 0;
+    php_socket_t fd;
+#ifndef PHP_WIN32
+    struct sockaddr_un sa;
+
+    if(c->host[0] == '/' && c->port < 1) {
+        if(strlen(c->host) >= sizeof(sa.sun_path) || (fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+            return -1;
+        }
+        memset(&sa, 0, sizeof(sa));
+        sa.sun_family = AF_UNIX;
+        strcpy(sa.sun_path, c->host);
+        if(connect(fd, (struct sockaddr*)&sa, sizeof(sa)) != 0) {
+            closesocket(fd);
+            return -1;
+        }
+        return fd;
+    }
+#endif
+
+    tv.tv_sec = (time_t)timeout;
+    tv.tv_usec = (int)((timeout - tv.tv_sec) * 1000000);
+    fd = php_network_connect_socket_to_host(c->host, (unsigned short)c->port, SOCK_STREAM, 0,
+                                            &tv, &errstr, &err, NULL, 0 TSRMLS_CC);
+    if(errstr) {
+        efree(errstr);
+    }
+    return fd;
+}
+
+/* CLIENT TRACKING on REDIRECT <ourselves> BCAST PREFIX ..., then listen on
+ * __redis__:invalidate.  Returns 1, 0 if the server doesn't have it, -1 if
+ * the connection failed. */
+static int redis_cache_track(redisCache *c, int timeout) {
+    smart_str cmd = {0};
+    char id[32], type;
+    int i;
+
+    redis_cmd_init_sstr(&cmd, 1, "CLIENT", sizeof("CLIENT")-1);
+    redis_cmd_append_sstr(&cmd, "ID", sizeof("ID")-1);
+    if((type = redis_cache_call(c, &cmd, timeout)) != ':') {
+        return type ? 0 : -1;
+    }
+    snprintf(id, sizeof(id), "%.*s", (int)c->toks[0].len, c->toks[0].str);
+
+    redis_cmd_init_sstr(&cmd, 5 + 2 * c->prefix_count, "CLIENT", sizeof("CLIENT")-1);
+    redis_cmd_append_sstr(&cmd, "TRACKING", sizeof("TRACKING")-1);
+    redis_cmd_append_sstr(&cmd, "on", sizeof("on")-1);
+    redis_cmd_append_sstr(&cmd, "REDIRECT", sizeof("REDIRECT")-1);
+    redis_cmd_append_sstr(&cmd, id, strlen(id));
+    redis_cmd_append_sstr(&cmd, "BCAST", sizeof("BCAST")-1);
+    for(i = 0; i < c->prefix_count; i++) {
+        redis_cmd_append_sstr(&cmd, "PREFIX", sizeof("PREFIX")-1);
+        redis_cmd_append_sstr(&cmd, c->prefixes[i], c->prefix_lens[i]);
+    }
+    if((type = redis_cache_call(c, &cmd, timeout)) != '+') {
+        return type ? 0 : -1;
+    }
+
+    redis_cmd_init_sstr(&cmd, 1, "SUBSCRIBE", sizeof("SUBSCRIBE")-1);
+    redis_cmd_append_sstr(&cmd, "__redis__:invalidate", sizeof("__redis__:invalidate")-1);
+    return redis_cache_call(c, &cmd, timeout) == '*' ? 1 : -1;
+}
+
+/* Without tracking: keyspace notifications, if the server sends those of
+ * every event to keys (notify-keyspace-events with K and A), on patterns
+ * for our prefixes.  Returns 1, 0 if it doesn't, -1 if the connection
+ * failed. */
+static int redis_cache_keyspace(redisCache *c, int timeout) {
+    smart_str cmd = {0}, pat = {0};
+    redisCacheTok *flags;
+    char type;
+    int i, j;
+
+    redis_cmd_init_sstr(&cmd, 2, "CONFIG", sizeof("CONFIG")-1);
+    redis_cmd_append_sstr(&cmd, "GET", sizeof("GET")-1);
+    redis_cmd_append_sstr(&cmd, "notify-keyspace-events", sizeof("notify-keyspace-events")-1);
+    if((type = redis_cache_call(c, &cmd, timeout)) != '*') {
+        return type ? 0 : -1;
+    }
+    flags = &c->toks[2];
+    if(c->toks_count < 3 || flags->type != '$' || flags->len < 0 ||
+       !memchr(flags->str, 'K', flags->len) || !memchr(flags->str, 'A', flags->len))
+    {
+        return 0;
+    }
+
+    redis_cmd_init_sstr(&cmd, c->prefix_count, "PSUBSCRIBE", sizeof("PSUBSCRIBE")-1);
+    for(i = 0; i < c->prefix_count; i++) {
+        pat.len = 0;
+        smart_str_appendl(&pat, "__keyspace@*__:", sizeof("__keyspace@*__:")-1);
+        for(j = 0; j < c->prefix_lens[i]; j++) {
+            if(strchr("*?[]\\", c->prefixes[i][j]) && c->prefixes[i][j]) {
+                smart_str_appendc(&pat, '\\');
+            }
+            smart_str_appendc(&pat, c->prefixes[i][j]);
+        }
+        smart_str_appendc(&pat, '*');
+        redis_cmd_append_sstr(&cmd, pat.c, pat.len);
+    }
+    smart_str_free(&pat);
+
+    /* one confirmation per pattern */
+    if(redis_cache_call(c, &cmd, timeout) != '*') {
+        return -1;
+    }
+    for(i = 1; i < c->prefix_count; i++) {
+        if(redis_cache_next(c, timeout) <= 0 || c->toks[0].type != '*') {
+            return -1;
+        }
+    }
+    return 1;
+}
+
+/* Open the side connection.  Returns 0, or -1 leaving it closed. */
+static int redis_cache_connect(redisCache *c, RedisSock *redis_sock TSRMLS_DC) {
+    double timeout = redis_sock->timeout > 0 ? redis_sock->timeout : REDIS_CACHE_TIMEOUT;
+    int ms = (int)(timeout * 1000), ret;
+    smart_str cmd = {0};
+
+    if((c->fd = redis_cache_socket(c, timeout TSRMLS_CC)) == -1) {
+        return -1;
+    }
+    c->pid = (long)getpid();
+    c->buf_pos = c->buf_len = 0;
+
+    if(c->auth) {
+        redis_cmd_init_sstr(&cmd, 1, "AUTH", sizeof("AUTH")-1);
+        redis_cmd_append_sstr(&cmd, c->auth, strlen(c->auth));
+        if(redis_cache_call(c, &cmd, ms) != '+') {
+            redis_cache_lost(c);
+            return -1;
+        }
+    }
+
+    if((ret = redis_cache_track(c, ms)) == 0 && (ret = redis_cache_keyspace(c, ms)) == 0 && !c->warned) {
+        php_error_docref(NULL TSRMLS_CC, E_WARNING,
+            "The client cache needs Redis 6, or notify-keyspace-events with K and A");
+        c->warned = 1;
+    }
+    if(ret <= 0) {
+        redis_cache_lost(c);
+        return -1;
+    }
+
+    /* everything kept before is suspect */
+    zend_hash_clean(&c->entries);
+    return 0;
+}
+
+/* An invalidation, or anything else, heard on the side connection */
+static void redis_cache_message(redisCache *c) {
+    redisCacheTok *t = c->toks;
+    const char *p, *end;
+    long db = 0;
+    int i;
+
+    if(c->toks_count >= 4 && t[0].type == '*' && REDIS_CACHE_TOK_IS(&t[1], "message")) {
+        /* keys, or nil when the server was flushed */
+        if(t[3].len < 0) {
+            zend_hash_clean(&c->entries);
+        } else if(t[3].type == '$') {
+            redis_cache_drop_key(c, t[3].str, t[3].len, -1);
+        } else {
+            for(i = 4; i < c->toks_count; i++) {
+                if(t[i].type == '$' && t[i].len >= 0) {
+                    redis_cache_drop_key(c, t[i].str, t[i].len, -1);
+                }
+            }
+        }
+    } else if(c->toks_count == 5 && t[0].type == '*' && REDIS_CACHE_TOK_IS(&t[1], "pmessage") &&
+              t[3].type == '$' && t[3].len > (long)sizeof("__keyspace@")-1 &&
+              !memcmp(t[3].str, "__keyspace@", sizeof("__keyspace@")-1))
+    {
+        /* __keyspace@<db>__:<key> */
+        p = t[3].str + sizeof("__keyspace@")-1;
+        end = t[3].str + t[3].len;
+        for(; p < end && *p >= '0' && *p <= '9'; p++) {
+            db = db * 10 + (*p - '0');
+        }
+        if(end - p >= 3 && !memcmp(p, "__:", 3)) {
+            redis_cache_drop_key(c, p + 3, end - p - 3, db);
+        }
+    }
+}
+
+/* Get the side connection up and apply everything it received.  Returns -1
+ * when the cache can't be trusted right now. */
+static int redis_cache_sync(redisCache *c, RedisSock *redis_sock TSRMLS_DC) {
+    int ret;
+
+    /* forked: the socket is shared with our parent */
+    if(c->fd != -1 && c->pid != (long)getpid()) {
+        redis_cache_lost(c);
+    }
+    if(c->fd == -1) {
+        if(time(NULL) < c->retry_at) {
+            return -1;
+        }
+        if(redis_cache_connect(c, redis_sock TSRMLS_CC) < 0) {
+            c->retry_at = time(NULL) + REDIS_CACHE_RETRY;
+            return -1;
+        }
+    }
+
+    while((ret = redis_cache_next(c, 0)) > 0) {
+        redis_cache_message(c);
+    }
+    if(ret < 0) {
+        redis_cache_lost(c);
+        return -1;
+    }
+    return 0;
+}
+
+/* Use the cache of our server for the prefixes in spec, separated by commas,
+ * or stop using one for an empty spec.  Keys are matched with OPT_PREFIX. */
+PHP_REDIS_API int redis_cache_enable(RedisSock *redis_sock, char *spec, int spec_len TSRMLS_DC) {
+    redisCache *c, **found;
+    smart_str id = {0};
+    char **prefixes, *p, *end, *comma, auth_hash[41];
+    int *lens, count = 0, i, j, prefix_len;
+    unsigned char digest[20];
+    PHP_SHA1_CTX ctx;
+
+    if(spec_len == 0) {
+        redis_sock->cache = NULL;
+        return 0;
+    }
+    if(!redis_caches_init || redis_cache_max_memory == 0) {
+        return -1;
+    }
+
+    /* the prefixes, dropping those under another */
+    prefix_len = redis_sock->prefix ? redis_sock->prefix_len : 0;
+    prefixes = emalloc((spec_len + 1) * sizeof(char*));
+    lens = emalloc((spec_len + 1) * sizeof(int));
+    for(p = spec, end = spec + spec_len; p <= end; p = comma + 1) {
+        if((comma = memchr(p, ',', end - p)) == NULL) {
+            comma = end;
+        }
+        if(comma > p) {
+            lens[count] = prefix_len + (comma - p);
+            prefixes[count] = emalloc(lens[count]);
+            if(prefix_len) memcpy(prefixes[count], redis_sock->prefix, prefix_len);
+            memcpy(prefixes[count] + prefix_len, p, comma - p);
+            count++;
+        }
+    }
+    for(i = 0; i < count; ) {
+        for(j = 0; j < count; j++) {
+            if(j != i && lens[j] <= lens[i] && !memcmp(prefixes[i], prefixes[j], lens[j]) &&
+               (lens[j] < lens[i] || j < i))
+            {
+                break;
+            }
+        }
+        if(j < count) {
+            efree(prefixes[i]);
+            prefixes[i] = prefixes[--count];
+            lens[i] = lens[count];
+        } else {
+            i++;
+        }
+    }
+    if(count == 0) {
+        efree(prefixes);
+        efree(lens);
+        return -1;
+    }
+
+    /* one cache per server, password and prefixes, per thread */
+    smart_str_appends(&id, redis_sock->host);
+    smart_str_appendc(&id, ':');
+    smart_str_append_long(&id, redis_sock->port);
+    if(redis_sock->auth) {
+        PHP_SHA1Init(&ctx);
+        PHP_SHA1Update(&ctx, (unsigned char*)redis_sock->auth, strlen(redis_sock->auth));
+        PHP_SHA1Final(digest, &ctx);
+        make_sha1_digest(auth_hash, digest);
+        smart_str_appends(&id, ":auth:");
+        smart_str_appendl(&id, auth_hash, 40);
+    }
+#ifdef ZTS
+    smart_str_appendc(&id, ':');
+    smart_str_append_unsigned(&id, (unsigned long)tsrm_thread_id());
+#endif
+    for(i = 0; i < count; i++) {
+        smart_str_appendc(&id, ':');
+        smart_str_append_long(&id, lens[i]);
+        smart_str_appendc(&id, ':');
+        smart_str_appendl(&id, prefixes[i], lens[i]);
+    }
+    smart_str_0(&id);
+
+    REDIS_CACHE_LOCK();
+    if(zend_hash_find(&redis_caches, id.c, id.len + 1, (void**)&found) == SUCCESS) {
+        c = *found;
+    } else {
+        c = pecalloc(1, sizeof(redisCache), 1);
+        c->spec = pemalloc(spec_len + 1, 1);
+        memcpy(c->spec, spec, spec_len);
+        c->spec[spec_len] = '\0';
+        c->host = pestrdup(redis_sock->host, 1);
+        c->port = redis_sock->port;
+        c->auth = redis_sock->auth ? pestrdup(redis_sock->auth, 1) : NULL;
+        c->prefixes = pemalloc(count * sizeof(char*), 1);
+        c->prefix_lens = pemalloc(count * sizeof(int), 1);
+        for(i = 0; i < count; i++) {
+            c->prefixes[i] = pemalloc(lens[i], 1);
+            memcpy(c->prefixes[i], prefixes[i], lens[i]);
+            c->prefix_lens[i] = lens[i];
+        }
+        c->prefix_count = count;
+        c->fd = -1;
+        zend_hash_init(&c->entries, 64, NULL, redis_cache_entries_dtor, 1);
+        zend_hash_update(&redis_caches, id.c, id.len + 1, &c, sizeof(redisCache*), NULL);
+    }
+    REDIS_CACHE_UNLOCK();
+
+    for(i = 0; i < count; i++) {
+        efree(prefixes[i]);
+    }
+    efree(prefixes);
+    efree(lens);
+    smart_str_free(&id);
+
+    redis_sock->cache = c;
+    return 0;
+}
+
+/* The connection changed its password: it moves to the cache of the new one */
+PHP_REDIS_API void redis_cache_auth(RedisSock *redis_sock TSRMLS_DC) {
+    char *spec;
+
+    if(!redis_sock->cache) {
+        return;
+    }
+    spec = estrdup(redis_sock->cache->spec);
+    if(redis_cache_enable(redis_sock, spec, strlen(spec) TSRMLS_CC) < 0) {
+        redis_sock->cache = NULL;
+    }
+    efree(spec);
+}
+
+PHP_REDIS_API const char *redis_cache_spec(RedisSock *redis_sock) {
+    return redis_sock->cache ? redis_sock->cache->spec : "";
+}
+
+/* Look a GET or HGETALL reply up.  Returns 1 with a copy of its strings in
+ * one block for the caller to efree (vals, NULL when there are none), 0 if
+ * we don't have it but can keep it, and -1 if it isn't for the cache. */
+PHP_REDIS_API int redis_cache_find(RedisSock *redis_sock, int type, char *key, int key_len,
+                                   int *count, char ***vals, int **lens TSRMLS_DC)
+{
+    redisCache *c = redis_sock->cache;
+    redisCacheEntry **head, *e;
+    char *block;
+    int i;
+
+    if(!c || redis_sock->mode != ATOMIC || !redis_cache_match(c, key, key_len) ||
+       redis_cache_sync(c, redis_sock TSRMLS_CC) < 0)
+    {
+        return -1;
+    }
+
+    if(zend_hash_find(&c->entries, key, key_len + 1, (void**)&head) == FAILURE) {
+        return 0;
+    }
+    for(e = *head; e && (e->db != redis_sock->dbNumber || e->type != type); e = e->next);
+    if(e == NULL) {
+        return 0;
+    }
+    if(e->expires && e->expires <= time(NULL)) {
+        redis_cache_drop(c, key, key_len, redis_sock->dbNumber);
+        return 0;
+    }
+
+    /* a copy: unserializing may run code that comes back here */
+    *count = e->count;
+    *vals = NULL;
+    *lens = NULL;
+    if(e->count) {
+        block = emalloc(e->data_len);
+        memcpy(block, e->vals, e->data_len);
+        *vals = (char**)block;
+        *lens = (int*)(block + ((char*)e->lens - (char*)e->vals));
+        for(i = 0; i < e->count; i++) {
+            (*vals)[i] = block + (e->vals[i] - (char*)e->vals);
+        }
+    }
+    return 1;
+}
+
+/* Make room for size bytes in the caches of the worker, dropping our oldest
+ * keys if need be.  Returns -1 if we can't. */
+static int redis_cache_reserve(redisCache *c, size_t size) {
+    char *key;
+    unsigned int key_len;
+    unsigned long idx;
+    int fits;
+
+    if(size > redis_cache_max_memory) {
+        return -1;
+    }
+    while(1) {
+        REDIS_CACHE_LOCK();
+        if((fits = redis_cache_used + size <= redis_cache_max_memory)) {
+            redis_cache_used += size;
+        }
+        REDIS_CACHE_UNLOCK();
+        if(fits) {
+            return 0;
+        }
+
+        zend_hash_internal_pointer_reset(&c->entries);
+        if(zend_hash_get_current_key_ex(&c->entries, &key, &key_len, &idx, 1, NULL) != HASH_KEY_IS_STRING) {
+            return -1;
+        }
+        zend_hash_del(&c->entries, key, key_len);
+        efree(key);
+    }
+}
+
+/* Keep the reply to a GET (one string, or none when there is no key) or an
+ * HGETALL, after redis_cache_find didn't have it */
+PHP_REDIS_API void redis_cache_store(RedisSock *redis_sock, int type, char *key, int key_len,
+                                     int count, char **vals, int *lens TSRMLS_DC)
+{
+    redisCache *c = redis_sock->cache;
+    redisCacheEntry *e, **head;
+    size_t data_len, size;
+    char *p;
+    int i;
+
+    if(!c || c->fd == -1) {
+        return;
+    }
+
+    data_len = count * (sizeof(char*) + sizeof(int));
+    for(i = 0; i < count; i++) {
+        data_len += lens[i] + 1;
+    }
+    size = sizeof(redisCacheEntry) + data_len + key_len + REDIS_CACHE_OVERHEAD;
+    if(redis_cache_reserve(c, size) < 0) {
+        return;
+    }
+
+    e = pemalloc(sizeof(redisCacheEntry) + data_len, 1);
+    e->db = redis_sock->dbNumber;
+    e->type = type;
+    e->expires = redis_cache_ttl ? time(NULL) + redis_cache_ttl : 0;
+    e->size = size;
+    e->data_len = data_len;
+    e->count = count;
+    e->vals = (char**)(e + 1);
+    e->lens = (int*)(e->vals + count);
+    p = (char*)(e->lens + count);
+    for(i = 0; i < count; i++) {
+        e->vals[i] = p;
+        e->lens[i] = lens[i];
+        memcpy(p, vals[i], lens[i]);
+        p[lens[i]] = '\0';
+        p += lens[i] + 1;
+    }
+
+    /* in place of what we had for the same db and command */
+    if(zend_hash_find(&c->entries, key, key_len + 1, (void**)&head) == SUCCESS) {
+        redisCacheEntry **old;
+
+        for(old = head; *old; old = &(*old)->next) {
+            if((*old)->db == e->db && (*old)->type == type) {
+                redisCacheEntry *dead = *old;
+                *old = dead->next;
+                redis_cache_entry_free(dead);
+                break;
+            }
+        }
+        e->next = *head;
+        *head = e;
+    } else {
+        e->next = NULL;
+        zend_hash_add(&c->entries, key, key_len + 1, &e, sizeof(redisCacheEntry*), NULL);
+    }
+}
+
+static int redis_cache_is_readonly(const char *cmd, int len) {
+    int i;
+
+    for(i = 0; redis_cache_readonly[i]; i++) {
+        if(strlen(redis_cache_readonly[i]) == (size_t)len && !strncasecmp(cmd, redis_cache_readonly[i], len)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* A command is going out: drop the keys it names, unless it only reads.
+ * Returns 0 if the other arguments are to be looked at. */
+static int redis_cache_command(redisCache *c, const char *cmd, int len) {
+    if((len == sizeof("FLUSHDB")-1 && !strncasecmp(cmd, "FLUSHDB", len)) ||
+       (len == sizeof("FLUSHALL")-1 && !strncasecmp(cmd, "FLUSHALL", len)))
+    {
+        zend_hash_clean(&c->entries);
+        return -1;
+    }
+    return redis_cache_is_readonly(cmd, len) ? -1 : 0;
+}
+
+/* Commands are going out on a connection using the cache, so that we read
+ * our own writes */
+PHP_REDIS_API void redis_cache_sent(RedisSock *redis_sock, const char *cmd, size_t len) {
+    redisCache *c = redis_sock->cache;
+    const char *p = cmd, *end = cmd + len, *arg;
+    char *next;
+    long argc, i, n;
+    int skip = 0;
+
+    if(!c || !zend_hash_num_elements(&c->entries)) {
+        return;
+    }
+
+    while(p < end && *p == '*') {
+        argc = strtol(p + 1, &next, 10);
+        p = next + 2;
+        for(i = 0; i < argc; i++) {
+            if(p >= end || *p != '$') {
+                return;
+            }
+            n = strtol(p + 1, &next, 10);
+            arg = next + 2;
+            if((p = arg + n + 2) > end) {
+                return;
+            }
+            if(i == 0) {
+                skip = redis_cache_command(c, arg, n);
+            } else if(!skip && redis_cache_match(c, arg, n)) {
+                redis_cache_drop_key(c, arg, n, -1);
+            }
+        }
+    }
+}
+
+PHP_REDIS_API void redis_cache_sent_argv(RedisSock *redis_sock, char *keyword, int keyword_len,
+                                         int argc, char **argv, int *argv_len)
+{
+    redisCache *c = redis_sock->cache;
+    int i;
+
+    if(!c || !zend_hash_num_elements(&c->entries) || redis_cache_command(c, keyword, keyword_len)) {
+        return;
+    }
+    for(i = 0; i < argc; i++) {
+        if(redis_cache_match(c, argv[i], argv_len[i])) {
+            redis_cache_drop_key(c, argv[i], argv_len[i], -1);
+        }
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef REDIS_CACHE_H
+#define REDIS_CACHE_H
+
+#include "common.h"
+
+/* what a cached reply was read with */
+#define REDIS_CACHE_STRING 1    /* GET */
+#define REDIS_CACHE_HASH   2    /* HGETALL */
+
+/* redis.client_cache.max_memory and redis.client_cache.ttl defaults */
+#define REDIS_CACHE_MAX_MEMORY "16M"
+#define REDIS_CACHE_TTL        "60"
+
+/* seconds between attempts to open a side connection that failed */
+#define REDIS_CACHE_RETRY 1
+
+typedef struct _redisCache redisCache;
+
+PHP_REDIS_API void redis_cache_startup(long max_memory, long ttl);
+PHP_REDIS_API void redis_cache_shutdown(void);
+
+PHP_REDIS_API int redis_cache_enable(RedisSock *redis_sock, char *spec, int spec_len TSRMLS_DC);
+PHP_REDIS_API void redis_cache_auth(RedisSock *redis_sock TSRMLS_DC);
+PHP_REDIS_API const char *redis_cache_spec(RedisSock *redis_sock);
+
+PHP_REDIS_API int redis_cache_find(RedisSock *redis_sock, int type, char *key, int key_len,
+                                   int *count, char ***vals, int **lens TSRMLS_DC);
+PHP_REDIS_API void redis_cache_store(RedisSock *redis_sock, int type, char *key, int key_len,
+                                     int count, char **vals, int *lens TSRMLS_DC);
+
+PHP_REDIS_API void redis_cache_sent(RedisSock *redis_sock, const char *cmd, size_t len);
+PHP_REDIS_API void redis_cache_sent_argv(RedisSock *redis_sock, char *keyword, int keyword_len,
+                                         int argc, char **argv, int *argv_len);
+
+#endif
@@ -0,0 +1,1372 @@
+/*
+  +----------------------------------------------------------------------+
+  | PHP Version 5                                                        |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 1997-2009 The PHP Group                                |
+  +----------------------------------------------------------------------+
+  | This source file is subject to version 3.01 of the PHP license,      |
+  | that is bundled with this package in the file LICENSE, and is        |
+  | available through the world-wide-web at the following url:           |
+  | http://www.php.net/license/3_01.txt                                  |
+  | If you did not receive a copy of the PHP license and are unable to   |
+  | obtain it through the world-wide-web, please send a note to          |
+  | license@php.net so we can mail you a copy immediately.               |
+  +----------------------------------------------------------------------+
+  | Maintainer: Lesorb <lesorb@gmail.com>                                |
+  +----------------------------------------------------------------------+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "common.h"
+#include "php_redis.h"
+#include "redis_cluster.h"
+#include <zend_exceptions.h>
+#include <ext/standard/php_smart_str.h>
+
+#include "library.h"
+#include "redis_commands.h"
+
+#include "php_variables.h"
+#include "SAPI.h"
+
+#ifndef PHP_WIN32
+#include <sys/mman.h>
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+/* Forward our call state, but collect the result in another zval */
+#define CLUSTER_PARAM_PASSTHRU_RV(rv) \
+	ht, rv, return_value_ptr, this_ptr, return_value_used TSRMLS_CC
+
+extern int le_redis_sock;
+extern zend_class_entry *redis_ce;
+extern zend_class_entry *redis_exception_ce;
+zend_class_entry *redis_cluster_ce;
+int le_redis_cluster;
+
+/* Slot maps shared by all workers, mapped once in MINIT */
+static clusterShmMap *cluster_shm = NULL;
+static size_t cluster_shm_count = 0;
+
+#if defined(__GNUC__) && !defined(PHP_WIN32)
+#define CLUSTER_SHM_BARRIER()		__sync_synchronize()
+#define CLUSTER_SHM_TRYLOCK(l)		__sync_bool_compare_and_swap((l), 0, 1)
+#define CLUSTER_SHM_UNLOCK(l)		__sync_lock_release(l)
+#define CLUSTER_SHM_CLAIM(id, v)	__sync_bool_compare_and_swap((id), 0, (v))
+#endif
+
+ZEND_BEGIN_ARG_INFO_EX(__redis_cluster_call_args, 0, 0, 2)
+	ZEND_ARG_INFO(0, function_name)
+	ZEND_ARG_INFO(0, arguments)
+ZEND_END_ARG_INFO()
+
+zend_function_entry redis_cluster_functions[] = {
+     PHP_ME(RedisCluster, __construct, NULL, ZEND_ACC_PUBLIC)
+     PHP_ME(RedisCluster, __call, __redis_cluster_call_args, ZEND_ACC_PUBLIC)
+
+     PHP_ME(RedisCluster, _masters, NULL, ZEND_ACC_PUBLIC)
+     PHP_ME(RedisCluster, _target, NULL, ZEND_ACC_PUBLIC)
+     PHP_ME(RedisCluster, _instance, NULL, ZEND_ACC_PUBLIC)
+     PHP_ME(RedisCluster, _slot, NULL, ZEND_ACC_PUBLIC)
+     PHP_ME(RedisCluster, _remap, NULL, ZEND_ACC_PUBLIC)
+
+     /* multi-key commands, split by slot */
+     PHP_ME(RedisCluster, mget, NULL, ZEND_ACC_PUBLIC)
+     PHP_ME(RedisCluster, mset, NULL, ZEND_ACC_PUBLIC)
+     PHP_ME(RedisCluster, del, NULL, ZEND_ACC_PUBLIC)
+     PHP_ME(RedisCluster, getOption, NULL, ZEND_ACC_PUBLIC)
+     PHP_ME(RedisCluster, setOption, NULL, ZEND_ACC_PUBLIC)
+
+     /* Aliases */
+     PHP_MALIAS(RedisCluster, delete, del, NULL, ZEND_ACC_PUBLIC)
+     PHP_MALIAS(RedisCluster, getMultiple, mget, NULL, ZEND_ACC_PUBLIC)
+     {NULL, NULL, NULL}
+};
+
+static void cluster_node_free(void *data) {
+	redisClusterNode *node = *(redisClusterNode**)data;
+
+	zval_dtor(node->z_redis);
+	efree(node->z_redis);
+	efree(node->name);
+	efree(node);
+}
+
+static void redis_cluster_free(RedisCluster *c) {
+	/* Nodes, and the Redis objects bound to them */
+	zend_hash_destroy(c->nodes);
+	FREE_HASHTABLE(c->nodes);
+
+	efree(c->slots);
+
+	zval_dtor(c->z_opts);
+	efree(c->z_opts);
+
+	if(c->prefix) {
+		efree(c->prefix);
+	}
+
+	efree(c);
+}
+
+void redis_destructor_redis_cluster(zend_rsrc_list_entry * rsrc TSRMLS_DC)
+{
+	redis_cluster_free((RedisCluster*)rsrc->ptr);
+}
+
+/**
+ * redis_cluster_get
+ */
+PHP_REDIS_API int redis_cluster_get(zval *id, RedisCluster **c TSRMLS_DC)
+{
+	zval **socket;
+	int resource_type;
+
+	if (Z_TYPE_P(id) != IS_OBJECT || zend_hash_find(Z_OBJPROP_P(id), "socket",
+								  sizeof("socket"), (void **) &socket) == FAILURE) {
+		return -1;
+	}
+
+	*c = (RedisCluster *) zend_list_find(Z_LVAL_PP(socket), &resource_type);
+
+	if (!*c || resource_type != le_redis_cluster) {
+			return -1;
+	}
+
+	return Z_LVAL_PP(socket);
+}
+
+/* Map a key to its hash slot.  Only the part between the first '{' and the
+ * following '}' is hashed when it is not empty, so related keys can be
+ * forced onto the same slot. */
+unsigned short cluster_hash_key(const char *key, int key_len) {
+	int s, e;
+
+	for(s = 0; s < key_len; s++) {
+		if(key[s] == '{') break;
+	}
+
+	if(s == key_len) {
+		return redis_crc16(key, key_len) & REDIS_CLUSTER_MOD;
+	}
+
+	for(e = s + 1; e < key_len; e++) {
+		if(key[e] == '}') break;
+	}
+
+	if(e == key_len || e == s + 1) {
+		return redis_crc16(key, key_len) & REDIS_CLUSTER_MOD;
+	}
+
+	return redis_crc16(key + s + 1, e - s - 1) & REDIS_CLUSTER_MOD;
+}
+
+/* Slot of a key as the nodes will see it, e.g. with our prefix applied */
+static short
+cluster_key_slot(RedisCluster *c, zval *z_key) {
+	zval z_tmp;
+	char *key;
+	int key_len;
+	short slot;
+
+	if(Z_TYPE_P(z_key) != IS_STRING) {
+		z_tmp = *z_key;
+		zval_copy_ctor(&z_tmp);
+		convert_to_string(&z_tmp);
+		z_key = &z_tmp;
+	}
+
+	if(c->prefix) {
+		key_len = c->prefix_len + Z_STRLEN_P(z_key);
+		key = emalloc(key_len);
+		memcpy(key, c->prefix, c->prefix_len);
+		memcpy(key + c->prefix_len, Z_STRVAL_P(z_key), Z_STRLEN_P(z_key));
+		slot = cluster_hash_key(key, key_len);
+		efree(key);
+	} else {
+		slot = cluster_hash_key(Z_STRVAL_P(z_key), Z_STRLEN_P(z_key));
+	}
+
+	if(z_key == &z_tmp) {
+		zval_dtor(&z_tmp);
+	}
+
+	return slot;
+}
+
+/* Replay the options set on the cluster on a single node */
+static void
+cluster_node_set_options(RedisCluster *c, redisClusterNode *node TSRMLS_DC) {
+	zval z_fun, z_ret, z_opt, **z_val, *z_args[2];
+	char *str_key;
+	unsigned int str_key_len;
+	unsigned long idx;
+	HashPosition pos;
+
+	ZVAL_STRING(&z_fun, "setOption", 0);
+
+	for(zend_hash_internal_pointer_reset_ex(Z_ARRVAL_P(c->z_opts), &pos);
+		zend_hash_get_current_data_ex(Z_ARRVAL_P(c->z_opts), (void**)&z_val, &pos) == SUCCESS;
+		zend_hash_move_forward_ex(Z_ARRVAL_P(c->z_opts), &pos))
+	{
+		zend_hash_get_current_key_ex(Z_ARRVAL_P(c->z_opts), &str_key, &str_key_len, &idx, 0, &pos);
+
+		INIT_ZVAL(z_opt);
+		ZVAL_LONG(&z_opt, idx);
+		z_args[0] = &z_opt;
+		z_args[1] = *z_val;
+
+		call_user_function(&redis_ce->function_table, &node->z_redis, &z_fun, &z_ret, 2, z_args TSRMLS_CC);
+		zval_dtor(&z_ret);
+	}
+}
+
+/* Find the node serving host:port, creating its Redis instance if we haven't
+ * seen it yet.  Sockets are connected lazily, on the first command. */
+static redisClusterNode *
+cluster_node_get(RedisCluster *c, const char *host, int host_len, unsigned short port TSRMLS_DC) {
+	redisClusterNode *node, **node_pp;
+	RedisSock *redis_sock;
+	zval z_cons, z_ret;
+	char *name;
+	int name_len, id;
+
+	name_len = spprintf(&name, 0, "%.*s:%d", host_len, host, port);
+	if(zend_hash_find(c->nodes, name, name_len + 1, (void**)&node_pp) == SUCCESS) {
+		efree(name);
+		return *node_pp;
+	}
+
+	node = emalloc(sizeof(redisClusterNode));
+	node->name = name;
+
+	/* create Redis object */
+	ZVAL_STRING(&z_cons, "__construct", 0);
+	MAKE_STD_ZVAL(node->z_redis);
+	object_init_ex(node->z_redis, redis_ce);
+	INIT_PZVAL(node->z_redis);
+	call_user_function(&redis_ce->function_table, &node->z_redis, &z_cons, &z_ret, 0, NULL TSRMLS_CC);
+
+	/* create socket */
+	redis_sock = redis_sock_create((char*)host, host_len, port, c->timeout, c->persistent, NULL, 0, 1);
+	if(c->read_timeout > 0) {
+		redis_sock->read_timeout = c->read_timeout;
+	}
+
+	/* attach */
+#if PHP_VERSION_ID >= 50400
+	id = zend_list_insert(redis_sock, le_redis_sock TSRMLS_CC);
+#else
+	id = zend_list_insert(redis_sock, le_redis_sock);
+#endif
+	add_property_resource(node->z_redis, "socket", id);
+
+	cluster_node_set_options(c, node TSRMLS_CC);
+
+	zend_hash_update(c->nodes, name, name_len + 1, (void*)&node, sizeof(redisClusterNode*), NULL);
+
+	return node;
+}
+
+/* Any node we know of, for commands that don't carry a key */
+static redisClusterNode *
+cluster_node_any(RedisCluster *c) {
+	redisClusterNode **node_pp;
+	int i;
+
+	for(i = 0; i < REDIS_CLUSTER_SLOTS; i++) {
+		if(c->slots[i]) return c->slots[i];
+	}
+
+	zend_hash_internal_pointer_reset(c->nodes);
+	if(zend_hash_get_current_data(c->nodes, (void**)&node_pp) == SUCCESS) {
+		return *node_pp;
+	}
+
+	return NULL;
+}
+
+/* Map the shared slot tables.  Only workers forked after this share them;
+ * elsewhere they still save a CLUSTER SLOTS per new RedisCluster. */
+int cluster_shm_startup(size_t maps) {
+#if defined(CLUSTER_SHM_BARRIER) && defined(MAP_ANONYMOUS)
+	void *p;
+
+	if(maps == 0) {
+		return 0;
+	}
+
+	p = mmap(NULL, maps * sizeof(clusterShmMap), PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(p == MAP_FAILED) {
+		return -1;
+	}
+
+	/* anonymous mappings come zeroed: every map is unused */
+	cluster_shm = (clusterShmMap*)p;
+	cluster_shm_count = maps;
+#endif
+	return 0;
+}
+
+void cluster_shm_shutdown(void) {
+#if defined(CLUSTER_SHM_BARRIER) && defined(MAP_ANONYMOUS)
+	if(cluster_shm) {
+		munmap((void*)cluster_shm, cluster_shm_count * sizeof(clusterShmMap));
+		cluster_shm = NULL;
+		cluster_shm_count = 0;
+	}
+#endif
+}
+
+/* Find the shared map of a cluster, or claim a free one for it */
+static clusterShmMap *
+cluster_shm_find(unsigned long id) {
+#ifdef CLUSTER_SHM_BARRIER
+	size_t i;
+
+	if(!cluster_shm) {
+		return NULL;
+	}
+
+	for(i = 0; i < cluster_shm_count; i++) {
+		if(cluster_shm[i].id == id) {
+			return &cluster_shm[i];
+		}
+	}
+	for(i = 0; i < cluster_shm_count; i++) {
+		if(CLUSTER_SHM_CLAIM(&cluster_shm[i].id, id) || cluster_shm[i].id == id) {
+			return &cluster_shm[i];
+		}
+	}
+#endif
+	return NULL;
+}
+
+/* Publish our slot map, unless another worker is already doing so */
+static void
+cluster_shm_store(RedisCluster *c) {
+#ifdef CLUSTER_SHM_BARRIER
+	clusterShmMap *map = c->shm_map;
+	redisClusterNode *node, *last = NULL;
+	unsigned short *slots, idx = 0;
+	char (*names)[REDIS_CLUSTER_SHM_NAME];
+	int s, n, node_count = 0;
+
+	if(!map) {
+		return;
+	}
+
+	/* build the table locally, so the map is only held while we copy it */
+	slots = ecalloc(REDIS_CLUSTER_SLOTS, sizeof(unsigned short));
+	names = ecalloc(REDIS_CLUSTER_SHM_NODES, REDIS_CLUSTER_SHM_NAME);
+
+	for(s = 0; s < REDIS_CLUSTER_SLOTS; s++) {
+		if(!(node = c->slots[s])) {
+			continue;
+		}
+		/* slots come in ranges, so the owner is usually the previous one */
+		if(node != last) {
+			for(n = 0; n < node_count && strcmp(names[n], node->name); n++);
+			if(n == node_count) {
+				if(node_count == REDIS_CLUSTER_SHM_NODES ||
+				   strlen(node->name) >= REDIS_CLUSTER_SHM_NAME)
+				{
+					goto done;
+				}
+				strcpy(names[node_count++], node->name);
+			}
+			idx = n + 1;
+			last = node;
+		}
+		slots[s] = idx;
+	}
+
+	if(!CLUSTER_SHM_TRYLOCK(&map->lock)) {
+		goto done;
+	}
+
+	map->seq++;
+	CLUSTER_SHM_BARRIER();
+
+	map->node_count = node_count;
+	memcpy(map->nodes, names, node_count * REDIS_CLUSTER_SHM_NAME);
+	memcpy(map->slots, slots, sizeof(map->slots));
+	c->epoch = ++map->epoch;
+
+	CLUSTER_SHM_BARRIER();
+	map->seq++;
+	CLUSTER_SHM_UNLOCK(&map->lock);
+
+done:
+	efree(slots);
+	efree(names);
+#endif
+}
+
+/* Load our slots from the shared map, without taking its lock.  Fails when
+ * the map is empty or keeps changing while we copy it. */
+static int
+cluster_shm_load(RedisCluster *c TSRMLS_DC) {
+#ifdef CLUSTER_SHM_BARRIER
+	clusterShmMap *map = c->shm_map;
+	redisClusterNode **nodes;
+	unsigned short *slots;
+	char (*names)[REDIS_CLUSTER_SHM_NAME], *colon;
+	unsigned long seq, epoch = 0;
+	int s, n, node_count = 0, tries, ret = -1;
+
+	if(!map || !map->epoch) {
+		return -1;
+	}
+
+	slots = emalloc(REDIS_CLUSTER_SLOTS * sizeof(unsigned short));
+	names = emalloc(REDIS_CLUSTER_SHM_NODES * REDIS_CLUSTER_SHM_NAME);
+
+	for(tries = 0; tries < 100; tries++) {
+		if((seq = map->seq) & 1) {
+			continue;
+		}
+		CLUSTER_SHM_BARRIER();
+
+		epoch = map->epoch;
+		node_count = map->node_count;
+		memcpy(names, map->nodes, node_count * REDIS_CLUSTER_SHM_NAME);
+		memcpy(slots, (void*)map->slots, REDIS_CLUSTER_SLOTS * sizeof(unsigned short));
+
+		CLUSTER_SHM_BARRIER();
+		if(map->seq == seq) {
+			break;
+		}
+	}
+
+	if(tries < 100 && node_count > 0 && node_count <= REDIS_CLUSTER_SHM_NODES) {
+		nodes = emalloc(node_count * sizeof(redisClusterNode*));
+		for(n = 0; n < node_count; n++) {
+			names[n][REDIS_CLUSTER_SHM_NAME - 1] = '\0';
+			if(!(colon = strrchr(names[n], ':'))) {
+				break;
+			}
+			nodes[n] = cluster_node_get(c, names[n], colon - names[n],
+										(unsigned short)atoi(colon + 1) TSRMLS_CC);
+		}
+
+		if(n == node_count) {
+			for(s = 0; s < REDIS_CLUSTER_SLOTS; s++) {
+				c->slots[s] = (slots[s] && slots[s] <= node_count) ? nodes[slots[s] - 1] : NULL;
+			}
+			c->epoch = epoch;
+			ret = 0;
+		}
+		efree(nodes);
+	}
+
+	efree(slots);
+	efree(names);
+	return ret;
+#else
+	return -1;
+#endif
+}
+
+/* Pick up a map another worker published since we last looked */
+static inline void
+cluster_shm_sync(RedisCluster *c TSRMLS_DC) {
+	if(c->shm_map && c->shm_map->epoch != c->epoch) {
+		cluster_shm_load(c TSRMLS_CC);
+	}
+}
+
+/* Load the slot => node table from CLUSTER SLOTS, as answered by one node */
+static int
+cluster_map_slots(RedisCluster *c, redisClusterNode *seed TSRMLS_DC) {
+	RedisSock *redis_sock;
+	redisClusterNode *node;
+	zval *z_slots, **z_range, **z_start, **z_end, **z_master, **z_host, **z_port;
+	char *cmd, *host;
+	int cmd_len, host_len, mapped = 0;
+	long s;
+	HashPosition pos;
+
+	if(redis_sock_get(seed->z_redis, &redis_sock TSRMLS_CC, 1) < 0) {
+		return -1;
+	}
+
+	cmd_len = redis_cmd_format_static(&cmd, "CLUSTER", "s", "SLOTS", sizeof("SLOTS")-1);
+	if(redis_sock_write(redis_sock, cmd, cmd_len TSRMLS_CC) < 0) {
+		efree(cmd);
+		return -1;
+	}
+	efree(cmd);
+
+	if(redis_sock_read_reply(redis_sock, &z_slots TSRMLS_CC) < 0) {
+		return -1;
+	}
+
+	/* e.g. FALSE when cluster support is disabled */
+	if(Z_TYPE_P(z_slots) != IS_ARRAY) {
+		zval_ptr_dtor(&z_slots);
+		return -1;
+	}
+
+	memset(c->slots, 0, REDIS_CLUSTER_SLOTS * sizeof(redisClusterNode*));
+
+	/* Each range is [start, end, [host, port, ...], replicas...] */
+	for(zend_hash_internal_pointer_reset_ex(Z_ARRVAL_P(z_slots), &pos);
+		zend_hash_get_current_data_ex(Z_ARRVAL_P(z_slots), (void**)&z_range, &pos) == SUCCESS;
+		zend_hash_move_forward_ex(Z_ARRVAL_P(z_slots), &pos))
+	{
+		if(Z_TYPE_PP(z_range) != IS_ARRAY ||
+		   zend_hash_index_find(Z_ARRVAL_PP(z_range), 0, (void**)&z_start) == FAILURE ||
+		   zend_hash_index_find(Z_ARRVAL_PP(z_range), 1, (void**)&z_end) == FAILURE ||
+		   zend_hash_index_find(Z_ARRVAL_PP(z_range), 2, (void**)&z_master) == FAILURE ||
+		   Z_TYPE_PP(z_start) != IS_LONG || Z_TYPE_PP(z_end) != IS_LONG ||
+		   Z_TYPE_PP(z_master) != IS_ARRAY ||
+		   zend_hash_index_find(Z_ARRVAL_PP(z_master), 0, (void**)&z_host) == FAILURE ||
+		   zend_hash_index_find(Z_ARRVAL_PP(z_master), 1, (void**)&z_port) == FAILURE ||
+		   Z_TYPE_PP(z_host) != IS_STRING || Z_TYPE_PP(z_port) != IS_LONG)
+		{
+			continue;
+		}
+
+		/* An empty host means the node we asked */
+		if(Z_STRLEN_PP(z_host)) {
+			host = Z_STRVAL_PP(z_host);
+			host_len = Z_STRLEN_PP(z_host);
+		} else {
+			host = redis_sock->host;
+			host_len = strlen(redis_sock->host);
+		}
+
+		node = cluster_node_get(c, host, host_len, (unsigned short)Z_LVAL_PP(z_port) TSRMLS_CC);
+		for(s = Z_LVAL_PP(z_start); s <= Z_LVAL_PP(z_end) && s < REDIS_CLUSTER_SLOTS; s++) {
+			if(s < 0) continue;
+			c->slots[s] = node;
+			mapped++;
+		}
+	}
+
+	zval_dtor(z_slots);
+	efree(z_slots);
+
+	if(!mapped) {
+		return -1;
+	}
+
+	/* let the other workers skip this round trip */
+	cluster_shm_store(c);
+	return 0;
+}
+
+/* Remap the whole keyspace, trying every node we know of until one answers */
+static int
+cluster_remap(RedisCluster *c, redisClusterNode *first TSRMLS_DC) {
+	redisClusterNode **node_pp;
+	HashPosition pos;
+
+	if(first && cluster_map_slots(c, first TSRMLS_CC) == 0) {
+		return 0;
+	}
+
+	for(zend_hash_internal_pointer_reset_ex(c->nodes, &pos);
+		zend_hash_get_current_data_ex(c->nodes, (void**)&node_pp, &pos) == SUCCESS;
+		zend_hash_move_forward_ex(c->nodes, &pos))
+	{
+		if(EG(exception)) {
+			return -1;
+		}
+		if(*node_pp != first && cluster_map_slots(c, *node_pp TSRMLS_CC) == 0) {
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/* Parse "MOVED <slot> <host>:<port>" or "ASK <slot> <host>:<port>".  The host
+ * points into the error string, and is not NULL terminated. */
+static int
+cluster_parse_redirect(const char *err, int err_len, int *asking, int *slot,
+					   const char **host, int *host_len, unsigned short *port)
+{
+	const char *p, *colon;
+
+	if(err_len > 6 && !memcmp(err, "MOVED ", 6)) {
+		*asking = 0;
+		p = err + 6;
+	} else if(err_len > 4 && !memcmp(err, "ASK ", 4)) {
+		*asking = 1;
+		p = err + 4;
+	} else {
+		return -1;
+	}
+
+	*slot = atoi(p);
+	if(*slot < 0 || *slot >= REDIS_CLUSTER_SLOTS ||
+	   !(p = strchr(p, ' ')) || !(colon = strrchr(p, ':')))
+	{
+		return -1;
+	}
+
+	*host = p + 1;
+	*host_len = colon - p - 1;
+	*port = (unsigned short)atoi(colon + 1);
+
+	return 0;
+}
+
+/* An ASK redirection is only honoured by the target after ASKING */
+static int
+cluster_send_asking(RedisSock *redis_sock TSRMLS_DC) {
+	char *response;
+	int response_len, ret = -1;
+
+	if(redis_sock_write(redis_sock, "*1" _NL "$6" _NL "ASKING" _NL,
+						sizeof("*1" _NL "$6" _NL "ASKING" _NL) - 1 TSRMLS_CC) < 0)
+	{
+		return -1;
+	}
+
+	if((response = redis_sock_read(redis_sock, &response_len TSRMLS_CC)) != NULL) {
+		ret = (response_len == 3 && !strncmp(response, "+OK", 3)) ? 0 : -1;
+		efree(response);
+	}
+
+	return ret;
+}
+
+/* Call a Redis method on the node owning the slot, following MOVED and ASK
+ * replies.  A slot of -1 means the command has no key and any node will do. */
+static void
+cluster_forward_call(INTERNAL_FUNCTION_PARAMETERS, RedisCluster *c, int slot,
+					 const char *cmd, int cmd_len, int argc, zval **z_args)
+{
+	redisClusterNode *node;
+	RedisSock *redis_sock;
+	zval z_fun;
+	const char *host;
+	int host_len, asking = 0, redirections = 0;
+	unsigned short port;
+
+	ZVAL_STRINGL(&z_fun, (char*)cmd, cmd_len, 0);
+
+	cluster_shm_sync(c TSRMLS_CC);
+	node = (slot >= 0 && c->slots[slot]) ? c->slots[slot] : cluster_node_any(c);
+
+	while(1) {
+		if(!node || redis_sock_get(node->z_redis, &redis_sock TSRMLS_CC, 0) < 0) {
+			RETURN_FALSE;
+		}
+
+		/* Only look at the error this command gives us */
+		redis_sock_set_err(redis_sock, NULL, 0);
+
+		if(asking && cluster_send_asking(redis_sock TSRMLS_CC) < 0) {
+			RETURN_FALSE;
+		}
+
+		call_user_function(&redis_ce->function_table, &node->z_redis, &z_fun, return_value, argc, z_args TSRMLS_CC);
+
+		if(EG(exception) || !redis_sock->err ||
+		   cluster_parse_redirect(redis_sock->err, redis_sock->err_len, &asking,
+								  &slot, &host, &host_len, &port) < 0)
+		{
+			return;
+		}
+
+		if(++redirections > REDIS_CLUSTER_MAX_REDIRECTIONS) {
+			zend_throw_exception(redis_exception_ce, "Too many cluster redirections", 0 TSRMLS_CC);
+			return;
+		}
+
+		/* Drop the failed reply and go to the node we were sent to */
+		zval_dtor(return_value);
+		ZVAL_NULL(return_value);
+		node = cluster_node_get(c, host, host_len, port TSRMLS_CC);
+
+		/* A MOVED reply means our map is stale: reload it, or at least
+		 * remember this slot if that fails. */
+		if(!asking && cluster_map_slots(c, node TSRMLS_CC) < 0) {
+			c->slots[slot] = node;
+		}
+	}
+}
+
+/* Load seeds and options for a named cluster from the INI settings */
+static zval *
+cluster_ini_param(zval *z_params, const char *ini_value, const char *name TSRMLS_DC) {
+	zval **z_data_pp;
+
+	array_init(z_params);
+	sapi_module.treat_data(PARSE_STRING, estrdup(ini_value), z_params TSRMLS_CC);
+	if(zend_hash_find(Z_ARRVAL_P(z_params), name, strlen(name) + 1, (void**)&z_data_pp) == SUCCESS) {
+		return *z_data_pp;
+	}
+
+	return NULL;
+}
+
+/* Identify a cluster by its seeds, to find its shared map */
+static unsigned long
+cluster_seeds_id(HashTable *h_seeds) {
+	zval **z_seed;
+	HashPosition pos;
+	smart_str buf = {0};
+	unsigned long id;
+
+	for(zend_hash_internal_pointer_reset_ex(h_seeds, &pos);
+		zend_hash_get_current_data_ex(h_seeds, (void**)&z_seed, &pos) == SUCCESS;
+		zend_hash_move_forward_ex(h_seeds, &pos))
+	{
+		if(Z_TYPE_PP(z_seed) == IS_STRING) {
+			smart_str_appendl(&buf, Z_STRVAL_PP(z_seed), Z_STRLEN_PP(z_seed));
+			smart_str_appendc(&buf, ',');
+		}
+	}
+
+	id = buf.c ? zend_inline_hash_func(buf.c, buf.len) : 0;
+	smart_str_free(&buf);
+
+	/* 0 marks unused maps */
+	return id ? id : 1;
+}
+
+/* {{{ proto RedisCluster RedisCluster::__construct(string name [, array seeds [, double timeout [, double read_timeout [, bool persistent]]]])
+    Public constructor */
+PHP_METHOD(RedisCluster, __construct)
+{
+	zval *z_seeds = NULL, **z_seed, z_ini_seeds, z_ini, *z_val;
+	char *name = NULL, *host, *p;
+	int name_len, host_len, id, mapped = 0;
+	unsigned short port;
+	double timeout = 0.0, read_timeout = 0.0;
+	zend_bool persistent = 0;
+	HashTable *h_seeds = NULL;
+	HashPosition pos;
+	RedisCluster *c;
+	redisClusterNode *node;
+
+	INIT_ZVAL(z_ini_seeds);
+
+	if(zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s!|a!ddb", &name, &name_len,
+							 &z_seeds, &timeout, &read_timeout, &persistent) == FAILURE)
+	{
+		RETURN_FALSE;
+	}
+
+	/* seeds and options for a named cluster come from redis.clusters.* */
+	if(z_seeds) {
+		h_seeds = Z_ARRVAL_P(z_seeds);
+	} else if(name) {
+		if((z_val = cluster_ini_param(&z_ini_seeds, INI_STR("redis.clusters.seeds"), name TSRMLS_CC)) &&
+		   Z_TYPE_P(z_val) == IS_ARRAY)
+		{
+			h_seeds = Z_ARRVAL_P(z_val);
+		}
+		if((z_val = cluster_ini_param(&z_ini, INI_STR("redis.clusters.timeout"), name TSRMLS_CC)) &&
+		   Z_TYPE_P(z_val) == IS_STRING)
+		{
+			timeout = atof(Z_STRVAL_P(z_val));
+		}
+		zval_dtor(&z_ini);
+		if((z_val = cluster_ini_param(&z_ini, INI_STR("redis.clusters.read_timeout"), name TSRMLS_CC)) &&
+		   Z_TYPE_P(z_val) == IS_STRING)
+		{
+			read_timeout = atof(Z_STRVAL_P(z_val));
+		}
+		zval_dtor(&z_ini);
+		if((z_val = cluster_ini_param(&z_ini, INI_STR("redis.clusters.persistent"), name TSRMLS_CC)) &&
+		   Z_TYPE_P(z_val) == IS_STRING && strncmp(Z_STRVAL_P(z_val), "1", 1) == 0)
+		{
+			persistent = 1;
+		}
+		zval_dtor(&z_ini);
+	}
+
+	if(!h_seeds || zend_hash_num_elements(h_seeds) == 0) {
+		zval_dtor(&z_ini_seeds);
+		zend_throw_exception(redis_exception_ce, "Must pass seeds", 0 TSRMLS_CC);
+		return;
+	}
+
+	if(timeout < 0L || timeout > INT_MAX || read_timeout < 0L || read_timeout > INT_MAX) {
+		zval_dtor(&z_ini_seeds);
+		zend_throw_exception(redis_exception_ce, "Invalid timeout", 0 TSRMLS_CC);
+		return;
+	}
+
+#ifdef ZTS
+	/* not sure how in threaded mode this works so disabled persistents at first */
+	persistent = 0;
+#endif
+
+	c = ecalloc(1, sizeof(RedisCluster));
+	c->slots = ecalloc(REDIS_CLUSTER_SLOTS, sizeof(redisClusterNode*));
+	c->timeout = timeout;
+	c->read_timeout = read_timeout;
+	c->persistent = persistent;
+	MAKE_STD_ZVAL(c->z_opts);
+	array_init(c->z_opts);
+	ALLOC_HASHTABLE(c->nodes);
+	zend_hash_init(c->nodes, 0, NULL, cluster_node_free, 0);
+
+	/* a map published by another worker saves us asking the seeds */
+	c->shm_map = cluster_shm_find(cluster_seeds_id(h_seeds));
+	mapped = (cluster_shm_load(c TSRMLS_CC) == 0);
+
+	/* map the keyspace from the first seed that answers */
+	for(zend_hash_internal_pointer_reset_ex(h_seeds, &pos);
+		!mapped && zend_hash_get_current_data_ex(h_seeds, (void**)&z_seed, &pos) == SUCCESS;
+		zend_hash_move_forward_ex(h_seeds, &pos))
+	{
+		if(Z_TYPE_PP(z_seed) != IS_STRING) {
+			continue;
+		}
+
+		host = Z_STRVAL_PP(z_seed);
+		host_len = Z_STRLEN_PP(z_seed);
+		port = 6379;
+		if((p = strrchr(host, ':'))) { /* found port */
+			host_len = p - host;
+			port = (unsigned short)atoi(p+1);
+		}
+
+		node = cluster_node_get(c, host, host_len, port TSRMLS_CC);
+		if(cluster_map_slots(c, node TSRMLS_CC) == 0) {
+			mapped = 1;
+		} else {
+			/* forget unreachable seeds, their socket won't reconnect */
+			zend_hash_del(c->nodes, node->name, strlen(node->name) + 1);
+		}
+
+		if(EG(exception)) {
+			break;
+		}
+	}
+
+	zval_dtor(&z_ini_seeds);
+
+	if(!mapped) {
+		redis_cluster_free(c);
+		if(!EG(exception)) {
+			zend_throw_exception(redis_exception_ce,
+				"Couldn't map cluster keyspace using any provided seed", 0 TSRMLS_CC);
+		}
+		return;
+	}
+
+#if PHP_VERSION_ID >= 50400
+	id = zend_list_insert(c, le_redis_cluster TSRMLS_CC);
+#else
+	id = zend_list_insert(c, le_redis_cluster);
+#endif
+	add_property_resource(getThis(), "socket", id);
+}
+/* }}} */
+
+/* Slot a command should be routed to, from its arguments.  -1 when it has no key. */
+static int
+cluster_args_slot(RedisCluster *c, const redisCommand *info, int argc, zval **z_args TSRMLS_DC) {
+	zval **zp_key;
+	int key_pos = info ? info->key_pos : 0;
+
+	if(info && (info->flags & REDIS_CMD_NOKEY)) {
+		return -1;
+	} else if(info && (info->flags & REDIS_CMD_EVAL)) {
+		/* eval(script, args, num_keys): route on the first key, if any */
+		if(argc < 3 || Z_TYPE_P(z_args[1]) != IS_ARRAY || Z_TYPE_P(z_args[2]) != IS_LONG ||
+		   Z_LVAL_P(z_args[2]) < 1 ||
+		   zend_hash_index_find(Z_ARRVAL_P(z_args[1]), 0, (void**)&zp_key) == FAILURE)
+		{
+			return -1;
+		}
+		return cluster_key_slot(c, *zp_key);
+	}
+
+	if(key_pos >= argc || Z_TYPE_P(z_args[key_pos]) == IS_ARRAY ||
+	   Z_TYPE_P(z_args[key_pos]) == IS_OBJECT)
+	{
+		return -1;
+	}
+
+	return cluster_key_slot(c, z_args[key_pos]);
+}
+
+PHP_METHOD(RedisCluster, __call)
+{
+	zval *object, *z_args, **zp_tmp, **z_callargs;
+	char *cmd;
+	int cmd_len, argc, i;
+	RedisCluster *c;
+	HashTable *h_args;
+	HashPosition pointer;
+	const redisCommand *info;
+
+	if(zend_parse_method_parameters(ZEND_NUM_ARGS() TSRMLS_CC, getThis(), "Osa",
+								   &object, redis_cluster_ce, &cmd, &cmd_len, &z_args) == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	if(redis_cluster_get(object, &c TSRMLS_CC) < 0) {
+		RETURN_FALSE;
+	}
+
+	/* Transactions and connection state can't span several nodes */
+	info = redis_command_find(cmd, cmd_len);
+	if(info && (info->flags & REDIS_CMD_CONN)) {
+		zend_throw_exception_ex(redis_exception_ce, 0 TSRMLS_CC,
+			"%s is not supported by RedisCluster", cmd);
+		RETURN_FALSE;
+	}
+
+	h_args = Z_ARRVAL_P(z_args);
+	argc = zend_hash_num_elements(h_args);
+	z_callargs = emalloc((argc ? argc : 1) * sizeof(zval*));
+
+	/* copy args to array */
+	for (i = 0, zend_hash_internal_pointer_reset_ex(h_args, &pointer);
+			zend_hash_get_current_data_ex(h_args, (void**) &zp_tmp,
+				&pointer) == SUCCESS;
+			++i, zend_hash_move_forward_ex(h_args, &pointer)) {
+
+		z_callargs[i] = *zp_tmp;
+	}
+
+	cluster_forward_call(INTERNAL_FUNCTION_PARAM_PASSTHRU, c,
+		cluster_args_slot(c, info, argc, z_callargs TSRMLS_CC), cmd, cmd_len, argc, z_callargs);
+
+	efree(z_callargs);
+}
+
+PHP_METHOD(RedisCluster, _masters)
+{
+	zval *object;
+	RedisCluster *c;
+	redisClusterNode **node_pp;
+	HashPosition pos;
+
+	if (zend_parse_method_parameters(ZEND_NUM_ARGS() TSRMLS_CC, getThis(), "O",
+				&object, redis_cluster_ce) == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	if (redis_cluster_get(object, &c TSRMLS_CC) < 0) {
+		RETURN_FALSE;
+	}
+
+	array_init(return_value);
+	for(zend_hash_internal_pointer_reset_ex(c->nodes, &pos);
+		zend_hash_get_current_data_ex(c->nodes, (void**)&node_pp, &pos) == SUCCESS;
+		zend_hash_move_forward_ex(c->nodes, &pos))
+	{
+		add_next_index_string(return_value, (*node_pp)->name, 1);
+	}
+}
+
+PHP_METHOD(RedisCluster, _slot)
+{
+	zval *object, *z_key;
+	RedisCluster *c;
+
+	if (zend_parse_method_parameters(ZEND_NUM_ARGS() TSRMLS_CC, getThis(), "Oz",
+				&object, redis_cluster_ce, &z_key) == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	if (redis_cluster_get(object, &c TSRMLS_CC) < 0) {
+		RETURN_FALSE;
+	}
+
+	RETURN_LONG(cluster_key_slot(c, z_key));
+}
+
+PHP_METHOD(RedisCluster, _target)
+{
+	zval *object, *z_key;
+	RedisCluster *c;
+	redisClusterNode *node;
+
+	if (zend_parse_method_parameters(ZEND_NUM_ARGS() TSRMLS_CC, getThis(), "Oz",
+				&object, redis_cluster_ce, &z_key) == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	if (redis_cluster_get(object, &c TSRMLS_CC) < 0) {
+		RETURN_FALSE;
+	}
+
+	cluster_shm_sync(c TSRMLS_CC);
+	if((node = c->slots[cluster_key_slot(c, z_key)])) {
+		RETURN_STRING(node->name, 1);
+	}
+
+	RETURN_NULL();
+}
+
+PHP_METHOD(RedisCluster, _instance)
+{
+	zval *object;
+	RedisCluster *c;
+	redisClusterNode **node_pp;
+	char *target;
+	int target_len;
+
+	if (zend_parse_method_parameters(ZEND_NUM_ARGS() TSRMLS_CC, getThis(), "Os",
+				&object, redis_cluster_ce, &target, &target_len) == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	if (redis_cluster_get(object, &c TSRMLS_CC) < 0) {
+		RETURN_FALSE;
+	}
+
+	if(zend_hash_find(c->nodes, target, target_len + 1, (void**)&node_pp) == SUCCESS) {
+		RETURN_ZVAL((*node_pp)->z_redis, 1, 0);
+	}
+
+	RETURN_NULL();
+}
+
+/* {{{ proto bool RedisCluster::_remap()
+    Reload the slot map from the cluster */
+PHP_METHOD(RedisCluster, _remap)
+{
+	zval *object;
+	RedisCluster *c;
+
+	if (zend_parse_method_parameters(ZEND_NUM_ARGS() TSRMLS_CC, getThis(), "O",
+				&object, redis_cluster_ce) == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	if (redis_cluster_get(object, &c TSRMLS_CC) < 0) {
+		RETURN_FALSE;
+	}
+
+	RETURN_BOOL(cluster_remap(c, cluster_node_any(c) TSRMLS_CC) == 0);
+}
+/* }}} */
+
+PHP_METHOD(RedisCluster, getOption)
+{
+	zval *object, z_fun, *z_args[1];
+	RedisCluster *c;
+	redisClusterNode *node;
+	long opt;
+
+	if (zend_parse_method_parameters(ZEND_NUM_ARGS() TSRMLS_CC, getThis(), "Ol",
+				&object, redis_cluster_ce, &opt) == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	if (redis_cluster_get(object, &c TSRMLS_CC) < 0 || !(node = cluster_node_any(c))) {
+		RETURN_FALSE;
+	}
+
+	/* all nodes share the same options, ask any of them */
+	ZVAL_STRING(&z_fun, "getOption", 0);
+	MAKE_STD_ZVAL(z_args[0]);
+	ZVAL_LONG(z_args[0], opt);
+
+	call_user_function(&redis_ce->function_table, &node->z_redis, &z_fun, return_value, 1, z_args TSRMLS_CC);
+
+	zval_dtor(z_args[0]);
+	efree(z_args[0]);
+}
+
+PHP_METHOD(RedisCluster, setOption)
+{
+	zval *object, z_fun, z_ret, *z_args[2];
+	RedisCluster *c;
+	redisClusterNode **node_pp;
+	HashPosition pos;
+	char *val;
+	int val_len;
+	long opt;
+	zend_bool ok = 1;
+
+	if (zend_parse_method_parameters(ZEND_NUM_ARGS() TSRMLS_CC, getThis(), "Ols",
+				&object, redis_cluster_ce, &opt, &val, &val_len) == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	if (redis_cluster_get(object, &c TSRMLS_CC) < 0) {
+		RETURN_FALSE;
+	}
+
+	/* prepare call */
+	ZVAL_STRING(&z_fun, "setOption", 0);
+	MAKE_STD_ZVAL(z_args[0]);
+	ZVAL_LONG(z_args[0], opt);
+	MAKE_STD_ZVAL(z_args[1]);
+	ZVAL_STRINGL(z_args[1], val, val_len, 1);
+
+	/* apply to every node we have */
+	for(zend_hash_internal_pointer_reset_ex(c->nodes, &pos);
+		zend_hash_get_current_data_ex(c->nodes, (void**)&node_pp, &pos) == SUCCESS;
+		zend_hash_move_forward_ex(c->nodes, &pos))
+	{
+		call_user_function(&redis_ce->function_table, &(*node_pp)->z_redis, &z_fun, &z_ret, 2, z_args TSRMLS_CC);
+		if(Z_TYPE(z_ret) != IS_BOOL || !Z_BVAL(z_ret)) {
+			ok = 0;
+		}
+		zval_dtor(&z_ret);
+	}
+
+	if(ok) {
+		/* keep it for nodes we discover later on */
+		add_index_stringl(c->z_opts, opt, val, val_len, 1);
+
+		if(opt == REDIS_OPT_PREFIX) {
+			if(c->prefix) {
+				efree(c->prefix);
+				c->prefix = NULL;
+			}
+			c->prefix_len = val_len;
+			if(val_len) {
+				c->prefix = estrndup(val, val_len);
+			}
+		}
+	}
+
+	zval_dtor(z_args[0]);
+	efree(z_args[0]);
+	zval_dtor(z_args[1]);
+	efree(z_args[1]);
+
+	RETURN_BOOL(ok);
+}
+
+/* Group the keys of a multi-key command by slot, in a single pass.  Each
+ * group gets the arguments to send (keys, or key => value pairs for MSET)
+ * and the positions these keys were given at. */
+static void
+cluster_group_by_slot(RedisCluster *c, HashTable *h_keys, int use_keys,
+					  zval *z_groups, zval *z_positions TSRMLS_DC)
+{
+	zval **z_val, *z_args, **z_args_pp, *z_pos, **z_pos_pp, z_key;
+	char *str_key;
+	unsigned int str_key_len;
+	unsigned long idx;
+	HashPosition pos;
+	int i, slot, key_type = 0;
+
+	array_init(z_groups);
+	array_init(z_positions);
+
+	for(i = 0, zend_hash_internal_pointer_reset_ex(h_keys, &pos);
+		zend_hash_get_current_data_ex(h_keys, (void**)&z_val, &pos) == SUCCESS;
+		i++, zend_hash_move_forward_ex(h_keys, &pos))
+	{
+		if(use_keys) {
+			INIT_ZVAL(z_key);
+			key_type = zend_hash_get_current_key_ex(h_keys, &str_key, &str_key_len, &idx, 0, &pos);
+			if(key_type == HASH_KEY_IS_STRING) {
+				ZVAL_STRINGL(&z_key, str_key, str_key_len - 1, 0);
+			} else {
+				ZVAL_LONG(&z_key, idx);
+			}
+			slot = cluster_key_slot(c, &z_key);
+		} else {
+			slot = cluster_key_slot(c, *z_val);
+		}
+
+		if(zend_hash_index_find(Z_ARRVAL_P(z_groups), slot, (void**)&z_args_pp) == FAILURE) {
+			MAKE_STD_ZVAL(z_args);
+			array_init(z_args);
+			add_index_zval(z_groups, slot, z_args);
+			MAKE_STD_ZVAL(z_pos);
+			array_init(z_pos);
+			add_index_zval(z_positions, slot, z_pos);
+		} else {
+			z_args = *z_args_pp;
+			zend_hash_index_find(Z_ARRVAL_P(z_positions), slot, (void**)&z_pos_pp);
+			z_pos = *z_pos_pp;
+		}
+
+		Z_ADDREF_PP(z_val);
+		if(!use_keys) {
+			add_next_index_zval(z_args, *z_val);
+		} else if(key_type == HASH_KEY_IS_STRING) {
+			add_assoc_zval_ex(z_args, str_key, str_key_len, *z_val);
+		} else {
+			add_index_zval(z_args, idx, *z_val);
+		}
+		add_next_index_long(z_pos, i);
+	}
+}
+
+/* Run a multi-key command once per slot group, handing each reply to a callback */
+typedef void (*cluster_group_cb)(zval *return_value, zval *z_pos, zval *z_ret);
+
+static void
+cluster_multi_key_cmd(INTERNAL_FUNCTION_PARAMETERS, RedisCluster *c, HashTable *h_keys,
+					  int use_keys, const char *cmd, int cmd_len, cluster_group_cb cb)
+{
+	zval z_groups, z_positions, **z_args_pp, **z_pos_pp, z_ret;
+	char *str_key;
+	unsigned int str_key_len;
+	unsigned long slot;
+	HashPosition pos;
+
+	cluster_group_by_slot(c, h_keys, use_keys, &z_groups, &z_positions TSRMLS_CC);
+
+	for(zend_hash_internal_pointer_reset_ex(Z_ARRVAL(z_groups), &pos);
+		zend_hash_get_current_data_ex(Z_ARRVAL(z_groups), (void**)&z_args_pp, &pos) == SUCCESS;
+		zend_hash_move_forward_ex(Z_ARRVAL(z_groups), &pos))
+	{
+		zend_hash_get_current_key_ex(Z_ARRVAL(z_groups), &str_key, &str_key_len, &slot, 0, &pos);
+		zend_hash_index_find(Z_ARRVAL(z_positions), slot, (void**)&z_pos_pp);
+
+		INIT_ZVAL(z_ret);
+		cluster_forward_call(CLUSTER_PARAM_PASSTHRU_RV(&z_ret), c, (int)slot, cmd, cmd_len, 1, z_args_pp);
+		cb(return_value, *z_pos_pp, &z_ret);
+		zval_dtor(&z_ret);
+
+		if(EG(exception)) {
+			break;
+		}
+	}
+
+	zval_dtor(&z_groups);
+	zval_dtor(&z_positions);
+}
+
+static void
+cluster_mget_cb(zval *return_value, zval *z_pos, zval *z_ret) {
+	zval **z_idx, **z_val;
+	HashPosition ppos, rpos;
+
+	/* place each value at the position its key was given at */
+	if(Z_TYPE_P(z_ret) == IS_ARRAY) {
+		zend_hash_internal_pointer_reset_ex(Z_ARRVAL_P(z_ret), &rpos);
+	}
+
+	for(zend_hash_internal_pointer_reset_ex(Z_ARRVAL_P(z_pos), &ppos);
+		zend_hash_get_current_data_ex(Z_ARRVAL_P(z_pos), (void**)&z_idx, &ppos) == SUCCESS;
+		zend_hash_move_forward_ex(Z_ARRVAL_P(z_pos), &ppos))
+	{
+		if(Z_TYPE_P(z_ret) == IS_ARRAY &&
+		   zend_hash_get_current_data_ex(Z_ARRVAL_P(z_ret), (void**)&z_val, &rpos) == SUCCESS)
+		{
+			Z_ADDREF_PP(z_val);
+			add_index_zval(return_value, Z_LVAL_PP(z_idx), *z_val);
+			zend_hash_move_forward_ex(Z_ARRVAL_P(z_ret), &rpos);
+		} else {
+			add_index_bool(return_value, Z_LVAL_PP(z_idx), 0);
+		}
+	}
+}
+
+static void
+cluster_mset_cb(zval *return_value, zval *z_pos, zval *z_ret) {
+	if(Z_TYPE_P(z_ret) != IS_BOOL || !Z_BVAL_P(z_ret)) {
+		ZVAL_FALSE(return_value);
+	}
+}
+
+static void
+cluster_del_cb(zval *return_value, zval *z_pos, zval *z_ret) {
+	if(Z_TYPE_P(z_ret) == IS_LONG) {
+		Z_LVAL_P(return_value) += Z_LVAL_P(z_ret);
+	}
+}
+
+/* {{{ proto array RedisCluster::mget(array keys) */
+PHP_METHOD(RedisCluster, mget)
+{
+	zval *object, *z_keys, **z_val, z_sorted;
+	RedisCluster *c;
+	long i;
+
+	if (zend_parse_method_parameters(ZEND_NUM_ARGS() TSRMLS_CC, getThis(), "Oa",
+				&object, redis_cluster_ce, &z_keys) == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	if (redis_cluster_get(object, &c TSRMLS_CC) < 0) {
+		RETURN_FALSE;
+	}
+
+	array_init(&z_sorted);
+	cluster_multi_key_cmd(CLUSTER_PARAM_PASSTHRU_RV(&z_sorted), c,
+		Z_ARRVAL_P(z_keys), 0, "mget", sizeof("mget")-1, cluster_mget_cb);
+
+	/* values were filled in slot order, return them in key order */
+	array_init(return_value);
+	for(i = 0; i < zend_hash_num_elements(Z_ARRVAL_P(z_keys)); i++) {
+		if(zend_hash_index_find(Z_ARRVAL(z_sorted), i, (void**)&z_val) == SUCCESS) {
+			Z_ADDREF_PP(z_val);
+			add_next_index_zval(return_value, *z_val);
+		} else {
+			add_next_index_bool(return_value, 0);
+		}
+	}
+	zval_dtor(&z_sorted);
+}
+/* }}} */
+
+/* {{{ proto bool RedisCluster::mset(array pairs) */
+PHP_METHOD(RedisCluster, mset)
+{
+	zval *object, *z_pairs;
+	RedisCluster *c;
+
+	if (zend_parse_method_parameters(ZEND_NUM_ARGS() TSRMLS_CC, getThis(), "Oa",
+				&object, redis_cluster_ce, &z_pairs) == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	if (redis_cluster_get(object, &c TSRMLS_CC) < 0) {
+		RETURN_FALSE;
+	}
+
+	ZVAL_TRUE(return_value);
+	cluster_multi_key_cmd(INTERNAL_FUNCTION_PARAM_PASSTHRU, c,
+		Z_ARRVAL_P(z_pairs), 1, "mset", sizeof("mset")-1, cluster_mset_cb);
+}
+/* }}} */
+
+/* {{{ proto long RedisCluster::del(string key | array keys, ...) */
+PHP_METHOD(RedisCluster, del)
+{
+	zval **z_args, *z_keys;
+	RedisCluster *c;
+	int argc = ZEND_NUM_ARGS(), i;
+
+	if (redis_cluster_get(getThis(), &c TSRMLS_CC) < 0) {
+		RETURN_FALSE;
+	}
+
+	/* keys can be given as an array, or as several arguments */
+	z_args = emalloc((argc ? argc : 1) * sizeof(zval*));
+	if(argc == 0 || zend_get_parameters_array(ht, argc, z_args) == FAILURE) {
+		efree(z_args);
+		RETURN_FALSE;
+	}
+
+	if(argc == 1 && Z_TYPE_P(z_args[0]) == IS_ARRAY) {
+		z_keys = z_args[0];
+		Z_ADDREF_P(z_keys);
+	} else {
+		MAKE_STD_ZVAL(z_keys);
+		array_init(z_keys);
+		for(i = 0; i < argc; i++) {
+			Z_ADDREF_P(z_args[i]);
+			add_next_index_zval(z_keys, z_args[i]);
+		}
+	}
+	efree(z_args);
+
+	ZVAL_LONG(return_value, 0);
+	cluster_multi_key_cmd(INTERNAL_FUNCTION_PARAM_PASSTHRU, c,
+		Z_ARRVAL_P(z_keys), 0, "del", sizeof("del")-1, cluster_del_cb);
+
+	zval_ptr_dtor(&z_keys);
+}
+/* }}} */
@@ -0,0 +1,71 @@
+#ifndef REDIS_CLUSTER_H
+#define REDIS_CLUSTER_H
+
+#include "common.h"
+
+/* Number of hash slots in a redis cluster, and the mask applied to CRC16 */
+#define REDIS_CLUSTER_SLOTS 16384
+#define REDIS_CLUSTER_MOD   (REDIS_CLUSTER_SLOTS - 1)
+
+/* How many MOVED/ASK hops we follow before giving up on a command */
+#define REDIS_CLUSTER_MAX_REDIRECTIONS 5
+
+/* Shared slot table: how many masters a map can name, and the longest
+ * host:port we can store for one. */
+#define REDIS_CLUSTER_SHM_NODES 1024
+#define REDIS_CLUSTER_SHM_NAME  64
+
+/* One cluster's slot map, shared by every process forked after MINIT.
+ * Writers serialize on lock and keep seq odd while they write; readers copy
+ * the map without locking and retry if seq moved under them. */
+typedef struct clusterShmMap_ {
+	volatile unsigned long id;		/* hash of the seeds, 0 while unused */
+	volatile int lock;				/* held by the process refreshing the map */
+	volatile unsigned long seq;		/* odd while a write is in progress */
+	volatile unsigned long epoch;	/* bumped on every refresh, 0 if never mapped */
+	unsigned short node_count;
+	char nodes[REDIS_CLUSTER_SHM_NODES][REDIS_CLUSTER_SHM_NAME];
+	unsigned short slots[REDIS_CLUSTER_SLOTS];	/* slot => node index + 1, 0 if unmapped */
+} clusterShmMap;
+
+void redis_destructor_redis_cluster(zend_rsrc_list_entry * rsrc TSRMLS_DC);
+
+PHP_METHOD(RedisCluster, __construct);
+PHP_METHOD(RedisCluster, __call);
+PHP_METHOD(RedisCluster, _masters);
+PHP_METHOD(RedisCluster, _target);
+PHP_METHOD(RedisCluster, _instance);
+PHP_METHOD(RedisCluster, _slot);
+PHP_METHOD(RedisCluster, _remap);
+
+PHP_METHOD(RedisCluster, mget);
+PHP_METHOD(RedisCluster, mset);
+PHP_METHOD(RedisCluster, del);
+PHP_METHOD(RedisCluster, getOption);
+PHP_METHOD(RedisCluster, setOption);
+
+typedef struct redisClusterNode_ {
+	char *name;				/* host:port */
+	zval *z_redis;			/* Redis instance bound to this node */
+} redisClusterNode;
+
+typedef struct RedisCluster_ {
+	HashTable *nodes;		/* host:port => redisClusterNode*, masters we know of */
+	redisClusterNode **slots;	/* slot => owning node, REDIS_CLUSTER_SLOTS entries */
+	double timeout;			/* socket connect timeout */
+	double read_timeout;	/* socket read timeout */
+	zend_bool persistent;	/* should we use pconnect */
+	zval *z_opts;			/* options set on the cluster, replayed on new nodes */
+	char *prefix;			/* key prefix, needed to hash keys like the nodes see them */
+	int prefix_len;
+	clusterShmMap *shm_map;	/* shared copy of our slot map, NULL if not cached */
+	unsigned long epoch;	/* epoch of the shared map our slots were loaded from */
+} RedisCluster;
+
+PHP_REDIS_API int redis_cluster_get(zval *id, RedisCluster **c TSRMLS_DC);
+unsigned short cluster_hash_key(const char *key, int key_len);
+
+int cluster_shm_startup(size_t maps);
+void cluster_shm_shutdown(void);
+
+#endif
@@ -0,0 +1,234 @@
+#ifndef REDIS_COMMANDS_H
+#define REDIS_COMMANDS_H
+
+/* What the routing layers (RedisArray, RedisCluster) need to know about each
+ * Redis method: whether it can write, and where its key is.  Keep this table
+ * sorted by name, since lookups binary search it.
+ *
+ *   X(method, flags, key)
+ *
+ * method - PHP method name, lower case, aliases listed separately
+ * flags  - REDIS_CMD_* below, 0 for a plain write command
+ * key    - index of the argument holding the key that routes the call
+ */
+#define REDIS_CMD_READONLY	0x01	/* never modifies the keyspace */
+#define REDIS_CMD_NOKEY		0x02	/* nothing to route on, any node will do */
+#define REDIS_CMD_EVAL		0x04	/* keys are in an array argument, counted by the one after it */
+#define REDIS_CMD_CONN		0x08	/* changes connection state (transactions, db, subscriptions) */
+
+#define REDIS_COMMAND_TABLE(X) \
+	X(append,              0, 0) \
+	X(auth,                REDIS_CMD_NOKEY, 0) \
+	X(bgrewriteaof,        REDIS_CMD_NOKEY, 0) \
+	X(bgsave,              REDIS_CMD_NOKEY, 0) \
+	X(bitcount,            REDIS_CMD_READONLY, 0) \
+	X(bitop,               0, 1) \
+	X(bitpos,              REDIS_CMD_READONLY, 0) \
+	X(blpop,               0, 0) \
+	X(brpop,               0, 0) \
+	X(brpoplpush,          0, 0) \
+	X(client,              REDIS_CMD_NOKEY, 0) \
+	X(config,              REDIS_CMD_NOKEY, 0) \
+	X(dbsize,              REDIS_CMD_READONLY | REDIS_CMD_NOKEY, 0) \
+	X(debug,               REDIS_CMD_READONLY, 0) \
+	X(decr,                0, 0) \
+	X(decrby,              0, 0) \
+	X(del,                 0, 0) \
+	X(delete,              0, 0) \
+	X(discard,             REDIS_CMD_NOKEY | REDIS_CMD_CONN, 0) \
+	X(dump,                REDIS_CMD_READONLY, 0) \
+	X(echo,                REDIS_CMD_READONLY | REDIS_CMD_NOKEY, 0) \
+	X(eval,                REDIS_CMD_EVAL, 0) \
+	X(evalsha,             REDIS_CMD_EVAL, 0) \
+	X(evaluate,            REDIS_CMD_EVAL, 0) \
+	X(evaluatesha,         REDIS_CMD_EVAL, 0) \
+	X(exec,                REDIS_CMD_NOKEY | REDIS_CMD_CONN, 0) \
+	X(exists,              REDIS_CMD_READONLY, 0) \
+	X(expire,              0, 0) \
+	X(expireat,            0, 0) \
+	X(flushall,            REDIS_CMD_NOKEY, 0) \
+	X(flushdb,             REDIS_CMD_NOKEY, 0) \
+	X(get,                 REDIS_CMD_READONLY, 0) \
+	X(getbit,              REDIS_CMD_READONLY, 0) \
+	X(getkeys,             REDIS_CMD_READONLY | REDIS_CMD_NOKEY, 0) \
+	X(getmultiple,         REDIS_CMD_READONLY, 0) \
+	X(getrange,            REDIS_CMD_READONLY, 0) \
+	X(getset,              0, 0) \
+	X(hdel,                0, 0) \
+	X(hexists,             REDIS_CMD_READONLY, 0) \
+	X(hget,                REDIS_CMD_READONLY, 0) \
+	X(hgetall,             REDIS_CMD_READONLY, 0) \
+	X(hincrby,             0, 0) \
+	X(hincrbyfloat,        0, 0) \
+	X(hkeys,               REDIS_CMD_READONLY, 0) \
+	X(hlen,                REDIS_CMD_READONLY, 0) \
+	X(hmget,               REDIS_CMD_READONLY, 0) \
+	X(hmset,               0, 0) \
+	X(hscan,               REDIS_CMD_READONLY, 0) \
+	X(hset,                0, 0) \
+	X(hsetnx,              0, 0) \
+	X(hvals,               REDIS_CMD_READONLY, 0) \
+	X(incr,                0, 0) \
+	X(incrby,              0, 0) \
+	X(incrbyfloat,         0, 0) \
+	X(info,                REDIS_CMD_READONLY | REDIS_CMD_NOKEY, 0) \
+	X(keys,                REDIS_CMD_READONLY | REDIS_CMD_NOKEY, 0) \
+	X(lastsave,            REDIS_CMD_READONLY | REDIS_CMD_NOKEY, 0) \
+	X(lget,                REDIS_CMD_READONLY, 0) \
+	X(lgetrange,           REDIS_CMD_READONLY, 0) \
+	X(lindex,              REDIS_CMD_READONLY, 0) \
+	X(linsert,             0, 0) \
+	X(listtrim,            0, 0) \
+	X(llen,                REDIS_CMD_READONLY, 0) \
+	X(lpop,                0, 0) \
+	X(lpush,               0, 0) \
+	X(lpushx,              0, 0) \
+	X(lrange,              REDIS_CMD_READONLY, 0) \
+	X(lrem,                0, 0) \
+	X(lremove,             0, 0) \
+	X(lset,                0, 0) \
+	X(lsize,               REDIS_CMD_READONLY, 0) \
+	X(ltrim,               0, 0) \
+	X(mget,                REDIS_CMD_READONLY, 0) \
+	X(migrate,             0, 2) \
+	X(move,                0, 0) \
+	X(mset,                0, 0) \
+	X(msetnx,              0, 0) \
+	X(multi,               REDIS_CMD_NOKEY | REDIS_CMD_CONN, 0) \
+	X(object,              REDIS_CMD_READONLY, 1) \
+	X(persist,             0, 0) \
+	X(pexpire,             0, 0) \
+	X(pexpireat,           0, 0) \
+	X(pfadd,               0, 0) \
+	X(pfcount,             REDIS_CMD_READONLY, 0) \
+	X(pfmerge,             0, 0) \
+	X(ping,                REDIS_CMD_READONLY | REDIS_CMD_NOKEY, 0) \
+	X(pipeline,            REDIS_CMD_NOKEY | REDIS_CMD_CONN, 0) \
+	X(psetex,              0, 0) \
+	X(psubscribe,          REDIS_CMD_NOKEY | REDIS_CMD_CONN, 0) \
+	X(pttl,                REDIS_CMD_READONLY, 0) \
+	X(publish,             0, 0) \
+	X(pubsub,              REDIS_CMD_NOKEY, 0) \
+	X(punsubscribe,        REDIS_CMD_NOKEY, 0) \
+	X(randomkey,           REDIS_CMD_READONLY | REDIS_CMD_NOKEY, 0) \
+	X(rawcommand,          REDIS_CMD_NOKEY, 0) \
+	X(rename,              0, 0) \
+	X(renamekey,           0, 0) \
+	X(renamenx,            0, 0) \
+	X(resetstat,           REDIS_CMD_NOKEY, 0) \
+	X(restore,             0, 0) \
+	X(rpop,                0, 0) \
+	X(rpoplpush,           0, 0) \
+	X(rpush,               0, 0) \
+	X(rpushx,              0, 0) \
+	X(sadd,                0, 0) \
+	X(save,                REDIS_CMD_NOKEY, 0) \
+	X(scan,                REDIS_CMD_READONLY | REDIS_CMD_NOKEY, 0) \
+	X(scard,               REDIS_CMD_READONLY, 0) \
+	X(scontains,           REDIS_CMD_READONLY, 0) \
+	X(script,              REDIS_CMD_NOKEY, 0) \
+	X(sdiff,               REDIS_CMD_READONLY, 0) \
+	X(sdiffstore,          0, 0) \
+	X(select,              REDIS_CMD_NOKEY | REDIS_CMD_CONN, 0) \
+	X(sendecho,            REDIS_CMD_READONLY | REDIS_CMD_NOKEY, 0) \
+	X(set,                 0, 0) \
+	X(setbit,              0, 0) \
+	X(setex,               0, 0) \
+	X(setnx,               0, 0) \
+	X(setrange,            0, 0) \
+	X(settimeout,          0, 0) \
+	X(sgetmembers,         REDIS_CMD_READONLY, 0) \
+	X(sinter,              REDIS_CMD_READONLY, 0) \
+	X(sinterstore,         0, 0) \
+	X(sismember,           REDIS_CMD_READONLY, 0) \
+	X(slaveof,             REDIS_CMD_NOKEY, 0) \
+	X(slowlog,             REDIS_CMD_NOKEY, 0) \
+	X(smembers,            REDIS_CMD_READONLY, 0) \
+	X(smove,               0, 0) \
+	X(sort,                0, 0) \
+	X(sortasc,             0, 0) \
+	X(sortascalpha,        0, 0) \
+	X(sortdesc,            0, 0) \
+	X(sortdescalpha,       0, 0) \
+	X(spop,                0, 0) \
+	X(srandmember,         REDIS_CMD_READONLY, 0) \
+	X(srem,                0, 0) \
+	X(sremove,             0, 0) \
+	X(sscan,               REDIS_CMD_READONLY, 0) \
+	X(ssize,               REDIS_CMD_READONLY, 0) \
+	X(strlen,              REDIS_CMD_READONLY, 0) \
+	X(subscribe,           REDIS_CMD_NOKEY | REDIS_CMD_CONN, 0) \
+	X(substr,              REDIS_CMD_READONLY, 0) \
+	X(sunion,              REDIS_CMD_READONLY, 0) \
+	X(sunionstore,         0, 0) \
+	X(time,                REDIS_CMD_READONLY | REDIS_CMD_NOKEY, 0) \
+	X(ttl,                 REDIS_CMD_READONLY, 0) \
+	X(type,                REDIS_CMD_READONLY, 0) \
+	X(unsubscribe,         REDIS_CMD_NOKEY, 0) \
+	X(unwatch,             REDIS_CMD_NOKEY | REDIS_CMD_CONN, 0) \
+	X(wait,                REDIS_CMD_NOKEY, 0) \
+	X(watch,               REDIS_CMD_CONN, 0) \
+	X(zadd,                0, 0) \
+	X(zcard,               REDIS_CMD_READONLY, 0) \
+	X(zcount,              REDIS_CMD_READONLY, 0) \
+	X(zdelete,             0, 0) \
+	X(zdeleterangebyrank,  0, 0) \
+	X(zdeleterangebyscore, 0, 0) \
+	X(zincrby,             0, 0) \
+	X(zinter,              0, 0) \
+	X(zinterstore,         0, 0) \
+	X(zrange,              REDIS_CMD_READONLY, 0) \
+	X(zrangebylex,         REDIS_CMD_READONLY, 0) \
+	X(zrangebyscore,       REDIS_CMD_READONLY, 0) \
+	X(zrank,               REDIS_CMD_READONLY, 0) \
+	X(zrem,                0, 0) \
+	X(zremove,             0, 0) \
+	X(zremoverangebyscore, 0, 0) \
+	X(zremrangebyrank,     0, 0) \
+	X(zremrangebyscore,    0, 0) \
+	X(zreverserange,       REDIS_CMD_READONLY, 0) \
+	X(zrevrange,           REDIS_CMD_READONLY, 0) \
+	X(zrevrangebyscore,    REDIS_CMD_READONLY, 0) \
+	X(zrevrank,            REDIS_CMD_READONLY, 0) \
+	X(zscan,               REDIS_CMD_READONLY, 0) \
+	X(zscore,              REDIS_CMD_READONLY, 0) \
+	X(zsize,               REDIS_CMD_READONLY, 0) \
+	X(zunion,              0, 0) \
+	X(zunionstore,         0, 0)
+
+/* Methods that send one command on one key and read one reply.  Their
+ * bodies are generated from this table, see REDIS_KEY_METHOD in redis.c;
+ * their routing is in the table above like any other.
+ *
+ *   K(method, keyword, reply)
+ *
+ * method  - PHP method name, as declared in php_redis.h
+ * keyword - the Redis command sent
+ * reply   - the callback reading its reply, a redisReplyFn
+ */
+#define REDIS_KEY_METHOD_TABLE(K) \
+	K(dump,    "DUMP",    redis_ping_response) \
+	K(exists,  "EXISTS",  redis_1_response) \
+	K(hLen,    "HLEN",    redis_long_response) \
+	K(lPop,    "LPOP",    redis_string_response) \
+	K(lSize,   "LLEN",    redis_long_response) \
+	K(persist, "PERSIST", redis_1_response) \
+	K(pttl,    "PTTL",    redis_long_response) \
+	K(rPop,    "RPOP",    redis_string_response) \
+	K(sPop,    "SPOP",    redis_string_response) \
+	K(sSize,   "SCARD",   redis_long_response) \
+	K(strlen,  "STRLEN",  redis_long_response) \
+	K(ttl,     "TTL",     redis_long_response) \
+	K(type,    "TYPE",    redis_type_response) \
+	K(zCard,   "ZCARD",   redis_long_response)
+
+typedef struct redisCommand_ {
+	const char *name;
+	int name_len;
+	int flags;
+	int key_pos;
+} redisCommand;
+
+const redisCommand *redis_command_find(const char *name, int name_len);
+
+#endif
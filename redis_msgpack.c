@@ -0,0 +1,446 @@
+/* -*- Mode: C; tab-width: 4 -*- */
+/*
+  +----------------------------------------------------------------------+
+  | PHP Version 5                                                        |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 1997-2009 The PHP Group                                |
+  +----------------------------------------------------------------------+
+  | This source file is subject to version 3.01 of the PHP license,      |
+  | that is bundled with this package in the file LICENSE, and is        |
+  | available through the world-wide-web at the following url:           |
+  | http://www.php.net/license/3_01.txt                                  |
+  | If you did not receive a copy of the PHP license and are unable to   |
+  | obtain it through the world-wide-web, please send a note to          |
+  | license@php.net so we can mail you a copy immediately.               |
+  +----------------------------------------------------------------------+
+*/
+
+/*
+ * MessagePack (https://msgpack.org) for SERIALIZER_MSGPACK, so that values
+ * can be read by clients in other languages.  PHP values map to msgpack as:
+ *
+ *   null, bool, int, float  nil, bool, the smallest int, float 64
+ *   string                  str
+ *   list (keys 0..n-1)      array
+ *   other array             map, with int or str keys
+ *   object                  map of its public properties
+ *
+ * Unpacking gives back the same, bin as string, float 32 as float, and
+ * integers too large for a long as float.  Extension types are refused.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef PHP_WIN32
+#include "win32/php_stdint.h"
+#else
+#include <stdint.h>
+#endif
+#include <limits.h>
+#include "common.h"
+#include <ext/standard/php_smart_str.h>
+#include "php_redis.h"
+#include "redis_msgpack.h"
+
+static void msgpack_put8(smart_str *buf, unsigned char type, uint8_t v) {
+    smart_str_appendc(buf, type);
+    smart_str_appendc(buf, (char)v);
+}
+
+static void msgpack_put16(smart_str *buf, unsigned char type, uint16_t v) {
+    char b[3];
+
+    b[0] = type;
+    b[1] = (char)(v >> 8);
+    b[2] = (char)v;
+    smart_str_appendl(buf, b, 3);
+}
+
+static void msgpack_put32(smart_str *buf, unsigned char type, uint32_t v) {
+    char b[5];
+
+    b[0] = type;
+    b[1] = (char)(v >> 24);
+    b[2] = (char)(v >> 16);
+    b[3] = (char)(v >> 8);
+    b[4] = (char)v;
+    smart_str_appendl(buf, b, 5);
+}
+
+static void msgpack_put64(smart_str *buf, unsigned char type, uint64_t v) {
+    char b[9];
+    int i;
+
+    b[0] = type;
+    for (i = 8; i > 0; i--) {
+        b[i] = (char)v;
+        v >>= 8;
+    }
+    smart_str_appendl(buf, b, 9);
+}
+
+static void msgpack_pack_long(smart_str *buf, long l) {
+    if (l >= 0) {
+        if (l < 128) {
+            smart_str_appendc(buf, (char)l);
+        } else if (l <= 0xff) {
+            msgpack_put8(buf, 0xcc, (uint8_t)l);
+        } else if (l <= 0xffff) {
+            msgpack_put16(buf, 0xcd, (uint16_t)l);
+        } else if ((uint64_t)l <= 0xffffffffULL) {
+            msgpack_put32(buf, 0xce, (uint32_t)l);
+        } else {
+            msgpack_put64(buf, 0xcf, (uint64_t)l);
+        }
+    } else {
+        if (l >= -32) {
+            smart_str_appendc(buf, (char)l);
+        } else if (l >= -128) {
+            msgpack_put8(buf, 0xd0, (uint8_t)l);
+        } else if (l >= -32768) {
+            msgpack_put16(buf, 0xd1, (uint16_t)l);
+        } else if ((int64_t)l >= -2147483647LL - 1) {
+            msgpack_put32(buf, 0xd2, (uint32_t)l);
+        } else {
+            msgpack_put64(buf, 0xd3, (uint64_t)l);
+        }
+    }
+}
+
+static void msgpack_pack_str(smart_str *buf, const char *s, int len) {
+    if (len < 32) {
+        smart_str_appendc(buf, (char)(0xa0 | len));
+    } else if (len <= 0xff) {
+        msgpack_put8(buf, 0xd9, (uint8_t)len);
+    } else if (len <= 0xffff) {
+        msgpack_put16(buf, 0xda, (uint16_t)len);
+    } else {
+        msgpack_put32(buf, 0xdb, (uint32_t)len);
+    }
+    smart_str_appendl(buf, s, len);
+}
+
+static void msgpack_pack_header(smart_str *buf, int map, uint32_t n) {
+    if (n < 16) {
+        smart_str_appendc(buf, (char)((map ? 0x80 : 0x90) | n));
+    } else if (n <= 0xffff) {
+        msgpack_put16(buf, map ? 0xde : 0xdc, (uint16_t)n);
+    } else {
+        msgpack_put32(buf, map ? 0xdf : 0xdd, (uint32_t)n);
+    }
+}
+
+static void msgpack_pack_zval(smart_str *buf, zval *z, int depth TSRMLS_DC);
+
+/* A list if its keys are 0..n-1 in order, else a map */
+static void msgpack_pack_hash(smart_str *buf, HashTable *ht, int is_obj, int depth TSRMLS_DC) {
+    HashPosition pos;
+    zval **z_ele;
+    char *key;
+    uint key_len;
+    ulong idx, n = 0, count = 0;
+    int type, is_list = !is_obj;
+
+    for (zend_hash_internal_pointer_reset_ex(ht, &pos);
+         zend_hash_get_current_data_ex(ht, (void**)&z_ele, &pos) == SUCCESS;
+         zend_hash_move_forward_ex(ht, &pos))
+    {
+        type = zend_hash_get_current_key_ex(ht, &key, &key_len, &idx, 0, &pos);
+        /* only the public properties of objects */
+        if (is_obj && (type != HASH_KEY_IS_STRING || key[0] == '\0')) {
+            continue;
+        }
+        if (type != HASH_KEY_IS_LONG || idx != n) {
+            is_list = 0;
+        }
+        n++;
+    }
+
+    msgpack_pack_header(buf, !is_list, (uint32_t)n);
+
+    for (zend_hash_internal_pointer_reset_ex(ht, &pos);
+         count < n && zend_hash_get_current_data_ex(ht, (void**)&z_ele, &pos) == SUCCESS;
+         zend_hash_move_forward_ex(ht, &pos))
+    {
+        type = zend_hash_get_current_key_ex(ht, &key, &key_len, &idx, 0, &pos);
+        if (is_obj && (type != HASH_KEY_IS_STRING || key[0] == '\0')) {
+            continue;
+        }
+        if (!is_list) {
+            if (type == HASH_KEY_IS_STRING) {
+                msgpack_pack_str(buf, key, key_len - 1);
+            } else {
+                msgpack_pack_long(buf, (long)idx);
+            }
+        }
+        msgpack_pack_zval(buf, *z_ele, depth + 1 TSRMLS_CC);
+        count++;
+    }
+}
+
+static void msgpack_pack_zval(smart_str *buf, zval *z, int depth TSRMLS_DC) {
+    union { double d; uint64_t u; } dbl;
+
+    if (depth > REDIS_MSGPACK_MAX_DEPTH) {
+        php_error_docref(NULL TSRMLS_CC, E_WARNING, "Value nested too deep (or recursive), packed as null");
+        smart_str_appendc(buf, (char)0xc0);
+        return;
+    }
+
+    switch (Z_TYPE_P(z)) {
+        case IS_BOOL:
+            smart_str_appendc(buf, Z_BVAL_P(z) ? (char)0xc3 : (char)0xc2);
+            break;
+        case IS_LONG:
+            msgpack_pack_long(buf, Z_LVAL_P(z));
+            break;
+        case IS_DOUBLE:
+            dbl.d = Z_DVAL_P(z);
+            msgpack_put64(buf, 0xcb, dbl.u);
+            break;
+        case IS_STRING:
+            msgpack_pack_str(buf, Z_STRVAL_P(z), Z_STRLEN_P(z));
+            break;
+        case IS_ARRAY:
+            msgpack_pack_hash(buf, Z_ARRVAL_P(z), 0, depth TSRMLS_CC);
+            break;
+        case IS_OBJECT:
+            msgpack_pack_hash(buf, Z_OBJPROP_P(z), 1, depth TSRMLS_CC);
+            break;
+        default:
+            smart_str_appendc(buf, (char)0xc0);
+            break;
+    }
+}
+
+/* Append the msgpack encoding of a value */
+PHP_REDIS_API void redis_msgpack_pack(smart_str *buf, zval *z TSRMLS_DC) {
+    msgpack_pack_zval(buf, z, 0 TSRMLS_CC);
+}
+
+typedef struct {
+    const unsigned char *p;
+    const unsigned char *end;
+} msgpack_reader;
+
+static int msgpack_get(msgpack_reader *r, int len, uint64_t *v) {
+    int i;
+
+    if (r->end - r->p < len) {
+        return -1;
+    }
+    for (*v = 0, i = 0; i < len; i++) {
+        *v = (*v << 8) | *r->p++;
+    }
+    return 0;
+}
+
+static int msgpack_unpack_zval(msgpack_reader *r, zval *z, int depth TSRMLS_DC);
+
+static int msgpack_unpack_str(msgpack_reader *r, zval *z, uint64_t len) {
+    if ((uint64_t)(r->end - r->p) < len) {
+        return -1;
+    }
+    ZVAL_STRINGL(z, (const char*)r->p, (int)len, 1);
+    r->p += len;
+    return 0;
+}
+
+static int msgpack_unpack_array(msgpack_reader *r, zval *z, uint64_t n, int depth TSRMLS_DC) {
+    zval *z_ele;
+
+    /* every element takes at least a byte */
+    if ((uint64_t)(r->end - r->p) < n) {
+        return -1;
+    }
+    array_init_size(z, (uint)n);
+    for (; n > 0; n--) {
+        MAKE_STD_ZVAL(z_ele);
+        if (msgpack_unpack_zval(r, z_ele, depth + 1 TSRMLS_CC) < 0) {
+            zval_ptr_dtor(&z_ele);
+            return -1;
+        }
+        add_next_index_zval(z, z_ele);
+    }
+    return 0;
+}
+
+/* Keys become what PHP would make of them as array keys */
+static int msgpack_unpack_map(msgpack_reader *r, zval *z, uint64_t n, int depth TSRMLS_DC) {
+    zval z_key, *z_ele;
+    int ret;
+
+    if ((uint64_t)(r->end - r->p) < n * 2) {
+        return -1;
+    }
+    array_init_size(z, (uint)n);
+    for (; n > 0; n--) {
+        if (msgpack_unpack_zval(r, &z_key, depth + 1 TSRMLS_CC) < 0) {
+            zval_dtor(&z_key);
+            return -1;
+        }
+        MAKE_STD_ZVAL(z_ele);
+        if (msgpack_unpack_zval(r, z_ele, depth + 1 TSRMLS_CC) < 0) {
+            zval_ptr_dtor(&z_ele);
+            zval_dtor(&z_key);
+            return -1;
+        }
+
+        ret = 0;
+        switch (Z_TYPE(z_key)) {
+            case IS_LONG:
+            case IS_BOOL:
+                add_index_zval(z, Z_LVAL(z_key), z_ele);
+                break;
+            case IS_DOUBLE:
+                add_index_zval(z, (long)Z_DVAL(z_key), z_ele);
+                break;
+            case IS_NULL:
+                add_assoc_zval_ex(z, "", 1, z_ele);
+                break;
+            case IS_STRING:
+                add_assoc_zval_ex(z, Z_STRVAL(z_key), Z_STRLEN(z_key) + 1, z_ele);
+                break;
+            default:
+                zval_ptr_dtor(&z_ele);
+                ret = -1;
+                break;
+        }
+        zval_dtor(&z_key);
+        if (ret < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Unpack one value into z.  On failure z is left as something that can be
+ * destroyed. */
+static int msgpack_unpack_zval(msgpack_reader *r, zval *z, int depth TSRMLS_DC) {
+    union { double d; uint64_t u; } dbl;
+    union { float f; uint32_t u; } flt;
+    uint64_t v;
+    unsigned char c;
+
+    INIT_PZVAL(z);
+    ZVAL_NULL(z);
+
+    if (depth > REDIS_MSGPACK_MAX_DEPTH || r->p >= r->end) {
+        return -1;
+    }
+
+    c = *r->p++;
+    if (c <= 0x7f) {
+        ZVAL_LONG(z, c);
+        return 0;
+    } else if (c >= 0xe0) {
+        ZVAL_LONG(z, (signed char)c);
+        return 0;
+    } else if ((c & 0xe0) == 0xa0) {
+        return msgpack_unpack_str(r, z, c & 0x1f);
+    } else if ((c & 0xf0) == 0x90) {
+        return msgpack_unpack_array(r, z, c & 0x0f, depth TSRMLS_CC);
+    } else if ((c & 0xf0) == 0x80) {
+        return msgpack_unpack_map(r, z, c & 0x0f, depth TSRMLS_CC);
+    }
+
+    switch (c) {
+        case 0xc0:
+            return 0;
+        case 0xc2:
+        case 0xc3:
+            ZVAL_BOOL(z, c == 0xc3);
+            return 0;
+
+        /* unsigned, past LONG_MAX as a float */
+        case 0xcc: case 0xcd: case 0xce: case 0xcf:
+            if (msgpack_get(r, 1 << (c - 0xcc), &v) < 0) {
+                return -1;
+            }
+            if (v > (uint64_t)LONG_MAX) {
+                ZVAL_DOUBLE(z, (double)v);
+            } else {
+                ZVAL_LONG(z, (long)v);
+            }
+            return 0;
+
+        /* signed, sign extended from their width */
+        case 0xd0: case 0xd1: case 0xd2: case 0xd3:
+            if (msgpack_get(r, 1 << (c - 0xd0), &v) < 0) {
+                return -1;
+            }
+            switch (c) {
+                case 0xd0: ZVAL_LONG(z, (int8_t)v); break;
+                case 0xd1: ZVAL_LONG(z, (int16_t)v); break;
+                case 0xd2: ZVAL_LONG(z, (int32_t)v); break;
+                default:
+                    if ((int64_t)v > LONG_MAX || (int64_t)v < LONG_MIN) {
+                        ZVAL_DOUBLE(z, (double)(int64_t)v);
+                    } else {
+                        ZVAL_LONG(z, (long)(int64_t)v);
+                    }
+                    break;
+            }
+            return 0;
+
+        case 0xca:
+            if (msgpack_get(r, 4, &v) < 0) {
+                return -1;
+            }
+            flt.u = (uint32_t)v;
+            ZVAL_DOUBLE(z, flt.f);
+            return 0;
+        case 0xcb:
+            if (msgpack_get(r, 8, &v) < 0) {
+                return -1;
+            }
+            dbl.u = v;
+            ZVAL_DOUBLE(z, dbl.d);
+            return 0;
+
+        /* str and bin are both strings to us */
+        case 0xd9: case 0xda: case 0xdb:
+            if (msgpack_get(r, 1 << (c - 0xd9), &v) < 0) {
+                return -1;
+            }
+            return msgpack_unpack_str(r, z, v);
+        case 0xc4: case 0xc5: case 0xc6:
+            if (msgpack_get(r, 1 << (c - 0xc4), &v) < 0) {
+                return -1;
+            }
+            return msgpack_unpack_str(r, z, v);
+
+        case 0xdc: case 0xdd:
+            if (msgpack_get(r, c == 0xdc ? 2 : 4, &v) < 0) {
+                return -1;
+            }
+            return msgpack_unpack_array(r, z, v, depth TSRMLS_CC);
+        case 0xde: case 0xdf:
+            if (msgpack_get(r, c == 0xde ? 2 : 4, &v) < 0) {
+                return -1;
+            }
+            return msgpack_unpack_map(r, z, v, depth TSRMLS_CC);
+
+        default:
+            /* extension types, and 0xc1 which is never used */
+            return -1;
+    }
+}
+
+/* Unpack a value, which must take the whole buffer.  Returns 0, or -1 with
+ * z left as NULL. */
+PHP_REDIS_API int redis_msgpack_unpack(const char *val, int val_len, zval *z TSRMLS_DC) {
+    msgpack_reader r;
+
+    r.p = (const unsigned char*)val;
+    r.end = r.p + val_len;
+
+    if (msgpack_unpack_zval(&r, z, 0 TSRMLS_CC) < 0 || r.p != r.end) {
+        zval_dtor(z);
+        ZVAL_NULL(z);
+        return -1;
+    }
+    return 0;
+}
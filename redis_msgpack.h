@@ -0,0 +1,12 @@
+#ifndef REDIS_MSGPACK_H
+#define REDIS_MSGPACK_H
+
+#include "common.h"
+
+/* nesting deeper than this is packed as nil, and refused when unpacking */
+#define REDIS_MSGPACK_MAX_DEPTH 512
+
+PHP_REDIS_API void redis_msgpack_pack(smart_str *buf, zval *z TSRMLS_DC);
+PHP_REDIS_API int redis_msgpack_unpack(const char *val, int val_len, zval *z TSRMLS_DC);
+
+#endif
@@ -189,6 +189,24 @@ class Redis_Test extends TestSuite
 	 $this->assertEquals($s, $this->redis->get('x'));
     }
 
+    public function testReplyBoundaries() {
+	 // replies straddling reads: many small values around large ones
+	 $this->redis->set('x', str_repeat('A', 100000));
+	 $this->redis->set('y', 'y');
+
+	 $pipe = $this->redis->multi(Redis::PIPELINE);
+	 for($i = 0; $i < 1000; $i++) {
+		 $pipe->get($i % 100 ? 'y' : 'x');
+	 }
+	 $ret = $pipe->exec();
+
+	 $this->assertEquals(1000, count($ret));
+	 for($i = 0; $i < 1000; $i++) {
+		 $this->assertEquals($i % 100 ? 'y' : str_repeat('A', 100000), $ret[$i]);
+	 }
+	 $this->assertEquals('y', $this->redis->get('y'));
+    }
+
 	public function testEcho() {
 		$this->assertEquals($this->redis->echo("hello"), "hello");
 		$this->assertEquals($this->redis->echo(""), "");
@@ -269,6 +287,29 @@ class Redis_Test extends TestSuite
         $this->assertEquals('42', gzuncompress($this->redis->get('key')));
     }
 
+    /* Values large enough to be written without being copied into the command */
+    public function testSetLargeValue() {
+        $big = str_repeat('0123456789', 300000);
+
+        $this->redis->del('key');
+        $this->assertTrue($this->redis->set('key', $big));
+        $this->assertEquals($big, $this->redis->get('key'));
+
+        $this->assertTrue($this->redis->set('key', $big, array('nx', 'ex' => 60)) === FALSE);
+        $this->assertTrue($this->redis->set('key', $big . 'x', array('xx', 'px' => 60000)));
+        $this->assertEquals($big . 'x', $this->redis->get('key'));
+
+        $this->assertTrue($this->redis->setex('key', 60, $big));
+        $this->assertEquals($big, $this->redis->getSet('key', 'small'));
+        $this->assertEquals(5 + strlen($big), $this->redis->append('key', $big));
+
+        // queued commands still go through the pipeline buffer
+        $this->redis->del('key');
+        $ret = $this->redis->pipeline()->setnx('key', $big)->get('key')->exec();
+        $this->assertTrue($ret === array(TRUE, $big));
+        $this->redis->del('key');
+    }
+
     /* Extended SET options for Redis >= 2.6.12 */
     public function testExtendedSet() {
         // Skip the test if we don't have a new enough version of Redis
@@ -958,6 +999,24 @@ class Redis_Test extends TestSuite
 	$this->redis->setOption(Redis::OPT_PREFIX, '');
     }
 
+    public function testMultiKeyPrefix() {
+        // Every key of a multi-key command gets the prefix
+        $this->redis->setOption(Redis::OPT_PREFIX, 'mk-prefix:');
+        $this->redis->mset(array('k1' => 'v1', 'k2' => 'v2', 3 => 'v3'));
+        $this->assertEquals(array('v1', 'v2', 'v3'), $this->redis->getMultiple(array('k1', 'k2', 3)));
+
+        $this->redis->del('s1', 's2', 'dst');
+        $this->redis->sAdd('s1', 'a', 'b');
+        $this->redis->sAdd('s2', 'b', 'c');
+        $this->assertEquals(array('b'), $this->redis->sInter('s1', 's2'));
+        $this->assertEquals(1, $this->redis->sInterStore('dst', array('s1', 's2')));
+
+        $this->redis->setOption(Redis::OPT_PREFIX, '');
+        $this->assertEquals(array('v1', 'v2', 'v3'), $this->redis->mget(array('mk-prefix:k1', 'mk-prefix:k2', 'mk-prefix:3')));
+        $this->assertEquals(array('b'), $this->redis->sMembers('mk-prefix:dst'));
+        $this->assertEquals(6, $this->redis->del('mk-prefix:k1', 'mk-prefix:k2', 'mk-prefix:3', 'mk-prefix:s1', 'mk-prefix:s2', 'mk-prefix:dst'));
+    }
+
     public function testSortAsc() {
 
 	$this->setupSort();
@@ -2137,6 +2196,24 @@ class Redis_Test extends TestSuite
 	$this->assertTrue(2.5 === $this->redis->zIncrBy('key', 1.5, 'val1'));
 	$this->assertTrue(2.5 === $this->redis->zScore('key', 'val1'));
 
+	// scores are sent with all the digits they need, and no more
+	$this->redis->delete('key');
+	foreach(array(0.1, 1/3, 1e-20, -2.5e300, 123456789012.5, -7.0) as $i => $score) {
+		$this->redis->zAdd('key', $score, 'm'.$i);
+		$this->assertTrue($score === $this->redis->zScore('key', 'm'.$i));
+	}
+	$this->assertTrue(0.1 + 1/3 === $this->redis->zIncrBy('key', 1/3, 'm0'));
+	$this->redis->zAdd('key', -0.0, 'neg0');
+	$this->assertEquals('-0', (string)$this->redis->zScore('key', 'neg0'));
+
+	// infinite scores come back infinite, not 0
+	$this->redis->delete('key');
+	$this->redis->zAdd('key', -INF, 'low', INF, 'high', 1, 'one');
+	$this->assertTrue(INF === $this->redis->zScore('key', 'high'));
+	$this->assertTrue(-INF === $this->redis->zScore('key', 'low'));
+	$this->assertTrue(array('low' => -INF, 'one' => 1.0, 'high' => INF) === $this->redis->zRange('key', 0, -1, true));
+	$this->assertTrue(array('high' => INF, 'one' => 1.0) === $this->redis->zRevRangeByScore('key', '+inf', 0, array('withscores' => TRUE)));
+
 	//zUnion
 	$this->redis->delete('key1');
 	$this->redis->delete('key2');
@@ -2477,6 +2554,17 @@ class Redis_Test extends TestSuite
 	$this->assertTrue('Object' === $h1['z']);
 	$this->assertTrue('' === $h1['t']);
 
+	// large hashes come back whole, numeric fields as integer keys
+	$this->redis->del('h');
+	$fields = array();
+	for($i = 0; $i < 5000; $i++) {
+		$fields['f'.$i] = 'v'.$i;
+	}
+	$fields[42] = 'answer';
+	$this->redis->hMset('h', $fields);
+	$this->assertTrue($fields == $this->redis->hGetAll('h'));
+	$this->assertTrue(5001 === count($this->redis->hGetAll('h')));
+	$this->redis->del('h');
     }
 
     public function testSetRange() {
@@ -2585,6 +2673,184 @@ class Redis_Test extends TestSuite
 	$this->assertTrue($ret === array('44')); // succeeded since we've cancel the WATCH command.
     }
 
+    public function testMultiBuffered() {
+	$this->redis->setOption(Redis::OPT_MULTI_BUFFER, 1);
+	$this->assertEquals(1, $this->redis->getOption(Redis::OPT_MULTI_BUFFER));
+
+	$this->sequence(Redis::MULTI);
+	$this->differentType(Redis::MULTI);
+
+	// watch still applies
+	$this->redis->set('x', '42');
+	$this->assertTrue($this->redis->watch('x'));
+	$r = new Redis();
+	$r->connect(self::HOST, self::PORT);
+	$r->set('x', '43');
+	$this->assertFalse($this->redis->multi()->get('x')->exec());
+
+	// nothing reaches the server before exec
+	$this->redis->del('x');
+	$this->redis->multi()->set('x', 'y');
+	$this->assertFalse($r->exists('x'));
+	$this->assertTrue($this->redis->discard());
+	$this->assertFalse($this->redis->exists('x'));
+
+	$this->assertEquals(array(TRUE, 'y'), $this->redis->multi()->set('x', 'y')->get('x')->exec());
+
+	// a command refused when queued aborts the whole transaction
+	if(version_compare($this->version, "2.6.5", "ge")) {
+		$this->redis->clearLastError();
+		$this->assertFalse($this->redis->multi()->set('x', 'z')->sInterStore('dst')->exec());
+		$this->assertTrue(strpos($this->redis->getLastError(), 'EXECABORT') === 0);
+		$this->assertEquals('y', $this->redis->get('x'));
+	}
+	$this->redis->setOption(Redis::OPT_MULTI_BUFFER, 0);
+    }
+
+    public function testAsync() {
+	$r = new Redis();
+	$r->connect(self::HOST, self::PORT);
+
+	$this->redis->set('x', 'a');
+	$h = array(
+		'x' => $this->redis->sendAsync('get', array('x')),
+		'incr' => $this->redis->sendAsync('incr', array('async-counter')),
+		'other' => $r->sendAsync('get', array('x')),
+	);
+	$ret = Redis::await($h, 1.0);
+	$this->assertEquals('a', $ret['x']);
+	$this->assertTrue(is_long($ret['incr']));
+	$this->assertEquals('a', $ret['other']);
+
+	// a blocking command reads pending async replies first
+	$h = $this->redis->sendAsync('set', array('x', 'b'));
+	$this->assertEquals('b', $this->redis->get('x'));
+	$this->assertEquals(array(TRUE), Redis::await(array($h)));
+
+	// a reply is only handed out once
+	$this->assertEquals(array(), Redis::await(array($h)));
+
+	$this->assertFalse($this->redis->sendAsync('multi'));
+	$this->redis->del('async-counter');
+    }
+
+    public function testMassInsert() {
+	$rows = array();
+	for($i = 0; $i < 5000; $i++) {
+		$rows[] = array('mass-'.$i, $i);
+	}
+	$this->assertEquals(array('sent' => 5000, 'errors' => 0),
+		$this->redis->massInsert($rows, 'SET', array('window' => 100)));
+	$this->assertEquals('0', $this->redis->get('mass-0'));
+	$this->assertEquals('4999', $this->redis->get('mass-4999'));
+
+	// errors are counted, the rest still goes through
+	$ret = $this->redis->massInsert(new ArrayIterator(array(
+		array('mass-0', 1), array('mass-h', 'field', 'value'), array('mass-0', 'x'))), 'INCRBY');
+	$this->assertEquals(array('sent' => 3, 'errors' => 2), $ret);
+	$this->assertEquals('1', $this->redis->get('mass-0'));
+	$this->assertTrue(is_string($this->redis->getLastError()));
+
+	// the first argument is prefixed like any key
+	$this->redis->setOption(Redis::OPT_PREFIX, 'mass:');
+	$this->redis->massInsert(array(array('h', 'a', '1', 'b', '2')), 'HMSET');
+	$this->assertEquals(array('a' => '1', 'b' => '2'), $this->redis->hGetAll('h'));
+	$this->redis->del('h');
+	$this->redis->setOption(Redis::OPT_PREFIX, '');
+
+	// the connection is still usable afterwards
+	$this->assertEquals('+PONG', $this->redis->ping());
+	$this->assertFalse($this->redis->pipeline()->massInsert($rows, 'SET'));
+	$this->redis->exec();
+	$this->redis->del(array_map('current', $rows));
+    }
+
+    public function testReplyIterator() {
+	$this->redis->del('iter-list', 'iter-hash', 'iter-zset');
+	for($i = 0; $i < 100; $i++) {
+		$this->redis->rPush('iter-list', 'v'.$i);
+		$this->redis->hSet('iter-hash', 'f'.$i, $i);
+		$this->redis->zAdd('iter-zset', $i / 2, 'm'.$i);
+	}
+	$this->redis->setOption(Redis::OPT_REPLY_ITERATOR, 50);
+	$this->assertEquals(50, $this->redis->getOption(Redis::OPT_REPLY_ITERATOR));
+
+	// smaller replies are still arrays
+	$this->assertEquals(array('v0', 'v1'), $this->redis->lRange('iter-list', 0, 1));
+
+	$it = $this->redis->lRange('iter-list', 0, -1);
+	$this->assertTrue($it instanceof RedisReplyIterator);
+	$this->assertEquals(100, count($it));
+	$this->assertEquals($this->lRangeArray(), iterator_to_array($it));
+
+	$it = $this->redis->hGetAll('iter-hash');
+	$this->assertEquals(100, $it->count());
+	$ret = array();
+	foreach($it as $k => $v) {
+		$ret[$k] = $v;
+	}
+	$this->assertEquals('99', $ret['f99']);
+	$this->assertEquals(100, count($ret));
+
+	$it = $this->redis->zRange('iter-zset', 0, -1, true);
+	foreach($it as $k => $v) {
+		$this->assertEquals('m0', $k);
+		$this->assertEquals(0.0, $v);
+		break;
+	}
+
+	// the next command skips what we didn't read, as does discard()
+	$this->assertEquals('v0', $this->redis->lIndex('iter-list', 0));
+	$this->assertFalse($it->valid());
+	$it = $this->redis->lRange('iter-list', 0, -1);
+	$this->assertEquals('v0', $it->current());
+	$this->assertTrue($it->discard());
+	$this->assertFalse($it->valid());
+	$this->assertEquals(100, $this->redis->lLen('iter-list'));
+
+	// so do sendAsync() and await()
+	$it = $this->redis->lRange('iter-list', 0, -1);
+	$this->assertEquals('v0', $it->current());
+	$h = $this->redis->sendAsync('lIndex', array('iter-list', 1));
+	$this->assertEquals(array('v1'), Redis::await(array($h), 1));
+	$this->assertFalse($it->valid());
+
+	// never in a pipeline
+	$ret = $this->redis->pipeline()->lRange('iter-list', 0, -1)->exec();
+	$this->assertEquals($this->lRangeArray(), $ret[0]);
+
+	$this->redis->setOption(Redis::OPT_REPLY_ITERATOR, 0);
+	$this->assertTrue(is_array($this->redis->lRange('iter-list', 0, -1)));
+	$this->redis->del('iter-list', 'iter-hash', 'iter-zset');
+    }
+
+    public function testInternKeys() {
+	$this->redis->del('intern-1', 'intern-2', 'intern-z');
+	$this->redis->hMSet('intern-1', array('name' => 'a', 'mail' => 'b', '12' => 'c'));
+	$this->redis->hMSet('intern-2', array('name' => 'd', 'mail' => 'e', '12' => 'f'));
+	$this->redis->zAdd('intern-z', 1, 'one', 2, 'two');
+
+	$this->redis->setOption(Redis::OPT_INTERN_KEYS, 1);
+	$this->assertEquals(1, $this->redis->getOption(Redis::OPT_INTERN_KEYS));
+	$ret = $this->redis->pipeline()->hGetAll('intern-1')->hGetAll('intern-2')->exec();
+	$this->assertEquals(array('name' => 'a', 'mail' => 'b', 12 => 'c'), $ret[0]);
+	$this->assertEquals(array('name' => 'd', 'mail' => 'e', 12 => 'f'), $ret[1]);
+	$this->assertEquals('e', $ret[1]['mail']);
+	$this->assertEquals('f', $ret[1][12]);
+	$this->assertEquals(array('one' => 1.0, 'two' => 2.0), $this->redis->zRange('intern-z', 0, -1, true));
+
+	$this->redis->setOption(Redis::OPT_INTERN_KEYS, 0);
+	$this->redis->del('intern-1', 'intern-2', 'intern-z');
+    }
+
+    private function lRangeArray() {
+	$ret = array();
+	for($i = 0; $i < 100; $i++) {
+		$ret[] = 'v'.$i;
+	}
+	return $ret;
+    }
+
     public function testPipeline() {
 	$this->sequence(Redis::PIPELINE);
 	$this->differentType(Redis::PIPELINE);
@@ -2596,6 +2862,49 @@ class Redis_Test extends TestSuite
 	$this->redis->setOption(Redis::OPT_PREFIX, "");
     }
 
+    public function testPipelineWindow() {
+	$this->redis->setOption(Redis::OPT_PIPELINE_WINDOW, 100);
+	$this->assertEquals(100, $this->redis->getOption(Redis::OPT_PIPELINE_WINDOW));
+
+	// replies read while queueing come back in order, with the last ones
+	$pipe = $this->redis->multi(Redis::PIPELINE);
+	for($i = 0; $i < 1050; $i++) {
+		$pipe->set("key-$i", $i);
+		$pipe->get("key-$i");
+	}
+	$ret = $pipe->exec();
+	$this->assertEquals(2100, count($ret));
+	for($i = 0; $i < 1050; $i++) {
+		$this->assertTrue($ret[2 * $i]);
+		$this->assertEquals("$i", $ret[2 * $i + 1]);
+	}
+
+	// each window is N commands, not counting those already sent
+	$this->redis->del('win-n');
+	$this->redis->setOption(Redis::OPT_PIPELINE_WINDOW, 3);
+	$r = $this->newInstance();
+	$pipe = $this->redis->multi(Redis::PIPELINE);
+	$seen = array();
+	for($i = 0; $i < 9; $i++) {
+		$pipe->incr('win-n');
+		usleep(20000);
+		$seen[] = (int)$r->get('win-n');
+	}
+	$this->assertEquals(array(0, 0, 3, 3, 3, 6, 6, 6, 9), $seen);
+	$this->assertEquals(range(1, 9), $pipe->exec());
+	$this->redis->del('win-n');
+
+	// the same by size
+	$this->redis->setOption(Redis::OPT_PIPELINE_WINDOW, 0);
+	$this->redis->setOption(Redis::OPT_PIPELINE_WINDOW_BYTES, 4096);
+	$this->sequence(Redis::PIPELINE);
+	$ret = $this->redis->multi(Redis::PIPELINE)->get('key-0')->exec();
+	$this->assertEquals(array('0'), $ret);
+	$this->redis->setOption(Redis::OPT_PIPELINE_WINDOW_BYTES, 0);
+
+	$this->assertFalse($this->redis->setOption(Redis::OPT_PIPELINE_WINDOW, -1));
+    }
+
     protected function sequence($mode) {
 
 	    $ret = $this->redis->multi($mode)
@@ -4064,6 +4373,229 @@ class Redis_Test extends TestSuite
 	    }
     }
 
+    public function testSerializerMsgpack() {
+	$this->assertTrue($this->redis->setOption(Redis::OPT_SERIALIZER, Redis::SERIALIZER_MSGPACK));
+
+	// the encoding other languages read
+	$this->assertEquals("\x93\x01\xa1a\xc3", $this->redis->_serialize(array(1, 'a', TRUE)));
+	$this->assertEquals("\x81\xa1k\xcd\x01\x00", $this->redis->_serialize(array('k' => 256)));
+
+	$vals = array(NULL, FALSE, 0, -33, 70000, -5000000000, 1.5, '', 'lesorb', str_repeat('x', 70000),
+		array(), array(1, 2, 3), array('a' => array('b' => array(1, 'c')), 5 => 'five'));
+	foreach($vals as $v) {
+		$this->redis->set('msgpack', $v);
+		$this->assertTrue($v === $this->redis->get('msgpack'));
+	}
+
+	// objects are maps of their public properties
+	$o = new stdClass;
+	$o->a = 1;
+	$this->redis->set('msgpack', $o);
+	$this->assertEquals(array('a' => 1), $this->redis->get('msgpack'));
+
+	$this->redis->hMSet('msgpack-h', array('f' => array(1, 2)));
+	$this->assertEquals(array('f' => array(1, 2)), $this->redis->hGetAll('msgpack-h'));
+
+	try {
+		$this->redis->_unserialize("\x92\x01");
+		$this->assertTrue(FALSE);
+	} catch(RedisException $e) {
+		$this->assertTrue(TRUE);
+	}
+
+	$this->redis->del('msgpack', 'msgpack-h');
+	$this->redis->setOption(Redis::OPT_SERIALIZER, Redis::SERIALIZER_NONE);
+    }
+
+    public function testSerializerBatch() {
+	$this->redis->setOption(Redis::OPT_SERIALIZER, Redis::SERIALIZER_PHP);
+
+	// every value of a multi-value command reads back on its own, back
+	// references included, though they share one serializer table
+	$o = new stdClass;
+	$o->n = 1;
+	$h = array();
+	for($i = 0; $i < 1000; $i++) {
+		$h["f$i"] = array($o, $o, $i);
+	}
+	$this->redis->del('batch-h', 'batch-s');
+	$this->assertTrue($this->redis->hMset('batch-h', $h));
+	$this->assertEquals($this->redis->_serialize($h['f0']), $this->redis->hGet('batch-h', 'f0'));
+	$ret = $this->redis->hGetAll('batch-h');
+	$this->assertEquals($h, $ret);
+	$ret['f999'][0]->n = 2;
+	$this->assertEquals(2, $ret['f999'][1]->n);
+
+	$this->assertTrue($this->redis->mset(array('batch-a' => array($o, $o), 'batch-b' => $o)));
+	$this->assertEquals(array(array($o, $o), $o), $this->redis->mget(array('batch-a', 'batch-b')));
+
+	$this->assertEquals(3, $this->redis->sAdd('batch-s', $o, array($o, $o), 'x'));
+	$this->assertEquals(3, count($this->redis->sMembers('batch-s')));
+
+	$this->redis->setOption(Redis::OPT_SERIALIZER, Redis::SERIALIZER_MSGPACK);
+	$this->assertEquals(2, $this->redis->zAdd('batch-z', 1, array(1), 2, array(2)));
+	$this->assertEquals(array(array(1), array(2)), $this->redis->zRange('batch-z', 0, -1));
+
+	$this->redis->del('batch-h', 'batch-s', 'batch-a', 'batch-b', 'batch-z');
+	$this->redis->setOption(Redis::OPT_SERIALIZER, Redis::SERIALIZER_NONE);
+    }
+
+    public function testClientCache() {
+	if(version_compare($this->version, "6.0.0", "lt")) {
+		$this->markTestSkipped();
+		return;
+	}
+	$this->redis->del('cc:str', 'cc:hash', 'cc:none', 'other');
+	$this->redis->set('cc:str', 'one');
+	$this->redis->hMset('cc:hash', array('a' => 'x', 'b' => 'y'));
+
+	$this->assertEquals('', $this->redis->getOption(Redis::OPT_CLIENT_CACHE));
+	$this->assertTrue($this->redis->setOption(Redis::OPT_CLIENT_CACHE, 'cc:,cc:str'));
+	$this->assertEquals('cc:,cc:str', $this->redis->getOption(Redis::OPT_CLIENT_CACHE));
+
+	// the second read of each key doesn't reach the server
+	$this->assertEquals('one', $this->redis->get('cc:str'));
+	$this->assertEquals(array('a' => 'x', 'b' => 'y'), $this->redis->hGetAll('cc:hash'));
+	$this->assertFalse($this->redis->get('cc:none'));
+	$info = $this->redis->info();
+	$this->assertEquals('one', $this->redis->get('cc:str'));
+	$this->assertEquals(array('a' => 'x', 'b' => 'y'), $this->redis->hGetAll('cc:hash'));
+	$this->assertFalse($this->redis->get('cc:none'));
+	$after = $this->redis->info();
+	$this->assertEquals(1, $after['total_commands_processed'] - $info['total_commands_processed']);
+
+	// our own writes are seen at once, other clients' once the server says so
+	$this->redis->set('cc:str', 'two');
+	$this->assertEquals('two', $this->redis->get('cc:str'));
+	$r = $this->newInstance();
+	$r->set('cc:str', 'three');
+	$r->hSet('cc:hash', 'c', 'z');
+	$r->set('cc:none', 'now');
+	usleep(100000);
+	$this->assertEquals('three', $this->redis->get('cc:str'));
+	$this->assertEquals(array('a' => 'x', 'b' => 'y', 'c' => 'z'), $this->redis->hGetAll('cc:hash'));
+	$this->assertEquals('now', $this->redis->get('cc:none'));
+
+	// keys outside the prefixes, and transactions, always go to the server
+	$this->redis->set('other', 'x');
+	$this->assertEquals('x', $this->redis->get('other'));
+	$ret = $this->redis->multi()->get('cc:str')->exec();
+	$this->assertEquals(array('three'), $ret);
+
+	// nor does a connection with another password: it gets its own cache,
+	// which is only served once its side connection could authenticate
+	$r = $this->newInstance();
+	@$r->auth('not-the-password');
+	$this->assertTrue($r->setOption(Redis::OPT_CLIENT_CACHE, 'cc:,cc:str'));
+	$info = $r->info();
+	$this->assertEquals('three', $r->get('cc:str'));
+	$this->assertEquals('three', $r->get('cc:str'));
+	$after = $r->info();
+	$this->assertEquals(3, $after['total_commands_processed'] - $info['total_commands_processed']);
+
+	$this->assertTrue($this->redis->setOption(Redis::OPT_CLIENT_CACHE, ''));
+	$this->assertEquals('', $this->redis->getOption(Redis::OPT_CLIENT_CACHE));
+	$this->redis->del('cc:str', 'cc:hash', 'cc:none', 'other');
+    }
+
+    public function testCompression() {
+	foreach(array('COMPRESSION_LZ4', 'COMPRESSION_ZSTD') as $name) {
+		if(defined('Redis::'.$name)) {
+			$this->checkCompression(constant('Redis::'.$name));
+		}
+	}
+	$this->assertFalse($this->redis->setOption(Redis::OPT_COMPRESSION, 42));
+
+	// dictionaries must be trained ones, a missing file leaves things as they were
+	$dict = $this->redis->getOption(Redis::OPT_COMPRESSION_DICTIONARY);
+	$this->assertFalse(@$this->redis->setOption(Redis::OPT_COMPRESSION_DICTIONARY, '/nonexistent/dict'));
+	$this->assertEquals($dict, $this->redis->getOption(Redis::OPT_COMPRESSION_DICTIONARY));
+	$this->assertTrue($this->redis->setOption(Redis::OPT_COMPRESSION_DICTIONARY, ''));
+	$this->assertEquals(0, $this->redis->getOption(Redis::OPT_COMPRESSION_DICTIONARY));
+    }
+
+    private function dictSample($i) {
+	return json_encode(array('id' => $i, 'name' => 'user'.$i, 'email' => 'user'.$i.'@example.com',
+		'roles' => array('reader', 'writer'), 'active' => $i % 3 != 0, 'score' => $i * 7 % 100));
+    }
+
+    public function testCompressionDictionary() {
+	if(!defined('Redis::COMPRESSION_ZSTD')) {
+		$this->markTestSkipped();
+	}
+
+	// a dictionary trained on values like the ones we store, by the zstd tool
+	$dir = sys_get_temp_dir().'/phpredis-dict-'.getmypid();
+	@mkdir($dir);
+	for($i = 0; $i < 1000; $i++) {
+		file_put_contents("$dir/s$i", $this->dictSample($i));
+	}
+	exec('zstd -q -f --train '.escapeshellarg($dir).'/s* --maxdict=2048 -o '.escapeshellarg("$dir.dict").' 2>/dev/null', $out, $status);
+	array_map('unlink', glob("$dir/s*"));
+	rmdir($dir);
+	if($status != 0) {
+		@unlink("$dir.dict");
+		$this->markTestSkipped('no zstd tool to train a dictionary');
+	}
+
+	$this->redis->setOption(Redis::OPT_COMPRESSION, Redis::COMPRESSION_ZSTD);
+	$this->redis->setOption(Redis::OPT_COMPRESSION_MIN_SIZE, 64);
+	$this->assertTrue($this->redis->setOption(Redis::OPT_COMPRESSION_DICTIONARY, "$dir.dict"));
+	$this->assertTrue($this->redis->getOption(Redis::OPT_COMPRESSION_DICTIONARY) > 0);
+	unlink("$dir.dict");
+
+	// small values compress with it, and come back
+	$val = $this->dictSample(5000);
+	$this->redis->set('dict-key', $val);
+	$this->assertTrue($this->redis->strlen('dict-key') < strlen($val));
+	$this->assertEquals($val, $this->redis->get('dict-key'));
+	$this->assertEquals(array($val), $this->redis->mGet(array('dict-key')));
+
+	// a value compressed with a dictionary we don't have is FALSE, not its raw bytes
+	$r = $this->newInstance();
+	$r->set('dict-key', "\x1bRZ".chr(Redis::COMPRESSION_ZSTD | 0x80).pack('V', 100).pack('V', 0x7ffffff0).'junk');
+	$this->assertFalse(@$this->redis->get('dict-key'));
+
+	$this->assertTrue($this->redis->setOption(Redis::OPT_COMPRESSION_DICTIONARY, ''));
+	$this->redis->setOption(Redis::OPT_COMPRESSION, Redis::COMPRESSION_NONE);
+	$this->redis->setOption(Redis::OPT_COMPRESSION_MIN_SIZE, 1024);
+	$this->redis->del('dict-key');
+    }
+
+    private function checkCompression($mode) {
+	$big = str_repeat('<li class="item">lesorb</li>', 200);
+	$this->redis->del('comp-key', 'comp-hash', 'comp-list');
+
+	$this->assertTrue($this->redis->setOption(Redis::OPT_COMPRESSION, $mode));
+	$this->assertEquals($mode, $this->redis->getOption(Redis::OPT_COMPRESSION));
+	$this->redis->setOption(Redis::OPT_COMPRESSION_MIN_SIZE, 100);
+
+	// big values are stored compressed, small ones as they are
+	$this->redis->set('comp-key', $big);
+	$this->assertTrue($this->redis->strlen('comp-key') < strlen($big) / 4);
+	$this->assertEquals($big, $this->redis->get('comp-key'));
+	$this->redis->set('comp-key', 'small');
+	$this->assertEquals(5, $this->redis->strlen('comp-key'));
+
+	$this->redis->hSet('comp-hash', 'f', $big);
+	$this->redis->lPush('comp-list', $big, 'small');
+	$this->assertEquals(array('f' => $big), $this->redis->hGetAll('comp-hash'));
+	$this->assertEquals(array('small', $big), $this->redis->lRange('comp-list', 0, -1));
+
+	// after serialization, and read back with compression off
+	$this->redis->setOption(Redis::OPT_SERIALIZER, Redis::SERIALIZER_PHP);
+	$arr = array_fill(0, 100, array('a' => 'b'));
+	$this->redis->set('comp-key', $arr);
+	$this->assertEquals($arr, $this->redis->get('comp-key'));
+	$this->assertEquals($arr, $this->redis->_unserialize($this->redis->_serialize($arr)));
+	$this->redis->setOption(Redis::OPT_COMPRESSION, Redis::COMPRESSION_NONE);
+	$this->assertEquals($arr, $this->redis->get('comp-key'));
+	$this->redis->setOption(Redis::OPT_SERIALIZER, Redis::SERIALIZER_NONE);
+
+	$this->redis->setOption(Redis::OPT_COMPRESSION_MIN_SIZE, 1024);
+	$this->redis->del('comp-key', 'comp-hash', 'comp-list');
+    }
+
     private function checkSerializer($mode) {
 
 	    $this->redis->delete('key');
@@ -4393,6 +4925,20 @@ class Redis_Test extends TestSuite
 		$this->assertTrue(is_array($result) && count(array_filter($result)) == 3);
     }
 
+    public function testReplySplitInCRLF() {
+
+		if (version_compare($this->version, "2.5.0", "lt")) {
+			$this->markTestSkipped();
+		}
+
+		// "*2\r\n$16371\r\n" and 16371 bytes fill a 16384 byte read, which
+		// ends between the \r and the \n of the first element.
+		$r = $this->newInstance();
+		$big = str_repeat('a', 16371);
+		$this->assertEquals(array($big, 'b'), $r->eval('return {ARGV[1], ARGV[2]}', array($big, 'b')));
+		$this->assertEquals('+PONG', $r->ping());
+    }
+
     public function testEval() {
 
 		if (version_compare($this->version, "2.5.0", "lt")) {
@@ -4486,6 +5032,15 @@ class Redis_Test extends TestSuite
 			}
 		}
 
+		// Deeply nested replies, and bulks larger than our read buffer
+		$deep = $this->redis->eval("local t = {'x', 1} for i=1,200 do t = {t} end return t");
+		for($i = 0; $i < 200 && is_array($deep) && count($deep) == 1; $i++) {
+			$deep = $deep[0];
+		}
+		$this->assertTrue($deep === Array('x', 1));
+		$big = $this->redis->eval("return {string.rep('a', 100000), 'b', string.rep('c', 20000)}");
+		$this->assertTrue($big === Array(str_repeat('a', 100000), 'b', str_repeat('c', 20000)));
+
 		/*
 		 * KEYS/ARGV
 		 */
@@ -4509,6 +5064,15 @@ class Redis_Test extends TestSuite
 				$this->assertTrue($args_result[$i] == $args_args[$i]);
 			}
 		}
+
+		// Many keys and arguments, of mixed types
+		$many_args = Array();
+		for($i=0;$i<5000;$i++) {
+			$many_args[] = $i % 2 ? 'arg-' . $i : $i;
+		}
+		$many_result = $this->redis->eval("return {#KEYS, #ARGV, KEYS[1], KEYS[10], ARGV[1], ARGV[#ARGV]}", $many_args, 10);
+		$this->assertTrue($many_result === Array(10, 4990, 'prefix:0', 'prefix:arg-9', '10', 'arg-4999'));
+		$this->redis->setOption(Redis::OPT_PREFIX, '');
     }
 
     public function testEvalSHA() {
@@ -52,6 +52,66 @@ class Redis_Array_Test extends TestSuite
 
 	public function testMGet() {
 		$this->assertTrue(array_values($this->strings) === $this->ra->mget(array_keys($this->strings)));
+
+		// the calls made for us read whole replies, whatever the nodes' options
+		$this->ra->setOption(Redis::OPT_REPLY_ITERATOR, 1);
+		$this->assertTrue(array_values($this->strings) === $this->ra->mget(array_keys($this->strings)));
+		$this->ra->setOption(Redis::OPT_REPLY_ITERATOR, 0);
+	}
+
+	public function testFanOut() {
+		// replies from all the nodes come back in key order, missing keys included
+		$keys = array();
+		$expected = array();
+		foreach($this->strings as $k => $v) {
+			$keys[] = $k;
+			$keys[] = 'missing-'.$k;
+			$expected[] = $v;
+			$expected[] = FALSE;
+		}
+		$this->assertTrue($expected === $this->ra->mget($keys));
+
+		// one reply per host
+		$this->assertTrue(count($this->ra->_hosts()) === count($this->ra->ping()));
+		$this->assertTrue(count($this->ra->_hosts()) === count($this->ra->keys('key-*')));
+
+		// DEL adds up what every node removed
+		$this->ra->mset(array('fan-1' => 'a', 'fan-2' => 'b', 'fan-3' => 'c'));
+		$this->assertTrue(3 === $this->ra->del(array('fan-1', 'fan-2', 'fan-3', 'fan-4')));
+		$this->assertTrue(array(FALSE, FALSE, FALSE) === $this->ra->mget(array('fan-1', 'fan-2', 'fan-3')));
+	}
+
+	public function testFanOutTimeout() {
+		// a node that misses the deadline of a fan out...
+		$keys = array_keys($this->strings);
+		list($host, $port) = explode(':', $this->ra->_target($keys[0]));
+		$fp = fsockopen($host, (int)$port);
+		fwrite($fp, "DEBUG SLEEP 1\r\n");
+		usleep(100000);
+
+		$this->ra->setOption(Redis::OPT_READ_TIMEOUT, 0.3);
+		$this->assertFalse($this->ra->mget($keys));
+		$this->ra->setOption(Redis::OPT_READ_TIMEOUT, (float)ini_get('default_socket_timeout'));
+		fgets($fp);
+		fclose($fp);
+
+		// ...doesn't leave its reply to be taken for the next command's
+		$this->assertTrue($this->strings[$keys[0]] === $this->ra->get($keys[0]));
+		$this->assertTrue(array_values($this->strings) === $this->ra->mget($keys));
+	}
+
+	public function testKeyPosition() {
+		// commands whose key isn't their first argument still go to the right node
+		foreach($this->strings as $k => $v) {
+			$this->assertTrue(FALSE !== $this->ra->object('encoding', $k));
+			$this->assertTrue($v === $this->ra->eval("return redis.call('get', KEYS[1])", array($k), 1));
+		}
+
+		// commands without a key go to a node of their own choosing
+		$this->assertEquals('hello', $this->ra->echo('hello'));
+		$this->assertTrue(is_array($this->ra->config('GET', 'maxmemory')));
+		$sha = $this->ra->script('load', "return 1");
+		$this->assertTrue(is_string($sha) && strlen($sha) === 40);
 	}
 
 	private function addData($commonString) {
@@ -0,0 +1,113 @@
+<?php
+
+require_once(dirname($_SERVER['PHP_SELF'])."/test.php");
+echo "Redis Cluster tests.\n\n";
+
+class Redis_Cluster_Test extends TestSuite
+{
+	public $rc = NULL;
+
+	public function setUp() {
+		global $seeds;
+		$this->rc = new RedisCluster(NULL, $seeds);
+	}
+
+	public function testSlots() {
+		// known slots, from the redis cluster specification
+		$this->assertEquals(12182, $this->rc->_slot('foo'));
+		$this->assertEquals(5061, $this->rc->_slot('bar'));
+
+		// hash tags
+		$this->assertEquals($this->rc->_slot('user1000'), $this->rc->_slot('{user1000}.following'));
+		$this->assertEquals($this->rc->_slot('{user1000}.following'), $this->rc->_slot('{user1000}.followers'));
+		// an empty tag means the whole key is hashed
+		$this->assertEquals(8363, $this->rc->_slot('foo{}{bar}'));
+	}
+
+	public function testRouting() {
+		$this->assertTrue(count($this->rc->_masters()) > 0);
+
+		for($i = 0; $i < 100; $i++) {
+			$this->assertTrue($this->rc->set("key-$i", "val-$i"));
+		}
+
+		// every key lives on the node we route it to
+		for($i = 0; $i < 100; $i++) {
+			$r = $this->rc->_instance($this->rc->_target("key-$i"));
+			$this->assertEquals("val-$i", $r->get("key-$i"));
+			$this->assertEquals("val-$i", $this->rc->get("key-$i"));
+		}
+	}
+
+	public function testRedirection() {
+		// ask a wrong node, it will answer MOVED
+		$this->rc->set('foo', 'bar');
+		$target = $this->rc->_target('foo');
+		foreach($this->rc->_masters() as $master) {
+			if($master !== $target) {
+				$r = $this->rc->_instance($master);
+				$this->assertFalse($r->get('foo'));
+				$this->assertEquals(0, strpos($r->getLastError(), 'MOVED'));
+				break;
+			}
+		}
+
+		$this->assertEquals('bar', $this->rc->get('foo'));
+		$this->assertTrue($this->rc->_remap());
+		$this->assertEquals($target, $this->rc->_target('foo'));
+	}
+
+	public function testSharedMap() {
+		global $seeds;
+
+		// a second cluster object on the same seeds routes like the first one
+		$rc = new RedisCluster(NULL, $seeds);
+		$this->assertEquals($this->rc->_masters(), $rc->_masters());
+		for($i = 0; $i < 100; $i++) {
+			$this->assertEquals($this->rc->_target("key-$i"), $rc->_target("key-$i"));
+		}
+
+		// and picks up a reload made through the first one
+		$this->assertTrue($this->rc->_remap());
+		$this->assertTrue($rc->set('foo', 'bar'));
+		$this->assertEquals('bar', $this->rc->get('foo'));
+	}
+
+	public function testMultiKey() {
+		$data = array();
+		for($i = 0; $i < 100; $i++) {
+			$data["mkey-$i"] = "mval-$i";
+		}
+
+		$this->assertTrue($this->rc->mset($data));
+		$this->assertEquals(array_values($data), $this->rc->mget(array_keys($data)));
+		$this->assertEquals(100, $this->rc->del(array_keys($data)));
+		$this->assertEquals(0, $this->rc->del('mkey-0', 'mkey-1'));
+	}
+
+	public function testPrefix() {
+		$this->assertTrue($this->rc->setOption(Redis::OPT_PREFIX, 'test:'));
+		$this->rc->set('prefixed', 'value');
+		$this->assertEquals('value', $this->rc->get('prefixed'));
+
+		$this->assertTrue($this->rc->setOption(Redis::OPT_PREFIX, ''));
+		$this->assertEquals('value', $this->rc->get('test:prefixed'));
+		$this->rc->del('test:prefixed');
+	}
+
+	public function testTransactionsRefused() {
+		try {
+			$this->rc->multi();
+			$this->assertTrue(FALSE);
+		} catch(RedisException $e) {
+			$this->assertTrue(TRUE);
+		}
+	}
+}
+
+global $seeds;
+$seeds = array('127.0.0.1:7000', '127.0.0.1:7001', '127.0.0.1:7002');
+
+exit(TestSuite::run('Redis_Cluster_Test', isset($argv[1]) ? $argv[1] : NULL));
+
+?>
@@ -0,0 +1,72 @@
+#!/bin/bash
+
+PORTS="7000 7001 7002"
+REDIS=redis-server
+
+function start_node() {
+	P=$1
+	echo "starting node on port $P";
+	CONFIG_FILE=`tempfile`
+	cat > $CONFIG_FILE << CONFIG
+port $P
+cluster-enabled yes
+cluster-config-file /tmp/nodes-$P.conf
+CONFIG
+	$REDIS $CONFIG_FILE > /dev/null 2>/dev/null &
+	sleep 1
+	rm -f $CONFIG_FILE
+}
+
+function stop_node() {
+
+	P=$1
+	PID=$2
+	redis-cli -h localhost -p $P shutdown
+	kill -9 $PID 2>/dev/null
+	rm -f /tmp/nodes-$P.conf
+}
+
+function stop() {
+	for P in $PORTS; do
+		PID=`lsof -i :$P | tail -1 | cut -f 2 -d " "`
+		if [ "$PID" != "" ]; then
+			stop_node $P $PID
+		fi
+	done
+}
+
+function start() {
+	for P in $PORTS; do
+		start_node $P
+	done
+
+	# join the nodes, and split the 16384 slots between them
+	set -- $PORTS
+	FIRST=$1
+	COUNT=$#
+	I=0
+	for P in $PORTS; do
+		redis-cli -p $P cluster meet 127.0.0.1 $FIRST > /dev/null
+		FROM=$(( I * 16384 / COUNT ))
+		TO=$(( (I + 1) * 16384 / COUNT - 1 ))
+		redis-cli -p $P cluster addslots `seq $FROM $TO` > /dev/null
+		I=$(( I + 1 ))
+	done
+	sleep 2
+}
+
+case "$1" in
+	start)
+		start
+		;;
+	stop)
+		stop
+		;;
+	restart)
+		stop
+		start
+		;;
+	*)
+		echo "Usage: $0 [start|stop|restart]"
+		;;
+esac